@@ -104,6 +104,17 @@ enum cmtspeech_state_tr {
 #define CMTSPEECH_SPC_FLAGS_PREV         (1 << 5)
 #define CMTSPEECH_SPC_FLAGS_DTX_USED     (1 << 6)
 
+/* bitmask returned by cmtspeech_buffer_frame_status() */
+#define CMTSPEECH_FRAME_STATUS_GAP       (1 << 0) /**< frames are missing
+						       before this frame */
+#define CMTSPEECH_FRAME_STATUS_DUPLICATE (1 << 1) /**< same frame counter
+						       as the previous frame */
+#define CMTSPEECH_FRAME_STATUS_REORDERED (1 << 2) /**< frame arrived after
+						       a newer frame */
+#define CMTSPEECH_FRAME_STATUS_XRUN      (1 << 3) /**< with GAP: the missing
+						       frames were dropped by
+						       a local DL overrun */
+
 /* Data structures
  * ----------------*/
 
@@ -141,7 +152,8 @@ struct cmtspeech_event_s {
   int msg_type;          /**< type of the message that caused
 			      the state change */
 
-  int reserved;          /**< reserved */
+  int reserved;          /**< reserved (used by the library to
+			      carry the resolved state transition) */
 
   /**
    * A copy of the protocol message that caused
@@ -165,7 +177,11 @@ struct cmtspeech_event_s {
       uint8_t sample_rate;
       uint8_t data_format;
       bool layout_changed;   /**< if true, acquired dl/ul buffers
-			          are invalid and need to be released */
+			          are invalid and need to be released;
+			          if false, acquired buffers keep their
+			          old layout until released, but their
+			          'data' and 'payload' are moved to
+			          library memory */
     } speech_config_req;
 
     /* msg_type == CMTSPEECH_TIMING_CONFIG_NTF: */
@@ -182,6 +198,13 @@ struct cmtspeech_event_s {
       int cmt_sent_req;  /**< whether CMT was the initiator */
     } reset_done;
 
+    /* msg_type == CMTSPEECH_EVENT_DTMF: */
+    struct {
+      char digit;        /**< '0'-'9', '*', '#' or 'A'-'D' */
+      uint16_t frame_counter; /**< counter of the DL frame where
+				   the key press was confirmed */
+    } dtmf;
+
     /* reserved / padding */
     struct {
       int reserved[4];
@@ -195,6 +218,30 @@ struct cmtspeech_event_s {
  */
 typedef struct cmtspeech_event_s cmtspeech_event_t;
 
+/**
+ * DL frame continuity statistics, accumulated from the
+ * frame counters of all DL frames since cmtspeech_open().
+ */
+struct cmtspeech_dl_frame_stats_s {
+  unsigned int frames;      /**< DL frames acquired */
+  unsigned int lost;        /**< frames missing from the counter
+			         sequence (lost on the radio side) */
+  unsigned int dropped;     /**< frames missing due to local DL
+			         overruns */
+  unsigned int duplicated;  /**< repeated frames */
+  unsigned int reordered;   /**< frames that arrived late; these
+			         are not counted in 'lost' or
+			         'dropped' */
+  unsigned int xruns;       /**< DL overrun events */
+  unsigned int resyncs;     /**< counter jumps too large to
+			         account for (e.g. modem restart) */
+};
+
+/**
+ * Typedef for cmtspeech_dl_frame_stats_s
+ */
+typedef struct cmtspeech_dl_frame_stats_s cmtspeech_dl_frame_stats_t;
+
 typedef void cmtspeech_t;
 
 /* Interfaces: Core I/O
@@ -228,6 +275,11 @@ int cmtspeech_close(cmtspeech_t *context);
  * When there is readable data, client should call
  * cmtspeech_check_events() function.
  *
+ * The descriptor may also become readable when a library
+ * internal timer expires (e.g. deferred control messages
+ * are ready to be sent). In this case cmtspeech_check_pending()
+ * returns zero and no flags are set.
+ *
  * @return a file descriptor
  */
 int cmtspeech_descriptor(cmtspeech_t *context);
@@ -264,6 +316,10 @@ int cmtspeech_read_event(cmtspeech_t *context, cmtspeech_event_t *event);
  * In case either 'context' or 'event' is invalid,
  * CMTSPEECH_TR_INVALID is returned.
  *
+ * For events returned by cmtspeech_read_event(), the
+ * transition resolved by the library when the event was
+ * generated is returned.
+ *
  * This function is a helper function and its use is not
  * mandatory.
  *
@@ -473,6 +529,33 @@ int cmtspeech_buffer_codec_sample_rate(cmtspeech_buffer_t *context);
  */
 int cmtspeech_buffer_sample_rate(cmtspeech_buffer_t *context);
 
+/**
+ * Returns the continuity status of a downlink buffer, based
+ * on the frame counter of the frame compared to previously
+ * acquired frames. The counter is expected to advance by one
+ * frame length (in 5ms units) per frame.
+ *
+ * @return bitmask of CMTSPEECH_FRAME_STATUS_*, zero for
+ *         an in-sequence frame and for uplink buffers
+ *
+ * @see cmtspeech_buffer_frames_missing()
+ */
+int cmtspeech_buffer_frame_status(cmtspeech_buffer_t *context);
+
+/**
+ * Returns the number of downlink frames missing between the
+ * previous frame and the frame in the buffer (non-zero only if
+ * CMTSPEECH_FRAME_STATUS_GAP is set).
+ */
+int cmtspeech_buffer_frames_missing(cmtspeech_buffer_t *context);
+
+/**
+ * Copies the DL frame continuity statistics to 'stats'.
+ *
+ * @return 0 on success, or a negative error code
+ */
+int cmtspeech_dl_frame_stats(cmtspeech_t *context, cmtspeech_dl_frame_stats_t *stats);
+
 /**
  * Returns the buffer descriptor pointing to raw downlink
  * frame at 'data'.
@@ -528,6 +611,49 @@ const char* cmtspeech_backend_name(cmtspeech_t* context);
  */
 int cmtspeech_backend_message(cmtspeech_t *self, int type, int args, ...);
 
+/* Interfaces: DTMF tones
+ * ---------------------- */
+
+/**
+ * Enables or disables DTMF detection on downlink frames.
+ *
+ * When enabled, the payload of every acquired DL frame is
+ * run through a DTMF detector. Each key press (a dual tone
+ * of 40ms or more) is reported once with a control event
+ * of type CMTSPEECH_EVENT_DTMF. The event does not change
+ * the protocol state ('state' and 'prev_state' are equal)
+ * and cmtspeech_event_to_state_transition() returns
+ * CMTSPEECH_TR_INVALID for it.
+ *
+ * As detection runs in cmtspeech_dl_buffer_acquire(), the
+ * event is queued there and cmtspeech_descriptor() becomes
+ * readable; the event is reported by the next
+ * cmtspeech_check_pending() call. Backends that cannot
+ * signal the descriptor report the event with the next
+ * wakeup caused by the modem.
+ *
+ * Detection is disabled by default.
+ *
+ * @return 0 on success, -1 if not supported by the backend
+ */
+int cmtspeech_set_dtmf_detection(cmtspeech_t *context, bool enabled);
+
+/**
+ * Sends DTMF tones on the uplink.
+ *
+ * Each digit in 'digits' ('0'-'9', '*', '#' or 'A'-'D') is
+ * sent as a dual tone of 'tone_ms' followed by 'gap_ms' of
+ * silence. The tones replace the payload of the UL frames
+ * passed to cmtspeech_ul_buffer_release() until all digits
+ * have been sent. A new call replaces digits not yet sent,
+ * and an empty string stops sending.
+ *
+ * @return 0 on success, -EINVAL if 'digits' is invalid or
+ *         longer than 32 digits, -1 if not supported by the
+ *         backend
+ */
+int cmtspeech_send_dtmf(cmtspeech_t *context, const char *digits, int tone_ms, int gap_ms);
+
 /* Interfaces: Low level message handling
  * -------------------------------------- */
 
@@ -575,6 +701,8 @@ typedef void (*cmtspeech_trace_handler_t)(int priority, const char *message, va_
 #define CMTSPEECH_TRACE_STATE_CHANGE    4
 #define CMTSPEECH_TRACE_IO              5
 #define CMTSPEECH_TRACE_DEBUG           8
+#define CMTSPEECH_TRACE_BINARY          9  /**< binary trace ring, see
+					        cmtspeech_trace_ring_read() */
 #define CMTSPEECH_TRACE_INTERNAL       16
 
 /**
@@ -598,4 +726,87 @@ void cmtspeech_trace_toggle(int priority, bool enabled);
  */
 int cmtspeech_set_trace_handler(cmtspeech_trace_handler_t func);
 
+/**
+ * Enables or disables trace messages of a given priority level
+ * for a single library instance.
+ *
+ * Until this function is called, the instance follows the
+ * process-wide settings (see cmtspeech_trace_toggle()). After the
+ * first call, the instance has its own trace mask, initialized
+ * from the process-wide mask at that point.
+ *
+ * This function may be called from any thread.
+ *
+ * @param priority one of CMTSPEECH_TRACE_*
+ * @param enabled if true, traces are allowed through
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+int cmtspeech_context_trace_toggle(cmtspeech_t *context, int priority, bool enabled);
+
+/**
+ * Sets the function to call when library instance 'context'
+ * emits a trace message.
+ *
+ * This function may be called from any thread.
+ *
+ * @param func handler function, or NULL to use the process-wide
+ *             handler (see cmtspeech_set_trace_handler())
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+int cmtspeech_context_set_trace_handler(cmtspeech_t *context, cmtspeech_trace_handler_t func);
+
+/* Interfaces: Binary trace ring
+ * ----------------------------- */
+
+/* enum for 'id' field of cmtspeech_trace_record_t */
+#define CMTSPEECH_TRACEPOINT_LOST               0 /**< args: records lost */
+#define CMTSPEECH_TRACEPOINT_DL_DATA_RECEIVED   1 /**< args: hw ptr, appl ptr, slot, event flags */
+#define CMTSPEECH_TRACEPOINT_DL_XRUN            2 /**< args: xrun case, slot, hw ptr, appl ptr */
+#define CMTSPEECH_TRACEPOINT_DL_BUFFER_ACQUIRE  3 /**< args: slot, frame counter, spc_flags, data type */
+#define CMTSPEECH_TRACEPOINT_UL_BUFFER_RELEASE  4 /**< args: slot, frame counter, payload octets, result */
+
+/**
+ * A binary trace record.
+ */
+struct cmtspeech_trace_record_s {
+  uint64_t tstamp_ns;    /**< CLOCK_MONOTONIC timestamp in nanoseconds */
+  uint32_t id;           /**< tracepoint (CMTSPEECH_TRACEPOINT_*) */
+  uint32_t reserved;
+  int32_t args[4];       /**< tracepoint specific arguments */
+};
+
+/**
+ * Typedef for cmtspeech_trace_record_s
+ */
+typedef struct cmtspeech_trace_record_s cmtspeech_trace_record_t;
+
+/**
+ * Reads records from the binary trace ring of 'context'.
+ *
+ * Records are only stored when trace level CMTSPEECH_TRACE_BINARY
+ * is enabled (see cmtspeech_trace_toggle(), or the "binary"
+ * option of CMTSPEECHDEBUG). Storing a record does not format
+ * any text, so the binary trace can be kept enabled on the
+ * data path without affecting frame timing.
+ *
+ * The function may be called from a different thread than
+ * the one driving 'context', but only from one thread at a time.
+ * If records were dropped because the ring was full, a record
+ * of type CMTSPEECH_TRACEPOINT_LOST is returned first.
+ *
+ * @param records array of at least 'count' records
+ * @param count maximum number of records to read
+ *
+ * @return number of records read, or a negative error code
+ */
+int cmtspeech_trace_ring_read(cmtspeech_t *context, cmtspeech_trace_record_t *records, int count);
+
+/**
+ * Returns a string describing tracepoint 'id'
+ * (CMTSPEECH_TRACEPOINT_*).
+ */
+const char *cmtspeech_tracepoint_to_string(int id);
+
 #endif /* INCLUDED_CMTSPEECH_H */
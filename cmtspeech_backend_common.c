@@ -34,7 +34,9 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "cmtspeech.h"
@@ -42,6 +44,7 @@
 #include "cmtspeech_backend_common.h"
 
 #include "sal_debug.h"
+#include "sal_probes.h"
 #define DEBUG_PREFIX "backend_common: "
 
 const char* priv_state_to_str(int state)
@@ -79,14 +82,16 @@ static int priv_state_assert(int v, int state, const char* str, int line)
 
 static void priv_state_change_to(cmtspeech_bc_state_t *state, int newstate, int priv_state)
 {
+  SAL_PROBE4(state_change, state->proto_state, newstate, state->priv_state, priv_state);
+
   if (newstate < 0) {
-    TRACE_STATE_CHANGE(DEBUG_PREFIX "PROTOCOL_STATE <%s> (%d->%d)", 
+    CTRACE_STATE_CHANGE(&state->trace, DEBUG_PREFIX "PROTOCOL_STATE <%s> (%d->%d)", 
 		       priv_state_to_str(state->proto_state), 
 		       state->priv_state, 
 		       priv_state);
   }
   else {
-    TRACE_STATE_CHANGE(DEBUG_PREFIX "PROTOCOL_STATE <%s> --> <%s> (%d->%d)", 
+    CTRACE_STATE_CHANGE(&state->trace, DEBUG_PREFIX "PROTOCOL_STATE <%s> --> <%s> (%d->%d)", 
 		       priv_state_to_str(state->proto_state), 
 		       priv_state_to_str(newstate),
 		       state->priv_state, 
@@ -112,7 +117,17 @@ static void priv_reset_state_to_disconnected(cmtspeech_bc_state_t *state)
 
 int cmtspeech_bc_open(cmtspeech_bc_state_t *state)
 {
+  sal_trace_ring_init(&state->trace_ring);
+  sal_trace_config_init(&state->trace, &state->trace_ring);
   priv_reset_state_to_disconnected(state);
+  state->event_tr = CMTSPEECH_TR_INVALID;
+  state->defer_writes = false;
+  state->deferred_cmds = 0;
+  memset(&state->dl_stats, 0, sizeof(state->dl_stats));
+  cmtspeech_bc_dl_counter_reset(state);
+  state->dtmf_detect = false;
+  cmtspeech_dtmf_det_init(&state->dtmf_det);
+  cmtspeech_dtmf_gen_init(&state->dtmf_gen);
 
   /* CMT Speech Data protocol versions:
    * - v1: 8kHz/NB support only 
@@ -123,6 +138,22 @@ int cmtspeech_bc_open(cmtspeech_bc_state_t *state)
   return 0;
 }
 
+/**
+ * Releases the backend-common state set up with
+ * cmtspeech_bc_open(). Commands still queued for a
+ * deferred write are dropped.
+ */
+int cmtspeech_bc_close(cmtspeech_bc_state_t *state)
+{
+  if (state->deferred_cmds > 0)
+    CTRACE_INFO(&state->trace, DEBUG_PREFIX "Dropping %d deferred commands at close.", state->deferred_cmds);
+
+  state->defer_writes = false;
+  state->deferred_cmds = 0;
+
+  return 0;
+}
+
 /* Public cmtspeech interface functions (common implementation
  * for all backends):
  * ----------------------------------------------------------- */
@@ -150,6 +181,11 @@ int cmtspeech_set_wb_preference(cmtspeech_t *context, bool enabled)
 
 int cmtspeech_event_to_state_transition(const cmtspeech_t *context, const cmtspeech_event_t *cev)
 {
+  /* note: events generated by the library carry the transition
+   *       resolved from the state transition table */
+  if ((cev->reserved & BC_EVENT_TR_TAG_MASK) == BC_EVENT_TR_TAG)
+    return (int8_t)(cev->reserved & 0xff);
+
   if (cev->prev_state == CMTSPEECH_STATE_DISCONNECTED &&
       cev->state == CMTSPEECH_STATE_CONNECTED)
 
@@ -201,6 +237,90 @@ int cmtspeech_event_to_state_transition(const cmtspeech_t *context, const cmtspe
   return CMTSPEECH_TR_INVALID;
 }
 
+int cmtspeech_context_trace_toggle(cmtspeech_t *context, int priority, bool enabled)
+{
+  cmtspeech_bc_state_t *state
+    = cmtspeech_bc_state_object(context);
+
+  sal_trace_config_toggle(&state->trace, priority, enabled);
+
+  return 0;
+}
+
+int cmtspeech_context_set_trace_handler(cmtspeech_t *context, cmtspeech_trace_handler_t func)
+{
+  cmtspeech_bc_state_t *state
+    = cmtspeech_bc_state_object(context);
+
+  sal_trace_config_set_handler(&state->trace, func);
+
+  return 0;
+}
+
+int cmtspeech_trace_ring_read(cmtspeech_t *context, cmtspeech_trace_record_t *records, int count)
+{
+  cmtspeech_bc_state_t *state
+    = cmtspeech_bc_state_object(context);
+
+  if (records == NULL || count < 0)
+    return -1;
+
+  return sal_trace_ring_read(&state->trace_ring, records, count);
+}
+
+const char *cmtspeech_tracepoint_to_string(int id)
+{
+  static const char *names[] =
+    { "LOST",
+      "DL_DATA_RECEIVED",
+      "DL_XRUN",
+      "DL_BUFFER_ACQUIRE",
+      "UL_BUFFER_RELEASE"
+    };
+
+  if (id < 0 || id >= (int)(sizeof(names) / sizeof(names[0])))
+    return "<unknown>";
+
+  return names[id];
+}
+
+/**
+ * Returns true if 'context' is a DL buffer that has been
+ * through cmtspeech_bc_dl_frame_check().
+ */
+static bool priv_is_checked_dl_buffer(const cmtspeech_buffer_t *context)
+{
+  return context->type == CMTSPEECH_BUFFER_TYPE_PCM_S16_LE &&
+    (context->reserved[1] & BC_FRAME_DL) != 0;
+}
+
+int cmtspeech_buffer_frame_status(cmtspeech_buffer_t *context)
+{
+  if (priv_is_checked_dl_buffer(context) != true)
+    return 0;
+  return context->reserved[1] & BC_FRAME_STATUS_MASK;
+}
+
+int cmtspeech_buffer_frames_missing(cmtspeech_buffer_t *context)
+{
+  if (priv_is_checked_dl_buffer(context) != true)
+    return 0;
+  return context->reserved[1] >> BC_FRAME_MISSING_SHIFT;
+}
+
+int cmtspeech_dl_frame_stats(cmtspeech_t *context, cmtspeech_dl_frame_stats_t *stats)
+{
+  cmtspeech_bc_state_t *state
+    = cmtspeech_bc_state_object(context);
+
+  if (stats == NULL)
+    return -EINVAL;
+
+  *stats = state->dl_stats;
+
+  return 0;
+}
+
 int cmtspeech_protocol_state(cmtspeech_t* context)
 {
   cmtspeech_bc_state_t *state 
@@ -224,7 +344,7 @@ int cmtspeech_bc_state_change_call_status(cmtspeech_t *context, bool server_stat
     if (state->priv_state == BC_STATE_CONFIG_DEACT_PEND) {
       SOFT_ASSERT(state->proto_state == CMTSPEECH_STATE_CONNECTED);
       ++state->io_errors;
-      TRACE_INFO(DEBUG_PREFIX "Call termination blocked due to pending SPEECH_CONFIG_RESP.");
+      CTRACE_INFO(&state->trace, DEBUG_PREFIX "Call termination blocked due to pending SPEECH_CONFIG_RESP.");
     }
     /* case 1.b-i): If protocol state CONNECTED, continue to 
      *         deactivate the SSI path immediately. */
@@ -269,7 +389,7 @@ int cmtspeech_bc_state_change_call_status(cmtspeech_t *context, bool server_stat
       /* case: 2.d-i) Spurious active-to-active call status
        *       change during call, ignoring. */
       if (state->call_server_active == true) {
-	TRACE_DEBUG("Spurious call status change during active call, ignoring..");	
+	CTRACE_DEBUG(&state->trace, "Spurious call status change during active call, ignoring..");	
       }
       /* case: 2.d-ii) The CMT has not acked the pending call
        *       termination. Either CMT is alive, but an ack will be
@@ -277,7 +397,7 @@ int cmtspeech_bc_state_change_call_status(cmtspeech_t *context, bool server_stat
        *       don't know for sure which is the case. */
       else {
 	if (state->io_errors > 0)  {
-	  TRACE_ERROR(DEBUG_PREFIX "CMT reset detected, continuing from DISCONNECTED state (prev %s/%d)",
+	  CTRACE_ERROR(&state->trace, DEBUG_PREFIX "CMT reset detected, continuing from DISCONNECTED state (prev %s/%d)",
 		      priv_state_to_str(state->proto_state), state->priv_state);
 	  priv_reset_state_to_disconnected(state);
 	  cmtspeech_send_ssi_config_request(context, true);
@@ -339,189 +459,341 @@ bool cmtspeech_is_active(cmtspeech_t *context)
   return false;
 }
 
-/* Backend helper functions
- * ------------------------ */
+/* Protocol state transition table
+ * ------------------------------- */
+
+#define P(s)   BC_PROTO(CMTSPEECH_STATE_ ## s)
+#define S(s)   BC_PRIV(BC_STATE_ ## s)
+#define ANY    BC_PROTO_ANY, BC_PRIV_ANY, BC_GUARD_ANY
+
+/* note: the transition ids match what cmtspeech_event_to_state_transition()
+ *       would compute from the event's previous and new state */
+
+static const cmtspeech_bc_transition_t priv_tr_speech_config_req_act[] = {
+  { P(ACTIVE_DL), BC_PRIV_ANY, BC_GUARD_ANY, BC_KEEP, BC_STATE_CONFIG_ACT_PEND, CMTSPEECH_TR_5_PARAM_UPDATE, 0 },
+  { ANY, BC_KEEP, BC_STATE_CONFIG_ACT_PEND, CMTSPEECH_TR_INVALID, 0 },
+};
+
+static const cmtspeech_bc_transition_t priv_tr_speech_config_req_deact[] = {
+  { P(ACTIVE_DL), BC_PRIV_ANY, BC_GUARD_ANY, BC_KEEP, BC_STATE_CONFIG_DEACT_PEND, CMTSPEECH_TR_5_PARAM_UPDATE, 0 },
+  { ANY, BC_KEEP, BC_STATE_CONFIG_DEACT_PEND, CMTSPEECH_TR_INVALID, 0 },
+};
+
+static const cmtspeech_bc_transition_t priv_tr_uplink_config_ntf[] = {
+  /* TR12 */
+  { P(ACTIVE_DL), BC_PRIV_ANY, BC_GUARD_ANY, CMTSPEECH_STATE_ACTIVE_DLUL, BC_STATE_IN_SYNC, CMTSPEECH_TR_12_UL_START, 0 },
+  { ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_INVALID, 0 },
+};
+
+static const cmtspeech_bc_transition_t priv_tr_timing_config_ntf[] = {
+  /* note: old CMT firmwares do not send UPLINK_CONFIG_NTF */
+  { P(ACTIVE_DL), BC_PRIV_ANY, BC_GUARD_ANY, CMTSPEECH_STATE_ACTIVE_DLUL, BC_STATE_IN_SYNC, CMTSPEECH_TR_6_TIMING_UPDATE, BC_ACTION_LEGACY_TIMING },
+  { BC_PROTO_ANY, S(TIMING), BC_GUARD_ANY, BC_KEEP, BC_STATE_IN_SYNC, CMTSPEECH_TR_6_TIMING_UPDATE, 0 },
+  { ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_6_TIMING_UPDATE, 0 },
+};
+
+static const cmtspeech_bc_transition_t priv_tr_ssi_config_resp_ok[] = {
+  /* TR1 */
+  { P(DISCONNECTED), S(CONNECTING), BC_GUARD_ANY, CMTSPEECH_STATE_CONNECTED, BC_STATE_IN_SYNC, CMTSPEECH_TR_1_CONNECTED, BC_ACTION_SET_LAYOUT },
+  { BC_PROTO_ANY, S(CONNECTING), BC_GUARD_ANY, CMTSPEECH_STATE_CONNECTED, BC_STATE_IN_SYNC, CMTSPEECH_TR_INVALID, BC_ACTION_SET_LAYOUT },
+  /* TR2 */
+  { P(CONNECTED), S(DISCONNECTING), BC_GUARD_ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_2_DISCONNECTED, BC_ACTION_RESET_STATE },
+  { BC_PROTO_ANY, S(DISCONNECTING), BC_GUARD_ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_INVALID, BC_ACTION_RESET_STATE },
+  /* call status changed while previous SSI_CONFIG_REQ was pending */
+  { P(CONNECTED), S(SSI_CONFIG_PEND), BC_GUARD_SERVER_ACTIVE, CMTSPEECH_STATE_DISCONNECTED, BC_KEEP, CMTSPEECH_TR_2_DISCONNECTED, BC_ACTION_SSI_CONNECT },
+  { BC_PROTO_ANY, S(SSI_CONFIG_PEND), BC_GUARD_SERVER_ACTIVE, CMTSPEECH_STATE_DISCONNECTED, BC_KEEP, CMTSPEECH_TR_INVALID, BC_ACTION_SSI_CONNECT },
+  { P(DISCONNECTED), S(SSI_CONFIG_PEND), BC_GUARD_SERVER_INACTIVE, CMTSPEECH_STATE_CONNECTED, BC_KEEP, CMTSPEECH_TR_1_CONNECTED, BC_ACTION_SSI_DISCONNECT },
+  { BC_PROTO_ANY, S(SSI_CONFIG_PEND), BC_GUARD_SERVER_INACTIVE, CMTSPEECH_STATE_CONNECTED, BC_KEEP, CMTSPEECH_TR_INVALID, BC_ACTION_SSI_DISCONNECT },
+  { ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_INVALID, 0 },
+};
+
+static const cmtspeech_bc_transition_t priv_tr_ssi_config_resp_error[] = {
+  /* note: do not reset internal state unless it was set
+   *       for SSI_CONFIG_REQ; no other way to recover from
+   *       this case than to ask for a protocol reset */
+  { BC_PROTO_ANY, S(CONNECTING) | S(DISCONNECTING), BC_GUARD_ANY, BC_KEEP, BC_STATE_IN_SYNC, CMTSPEECH_TR_INVALID, BC_ACTION_ERROR_RESET },
+  { ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_INVALID, BC_ACTION_ERROR_RESET },
+};
+
+static const cmtspeech_bc_transition_t priv_tr_reset_conn_req[] = {
+  /* TR10 */
+  { P(CONNECTED), BC_PRIV_ANY, BC_GUARD_ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_2_DISCONNECTED, BC_ACTION_RESET_STATE },
+  { ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_10_RESET, BC_ACTION_RESET_STATE },
+};
+
+static const cmtspeech_bc_transition_t priv_tr_reset_conn_resp[] = {
+  /* TR10 */
+  { P(CONNECTED), S(RESET_BEFORE_CONNECT), BC_GUARD_ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_2_DISCONNECTED, BC_ACTION_RESET_STATE | BC_ACTION_SSI_CONNECT },
+  { BC_PROTO_ANY, S(RESET_BEFORE_CONNECT), BC_GUARD_ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_10_RESET, BC_ACTION_RESET_STATE | BC_ACTION_SSI_CONNECT },
+  { P(CONNECTED), BC_PRIV_ANY, BC_GUARD_ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_2_DISCONNECTED, BC_ACTION_RESET_STATE },
+  { ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_10_RESET, BC_ACTION_RESET_STATE },
+};
+
+static const cmtspeech_bc_transition_t priv_tr_test_ramp_ping[] = {
+  /* note: as we send the response immediately on the data path, we
+   *       do not need to track the state for inbound
+   *       TEST_RAMP_PINGs */
+  { ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_INVALID, 0 },
+};
+
+static const cmtspeech_bc_transition_t priv_tr_sent_reset_conn_req[] = {
+  /* note: RESET_CONN_REQ is only sent on error, so our current
+   *       state has no significange any more */
+  { ANY, CMTSPEECH_STATE_INVALID, BC_STATE_IN_SYNC, CMTSPEECH_TR_INVALID, 0 },
+};
+
+static const cmtspeech_bc_transition_t priv_tr_sent_speech_config_resp_ok[] = {
+  /* TR3 */
+  { P(CONNECTED), S(CONFIG_ACT_PEND), BC_GUARD_ANY, CMTSPEECH_STATE_ACTIVE_DL, BC_STATE_IN_SYNC, CMTSPEECH_TR_3_DL_START, BC_ACTION_TIMING_REQ },
+  /* TR11 */
+  { P(ACTIVE_DLUL), S(CONFIG_ACT_PEND), BC_GUARD_ANY, CMTSPEECH_STATE_ACTIVE_DL, BC_STATE_IN_SYNC, CMTSPEECH_TR_11_UL_STOP, 0 },
+  /* TR5, note: 'priv_state' is left to CONFIG_ACT_PEND */
+  { P(ACTIVE_DL), S(CONFIG_ACT_PEND), BC_GUARD_ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_5_PARAM_UPDATE, 0 },
+  /* TR4 */
+  { P(ACTIVE_DL) | P(ACTIVE_DLUL), S(CONFIG_DEACT_PEND), BC_GUARD_SERVER_INACTIVE, CMTSPEECH_STATE_CONNECTED, BC_STATE_IN_SYNC, CMTSPEECH_TR_4_DLUL_STOP, BC_ACTION_SSI_DISCONNECT },
+  { P(ACTIVE_DL) | P(ACTIVE_DLUL), S(CONFIG_DEACT_PEND), BC_GUARD_ANY, CMTSPEECH_STATE_CONNECTED, BC_STATE_IN_SYNC, CMTSPEECH_TR_4_DLUL_STOP, 0 },
+  { P(ACTIVE_DL), BC_PRIV_ANY, BC_GUARD_ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_5_PARAM_UPDATE, 0 },
+  { ANY, BC_KEEP, BC_KEEP, CMTSPEECH_TR_INVALID, 0 },
+};
+
+static const cmtspeech_bc_transition_t priv_tr_sent_speech_config_resp_error[] = {
+  /* note: transaction has failed, do not change the state */
+  { P(ACTIVE_DL), BC_PRIV_ANY, BC_GUARD_ANY, BC_KEEP, BC_STATE_IN_SYNC, CMTSPEECH_TR_5_PARAM_UPDATE, 0 },
+  { ANY, BC_KEEP, BC_STATE_IN_SYNC, CMTSPEECH_TR_INVALID, 0 },
+};
+
+struct bc_input_desc_s {
+  const char *name;
+  uint8_t proto_mask;       /**< 'proto_state' values allowed by the protocol */
+  uint16_t priv_mask;       /**< 'priv_state' values allowed by the protocol */
+  const cmtspeech_bc_transition_t *rows;
+};
+
+static const struct bc_input_desc_s priv_bc_inputs[BC_INPUT_LAST] = {
+  [BC_INPUT_SPEECH_CONFIG_REQ_ACT] =
+  { "SPEECH_CONFIG_REQ(1)", P(CONNECTED) | P(ACTIVE_DL) | P(ACTIVE_DLUL), BC_PRIV_ANY, priv_tr_speech_config_req_act },
+  [BC_INPUT_SPEECH_CONFIG_REQ_DEACT] =
+  { "SPEECH_CONFIG_REQ(0)", P(CONNECTED) | P(ACTIVE_DL) | P(ACTIVE_DLUL), BC_PRIV_ANY, priv_tr_speech_config_req_deact },
+  [BC_INPUT_UPLINK_CONFIG_NTF] =
+  { "UPLINK_CONFIG_NTF", P(ACTIVE_DL), BC_PRIV_ANY, priv_tr_uplink_config_ntf },
+  [BC_INPUT_TIMING_CONFIG_NTF] =
+  { "TIMING_CONFIG_NTF", P(ACTIVE_DL) | P(ACTIVE_DLUL), BC_PRIV_ANY, priv_tr_timing_config_ntf },
+  /* note: it is possible that we go through DISCONNECTED ->
+   *       CONNECTING -> DISCONNECTING -> DISCONNECTED without
+   *       being CONNECTED at any point */
+  [BC_INPUT_SSI_CONFIG_RESP_OK] =
+  { "SSI_CONFIG_RESP", P(CONNECTED) | P(DISCONNECTED), BC_PRIV_ANY, priv_tr_ssi_config_resp_ok },
+  [BC_INPUT_SSI_CONFIG_RESP_ERROR] =
+  { "SSI_CONFIG_RESP(error)", P(CONNECTED) | P(DISCONNECTED), BC_PRIV_ANY, priv_tr_ssi_config_resp_error },
+  [BC_INPUT_RESET_CONN_REQ] =
+  { "RESET_CONN_REQ", BC_PROTO_ANY & ~P(DISCONNECTED), BC_PRIV_ANY, priv_tr_reset_conn_req },
+  [BC_INPUT_RESET_CONN_RESP] =
+  { "RESET_CONN_RESP", BC_PROTO_ANY & ~P(DISCONNECTED), BC_PRIV_ANY, priv_tr_reset_conn_resp },
+  [BC_INPUT_TEST_RAMP_PING] =
+  { "TEST_RAMP_PING", P(DISCONNECTED), BC_PRIV_ANY, priv_tr_test_ramp_ping },
+  [BC_INPUT_SENT_RESET_CONN_REQ] =
+  { "sent RESET_CONN_REQ", BC_PROTO_ANY, BC_PRIV_ANY, priv_tr_sent_reset_conn_req },
+  [BC_INPUT_SENT_SPEECH_CONFIG_RESP_OK] =
+  { "sent SPEECH_CONFIG_RESP", BC_PROTO_ANY, S(CONFIG_ACT_PEND) | S(CONFIG_DEACT_PEND), priv_tr_sent_speech_config_resp_ok },
+  [BC_INPUT_SENT_SPEECH_CONFIG_RESP_ERROR] =
+  { "sent SPEECH_CONFIG_RESP(error)", BC_PROTO_ANY, S(CONFIG_ACT_PEND) | S(CONFIG_DEACT_PEND), priv_tr_sent_speech_config_resp_error },
+};
+
+#undef P
+#undef S
+#undef ANY
 
 /**
- * Handles a CMT Speech Data control message and creates 
- * a cmtspeech event as result.
- *
- * @param inbuf a four-octet control message
- * @param event a pointer to event structure
- * 
- * @see cmtspeech_bc_post_command()
- *
- * @return 0 on success, -1 on error (unknown message, error parsing, ...)
+ * Returns the state transition for 'input' in the current
+ * state. Never returns NULL.
  */
-int cmtspeech_bc_handle_command(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, cmtspeech_cmd_t inbuf, cmtspeech_event_t *event)
+const cmtspeech_bc_transition_t *cmtspeech_bc_transition_lookup(const cmtspeech_bc_state_t *state, int input)
 {
-  int type, channel;
-  int res = 0;
+  const cmtspeech_bc_transition_t *t = priv_bc_inputs[input].rows;
+  unsigned int proto_bit = BC_PROTO(state->proto_state);
+  unsigned int priv_bit = BC_PRIV(state->priv_state);
+  unsigned int guard_bit =
+    state->call_server_active ? BC_GUARD_SERVER_ACTIVE : BC_GUARD_SERVER_INACTIVE;
+
+  /* note: last row of each input matches all states */
+  while (!((t->proto_mask & proto_bit) &&
+	   (t->priv_mask & priv_bit) &&
+	   (t->guard & guard_bit)))
+    ++t;
+
+  return t;
+}
 
-  type = cmtspeech_msg_get_type(inbuf);
-  channel = cmtspeech_msg_get_domain(inbuf);
+/**
+ * Performs the state transition for 'input', including its
+ * side-effects. The transition id is stored for
+ * cmtspeech_bc_complete_event_processing().
+ *
+ * @param event event being generated, or NULL
+ */
+static const cmtspeech_bc_transition_t *priv_transition_apply(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, int input, const cmtspeech_event_t *event)
+{
+  const cmtspeech_bc_transition_t *t;
 
-  SOFT_ASSERT(event != NULL);
+  /* state machine assertions */
+  STATE_ASSERT((priv_bc_inputs[input].proto_mask & BC_PROTO(state->proto_state)) != 0);
+  SOFT_ASSERT((priv_bc_inputs[input].priv_mask & BC_PRIV(state->priv_state)) != 0);
 
-  event->msg_type = type;
-  event->prev_state = state->proto_state;
+  t = cmtspeech_bc_transition_lookup(state, input);
 
-  if (type == CMTSPEECH_SPEECH_CONFIG_REQ) {
-    cmtspeech_msg_decode_speech_config_req(inbuf, 
-					   &event->msg.speech_config_req.speech_data_stream, 
-					   &event->msg.speech_config_req.call_user_connect_ind, 
-					   &event->msg.speech_config_req.codec_info, 
-					   &event->msg.speech_config_req.cellular_info, 
-					   &event->msg.speech_config_req.sample_rate, 
-					   &event->msg.speech_config_req.data_format);
-    event->msg.speech_config_req.layout_changed = false;
+  CTRACE_DEBUG(&state->trace, DEBUG_PREFIX "%s in state <%s>/%d, TR %d, actions %02x.",
+	       priv_bc_inputs[input].name, priv_state_to_str(state->proto_state), state->priv_state, t->tr, t->actions);
 
-    TRACE_DEBUG(DEBUG_PREFIX "Generating event: SPEECH_CONFIG_REQ (conn %d)", event->msg.speech_config_req.call_user_connect_ind);
+  state->event_tr = t->tr;
 
-    /* state machine assertion */
-    STATE_ASSERT((state->proto_state == CMTSPEECH_STATE_CONNECTED) ||
-		 (state->proto_state == CMTSPEECH_STATE_ACTIVE_DL) ||
-		 (state->proto_state == CMTSPEECH_STATE_ACTIVE_DLUL));
+  if (t->next_proto != BC_KEEP || t->next_priv != BC_KEEP)
+    priv_state_change_to(state,
+			 t->next_proto,
+			 t->next_priv != BC_KEEP ? t->next_priv : state->priv_state);
 
-    if (event->msg.speech_config_req.speech_data_stream) 
-      priv_state_change_to(state, -1, BC_STATE_CONFIG_ACT_PEND);
-    else
-      priv_state_change_to(state, -1, BC_STATE_CONFIG_DEACT_PEND);
-  }
-  else if (type == CMTSPEECH_UPLINK_CONFIG_NTF) {
-    TRACE_DEBUG(DEBUG_PREFIX "Generating event: UPLINK_CONFIG_NTF");
+  if (t->actions & BC_ACTION_RESET_STATE)
+    priv_reset_state_to_disconnected(state);
 
-    /* state machine assertion */
-    STATE_ASSERT(state->proto_state == CMTSPEECH_STATE_ACTIVE_DL);
+  if (t->actions & BC_ACTION_SET_LAYOUT) {
+    SOFT_ASSERT(event != NULL);
+    state->sample_layout = event->msg.ssi_config_resp.layout;
 
-    if (state->proto_state == CMTSPEECH_STATE_ACTIVE_DL)
-      /* state machine transition (TR12) */
-      priv_state_change_to(state, CMTSPEECH_STATE_ACTIVE_DLUL, BC_STATE_IN_SYNC);
-    
+    /* step: default to swapped configuration */
+    if (state->sample_layout == CMTSPEECH_SAMPLE_LAYOUT_NO_PREF)
+      state->sample_layout = CMTSPEECH_SAMPLE_LAYOUT_SWAPPED_LE;
   }
-  else if (type == CMTSPEECH_TIMING_CONFIG_NTF) {
-    TRACE_DEBUG(DEBUG_PREFIX "Generating event: TIMING_CONFIG_NTF");
 
-    /* XXX: should we have a kernel timestamp? */
-    cmtspeech_msg_decode_timing_config_ntf(inbuf, 
-					   &event->msg.timing_config_ntf.msec,
-					   &event->msg.timing_config_ntf.usec);
+  if (t->actions & BC_ACTION_LEGACY_TIMING)
+    CTRACE_INFO(&state->trace, DEBUG_PREFIX "XXX detected an old CMT firmware that does not send UPLINK_CONFIG_NTF. Support for old versions will be dropped in later versions.");
 
-    /* state machine assertion */
-    STATE_ASSERT(state->proto_state == CMTSPEECH_STATE_ACTIVE_DL ||
-		 state->proto_state == CMTSPEECH_STATE_ACTIVE_DLUL);
+  if (t->actions & BC_ACTION_SSI_CONNECT)
+    cmtspeech_send_ssi_config_request(pcontext, 1);
 
-
-    /* XXX: support legacy CMT firmwares */
-    if (state->proto_state == CMTSPEECH_STATE_ACTIVE_DL) {
-      priv_state_change_to(state, CMTSPEECH_STATE_ACTIVE_DLUL, BC_STATE_IN_SYNC);
-      TRACE_INFO(DEBUG_PREFIX "XXX detected an old CMT firmware that does not send UPLINK_CONFIG_NTF. Support for old versions will be dropped in later versions.");
-    }
-
-    if (state->priv_state == BC_STATE_TIMING)
-      priv_state_change_to(state, -1, BC_STATE_IN_SYNC);
-    
+  if (t->actions & BC_ACTION_SSI_DISCONNECT) {
+    CTRACE_DEBUG(&state->trace, DEBUG_PREFIX "Call Server already inactive, closing SSI connection.");
+    cmtspeech_send_ssi_config_request(pcontext, 0);
   }
-  else if (type == CMTSPEECH_SSI_CONFIG_RESP) {
-    cmtspeech_msg_decode_ssi_config_resp(inbuf, 
-					 &event->msg.ssi_config_resp.layout,
-					 &event->msg.ssi_config_resp.result);
-    event->msg.ssi_config_resp.version = 0; /* deprecated */
-    
-    TRACE_IO(DEBUG_PREFIX "Generating event: SSI_CONFIG_RESP (layout %u, res %u)", 
-	     event->msg.ssi_config_resp.layout,
-	     event->msg.ssi_config_resp.result);
-
-    /* state machine assertions */
-    /* note: it is possible that we go through DISCONNECTED ->
-     *       CONNECTING -> DISCONNECTING -> DISCONNECTED without
-     *       being CONNECTED at any point */
-    STATE_ASSERT(state->proto_state == CMTSPEECH_STATE_CONNECTED ||
-		 state->proto_state == CMTSPEECH_STATE_DISCONNECTED);
-
-    if (event->msg.ssi_config_resp.result == CMTSPEECH_SSI_CONFIG_RES_SUCCESS) {
-      if (state->priv_state == BC_STATE_CONNECTING) {
-	priv_state_change_to(state, CMTSPEECH_STATE_CONNECTED, BC_STATE_IN_SYNC);
-	
-	state->sample_layout = event->msg.ssi_config_resp.layout;
-	
-	/* step: default to swapped configuration */
-	if (state->sample_layout == CMTSPEECH_SAMPLE_LAYOUT_NO_PREF)
-	  state->sample_layout = CMTSPEECH_SAMPLE_LAYOUT_SWAPPED_LE;
-      }
-      else if (state->priv_state == BC_STATE_DISCONNECTING) {
-	priv_reset_state_to_disconnected(state);
 
-	TRACE_INFO(DEBUG_PREFIX "CMT Speech Data state machine deactivated.");
-      }
-      else if (state->priv_state == BC_STATE_SSI_CONFIG_PEND) {
-	if (state->call_server_active) {
-	  cmtspeech_send_ssi_config_request(pcontext, 1);
-	  priv_state_change_to(state, CMTSPEECH_STATE_DISCONNECTED, BC_STATE_CONNECTING);
-	}
-	else {
-	  cmtspeech_send_ssi_config_request(pcontext,0);
-	  priv_state_change_to(state, CMTSPEECH_STATE_CONNECTED, BC_STATE_DISCONNECTING);
-	}
-      }
+  if (t->actions & BC_ACTION_TIMING_REQ)
+    cmtspeech_send_timing_request(pcontext);
 
-    }
-    else {
-      TRACE_ERROR(DEBUG_PREFIX "ERROR: SSI_CONFIG_RESP returned an error %d", event->msg.ssi_config_resp.result);
-      /* note: do not reset internal state unless it was set
-       *       for SSI_CONFIG_REQ */
-      if (state->priv_state == BC_STATE_CONNECTING ||
-	  state->priv_state == BC_STATE_DISCONNECTING) {
-	priv_state_change_to(state, -1, BC_STATE_IN_SYNC);
-      }
-      /* note: no other way to recover from this case than to
-       *       ask for a protocol reset */
-      cmtspeech_state_change_error(pcontext);
-    }
-  }
-  else if (type == CMTSPEECH_RESET_CONN_REQ) {
-    TRACE_IO(DEBUG_PREFIX "Generating event: CMTSPEECH_EVENT_RESET (CMT initiated)");
-    event->msg_type = CMTSPEECH_EVENT_RESET;
-    event->msg.reset_done.cmt_sent_req = 1;
+  if (t->actions & BC_ACTION_ERROR_RESET)
+    cmtspeech_state_change_error(pcontext);
 
-    /* state machine assertion */
-    STATE_ASSERT(state->proto_state != CMTSPEECH_STATE_DISCONNECTED);
+  return t;
+}
 
-    /* state machine transition, to DISCONNECTED (TR10) */
-    priv_reset_state_to_disconnected(state);
-  }
-  else if (type == CMTSPEECH_RESET_CONN_RESP) {
-    int cached_priv_state = state->priv_state;
-    TRACE_IO(DEBUG_PREFIX "Generating event: CMTSPEECH_EVENT_RESET (APE initiated)");
-    event->msg_type = CMTSPEECH_EVENT_RESET;
-    event->msg.reset_done.cmt_sent_req = 0;
+/* Backend helper functions
+ * ------------------------ */
 
-    /* state machine assertion */
-    STATE_ASSERT(state->proto_state != CMTSPEECH_STATE_DISCONNECTED);
+/**
+ * Handles a CMT Speech Data control message and creates 
+ * a cmtspeech event as result.
+ *
+ * @param inbuf a four-octet control message
+ * @param event a pointer to event structure
+ * 
+ * @see cmtspeech_bc_post_command()
+ *
+ * @return 0 on success, -1 on error (unknown message, error parsing, ...)
+ */
+int cmtspeech_bc_handle_command(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, cmtspeech_cmd_t inbuf, cmtspeech_event_t *event)
+{
+  const cmtspeech_bc_transition_t *t;
+  cmtspeech_msg_t msg;
+  int input;
 
-    /* state machine transition, to DISCONNECTED (TR10) */
-    priv_reset_state_to_disconnected(state);
+  /* note: unknown types are caught in the default branch */
+  cmtspeech_msg_decode(inbuf, &msg);
 
-    if (cached_priv_state == BC_STATE_RESET_BEFORE_CONNECT) {
-      cmtspeech_send_ssi_config_request(pcontext, 1);
+  SOFT_ASSERT(event != NULL);
+
+  event->msg_type = msg.type;
+  event->prev_state = state->proto_state;
+  state->event_tr = CMTSPEECH_TR_INVALID;
+
+  SAL_PROBE3(control_msg, msg.type, msg.domain, state->proto_state);
+
+  switch(msg.type)
+    {
+    case CMTSPEECH_SPEECH_CONFIG_REQ:
+      event->msg.speech_config_req.speech_data_stream = msg.u.speech_config_req.speech_data_stream;
+      event->msg.speech_config_req.call_user_connect_ind = msg.u.speech_config_req.call_user_connecting_ind;
+      event->msg.speech_config_req.codec_info = msg.u.speech_config_req.codec_info;
+      event->msg.speech_config_req.cellular_info = msg.u.speech_config_req.cellular_info;
+      event->msg.speech_config_req.sample_rate = msg.u.speech_config_req.sample_rate;
+      event->msg.speech_config_req.data_format = msg.u.speech_config_req.data_format;
+      event->msg.speech_config_req.layout_changed = false;
+
+      CTRACE_DEBUG(&state->trace, DEBUG_PREFIX "Generating event: SPEECH_CONFIG_REQ (conn %d)", event->msg.speech_config_req.call_user_connect_ind);
+
+      input = event->msg.speech_config_req.speech_data_stream ?
+	BC_INPUT_SPEECH_CONFIG_REQ_ACT : BC_INPUT_SPEECH_CONFIG_REQ_DEACT;
+      break;
+
+    case CMTSPEECH_UPLINK_CONFIG_NTF:
+      CTRACE_DEBUG(&state->trace, DEBUG_PREFIX "Generating event: UPLINK_CONFIG_NTF");
+      input = BC_INPUT_UPLINK_CONFIG_NTF;
+      break;
+
+    case CMTSPEECH_TIMING_CONFIG_NTF:
+      CTRACE_DEBUG(&state->trace, DEBUG_PREFIX "Generating event: TIMING_CONFIG_NTF");
+
+      /* XXX: should we have a kernel timestamp? */
+      event->msg.timing_config_ntf.msec = msg.u.timing_config_ntf.msec;
+      event->msg.timing_config_ntf.usec = msg.u.timing_config_ntf.usec;
+      input = BC_INPUT_TIMING_CONFIG_NTF;
+      break;
+
+    case CMTSPEECH_SSI_CONFIG_RESP:
+      event->msg.ssi_config_resp.layout = msg.u.ssi_config_resp.layout;
+      event->msg.ssi_config_resp.result = msg.u.ssi_config_resp.result;
+      event->msg.ssi_config_resp.version = 0; /* deprecated */
+
+      CTRACE_IO(&state->trace, DEBUG_PREFIX "Generating event: SSI_CONFIG_RESP (layout %u, res %u)", 
+		event->msg.ssi_config_resp.layout,
+		event->msg.ssi_config_resp.result);
+
+      if (event->msg.ssi_config_resp.result == CMTSPEECH_SSI_CONFIG_RES_SUCCESS)
+	input = BC_INPUT_SSI_CONFIG_RESP_OK;
+      else {
+	CTRACE_ERROR(&state->trace, DEBUG_PREFIX "ERROR: SSI_CONFIG_RESP returned an error %d", event->msg.ssi_config_resp.result);
+	input = BC_INPUT_SSI_CONFIG_RESP_ERROR;
+      }
+      break;
+
+    case CMTSPEECH_RESET_CONN_REQ:
+      CTRACE_IO(&state->trace, DEBUG_PREFIX "Generating event: CMTSPEECH_EVENT_RESET (CMT initiated)");
+      event->msg_type = CMTSPEECH_EVENT_RESET;
+      event->msg.reset_done.cmt_sent_req = 1;
+      input = BC_INPUT_RESET_CONN_REQ;
+      break;
+
+    case CMTSPEECH_RESET_CONN_RESP:
+      CTRACE_IO(&state->trace, DEBUG_PREFIX "Generating event: CMTSPEECH_EVENT_RESET (APE initiated)");
+      event->msg_type = CMTSPEECH_EVENT_RESET;
+      event->msg.reset_done.cmt_sent_req = 0;
+      input = BC_INPUT_RESET_CONN_RESP;
+      break;
+
+    case CMTSPEECH_TEST_RAMP_PING:
+      input = BC_INPUT_TEST_RAMP_PING;
+      break;
+
+    default:
+      CTRACE_ERROR(&state->trace, DEBUG_PREFIX "ERROR: Unknown protocol message %d", msg.type);
+      return -1;
     }
-  }
-  else if (type == CMTSPEECH_TEST_RAMP_PING) {
-    /* state machine assertion */
-    STATE_ASSERT(state->proto_state == CMTSPEECH_STATE_DISCONNECTED);
 
-    /* note: as we send the response immediately on the data path, we 
-     *       do not need to track the state for inbound
-     *       TEST_RAMP_PINGs */
-  }
-  else {
-    TRACE_ERROR(DEBUG_PREFIX "ERROR: Unknown protocol message %d", type);
-    res = -1;
-  }
+  t = priv_transition_apply(state, pcontext, input, event);
+
+  if (input == BC_INPUT_SSI_CONFIG_RESP_OK &&
+      (t->actions & BC_ACTION_RESET_STATE))
+    CTRACE_INFO(&state->trace, DEBUG_PREFIX "CMT Speech Data state machine deactivated.");
 
   /* note: see also cmtspeech_bc_complete_event_processing */
 
-  return res;
+  return 0;
 }
 
 /**
@@ -537,62 +809,24 @@ void cmtspeech_bc_post_command(cmtspeech_bc_state_t *state, cmtspeech_t *pcontex
   int channel =
     cmtspeech_msg_get_domain(cmd);
 
-  if (channel == CMTSPEECH_DOMAIN_CONTROL) {
-    if (type == CMTSPEECH_RESET_CONN_REQ) {
-      /* note: RESET_CONN_REQ is only sent on error, so our current
-       *       state has no significange any more */
-      priv_state_change_to(state, CMTSPEECH_STATE_INVALID, BC_STATE_IN_SYNC);
-    }
-    else if (type == CMTSPEECH_SPEECH_CONFIG_RESP) {
-      uint8_t resp;
-      cmtspeech_msg_decode_speech_config_resp(cmd, &resp);
-
-      /* state machine assertions */
-      SOFT_ASSERT(state->priv_state == BC_STATE_CONFIG_ACT_PEND ||
-		  state->priv_state == BC_STATE_CONFIG_DEACT_PEND);
-
-      /* state machine transitions */
-      if (resp != 0) {
-	/* note: transaction has failed, do not change the state */
-	TRACE_ERROR(DEBUG_PREFIX "unable to change %s state due to local error",
-		    (state->priv_state == BC_STATE_CONFIG_ACT_PEND) ?
-		    "to ACTIVE_DL" : "back to CONNECTED");
-	priv_state_change_to(state, -1, BC_STATE_IN_SYNC);
-      }
-      else {
-	if (state->proto_state == CMTSPEECH_STATE_CONNECTED) {
-	  /* state machine transition (TR3) */
-	  if (state->priv_state == BC_STATE_CONFIG_ACT_PEND) {
-	    priv_state_change_to(state, CMTSPEECH_STATE_ACTIVE_DL, BC_STATE_IN_SYNC);
-	    cmtspeech_send_timing_request(pcontext);
-	  }
-	}
-	else if (state->proto_state == CMTSPEECH_STATE_ACTIVE_DL ||
-		 state->proto_state == CMTSPEECH_STATE_ACTIVE_DLUL) {
-	  if (state->priv_state == BC_STATE_CONFIG_ACT_PEND) {
-	    if (state->proto_state == CMTSPEECH_STATE_ACTIVE_DLUL) {
-	      /* state machine transition (TR11) */
-	      priv_state_change_to(state, CMTSPEECH_STATE_ACTIVE_DL, BC_STATE_IN_SYNC);
-	    }
-	    else {
-	      /* state machine transition (TR5) */
-	      /* <NOCHANGE> */
-	      ;
-	    }
-	  }
-	  else if (state->priv_state == BC_STATE_CONFIG_DEACT_PEND) {
-	    /* state machine transition (TR4) */
-	    priv_state_change_to(state, CMTSPEECH_STATE_CONNECTED, BC_STATE_IN_SYNC);
-	    
-	    if (state->call_server_active != true) {
-	      TRACE_DEBUG(DEBUX_PREFIX "Call Server already inactive, closing SSI connection.");
-	      /* note: send request in cmtspeech_bc_post_command() */
-	      cmtspeech_send_ssi_config_request(pcontext, 0);
-	    }
-	  }
-	}
-      }
+  if (channel != CMTSPEECH_DOMAIN_CONTROL)
+    return;
+
+  if (type == CMTSPEECH_RESET_CONN_REQ) {
+    priv_transition_apply(state, pcontext, BC_INPUT_SENT_RESET_CONN_REQ, NULL);
+  }
+  else if (type == CMTSPEECH_SPEECH_CONFIG_RESP) {
+    uint8_t resp;
+    cmtspeech_msg_decode_speech_config_resp(cmd, &resp);
+
+    if (resp != 0) {
+      CTRACE_ERROR(&state->trace, DEBUG_PREFIX "unable to change %s state due to local error",
+		   (state->priv_state == BC_STATE_CONFIG_ACT_PEND) ?
+		   "to ACTIVE_DL" : "back to CONNECTED");
+      priv_transition_apply(state, pcontext, BC_INPUT_SENT_SPEECH_CONFIG_RESP_ERROR, NULL);
     }
+    else
+      priv_transition_apply(state, pcontext, BC_INPUT_SENT_SPEECH_CONFIG_RESP_OK, NULL);
   }
 }
 
@@ -606,14 +840,43 @@ void cmtspeech_bc_post_command(cmtspeech_bc_state_t *state, cmtspeech_t *pcontex
 void cmtspeech_bc_complete_event_processing(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, cmtspeech_event_t *event)
 {
   event->state = state->proto_state;
+  event->reserved = BC_EVENT_TR_TAG | (state->event_tr & 0xff);
 }
 
+/**
+ * Writes command 'msg' to 'fd' and updates the state machine.
+ *
+ * If 'state->defer_writes' is set, the command is queued and
+ * written later with cmtspeech_bc_flush_deferred(). The state
+ * machine is updated already when the command is queued. If
+ * the queue is full, the command is not sent and -1 is returned
+ * (errno set to ENOBUFS).
+ */
 int cmtspeech_bc_write_command(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, cmtspeech_cmd_t msg, int fd)
 {
-  int res =
-    write(fd, msg.d.buf, sizeof(msg));
+  int res;
+
+  if (state->defer_writes == true) {
+    if (state->deferred_cmds < BC_DEFERRED_CMDS_MAX) {
+      state->deferred[state->deferred_cmds++] = msg;
+      CTRACE_IO(&state->trace, DEBUG_PREFIX "deferred %s (%d queued).",
+		cmtspeech_msg_type_to_string(msg), state->deferred_cmds);
+      if (cmtspeech_msg_get_domain(msg) != CMTSPEECH_DOMAIN_INTERNAL)
+	cmtspeech_bc_post_command(state, pcontext, msg);
+      return sizeof(msg);
+    }
+
+    /* note: writing it now would send it ahead of the queued
+     *       commands, and before the modem is ready */
+    CTRACE_ERROR(&state->trace, DEBUG_PREFIX "ERROR: deferred command queue full, unable to send %s.",
+		 cmtspeech_msg_type_to_string(msg));
+    errno = ENOBUFS;
+    return -1;
+  }
 
-  TRACE_IO(DEBUG_PREFIX "wrote %s (%02X:%02X:%02X:%02X), fd %d, res %d.", 
+  res = write(fd, msg.d.buf, sizeof(msg));
+
+  CTRACE_IO(&state->trace, DEBUG_PREFIX "wrote %s (%02X:%02X:%02X:%02X), fd %d, res %d.", 
 	   cmtspeech_msg_type_to_string(msg), 
 	   msg.d.buf[0], msg.d.buf[1], msg.d.buf[2], msg.d.buf[3], 
 	   fd, res);
@@ -625,13 +888,49 @@ int cmtspeech_bc_write_command(cmtspeech_bc_state_t *state, cmtspeech_t *pcontex
     state->io_errors = 0;
   }
   else {
-    TRACE_ERROR(DEBUG_PREFIX "ERROR: sending cmd %s failed, res %d",
+    CTRACE_ERROR(&state->trace, DEBUG_PREFIX "ERROR: sending cmd %s failed, res %d",
 		cmtspeech_msg_type_to_string(msg), res);
     ++state->io_errors;
   }
   return res;
 }
 
+/**
+ * Writes all commands queued while 'state->defer_writes'
+ * was set, and disables deferring of writes.
+ *
+ * @return 0 on success, -1 if any of the writes failed
+ */
+int cmtspeech_bc_flush_deferred(cmtspeech_bc_state_t *state, int fd)
+{
+  int i, res = 0;
+
+  state->defer_writes = false;
+
+  for(i = 0; i < state->deferred_cmds; i++) {
+    cmtspeech_cmd_t msg = state->deferred[i];
+    int wres =
+      write(fd, msg.d.buf, sizeof(msg));
+
+    CTRACE_IO(&state->trace, DEBUG_PREFIX "wrote deferred %s (%02X:%02X:%02X:%02X), fd %d, res %d.",
+	      cmtspeech_msg_type_to_string(msg),
+	      msg.d.buf[0], msg.d.buf[1], msg.d.buf[2], msg.d.buf[3],
+	      fd, wres);
+
+    if (wres == sizeof(msg))
+      state->io_errors = 0;
+    else {
+      CTRACE_ERROR(&state->trace, DEBUG_PREFIX "ERROR: sending deferred cmd %s failed, res %d",
+		   cmtspeech_msg_type_to_string(msg), wres);
+      ++state->io_errors;
+      res = -1;
+    }
+  }
+  state->deferred_cmds = 0;
+
+  return res;
+}
+
 int cmtspeech_bc_test_data_ramp_req(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, int fd, uint8_t channel, uint8_t replychannel, uint8_t rampstart, uint8_t ramplen)
 {
   int res;
@@ -641,7 +940,7 @@ int cmtspeech_bc_test_data_ramp_req(cmtspeech_bc_state_t *state, cmtspeech_t *pc
   STATE_ASSERT(state->proto_state == CMTSPEECH_STATE_DISCONNECTED);
 
   if (state->proto_state != CMTSPEECH_STATE_DISCONNECTED) {
-    TRACE_ERROR(DEBUG_PREFIX "ERROR: call ongoing, cannot send TEST_RAMP_PING!");
+    CTRACE_ERROR(&state->trace, DEBUG_PREFIX "ERROR: call ongoing, cannot send TEST_RAMP_PING!");
     return -1;
   }
 
@@ -669,6 +968,150 @@ int cmtspeech_bc_test_sequence_received(cmtspeech_bc_state_t *state)
   return 0;
 }
 
+/**
+ * Starts a new DL frame counter sequence. Should be called
+ * when DL buffers are set up for a new call.
+ */
+void cmtspeech_bc_dl_counter_reset(cmtspeech_bc_state_t *state)
+{
+  state->dl_counter_valid = false;
+  state->dl_counter_next = 0;
+  state->dl_counter_last = 0;
+  state->dl_gap_missing = 0;
+  state->dl_gap_xrun = false;
+}
+
+/**
+ * Checks the counter of a received DL frame against the
+ * expected sequence and updates 'dl_stats'. 'step' is the
+ * expected counter increment per frame. If 'xrun' is set,
+ * frames were skipped locally because of a DL overrun, and
+ * a gap is accounted as dropped frames instead of lost ones.
+ * A frame is reordered only if its counter is an earlier
+ * frame position within the window; a late frame of the last
+ * gap is taken off the 'dropped' or 'lost' count where the
+ * gap was accounted. Other unexpected counters are resyncs.
+ *
+ * @return value for the 'reserved[1]' field of the DL buffer
+ */
+int cmtspeech_bc_dl_frame_check(cmtspeech_bc_state_t *state, uint16_t frame_counter, int step, bool xrun)
+{
+  cmtspeech_dl_frame_stats_t *stats = &state->dl_stats;
+  int16_t diff = frame_counter - state->dl_counter_next;
+  int status = 0, missing = 0;
+
+  ++stats->frames;
+
+  if (step < 1)
+    step = 1;
+
+  if (state->dl_counter_valid == true) {
+    if (frame_counter == state->dl_counter_last) {
+      ++stats->duplicated;
+      return BC_FRAME_DL | CMTSPEECH_FRAME_STATUS_DUPLICATE;
+    }
+    else if (diff <= -step && diff >= -BC_DL_COUNTER_WINDOW * step &&
+	     diff % step == 0) {
+      ++stats->reordered;
+      /* note: already accounted as missing when the gap was seen */
+      if (state->dl_gap_missing > 0) {
+	--state->dl_gap_missing;
+	if (state->dl_gap_xrun == true)
+	  --stats->dropped;
+	else
+	  --stats->lost;
+      }
+      return BC_FRAME_DL | CMTSPEECH_FRAME_STATUS_REORDERED;
+    }
+    else if (diff > 0 && diff <= BC_DL_COUNTER_WINDOW * step) {
+      missing = (diff + step - 1) / step;
+      status = CMTSPEECH_FRAME_STATUS_GAP;
+      if (xrun == true) {
+	status |= CMTSPEECH_FRAME_STATUS_XRUN;
+	stats->dropped += missing;
+      }
+      else
+	stats->lost += missing;
+      state->dl_gap_missing = missing;
+      state->dl_gap_xrun = xrun;
+    }
+    else if (diff != 0) {
+      ++stats->resyncs;
+      state->dl_gap_missing = 0;
+    }
+  }
+
+  state->dl_counter_valid = true;
+  state->dl_counter_last = frame_counter;
+  state->dl_counter_next = frame_counter + step;
+
+  return BC_FRAME_DL | status | (missing << BC_FRAME_MISSING_SHIFT);
+}
+
+int cmtspeech_bc_set_dtmf_detection(cmtspeech_bc_state_t *state, bool enabled)
+{
+  if (enabled == true && state->dtmf_detect != true)
+    cmtspeech_dtmf_det_init(&state->dtmf_det);
+
+  state->dtmf_detect = enabled;
+
+  return 0;
+}
+
+int cmtspeech_bc_send_dtmf(cmtspeech_bc_state_t *state, const char *digits, int tone_ms, int gap_ms)
+{
+  if (digits == NULL)
+    return -EINVAL;
+
+  return cmtspeech_dtmf_gen_start(&state->dtmf_gen, digits, tone_ms, gap_ms);
+}
+
+/**
+ * Runs the payload of DL buffer 'buf', sampled at 'rate' Hz,
+ * through the DTMF detector. Payload must be in host sample
+ * order.
+ *
+ * @return 1 if a key press was detected and 'event' filled
+ *         with a CMTSPEECH_EVENT_DTMF event, 0 otherwise
+ */
+int cmtspeech_bc_dtmf_dl_frame(cmtspeech_bc_state_t *state, cmtspeech_buffer_t *buf, int rate, uint16_t frame_counter, cmtspeech_event_t *event)
+{
+  int digit;
+
+  if (state->dtmf_detect != true ||
+      buf->type != CMTSPEECH_BUFFER_TYPE_PCM_S16_LE)
+    return 0;
+
+  digit = cmtspeech_dtmf_det_process(&state->dtmf_det, (const int16_t*)buf->payload, buf->pcount / 2, rate);
+  if (digit == 0)
+    return 0;
+
+  memset(event, 0, sizeof(*event));
+  event->msg_type = CMTSPEECH_EVENT_DTMF;
+  event->state = state->proto_state;
+  event->prev_state = state->proto_state;
+  event->reserved = BC_EVENT_TR_TAG | (CMTSPEECH_TR_INVALID & 0xff);
+  event->msg.dtmf.digit = digit;
+  event->msg.dtmf.frame_counter = frame_counter;
+
+  return 1;
+}
+
+/**
+ * Replaces the payload of UL buffer 'buf', sampled at 'rate'
+ * Hz, with DTMF tones if any digits are being sent. Payload
+ * is in host sample order.
+ */
+void cmtspeech_bc_dtmf_ul_frame(cmtspeech_bc_state_t *state, cmtspeech_buffer_t *buf, int rate)
+{
+  if (cmtspeech_dtmf_gen_active(&state->dtmf_gen) != true ||
+      buf->type != CMTSPEECH_BUFFER_TYPE_PCM_S16_LE)
+    return;
+
+  cmtspeech_dtmf_gen_fill(&state->dtmf_gen, (int16_t*)buf->payload, buf->pcount / 2, rate);
+  buf->frame_flags = CMTSPEECH_DATA_TYPE_VALID;
+}
+
 int cmtspeech_bc_send_timing_request(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, int fd)
 {
   int res;
@@ -696,7 +1139,7 @@ int cmtspeech_bc_send_ssi_config_request(cmtspeech_bc_state_t *state, cmtspeech_
 					state->conf_proto_version,
 					state_arg == true ? 1 : 0);
 
-  TRACE_DEBUG(DEBUG_PREFIX "Trying to send SSI_CONFIG_REQ with layout %d, version %d and status %d.", 
+  CTRACE_DEBUG(&state->trace, DEBUG_PREFIX "Trying to send SSI_CONFIG_REQ with layout %d, version %d and status %d.", 
 	      layout,
 	      state->conf_proto_version,
 	      state_arg == true ? 1 : 0);
@@ -708,7 +1151,7 @@ int cmtspeech_bc_send_ssi_config_request(cmtspeech_bc_state_t *state, cmtspeech_
 		 state->priv_state == BC_STATE_SSI_CONFIG_PEND);
 
     if (state->priv_state == BC_STATE_DISCONNECTING) {
-      TRACE_ERROR(DEBUG_PREFIX "ERROR: SSI_CONFIG_REQ(state_arg=0) already pending!");
+      CTRACE_ERROR(&state->trace, DEBUG_PREFIX "ERROR: SSI_CONFIG_REQ(state_arg=0) already pending!");
       return -1;
     }
 
@@ -719,13 +1162,13 @@ int cmtspeech_bc_send_ssi_config_request(cmtspeech_bc_state_t *state, cmtspeech_
     STATE_ASSERT(state->proto_state == CMTSPEECH_STATE_DISCONNECTED ||
 		 state->priv_state == BC_STATE_SSI_CONFIG_PEND);
 
-    TRACE_INFO(DEBUG_PREFIX "CMT Speech Data state machine activated with SSI_CONFIG_REQ.");
+    CTRACE_INFO(&state->trace, DEBUG_PREFIX "CMT Speech Data state machine activated with SSI_CONFIG_REQ.");
     priv_state_change_to(state, -1, BC_STATE_CONNECTING);
   }
 
   if (res == CMTSPEECH_CTRL_LEN) {
     res = cmtspeech_bc_write_command(state, pcontext, msg, fd);
-    TRACE_IO(DEBUG_PREFIX "Sent SSI_CONFIG_REQ with layout %d, version %d and status %d.", 
+    CTRACE_IO(&state->trace, DEBUG_PREFIX "Sent SSI_CONFIG_REQ with layout %d, version %d and status %d.", 
 	     layout,
 	     state->conf_proto_version,
 	     state_arg == true ? 1 : 0);
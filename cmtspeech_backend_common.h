@@ -43,6 +43,9 @@
 #endif
 
 #include "cmtspeech_msgs.h"
+#include "cmtspeech_dtmf.h"
+#include "sal_trace_ring.h"
+#include "sal_trace_config.h"
 
 enum cmtspeech_bc_state {
   BC_STATE_IN_SYNC = 0,        /**< state describes 'proto_state' */
@@ -58,6 +61,87 @@ enum cmtspeech_bc_state {
 				    processed, reply not sent */
 };
 
+/**
+ * Inputs to the protocol state machine. Inbound messages
+ * are handled in cmtspeech_bc_handle_command() and messages
+ * sent by us in cmtspeech_bc_post_command().
+ */
+enum cmtspeech_bc_input {
+  BC_INPUT_SPEECH_CONFIG_REQ_ACT = 0,
+  BC_INPUT_SPEECH_CONFIG_REQ_DEACT,
+  BC_INPUT_UPLINK_CONFIG_NTF,
+  BC_INPUT_TIMING_CONFIG_NTF,
+  BC_INPUT_SSI_CONFIG_RESP_OK,
+  BC_INPUT_SSI_CONFIG_RESP_ERROR,
+  BC_INPUT_RESET_CONN_REQ,
+  BC_INPUT_RESET_CONN_RESP,
+  BC_INPUT_TEST_RAMP_PING,
+  BC_INPUT_SENT_RESET_CONN_REQ,
+  BC_INPUT_SENT_SPEECH_CONFIG_RESP_OK,
+  BC_INPUT_SENT_SPEECH_CONFIG_RESP_ERROR,
+  BC_INPUT_LAST
+};
+
+/* Bitmasks used to match states in cmtspeech_bc_transition_t */
+#define BC_PROTO(s)          (1U << (s))        /**< CMTSPEECH_STATE_* */
+#define BC_PRIV(s)           (1U << ((s) + 1))  /**< BC_STATE_*, or -1 */
+#define BC_PROTO_ANY         0xff
+#define BC_PRIV_ANY          0xffff
+
+#define BC_GUARD_SERVER_ACTIVE    0x1   /**< only if call server active */
+#define BC_GUARD_SERVER_INACTIVE  0x2   /**< only if call server inactive */
+#define BC_GUARD_ANY              0x3
+
+#define BC_KEEP              -1         /**< no change to state */
+
+/* Side-effects of a transition, executed in this order
+ * after the state change */
+#define BC_ACTION_RESET_STATE     0x01  /**< reset to DISCONNECTED */
+#define BC_ACTION_SET_LAYOUT      0x02  /**< sample layout from SSI_CONFIG_RESP */
+#define BC_ACTION_LEGACY_TIMING   0x04  /**< warn about old CMT firmware */
+#define BC_ACTION_SSI_CONNECT     0x08  /**< send SSI_CONFIG_REQ(1) */
+#define BC_ACTION_SSI_DISCONNECT  0x10  /**< send SSI_CONFIG_REQ(0) */
+#define BC_ACTION_TIMING_REQ      0x20  /**< send NEW_TIMING_CONFIG_REQ */
+#define BC_ACTION_ERROR_RESET     0x40  /**< send RESET_CONN_REQ */
+
+/**
+ * One row of the protocol state transition table. The rows
+ * for each input are matched in order against current state,
+ * and the first match is used. The last row for each input
+ * matches any state.
+ */
+struct cmtspeech_bc_transition_s {
+  uint8_t proto_mask;    /**< matching 'proto_state' values (BC_PROTO) */
+  uint16_t priv_mask;    /**< matching 'priv_state' values (BC_PRIV) */
+  uint8_t guard;         /**< BC_GUARD_* */
+  int8_t next_proto;     /**< new 'proto_state', or BC_KEEP */
+  int8_t next_priv;      /**< new 'priv_state', or BC_KEEP */
+  int8_t tr;             /**< CMTSPEECH_TR_* reported for the event */
+  uint8_t actions;       /**< BC_ACTION_* bitmask */
+};
+typedef struct cmtspeech_bc_transition_s cmtspeech_bc_transition_t;
+
+/* Tag stored to 'cmtspeech_event_t.reserved' together with
+ * the state transition (lowest 8 bits) */
+#define BC_EVENT_TR_TAG      0x54520000
+#define BC_EVENT_TR_TAG_MASK 0xffff0000
+
+/* Maximum number of control messages that can be queued
+ * while writes are deferred (see 'defer_writes') */
+#define BC_DEFERRED_CMDS_MAX 4
+
+/* DL frame counter jumps of more than this many frames
+ * are treated as a restart of the counter sequence */
+#define BC_DL_COUNTER_WINDOW 50
+
+/* Layout of 'cmtspeech_buffer_t.reserved[1]' of DL buffers:
+ * CMTSPEECH_FRAME_STATUS_* in the low 7 bits, BC_FRAME_DL set
+ * on all checked DL frames, followed by the number of missing
+ * frames */
+#define BC_FRAME_STATUS_MASK     0x7f
+#define BC_FRAME_DL              0x80
+#define BC_FRAME_MISSING_SHIFT   8
+
 struct cmtspeech_bc_state_s {
   bool call_server_active;         /**< call signaling: whether Call Server
 				      is active or not */
@@ -68,6 +152,27 @@ struct cmtspeech_bc_state_s {
   int sample_layout;
   int io_errors;                   /**< counter of fatal i/o errors */
   int conf_proto_version;          /**< which protocol version to use */
+  int event_tr;                    /**< transition (CMTSPEECH_TR_*) of
+				      the event being processed */
+  bool defer_writes;               /**< queue commands passed to
+				      cmtspeech_bc_write_command() until
+				      cmtspeech_bc_flush_deferred() */
+  int deferred_cmds;               /**< number of queued commands */
+  cmtspeech_cmd_t deferred[BC_DEFERRED_CMDS_MAX];
+  bool dl_counter_valid;           /**< whether 'dl_counter_*' are set */
+  uint16_t dl_counter_next;        /**< expected DL frame counter */
+  uint16_t dl_counter_last;        /**< counter of the previous DL frame */
+  int dl_gap_missing;              /**< frames of the last gap that
+				      have not arrived late */
+  bool dl_gap_xrun;                /**< whether the last gap was
+				      counted as dropped frames */
+  cmtspeech_dl_frame_stats_t dl_stats;
+  bool dtmf_detect;                /**< whether DL frames are run
+				      through 'dtmf_det' */
+  cmtspeech_dtmf_det_t dtmf_det;   /**< DL DTMF detector */
+  cmtspeech_dtmf_gen_t dtmf_gen;   /**< UL DTMF generator */
+  sal_trace_config_t trace;        /**< instance trace configuration */
+  sal_trace_ring_t trace_ring;     /**< binary trace records */
 };
 typedef struct cmtspeech_bc_state_s cmtspeech_bc_state_t;
 
@@ -75,14 +180,23 @@ typedef struct cmtspeech_bc_state_s cmtspeech_bc_state_t;
  * ------------------------ */
 
 int cmtspeech_bc_open(cmtspeech_bc_state_t *state);
+int cmtspeech_bc_close(cmtspeech_bc_state_t *state);
 int cmtspeech_bc_handle_command(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, cmtspeech_cmd_t inbuf, cmtspeech_event_t *event);
 void cmtspeech_bc_post_command(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, cmtspeech_cmd_t resp);
+const cmtspeech_bc_transition_t *cmtspeech_bc_transition_lookup(const cmtspeech_bc_state_t *state, int input);
 void cmtspeech_bc_complete_event_processing(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, cmtspeech_event_t *event);
 int cmtspeech_bc_write_command(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, cmtspeech_cmd_t msg, int fd);
+int cmtspeech_bc_flush_deferred(cmtspeech_bc_state_t *state, int fd);
 int cmtspeech_bc_send_timing_request(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, int fd);
 int cmtspeech_bc_send_ssi_config_request(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, int fd, bool state_arg);
 int cmtspeech_bc_test_data_ramp_req(cmtspeech_bc_state_t *state, cmtspeech_t *pcontext, int fd, uint8_t channel, uint8_t replychannel, uint8_t rampstart, uint8_t ramplen);
 int cmtspeech_bc_test_sequence_received(cmtspeech_bc_state_t *state);
+void cmtspeech_bc_dl_counter_reset(cmtspeech_bc_state_t *state);
+int cmtspeech_bc_dl_frame_check(cmtspeech_bc_state_t *state, uint16_t frame_counter, int step, bool xrun);
+int cmtspeech_bc_set_dtmf_detection(cmtspeech_bc_state_t *state, bool enabled);
+int cmtspeech_bc_send_dtmf(cmtspeech_bc_state_t *state, const char *digits, int tone_ms, int gap_ms);
+int cmtspeech_bc_dtmf_dl_frame(cmtspeech_bc_state_t *state, cmtspeech_buffer_t *buf, int rate, uint16_t frame_counter, cmtspeech_event_t *event);
+void cmtspeech_bc_dtmf_ul_frame(cmtspeech_bc_state_t *state, cmtspeech_buffer_t *buf, int rate);
 int cmtspeech_bc_state_change_call_connect(cmtspeech_t *context, bool connect_state);
 int cmtspeech_bc_state_change_call_status(cmtspeech_t *context, bool server_state);
 void cmtspeech_bc_state_change_reset(cmtspeech_t *context);
@@ -0,0 +1,361 @@
+/*
+ * This file is part of libcmtspeechdata.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/** @file cmtspeech_dtmf.c
+ *
+ * DTMF tone detector and generator.
+ *
+ * The detector runs a bank of eight Goertzel filters over
+ * blocks of 12.75ms (102 samples at 8kHz). A block is a hit
+ * if one row and one column tone dominate the block, and a
+ * digit is reported when two consecutive blocks give the
+ * same hit, so tones of 40ms or more are always detected.
+ *
+ * The generator sums two sines from phase accumulators,
+ * looked up from a quarter-wave table with linear
+ * interpolation.
+ *
+ * All arithmetic is fixed-point. The per-sample filter loop
+ * runs the eight filters side by side, and the generator
+ * computes each sample from the sample index only, so both
+ * inner loops are free of cross-iteration dependencies and
+ * can be vectorized by the compiler.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "cmtspeech_dtmf.h"
+
+/* Build-time configuration */
+/* -------------------------------------------------------------------- */
+
+#define DTMF_BLOCK_8KHZ        102  /* samples per block at 8kHz */
+#define DTMF_MIN_AMPLITUDE     330  /* per tone, about -40dBFS */
+#define DTMF_NORMAL_TWIST      63   /* row over column, 8dB (x10) */
+#define DTMF_REVERSE_TWIST     25   /* column over row, 4dB (x10) */
+#define DTMF_RELATIVE_PEAK     63   /* over other tones of the group, 8dB (x10) */
+#define DTMF_TO_TOTAL_ENERGY   42   /* share of block energy, percent */
+
+#define DTMF_GEN_AMPLITUDE_ROW 7336 /* -13dBFS */
+#define DTMF_GEN_AMPLITUDE_COL 9235 /* -11dBFS */
+
+/* Data types */
+/* -------------------------------------------------------------------- */
+
+static const uint16_t priv_freqs[CMTSPEECH_DTMF_TONES] =
+  { 697, 770, 852, 941, 1209, 1336, 1477, 1633 };
+
+/* 2cos(2*pi*f/fs) in Q14 */
+static const int32_t priv_coef_8khz[CMTSPEECH_DTMF_TONES] =
+  { 27980, 26956, 25701, 24219, 19073, 16325, 13085, 9315 };
+static const int32_t priv_coef_16khz[CMTSPEECH_DTMF_TONES] =
+  { 31548, 31281, 30951, 30556, 29144, 28361, 27409, 26258 };
+
+static const char priv_keys[4][4] = {
+  { '1', '2', '3', 'A' },
+  { '4', '5', '6', 'B' },
+  { '7', '8', '9', 'C' },
+  { '*', '0', '#', 'D' }
+};
+
+/* sin(x) for x in [0, pi/2] in 64 steps, Q15; the extra
+ * entry keeps the interpolation at pi/2 in bounds */
+static const int16_t priv_quarter_sine[66] = {
+  0, 804, 1608, 2410, 3212, 4011, 4808, 5602, 6393, 7179, 7962,
+  8739, 9512, 10278, 11039, 11793, 12539, 13279, 14010, 14732,
+  15446, 16151, 16846, 17530, 18204, 18868, 19519, 20159, 20787,
+  21403, 22005, 22594, 23170, 23731, 24279, 24811, 25329, 25832,
+  26319, 26790, 27245, 27683, 28105, 28510, 28898, 29268, 29621,
+  29956, 30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+  32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757, 32767,
+  32767
+};
+
+/* Detector */
+/* -------------------------------------------------------------------- */
+
+static void priv_det_reset_block(cmtspeech_dtmf_det_t *det)
+{
+  memset(det->s1, 0, sizeof(det->s1));
+  memset(det->s2, 0, sizeof(det->s2));
+  det->energy = 0;
+  det->fill = 0;
+}
+
+static void priv_det_set_rate(cmtspeech_dtmf_det_t *det, int rate)
+{
+  det->rate = rate;
+  det->block = DTMF_BLOCK_8KHZ * (rate / 8000);
+  det->coef = (rate == 16000) ? priv_coef_16khz : priv_coef_8khz;
+  det->last_hit = 0;
+  det->digit = 0;
+  priv_det_reset_block(det);
+}
+
+void cmtspeech_dtmf_det_init(cmtspeech_dtmf_det_t *det)
+{
+  memset(det, 0, sizeof(*det));
+}
+
+/**
+ * Classifies a completed block. Returns the digit
+ * present in the block, or zero.
+ */
+static char priv_det_block_result(cmtspeech_dtmf_det_t *det)
+{
+  int64_t power[CMTSPEECH_DTMF_TONES];
+  int64_t min_power, n2 = (int64_t)det->block * det->block;
+  int i, row = 0, col = 4;
+
+  for (i = 0; i < CMTSPEECH_DTMF_TONES; i++) {
+    int64_t s1 = det->s1[i], s2 = det->s2[i];
+    power[i] = s1 * s1 + s2 * s2 - ((det->coef[i] * s1) >> 14) * s2;
+  }
+
+  for (i = 1; i < 4; i++) {
+    if (power[i] > power[row])
+      row = i;
+    if (power[4 + i] > power[col])
+      col = 4 + i;
+  }
+
+  /* note: a tone of amplitude A gives power (A*N/2)^2
+   *       over a block of N samples */
+  min_power = (int64_t)DTMF_MIN_AMPLITUDE * DTMF_MIN_AMPLITUDE * n2 / 4;
+  if (power[row] < min_power || power[col] < min_power)
+    return 0;
+
+  if (power[row] * 10 > power[col] * DTMF_NORMAL_TWIST ||
+      power[col] * 10 > power[row] * DTMF_REVERSE_TWIST)
+    return 0;
+
+  for (i = 0; i < 4; i++) {
+    if ((i != row && power[i] * DTMF_RELATIVE_PEAK > power[row] * 10) ||
+	(4 + i != col && power[4 + i] * DTMF_RELATIVE_PEAK > power[col] * 10))
+      return 0;
+  }
+
+  /* note: the two tones carry all of the block energy,
+   *       sum(x^2) * N / 2, if nothing else is present */
+  if ((power[row] + power[col]) * 200 < det->energy * det->block * DTMF_TO_TOTAL_ENERGY)
+    return 0;
+
+  return priv_keys[row][col - 4];
+}
+
+/**
+ * Feeds 'n' samples at sampling rate 'rate' (8000 or 16000)
+ * to the detector.
+ *
+ * @return the digit ('0'-'9', '*', '#', 'A'-'D') if a new
+ *         key press was confirmed, zero otherwise
+ */
+int cmtspeech_dtmf_det_process(cmtspeech_dtmf_det_t *det, const int16_t *samples, int n, int rate)
+{
+  int res = 0;
+
+  if (rate != 8000 && rate != 16000)
+    return 0;
+
+  if (rate != det->rate)
+    priv_det_set_rate(det, rate);
+
+  while (n > 0) {
+    int32_t coef[CMTSPEECH_DTMF_TONES], s1[CMTSPEECH_DTMF_TONES], s2[CMTSPEECH_DTMF_TONES];
+    int64_t energy = det->energy;
+    int i, k, count = det->block - det->fill;
+
+    if (count > n)
+      count = n;
+
+    /* note: local copies, so that the compiler can keep the
+     *       filter bank in vector registers */
+    memcpy(coef, det->coef, sizeof(coef));
+    memcpy(s1, det->s1, sizeof(s1));
+    memcpy(s2, det->s2, sizeof(s2));
+
+    for (i = 0; i < count; i++) {
+      int32_t x = samples[i];
+
+      energy += x * x;
+      for (k = 0; k < CMTSPEECH_DTMF_TONES; k++) {
+	/* note: (coef * s1) >> 14 as two exact 32bit products,
+	 *       as s1 grows past 16 bits during a block */
+	int32_t s = x + coef[k] * (s1[k] >> 14) +
+	  ((coef[k] * (s1[k] & 0x3fff)) >> 14) - s2[k];
+	s2[k] = s1[k];
+	s1[k] = s;
+      }
+    }
+
+    memcpy(det->s1, s1, sizeof(s1));
+    memcpy(det->s2, s2, sizeof(s2));
+    det->energy = energy;
+
+    samples += count;
+    n -= count;
+    det->fill += count;
+
+    if (det->fill == det->block) {
+      char hit = priv_det_block_result(det);
+
+      /* note: a digit starts and ends with two equal
+       *       consecutive block results */
+      if (hit == det->last_hit && hit != det->digit) {
+	det->digit = hit;
+	if (hit)
+	  res = hit;
+      }
+      det->last_hit = hit;
+      priv_det_reset_block(det);
+    }
+  }
+
+  return res;
+}
+
+/* Generator */
+/* -------------------------------------------------------------------- */
+
+static int priv_key_tones(char key, int *row, int *col)
+{
+  int i, j;
+
+  for (i = 0; i < 4; i++)
+    for (j = 0; j < 4; j++)
+      if (priv_keys[i][j] == key) {
+	*row = i;
+	*col = 4 + j;
+	return 0;
+      }
+
+  return -1;
+}
+
+static inline int32_t priv_sine_q15(uint32_t phase)
+{
+  uint32_t p = phase & 0x3fffffff;
+  uint32_t idx, frac;
+  int32_t v;
+
+  /* note: second and fourth quadrant run the table backwards */
+  p = (phase & 0x40000000) ? 0x40000000 - p : p;
+  idx = p >> 24;
+  frac = (p >> 8) & 0xffff;
+  v = priv_quarter_sine[idx] +
+    (((priv_quarter_sine[idx + 1] - priv_quarter_sine[idx]) * (int32_t)frac) >> 16);
+
+  return (phase & 0x80000000) ? -v : v;
+}
+
+void cmtspeech_dtmf_gen_init(cmtspeech_dtmf_gen_t *gen)
+{
+  memset(gen, 0, sizeof(*gen));
+}
+
+/**
+ * Starts sending 'digits', each as a tone of 'tone_ms'
+ * followed by 'gap_ms' of silence. Replaces any digits
+ * still being sent. An empty string stops the generator.
+ *
+ * @return 0 on success, -EINVAL if 'digits' contains an
+ *         invalid key or is too long
+ */
+int cmtspeech_dtmf_gen_start(cmtspeech_dtmf_gen_t *gen, const char *digits, int tone_ms, int gap_ms)
+{
+  size_t i, len = strlen(digits);
+  int row, col;
+
+  if (len > CMTSPEECH_DTMF_MAX_DIGITS || tone_ms <= 0 || gap_ms < 0)
+    return -EINVAL;
+
+  for (i = 0; i < len; i++)
+    if (priv_key_tones(digits[i], &row, &col) != 0)
+      return -EINVAL;
+
+  memcpy(gen->digits, digits, len + 1);
+  gen->pos = 0;
+  gen->tone_ms = tone_ms;
+  gen->gap_ms = gap_ms;
+  gen->left = -1;
+  gen->in_gap = false;
+
+  return 0;
+}
+
+bool cmtspeech_dtmf_gen_active(const cmtspeech_dtmf_gen_t *gen)
+{
+  return gen->digits[gen->pos] != 0;
+}
+
+/**
+ * Writes 'n' samples at sampling rate 'rate' of the
+ * current tone or gap to 'samples'. Once all digits
+ * have been sent, the remaining samples are left
+ * untouched.
+ */
+void cmtspeech_dtmf_gen_fill(cmtspeech_dtmf_gen_t *gen, int16_t *samples, int n, int rate)
+{
+  while (n > 0 && cmtspeech_dtmf_gen_active(gen)) {
+    int i, count;
+
+    if (gen->left < 0) {
+      int row = 0, col = 4;
+
+      priv_key_tones(gen->digits[gen->pos], &row, &col);
+      gen->step[0] = (uint32_t)(((uint64_t)priv_freqs[row] << 32) / rate);
+      gen->step[1] = (uint32_t)(((uint64_t)priv_freqs[col] << 32) / rate);
+      gen->phase[0] = gen->phase[1] = 0;
+      gen->left = gen->tone_ms * (rate / 1000);
+      gen->in_gap = false;
+    }
+
+    count = gen->left < n ? gen->left : n;
+
+    if (gen->in_gap)
+      memset(samples, 0, count * sizeof(int16_t));
+    else {
+      for (i = 0; i < count; i++) {
+	uint32_t p0 = gen->phase[0] + (uint32_t)i * gen->step[0];
+	uint32_t p1 = gen->phase[1] + (uint32_t)i * gen->step[1];
+
+	samples[i] = (int16_t)((DTMF_GEN_AMPLITUDE_ROW * priv_sine_q15(p0) +
+				DTMF_GEN_AMPLITUDE_COL * priv_sine_q15(p1)) >> 15);
+      }
+      gen->phase[0] += (uint32_t)count * gen->step[0];
+      gen->phase[1] += (uint32_t)count * gen->step[1];
+    }
+
+    samples += count;
+    n -= count;
+    gen->left -= count;
+
+    if (gen->left == 0) {
+      if (gen->in_gap == false && gen->gap_ms > 0) {
+	gen->in_gap = true;
+	gen->left = gen->gap_ms * (rate / 1000);
+      }
+      else {
+	++gen->pos;
+	gen->left = -1;
+      }
+    }
+  }
+}
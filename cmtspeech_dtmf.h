@@ -0,0 +1,81 @@
+/*
+ * This file is part of libcmtspeechdata.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/** @file cmtspeech_dtmf.h
+ *
+ * DTMF tone detector and generator working on 16bit
+ * PCM speech frames (8kHz and 16kHz). Library internal
+ * interface, see cmtspeech_set_dtmf_detection() and
+ * cmtspeech_send_dtmf() for the public API.
+ */
+
+#ifndef INCLUDED_CMTSPEECH_DTMF_H
+#define INCLUDED_CMTSPEECH_DTMF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Number of Goertzel filters: four row and four column tones */
+#define CMTSPEECH_DTMF_TONES      8
+
+/* Maximum length of a digit string passed to the generator */
+#define CMTSPEECH_DTMF_MAX_DIGITS 32
+
+/**
+ * Goertzel filter bank state. Samples are fed in as they
+ * arrive, so one analysis block may span two speech frames.
+ */
+struct cmtspeech_dtmf_det_s {
+  int rate;                     /**< sampling rate in Hz, 0 if not set */
+  int block;                    /**< samples per analysis block */
+  int fill;                     /**< samples of current block processed */
+  const int32_t *coef;          /**< 2cos(w) of each tone, Q14 */
+  int32_t s1[CMTSPEECH_DTMF_TONES]; /**< filter state, s[n-1] */
+  int32_t s2[CMTSPEECH_DTMF_TONES]; /**< filter state, s[n-2] */
+  int64_t energy;               /**< sum of squares over current block */
+  char last_hit;                /**< result of the previous block, 0 if none */
+  char digit;                   /**< digit currently present, 0 if none */
+};
+typedef struct cmtspeech_dtmf_det_s cmtspeech_dtmf_det_t;
+
+/**
+ * Dual-tone generator state.
+ */
+struct cmtspeech_dtmf_gen_s {
+  char digits[CMTSPEECH_DTMF_MAX_DIGITS + 1]; /**< digits to send */
+  int pos;                      /**< index of current digit in 'digits' */
+  int tone_ms;                  /**< duration of each tone */
+  int gap_ms;                   /**< silence after each tone */
+  int left;                     /**< samples left of current tone or gap,
+				   -1 if the next tone is not yet started */
+  bool in_gap;                  /**< whether generating the gap */
+  uint32_t phase[2];            /**< phase accumulators, 2^32 is one period */
+  uint32_t step[2];             /**< phase increment per sample */
+};
+typedef struct cmtspeech_dtmf_gen_s cmtspeech_dtmf_gen_t;
+
+void cmtspeech_dtmf_det_init(cmtspeech_dtmf_det_t *det);
+int cmtspeech_dtmf_det_process(cmtspeech_dtmf_det_t *det, const int16_t *samples, int n, int rate);
+
+void cmtspeech_dtmf_gen_init(cmtspeech_dtmf_gen_t *gen);
+int cmtspeech_dtmf_gen_start(cmtspeech_dtmf_gen_t *gen, const char *digits, int tone_ms, int gap_ms);
+bool cmtspeech_dtmf_gen_active(const cmtspeech_dtmf_gen_t *gen);
+void cmtspeech_dtmf_gen_fill(cmtspeech_dtmf_gen_t *gen, int16_t *samples, int n, int rate);
+
+#endif /* INCLUDED_CMTSPEECH_DTMF_H */
@@ -28,22 +28,163 @@
  * SSI Protocol' document (DCU02180).
  */
 
+#include <string.h>
+
 #include "cmtspeech_msgs.h"
 
-#if CMTSPEECH_BIG_ENDIAN_CMDS
-#define BYTE0 0  /* MSB byte */
-#define BYTE1 1
-#define BYTE2 2
-#define BYTE3 3  /* LSB byte */
-#elif CMTSPEECH_LITTLE_ENDIAN_CMDS
-#define BYTE0 3  /* MSB byte */
-#define BYTE1 2
-#define BYTE2 1
-#define BYTE3 0  /* LSB byte */
-#else
+#if !CMTSPEECH_BIG_ENDIAN_CMDS && !CMTSPEECH_LITTLE_ENDIAN_CMDS
 #error "Endianess must be set."
 #endif
 
+/* note: messages are stored to memory in CMTSPEECH_*_ENDIAN_CMDS
+ *       order; swap when loading/storing the 32bit message word
+ *       if host byte-order differs */
+#if (CMTSPEECH_BIG_ENDIAN_CMDS && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || \
+    (CMTSPEECH_LITTLE_ENDIAN_CMDS && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define PRIV_SWAP_WORD(w) __builtin_bswap32(w)
+#else
+#define PRIV_SWAP_WORD(w) (w)
+#endif
+
+#define TYPE_SHIFT   28
+#define DOMAIN_SHIFT 24
+
+/**
+ * Location of one message field within the 32bit message word
+ * (bit 0 is the LSB of the last octet on the wire).
+ */
+struct msg_field_s {
+  uint8_t shift;
+  uint16_t mask;
+};
+
+/**
+ * Layout of one message type. Unused fields have a zero mask,
+ * so pack/unpack can always process CMTSPEECH_MSG_MAX_FIELDS
+ * fields without branching on the message type.
+ */
+struct msg_desc_s {
+  const char *name;
+  struct msg_field_s f[CMTSPEECH_MSG_MAX_FIELDS];
+};
+
+#define FIELD(lsb, width) { (lsb), (uint16_t)((1U << (width)) - 1) }
+
+/* note: field order must match the views in cmtspeech_msg_t */
+static const struct msg_desc_s priv_msg_table[16] = {
+  [CMTSPEECH_RESET_CONN_REQ] =
+  { "RESET_CONN_REQ", { } },
+  [CMTSPEECH_RESET_CONN_RESP] =
+  { "RESET_CONN_RESP", { } },
+  [CMTSPEECH_SSI_CONFIG_REQ] =
+  { "SSI_CONFIG_REQ",
+    { FIELD(8, 3),     /* layout */
+      FIELD(1, 4),     /* version */
+      FIELD(0, 1) } }, /* state */
+  [CMTSPEECH_SPEECH_CONFIG_REQ] =
+  { "SPEECH_CONFIG_REQ",
+    { FIELD(11, 1),    /* speech_data_stream */
+      FIELD(10, 1),    /* call_user_connecting_ind */
+      FIELD(6, 4),     /* codec_info */
+      FIELD(4, 2),     /* cellular_info */
+      FIELD(2, 2),     /* sample_rate */
+      FIELD(0, 2) } }, /* data_format */
+  [CMTSPEECH_TIMING_CONFIG_NTF] =
+  { "TIMING_CONFIG_NTF",
+    { FIELD(10, 9),    /* msec */
+      FIELD(0, 10) } },/* usec */
+  [CMTSPEECH_NEW_TIMING_CONFIG_REQ] =
+  { "NEW_TIMING_CONFIG_REQ", { } },
+  [CMTSPEECH_SSI_CONFIG_RESP] =
+  { "SSI_CONFIG_RESP",
+    { FIELD(8, 3),     /* layout */
+      FIELD(0, 2) } }, /* result */
+  [CMTSPEECH_SPEECH_CONFIG_RESP] =
+  { "SPEECH_CONFIG_RESP",
+    { FIELD(0, 1) } }, /* result */
+  [CMTSPEECH_UPLINK_CONFIG_NTF] =
+  { "UPLINK_CONFIG_NTF", { } },
+  [CMTSPEECH_TEST_RAMP_PING] =
+  { "TEST_RAMP_PING",
+    { FIELD(16, 4),    /* replydomain */
+      FIELD(8, 8),     /* rampstart */
+      FIELD(0, 8) } }, /* ramplen */
+};
+
+/* note: field order matches the data header function arguments */
+static const struct msg_desc_s priv_ul_data_header =
+  { "UL_SPEECH_DATA_FRAME",
+    { FIELD(16, 16),   /* frame_counter */
+      FIELD(4, 2),     /* data_length */
+      FIELD(2, 2),     /* sample_rate */
+      FIELD(0, 2) } }; /* data_type */
+
+static const struct msg_desc_s priv_dl_data_header =
+  { "DL_SPEECH_DATA_FRAME",
+    { FIELD(16, 16),   /* frame_counter */
+      FIELD(6, 7),     /* spc_flags */
+      FIELD(4, 2),     /* data_length */
+      FIELD(2, 2),     /* sample_rate */
+      FIELD(13, 2),    /* codec_sample_rate */
+      FIELD(0, 2) } }; /* data_type */
+
+static inline uint32_t priv_load_word(const uint8_t *buf)
+{
+  uint32_t w;
+  memcpy(&w, buf, sizeof(w));
+  return PRIV_SWAP_WORD(w);
+}
+
+static inline void priv_store_word(uint8_t *buf, uint32_t w)
+{
+  w = PRIV_SWAP_WORD(w);
+  memcpy(buf, &w, sizeof(w));
+}
+
+static inline uint32_t priv_pack_fields(const struct msg_desc_s *desc, const uint16_t *vals)
+{
+  uint32_t w = 0;
+  int i;
+
+  for(i = 0; i < CMTSPEECH_MSG_MAX_FIELDS; i++)
+    w |= (uint32_t)(vals[i] & desc->f[i].mask) << desc->f[i].shift;
+
+  return w;
+}
+
+static inline void priv_unpack_fields(const struct msg_desc_s *desc, uint32_t w, uint16_t *vals)
+{
+  int i;
+
+  for(i = 0; i < CMTSPEECH_MSG_MAX_FIELDS; i++)
+    vals[i] = (w >> desc->f[i].shift) & desc->f[i].mask;
+}
+
+static int priv_encode_control(cmtspeech_cmd_t *cmd, unsigned type, unsigned domain, const uint16_t *vals)
+{
+  uint32_t w =
+    (type & 0xf) << TYPE_SHIFT |
+    (domain & 0xf) << DOMAIN_SHIFT |
+    priv_pack_fields(&priv_msg_table[type & 0xf], vals);
+
+  priv_store_word(cmd->d.buf, w);
+
+  return 4;
+}
+
+/**
+ * Decodes 'cmd' to 'msg' using the field layout of message
+ * 'type', or of the type found in 'cmd' if 'type' is negative.
+ */
+static void priv_decode_control(const cmtspeech_cmd_t cmd, int type, cmtspeech_msg_t *msg)
+{
+  uint32_t w = priv_load_word(cmd.d.buf);
+
+  msg->type = w >> TYPE_SHIFT;
+  msg->domain = (w >> DOMAIN_SHIFT) & 0xf;
+  priv_unpack_fields(&priv_msg_table[type < 0 ? msg->type : type], w, msg->u.fields);
+}
+
 /**
  * Returns the type of control message in 'cmd'.
  * On success, returned type is one of CMTSPEECH_RESET_CONN,
@@ -52,7 +193,7 @@
  */
 int cmtspeech_msg_get_type(const cmtspeech_cmd_t cmd)
 {
-  return (int)cmd.d.buf[BYTE0] >> 4;
+  return (int)(priv_load_word(cmd.d.buf) >> TYPE_SHIFT);
 }
 
 /**
@@ -61,30 +202,44 @@ int cmtspeech_msg_get_type(const cmtspeech_cmd_t cmd)
  */
 int cmtspeech_msg_get_domain(const cmtspeech_cmd_t cmd)
 {
-  return (int)cmd.d.buf[BYTE0] & 0xf;
+  return (int)(priv_load_word(cmd.d.buf) >> DOMAIN_SHIFT) & 0xf;
+}
+
+/**
+ * Decodes any control message in 'cmd' to 'msg'. Fields
+ * not used by the message type are set to zero.
+ *
+ * @return 0 on success, -1 if message type is not known
+ */
+int cmtspeech_msg_decode(const cmtspeech_cmd_t cmd, cmtspeech_msg_t *msg)
+{
+  priv_decode_control(cmd, -1, msg);
+
+  return priv_msg_table[msg->type].name != NULL ? 0 : -1;
+}
+
+/**
+ * Encodes control message 'msg' to buffer pointed by 'cmd'.
+ *
+ * @return size of encoded data (in octets), or -1 if message
+ *         type is not known
+ */
+int cmtspeech_msg_encode(cmtspeech_cmd_t *cmd, const cmtspeech_msg_t *msg)
+{
+  if (msg->type > 0xf || priv_msg_table[msg->type].name == NULL)
+    return -1;
+
+  return priv_encode_control(cmd, msg->type, msg->domain, msg->u.fields);
 }
 
 const char* cmtspeech_msg_type_to_string(const cmtspeech_cmd_t cmd)
 {
-#if !defined(NDEBUG)
   int domain =
     cmtspeech_msg_get_domain(cmd);
 
   if (domain == CMTSPEECH_DOMAIN_CONTROL) {
-    switch(cmtspeech_msg_get_type(cmd))
-    {
-    case CMTSPEECH_RESET_CONN_REQ: return "RESET_CONN_REQ";
-    case CMTSPEECH_RESET_CONN_RESP: return "RESET_CONN_RESP";
-    case CMTSPEECH_SSI_CONFIG_REQ: return "SSI_CONFIG_REQ";
-    case CMTSPEECH_SPEECH_CONFIG_REQ: return "SPEECH_CONFIG_REQ";
-    case CMTSPEECH_TIMING_CONFIG_NTF: return "TIMING_CONFIG_NTF";
-    case CMTSPEECH_UPLINK_CONFIG_NTF: return "UPLINK_CONFIG_NTF";
-    case CMTSPEECH_NEW_TIMING_CONFIG_REQ: return "NEW_TIMING_CONFIG_REQ";
-    case CMTSPEECH_SSI_CONFIG_RESP: return "SSI_CONFIG_RESP";
-    case CMTSPEECH_SPEECH_CONFIG_RESP: return "SPEECH_CONFIG_RESP";
-    case CMTSPEECH_TEST_RAMP_PING: return "TEST_RAMP_PING";
-    default: return "<unknown-control-message-type>";
-    }
+    const char *name = priv_msg_table[cmtspeech_msg_get_type(cmd)].name;
+    return name ? name : "<unknown-control-message-type>";
   }
   else if (domain == CMTSPEECH_DOMAIN_INTERNAL) {
     switch(cmtspeech_msg_get_type(cmd))
@@ -95,10 +250,6 @@ const char* cmtspeech_msg_type_to_string(const cmtspeech_cmd_t cmd)
   }
 
   return "<unknown-message-type>";
-
-#else
-  return "<disabled-in-build>";
-#endif
 }
 
 /**
@@ -107,13 +258,13 @@ const char* cmtspeech_msg_type_to_string(const cmtspeech_cmd_t cmd)
  */
 int cmtspeech_msg_encode_ul_data_header(uint8_t *buf, int len, uint16_t frame_counter, uint8_t data_length, uint8_t sample_rate, uint8_t data_type)
 {
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS] =
+    { frame_counter, data_length, sample_rate, data_type };
+
   if (len < 4)
     return -1;
 
-  buf[BYTE0] = frame_counter >> 8;
-  buf[BYTE1] = frame_counter;
-  buf[BYTE2] = 0; /* reserved; */
-  buf[BYTE3] = (data_length & 0x3) << 4 | (sample_rate & 0x3) << 2 | (data_type & 0x3);
+  priv_store_word(buf, priv_pack_fields(&priv_ul_data_header, vals));
 
   return 4;
 }
@@ -126,13 +277,17 @@ int cmtspeech_msg_encode_ul_data_header(uint8_t *buf, int len, uint16_t frame_co
  */
 int cmtspeech_msg_decode_ul_data_header(uint8_t *buf, int len, uint16_t *frame_counter, uint8_t *data_length, uint8_t *sample_rate, uint8_t *data_type)
 {
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS];
+
   if (len < 4)
     return -1;
 
-  *frame_counter = buf[BYTE0] << 8 | buf[BYTE1];
-  *data_length = (buf[BYTE3] >> 4) & 0x3;
-  *sample_rate = (buf[BYTE3] >> 2) & 0x3;
-  *data_type = buf[BYTE3] & 0x3;
+  priv_unpack_fields(&priv_ul_data_header, priv_load_word(buf), vals);
+
+  *frame_counter = vals[0];
+  *data_length = vals[1];
+  *sample_rate = vals[2];
+  *data_type = vals[3];
 
   return 0;
 }
@@ -159,19 +314,13 @@ int cmtspeech_msg_encode_dl_data_header(uint8_t *buf, int len, uint16_t frame_co
  */
 int cmtspeech_msg_encode_dl_data_header_v5(uint8_t *buf, int len, uint16_t frame_counter, uint8_t spc_flags, uint8_t data_length, uint8_t sample_rate, uint8_t codec_sample_rate, uint8_t data_type)
 {
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS] =
+    { frame_counter, spc_flags, data_length, sample_rate, codec_sample_rate, data_type };
+
   if (len < 4)
     return -1;
 
-  buf[BYTE0] = frame_counter >> 8;
-  buf[BYTE1] = frame_counter;
-  buf[BYTE2] =
-    (codec_sample_rate & 0x3) << 7 |
-    ((spc_flags >> 2) & 0x1f);
-  buf[BYTE3] =
-    (spc_flags & 0x3) << 6 |
-    (data_length & 0x3) << 4 |
-    (sample_rate & 0x3) << 2 |
-    (data_type & 0x3);
+  priv_store_word(buf, priv_pack_fields(&priv_dl_data_header, vals));
 
   return 4;
 }
@@ -206,18 +355,19 @@ int cmtspeech_msg_decode_dl_data_header(uint8_t *buf, int len, uint16_t *frame_c
  */
 int cmtspeech_msg_decode_dl_data_header_v5(uint8_t *buf, int len, uint16_t *frame_counter, uint8_t *spc_flags, uint8_t *data_length, uint8_t *sample_rate, uint8_t *codec_sample_rate, uint8_t *data_type)
 {
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS];
 
   if (len < 4)
     return -1;
 
-  *frame_counter = buf[BYTE0] << 8 | buf[BYTE1];
-  *spc_flags =
-    ((buf[BYTE2] & 0x1f) << 2) |
-    ((buf[BYTE3] >> 6) & 0x3);
-  *data_length = (buf[BYTE3] >> 4) & 0x3;
-  *sample_rate = (buf[BYTE3] >> 2) & 0x3;
-  *codec_sample_rate = (buf[BYTE2] >> 5) & 0x3;
-  *data_type = buf[BYTE3] & 0x3;
+  priv_unpack_fields(&priv_dl_data_header, priv_load_word(buf), vals);
+
+  *frame_counter = vals[0];
+  *spc_flags = vals[1];
+  *data_length = vals[2];
+  *sample_rate = vals[3];
+  *codec_sample_rate = vals[4];
+  *data_type = vals[5];
 
   return 0;
 }
@@ -228,19 +378,10 @@ int cmtspeech_msg_decode_dl_data_header_v5(uint8_t *buf, int len, uint16_t *fram
  */
 int cmtspeech_msg_encode_speech_config_req(cmtspeech_cmd_t *cmd, uint8_t speech_data_stream, uint8_t call_user_connecting_ind, uint8_t codec_info, uint8_t cellular_info, uint8_t sample_rate, uint8_t data_format)
 {
-  cmd->d.buf[BYTE0] = (CMTSPEECH_SPEECH_CONFIG_REQ << 4) | CMTSPEECH_DOMAIN_CONTROL;
-  cmd->d.buf[BYTE1] = 0; /* part of reserved range */
-  cmd->d.buf[BYTE2] =
-    (speech_data_stream & 0x1) << 3 |
-    (call_user_connecting_ind & 0x1) << 2 |
-    (codec_info & 0xf) >> 2;
-  cmd->d.buf[BYTE3] =
-    ((codec_info & 0xf) << 6) |
-    ((cellular_info & 0x3) << 4) |
-    ((sample_rate & 0x3) << 2) |
-    (data_format & 0x3);
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS] =
+    { speech_data_stream, call_user_connecting_ind, codec_info, cellular_info, sample_rate, data_format };
 
-  return 4;
+  return priv_encode_control(cmd, CMTSPEECH_SPEECH_CONFIG_REQ, CMTSPEECH_DOMAIN_CONTROL, vals);
 }
 
 /**
@@ -251,43 +392,40 @@ int cmtspeech_msg_encode_speech_config_req(cmtspeech_cmd_t *cmd, uint8_t speech_
  */
 int cmtspeech_msg_decode_speech_config_req(const cmtspeech_cmd_t cmd, uint8_t *speech_data_stream, uint8_t *call_user_connecting_ind, uint8_t *codec_info, uint8_t *cellular_info, uint8_t *sample_rate, uint8_t *data_format)
 {
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS];
+
+  priv_unpack_fields(&priv_msg_table[CMTSPEECH_SPEECH_CONFIG_REQ], priv_load_word(cmd.d.buf), vals);
+
   if (speech_data_stream)
-    *speech_data_stream =
-      (cmd.d.buf[BYTE2] >> 3) & 0x1;
+    *speech_data_stream = vals[0];
 
   if (call_user_connecting_ind)
-    *call_user_connecting_ind =
-      (cmd.d.buf[BYTE2] >> 2) & 0x1;
+    *call_user_connecting_ind = vals[1];
 
   if (codec_info)
-    *codec_info =
-      (cmd.d.buf[BYTE2] << 2 | cmd.d.buf[BYTE3] >> 6) & 0xf;
+    *codec_info = vals[2];
 
   if (cellular_info)
-    *cellular_info =
-      (cmd.d.buf[BYTE3] >> 4) & 0x3;
+    *cellular_info = vals[3];
 
   if (sample_rate)
-    *sample_rate = (cmd.d.buf[BYTE3] >> 2) & 0x3;
+    *sample_rate = vals[4];
 
   if (data_format)
-    *data_format = cmd.d.buf[BYTE3] & 0x3;
+    *data_format = vals[5];
 
   return 0;
 }
 
 /**
- * Encodes a NEW_TIMING_CONFIG_REQ message to buffer pointed
+ * Encodes a message without parameters to buffer pointed
  * by 'cmd'. Returns size of encoded data (in octets).
  */
 static int priv_cmtspeech_msg_encode_simple_message(cmtspeech_cmd_t *cmd, unsigned simplecmd)
 {
-  cmd->d.buf[BYTE0] = (simplecmd << 4) | CMTSPEECH_DOMAIN_CONTROL;
-  cmd->d.buf[BYTE1] = 0;
-  cmd->d.buf[BYTE2] = 0;
-  cmd->d.buf[BYTE3] = 0;
+  static const uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS];
 
-  return 4;
+  return priv_encode_control(cmd, simplecmd, CMTSPEECH_DOMAIN_CONTROL, vals);
 }
 
 /**
@@ -314,14 +452,9 @@ int cmtspeech_msg_encode_uplink_config_ntf(cmtspeech_cmd_t *cmd)
  */
 int cmtspeech_msg_encode_timing_config_ntf(cmtspeech_cmd_t *cmd, uint16_t msec, uint16_t usec)
 {
-  cmd->d.buf[BYTE0] = (CMTSPEECH_TIMING_CONFIG_NTF << 4) | CMTSPEECH_DOMAIN_CONTROL;
-  cmd->d.buf[BYTE1] = (msec & 0x1ff) >> 6;
-  cmd->d.buf[BYTE2] =
-    ((msec & 0x1ff) << 2) |
-    (usec & 0x3ff) >> 8;
-  cmd->d.buf[BYTE3] = usec & 0xff;
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS] = { msec, usec };
 
-  return 4;
+  return priv_encode_control(cmd, CMTSPEECH_TIMING_CONFIG_NTF, CMTSPEECH_DOMAIN_CONTROL, vals);
 }
 
 /**
@@ -332,11 +465,15 @@ int cmtspeech_msg_encode_timing_config_ntf(cmtspeech_cmd_t *cmd, uint16_t msec,
  */
 int cmtspeech_msg_decode_timing_config_ntf(const cmtspeech_cmd_t cmd, uint16_t *msec, uint16_t *usec)
 {
+  cmtspeech_msg_t msg;
+
+  priv_decode_control(cmd, CMTSPEECH_TIMING_CONFIG_NTF, &msg);
+
   if (msec)
-    *msec = (cmd.d.buf[BYTE1] & 0x7) << 6 | cmd.d.buf[BYTE2] >> 2;
+    *msec = msg.u.timing_config_ntf.msec;
 
   if (usec)
-    *usec = (cmd.d.buf[BYTE2] & 0x3) << 8 | cmd.d.buf[BYTE3];
+    *usec = msg.u.timing_config_ntf.usec;
 
   return 0;
 }
@@ -348,12 +485,9 @@ int cmtspeech_msg_decode_timing_config_ntf(const cmtspeech_cmd_t cmd, uint16_t *
  */
 int cmtspeech_msg_encode_ssi_config_req(cmtspeech_cmd_t *cmd, uint8_t layout, uint8_t version, uint8_t state)
 {
-  cmd->d.buf[BYTE0] = (CMTSPEECH_SSI_CONFIG_REQ << 4) | CMTSPEECH_DOMAIN_CONTROL;
-  cmd->d.buf[BYTE1] = 0x0;
-  cmd->d.buf[BYTE2] = layout & 0x7;
-  cmd->d.buf[BYTE3] = ((version & 0xf) << 1) | (state & 0x1);
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS] = { layout, version, state };
 
-  return 4;
+  return priv_encode_control(cmd, CMTSPEECH_SSI_CONFIG_REQ, CMTSPEECH_DOMAIN_CONTROL, vals);
 }
 
 /**
@@ -364,14 +498,18 @@ int cmtspeech_msg_encode_ssi_config_req(cmtspeech_cmd_t *cmd, uint8_t layout, ui
  */
 int cmtspeech_msg_decode_ssi_config_req(const cmtspeech_cmd_t cmd, uint8_t *layout, uint8_t *version, uint8_t *state)
 {
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS];
+
+  priv_unpack_fields(&priv_msg_table[CMTSPEECH_SSI_CONFIG_REQ], priv_load_word(cmd.d.buf), vals);
+
   if (version)
-    *version = (cmd.d.buf[BYTE3] >> 1) & 0xf;
+    *version = vals[1];
 
   if (state)
-    *state = cmd.d.buf[BYTE3] & 0x1;
+    *state = vals[2];
 
   if (layout)
-    *layout = cmd.d.buf[BYTE2] & 0x7;
+    *layout = vals[0];
 
   return 0;
 }
@@ -382,12 +520,9 @@ int cmtspeech_msg_decode_ssi_config_req(const cmtspeech_cmd_t cmd, uint8_t *layo
  */
 int cmtspeech_msg_encode_ssi_config_resp(cmtspeech_cmd_t *cmd, uint8_t layout, uint8_t result)
 {
-  cmd->d.buf[BYTE0] = (CMTSPEECH_SSI_CONFIG_RESP << 4) | CMTSPEECH_DOMAIN_CONTROL;
-  cmd->d.buf[BYTE1] = 0x0;
-  cmd->d.buf[BYTE2] = layout & 0x7;
-  cmd->d.buf[BYTE3] = result & 0x3;
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS] = { layout, result };
 
-  return 4;
+  return priv_encode_control(cmd, CMTSPEECH_SSI_CONFIG_RESP, CMTSPEECH_DOMAIN_CONTROL, vals);
 }
 
 /**
@@ -398,11 +533,15 @@ int cmtspeech_msg_encode_ssi_config_resp(cmtspeech_cmd_t *cmd, uint8_t layout, u
  */
 int cmtspeech_msg_decode_ssi_config_resp(const cmtspeech_cmd_t cmd, uint8_t *layout, uint8_t *result)
 {
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS];
+
+  priv_unpack_fields(&priv_msg_table[CMTSPEECH_SSI_CONFIG_RESP], priv_load_word(cmd.d.buf), vals);
+
   if (result)
-    *result = cmd.d.buf[BYTE3] & 0x3;
+    *result = vals[1];
 
   if (layout)
-    *layout = cmd.d.buf[BYTE2] & 0x7;
+    *layout = vals[0];
 
   return 0;
 }
@@ -415,8 +554,12 @@ int cmtspeech_msg_decode_ssi_config_resp(const cmtspeech_cmd_t cmd, uint8_t *lay
  */
 int cmtspeech_msg_decode_speech_config_resp(const cmtspeech_cmd_t cmd, uint8_t *result)
 {
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS];
+
+  priv_unpack_fields(&priv_msg_table[CMTSPEECH_SPEECH_CONFIG_RESP], priv_load_word(cmd.d.buf), vals);
+
   if (result)
-    *result = cmd.d.buf[BYTE3] & 0x1;
+    *result = vals[0];
 
   return 0;
 }
@@ -427,12 +570,7 @@ int cmtspeech_msg_decode_speech_config_resp(const cmtspeech_cmd_t cmd, uint8_t *
  */
 int cmtspeech_msg_encode_reset_conn_resp(cmtspeech_cmd_t *cmd)
 {
-  cmd->d.buf[BYTE0] = (CMTSPEECH_RESET_CONN_RESP << 4) | CMTSPEECH_DOMAIN_CONTROL;
-  cmd->d.buf[BYTE1] = 0x0;
-  cmd->d.buf[BYTE2] = 0x0;
-  cmd->d.buf[BYTE3] = 0x0;
-
-  return 4;
+  return priv_cmtspeech_msg_encode_simple_message(cmd, CMTSPEECH_RESET_CONN_RESP);
 }
 
 /**
@@ -441,12 +579,7 @@ int cmtspeech_msg_encode_reset_conn_resp(cmtspeech_cmd_t *cmd)
  */
 int cmtspeech_msg_encode_reset_conn_req(cmtspeech_cmd_t *cmd)
 {
-  cmd->d.buf[BYTE0] = (CMTSPEECH_RESET_CONN_REQ << 4) | CMTSPEECH_DOMAIN_CONTROL;
-  cmd->d.buf[BYTE1] = 0x0;
-  cmd->d.buf[BYTE2] = 0x0;
-  cmd->d.buf[BYTE3] = 0x0;
-
-  return 4;
+  return priv_cmtspeech_msg_encode_simple_message(cmd, CMTSPEECH_RESET_CONN_REQ);
 }
 
 /**
@@ -455,12 +588,9 @@ int cmtspeech_msg_encode_reset_conn_req(cmtspeech_cmd_t *cmd)
  */
 int cmtspeech_msg_encode_speech_config_resp(cmtspeech_cmd_t *cmd, uint8_t result)
 {
-  cmd->d.buf[BYTE0] = (CMTSPEECH_SPEECH_CONFIG_RESP << 4) | CMTSPEECH_DOMAIN_CONTROL;
-  cmd->d.buf[BYTE1] = 0x0;
-  cmd->d.buf[BYTE2] = 0x0;
-  cmd->d.buf[BYTE3] = result;
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS] = { result };
 
-  return 4;
+  return priv_encode_control(cmd, CMTSPEECH_SPEECH_CONFIG_RESP, CMTSPEECH_DOMAIN_CONTROL, vals);
 }
 
 /**
@@ -471,17 +601,21 @@ int cmtspeech_msg_encode_speech_config_resp(cmtspeech_cmd_t *cmd, uint8_t result
  */
 int cmtspeech_msg_decode_test_ramp_ping(const cmtspeech_cmd_t cmd, uint8_t *domain, uint8_t *replydomain, uint8_t *rampstart, uint8_t *ramplen)
 {
+  cmtspeech_msg_t msg;
+
+  priv_decode_control(cmd, CMTSPEECH_TEST_RAMP_PING, &msg);
+
   if (domain)
-    *domain = cmd.d.buf[BYTE0] & 0xf;
+    *domain = msg.domain;
 
   if (replydomain)
-    *replydomain = cmd.d.buf[BYTE1] & 0xf;
+    *replydomain = msg.u.test_ramp_ping.replydomain;
 
   if (rampstart)
-    *rampstart = cmd.d.buf[BYTE2];
+    *rampstart = msg.u.test_ramp_ping.rampstart;
 
   if (ramplen)
-    *ramplen = cmd.d.buf[BYTE3];
+    *ramplen = msg.u.test_ramp_ping.ramplen;
 
   return 0;
 }
@@ -492,11 +626,7 @@ int cmtspeech_msg_decode_test_ramp_ping(const cmtspeech_cmd_t cmd, uint8_t *doma
  */
 int cmtspeech_msg_encode_test_ramp_ping(cmtspeech_cmd_t *cmd, uint8_t domain, uint8_t replydomain, uint8_t rampstart, uint8_t ramplen)
 {
-  cmd->d.buf[BYTE0] = (CMTSPEECH_TEST_RAMP_PING << 4) | domain;
-  cmd->d.buf[BYTE1] = replydomain & 0xf;
-  cmd->d.buf[BYTE2] = rampstart;
-  cmd->d.buf[BYTE3] = ramplen;
-
-  return 4;
+  uint16_t vals[CMTSPEECH_MSG_MAX_FIELDS] = { replydomain, rampstart, ramplen };
 
+  return priv_encode_control(cmd, CMTSPEECH_TEST_RAMP_PING, domain, vals);
 }
@@ -59,6 +59,7 @@
 #define CMTSPEECH_EVENT_STATE_CHANGE      0xff01
 #define CMTSPEECH_EVENT_ERROR             0xff02
 #define CMTSPEECH_EVENT_RESET             0xff03
+#define CMTSPEECH_EVENT_DTMF              0xff04
 
 /* Header and message sizes */
 /* -------------------------*/
@@ -114,12 +115,74 @@ struct cmtspeech_cmd_s {
 };
 typedef struct cmtspeech_cmd_s cmtspeech_cmd_t;
 
+#define CMTSPEECH_MSG_MAX_FIELDS          6
+
+/**
+ * Control message in host representation.
+ *
+ * The 'fields' array and the per-type views share storage; the
+ * order of members in each view matches the message table in
+ * cmtspeech_msgs.c. Unused fields are zero after decoding.
+ */
+struct cmtspeech_msg_s {
+  uint8_t type;          /**< CMTSPEECH_RESET_CONN_REQ, ... */
+  uint8_t domain;        /**< CMTSPEECH_DOMAIN_* */
+  union {
+    uint16_t fields[CMTSPEECH_MSG_MAX_FIELDS];
+
+    /* type == CMTSPEECH_SSI_CONFIG_REQ */
+    struct {
+      uint16_t layout;
+      uint16_t version;
+      uint16_t state;
+    } ssi_config_req;
+
+    /* type == CMTSPEECH_SSI_CONFIG_RESP */
+    struct {
+      uint16_t layout;
+      uint16_t result;
+    } ssi_config_resp;
+
+    /* type == CMTSPEECH_SPEECH_CONFIG_REQ */
+    struct {
+      uint16_t speech_data_stream;
+      uint16_t call_user_connecting_ind;
+      uint16_t codec_info;
+      uint16_t cellular_info;
+      uint16_t sample_rate;
+      uint16_t data_format;
+    } speech_config_req;
+
+    /* type == CMTSPEECH_SPEECH_CONFIG_RESP */
+    struct {
+      uint16_t result;
+    } speech_config_resp;
+
+    /* type == CMTSPEECH_TIMING_CONFIG_NTF */
+    struct {
+      uint16_t msec;
+      uint16_t usec;
+    } timing_config_ntf;
+
+    /* type == CMTSPEECH_TEST_RAMP_PING */
+    struct {
+      uint16_t replydomain;
+      uint16_t rampstart;
+      uint16_t ramplen;
+    } test_ramp_ping;
+  } u;
+};
+typedef struct cmtspeech_msg_s cmtspeech_msg_t;
+
 /* Function prototypes / common */
 /* -----------------------------*/
 
 int cmtspeech_msg_get_type(const cmtspeech_cmd_t cmd);
 int cmtspeech_msg_get_domain(const cmtspeech_cmd_t cmd);
 
+int cmtspeech_msg_decode(const cmtspeech_cmd_t cmd, cmtspeech_msg_t *msg);
+int cmtspeech_msg_encode(cmtspeech_cmd_t *cmd, const cmtspeech_msg_t *msg);
+
 /* Function prototypes / tracing */
 /* ------------------------------*/
 
@@ -42,6 +42,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -50,6 +51,11 @@
 
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include <time.h>
 
 #include <errno.h>
 #include <fcntl.h>
@@ -60,6 +66,7 @@
 #include "cmtspeech.h"
 #include "cmtspeech_msgs.h"
 #include "cmtspeech_backend_common.h"
+#include "cmtspeech_nokiamodem.h"
 #include "sal_ring.h"
 
 #define CS_COMMAND(x)  ((x >> CS_CMD_SHIFT) & 0xf)
@@ -83,6 +90,13 @@
 #define SHARED_MEMORY_AREA_PAGE 4096
 #define MAX_UL_ERRORS_PAUSE     5  /* pause UL after this many errors */
 #define CLOCK_WAKE_UP_DELAY_NS  500000
+#define UL_FRAME_PERIOD_US      20000 /* 20ms UL frames */
+#define UL_CONCEAL_SLACK_US     5000  /* allowed app lateness before concealment,
+					 until the modem UL timing is known */
+#define UL_CONCEAL_GUARD_US     2000  /* concealment is sent this long before
+					 the UL deadline of the modem */
+#define UL_CONCEAL_MAX_REPEATS  4     /* faded repeats before falling back to silence */
+#define UL_CONCEAL_NOISE_LEVEL  32    /* comfort noise peak amplitude */
 
 #if NOKIAMODEM_VDD2LOCK
   /* maemo5-specific kernel interface for locking memory+ssi bus speed
@@ -93,11 +107,18 @@
 #define PM_VDD2_LOCK_INTERFACE "/sys/power/vdd2_lock"
 #endif
 
+/* PM QoS interface for limiting CPU DMA latency while
+ * speech data is flowing */
+#define PM_QOS_INTERFACE          "/dev/cpu_dma_latency"
+#define PM_QOS_CALL_LATENCY_US    100
+#define PM_QOS_DEFAULT_LATENCY_US 2000000000
+
 /* support use of 'swapped little endian' sample layout
  * for transfering speech data frames */
 #define PROTOCOL_SUPPORT_SAMPLE_SWAP 1
 
 #include "sal_debug.h"
+#include "sal_probes.h"
 #define DEBUG_PREFIX "nokiamodem_backend: "
 
 /* Data types */
@@ -113,7 +134,9 @@ enum {
   BUF_LOCKED   = 1,
   BUF_INVALID  = 1 << 1,
   BUF_XRUN     = 1 << 2,
-  BUF_LAST     = 1 << 3,
+  BUF_RETIRED  = 1 << 3,        /**< buffer from the previous layout, see
+				     priv_retire_locked_buffers() */
+  BUF_LAST     = 1 << 4,
 };
 
 enum {
@@ -130,16 +153,56 @@ enum DriverFeatures {
 struct nokiamodem_buffer_desc_s {
   cmtspeech_buffer_t bd;
   int flags;
+  uint8_t *mmap_data;           /**< retired buffers: 'bd.data' in the
+				     previous layout */
 };
 typedef struct nokiamodem_buffer_desc_s nokiamodem_buffer_desc_t;
 
+/**
+ * UL concealment state. When enabled, a fallback frame is
+ * sent if the application does not send a UL frame in time.
+ */
+struct nokiamodem_ul_conceal_s {
+  int mode;                     /**< CMTSPEECH_NOKIAMODEM_UL_CONCEAL_* */
+  int timerfd;                  /**< UL deadline timer, -1 if not available */
+  int repeats;                  /**< consecutive concealment frames sent */
+  uint32_t noise_seed;          /**< comfort noise generator state */
+  bool anchored;                /**< whether 'anchor_us' is set */
+  int64_t anchor_us;            /**< UL deadline of frame period 0
+				     (CLOCK_MONOTONIC, usecs) */
+  bool sent_valid;              /**< whether 'sent_period' is set */
+  int64_t sent_period;          /**< frame period of the last sent UL frame */
+  int last_pcount;              /**< octets of payload in 'last' */
+  uint8_t last[MAX_SLOT_SIZE];  /**< payload of last sent UL frame */
+  int spare_pcount;             /**< octets of payload in 'spare',
+				     zero if not filled */
+  int spare_type;               /**< CMTSPEECH_DATA_TYPE_* of 'spare' */
+  uint8_t spare[MAX_SLOT_SIZE]; /**< next concealment frame, filled
+				     ahead of the deadline */
+};
+typedef struct nokiamodem_ul_conceal_s nokiamodem_ul_conceal_t;
+
 struct nokiamodem_driver_state_s {
   int fd;                       /**< driver-io: cmt_speech driver handle */
+  int timerfd;                  /**< driver-io: wakeline settle timer, -1 if
+				   not available */
+  int epfd;                     /**< driver-io: epoll set of 'fd', 'timerfd'
+				   and 'evfd' (see cmtspeech_descriptor()),
+				   or -1 */
+  int evfd;                     /**< driver-io: eventfd signalling events
+				   queued by the library, -1 if not
+				   available */
+  int vdd2_fd;                  /**< driver-io: VDD2 lock interface, or -1 */
+  int pm_qos_fd;                /**< driver-io: PM QoS interface, or -1 */
+  bool pm_active;               /**< driver-io: whether 'pm_hook' is applied */
+  cmtspeech_nokiamodem_pm_hook_t pm_hook; /**< driver-io: PM hook */
+  void *pm_userdata;            /**< driver-io: userdata for 'pm_hook' */
   int wakeline_users;           /**< driver-io: bitmask of wakeline users */
   int flags;                    /**< driver-io: bitmask of DriverFeatures enum */
   uint8_t *buf;                 /**< driver-io: mmap()'ed driver buffer  */
   size_t buflen;                /**< driver-io: size of 'buf' */
   uint8_t *dlswapbuf;           /**< driver-io: temporary buffer for public DL buffers */
+  uint8_t *retirebuf;           /**< driver-io: copies of retired buffers */
   ring_buffer_t evbuf;          /**< driver-io: queued received events */
   uint32_t rx_offsets[DL_SLOTS];
   uint32_t tx_offsets[UL_SLOTS];
@@ -155,6 +218,11 @@ struct cmtspeech_nokiamodem_s {
   uint8_t conf_sample_rate;     /**< buf state: CMTSPEECH_SAMPLE_RATE_* */
   uint8_t conf_data_length;     /**< buf state: CMTSPEECH_DATA_LENGTH_* */
   int ul_errors;                /**< buf state: number of consecutive UL errors */
+  int16_t ul_counter;           /**< buf state: frame counter of next UL frame */
+  bool dl_xrun_pending;         /**< buf state: DL overrun since the
+				   last acquired DL frame */
+  bool dtmf_event_pending;      /**< buf state: DTMF event queued since
+				   the last cmtspeech_check_pending() */
   int rx_ptr_hw;                /**< buf state: next ptr hw driver will
 				   write to, -1 if buffer not yet configured */
   int rx_ptr_appl;              /**< buf state: next ptr to give out to
@@ -163,12 +231,20 @@ struct cmtspeech_nokiamodem_s {
   int ul_slot_app;              /**< buf state: next slot to give to
 				   the app, -1 if buffer not yet
 				   configured */
-  nokiamodem_buffer_desc_t dlbufdesc[DL_SLOTS]; /**< buf state: DL buffer descs */
-  nokiamodem_buffer_desc_t ulbufdesc[UL_SLOTS]; /**< buf state: DL buffer descs */
+  nokiamodem_buffer_desc_t *dlbufdesc; /**< buf state: DL buffer descs (active bank) */
+  nokiamodem_buffer_desc_t *ulbufdesc; /**< buf state: UL buffer descs (active bank) */
+  nokiamodem_buffer_desc_t dlbanks[2][DL_SLOTS]; /**< buf state: DL descriptor banks */
+  nokiamodem_buffer_desc_t ulbanks[2][UL_SLOTS]; /**< buf state: UL descriptor banks */
+  struct timespec setup_started; /**< stats: time of the SPEECH_CONFIG_REQ(1)
+				    starting the call, zero if first DL frame
+				    already received */
+  cmtspeech_nokiamodem_setup_stats_t setup_stats; /**< stats: SPEECH_CONFIG_REQ
+						      to first DL frame */
+  nokiamodem_ul_conceal_t ul_conceal; /**< UL deadline-miss concealment */
 };
 typedef struct cmtspeech_nokiamodem_s cmtspeech_nokiamodem_t;
 
-#define CMTSPEECH_BACKEND_ID "cmtspeech_nokiamodem"
+#define CMTSPEECH_BACKEND_ID CMTSPEECH_NOKIAMODEM_BACKEND_ID
 
 /* Definitions derived from build-time configuration */
 /* -------------------------------------------------------------------- */
@@ -190,6 +266,7 @@ typedef struct cmtspeech_nokiamodem_s cmtspeech_nokiamodem_t;
 static int priv_setup_driver_bufconfig(cmtspeech_nokiamodem_t *priv);
 static void priv_reset_buf_state_to_disconnected(cmtspeech_nokiamodem_t *priv);
 static void priv_initialize_after_peer_reset(cmtspeech_nokiamodem_t *priv);
+static void priv_ul_conceal_timing_config(cmtspeech_nokiamodem_t *priv, const cmtspeech_event_t *event);
 
 /* Function definitions */
 /* -------------------------------------------------------------------- */
@@ -214,7 +291,7 @@ static int priv_write_data(cmtspeech_nokiamodem_t *priv, cmtspeech_cmd_t msg)
 {
   int res =
     write(priv->d.fd, msg.d.buf, sizeof(msg));
-  TRACE_DEBUG(DEBUG_PREFIX "wrote %s, fd %d, res %d.",
+  CTRACE_DEBUG(&priv->bcstate.trace, DEBUG_PREFIX "wrote %s, fd %d, res %d.",
 	      cmtspeech_msg_type_to_string(msg), priv->d.fd, res);
 
   /* note: priv->bcstate.io_errors are not updated for data
@@ -235,26 +312,172 @@ static int priv_write(cmtspeech_nokiamodem_t *priv, cmtspeech_cmd_t msg)
  */
 static void priv_set_ssi_lock(cmtspeech_nokiamodem_t *priv, bool enabled)
 {
-  int fd;
-
-  fd =
-    open(PM_VDD2_LOCK_INTERFACE, O_WRONLY, 0);
-
-  if (fd >= 0) {
+  if (priv->d.vdd2_fd >= 0) {
     char buf[2];
     int res;
     snprintf(buf, sizeof(buf), "%hu",
 	     enabled == true ? PM_VDD2_LOCK_TO_OPP3 : PM_VDD2_UNLOCK);
-    res = write(fd, buf, sizeof(buf));
-    TRACE_IO("setting VDD2 lock to '%s', res %d.", buf, res);
-    close(fd);
+    res = pwrite(priv->d.vdd2_fd, buf, sizeof(buf), 0);
+    CTRACE_IO(&priv->bcstate.trace, "setting VDD2 lock to '%s', res %d.", buf, res);
   }
-  else {
-    TRACE_IO(DEBUG_PREFIX "Unable to lock VDD2, dev %s ('%s').", PM_VDD2_LOCK_INTERFACE, strerror(errno));
+}
+#endif
+
+/**
+ * Sets the CPU DMA latency limit via the PM QoS interface.
+ * The request stays in effect as long as 'pm_qos_fd' is open.
+ */
+static void priv_set_pm_qos(cmtspeech_nokiamodem_t *priv, bool enabled)
+{
+  if (priv->d.pm_qos_fd >= 0) {
+    int32_t latency =
+      enabled == true ? PM_QOS_CALL_LATENCY_US : PM_QOS_DEFAULT_LATENCY_US;
+    CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "setting CPU DMA latency limit to %d us.", latency);
+    if (write(priv->d.pm_qos_fd, &latency, sizeof(latency)) != sizeof(latency))
+      CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "ERROR: unable to set CPU DMA latency limit ('%s').", strerror(errno));
   }
 }
+
+/**
+ * The default power management hook.
+ *
+ * @see CMTSPEECH_NOKIAMODEM_MSG_SET_PM_HOOK
+ */
+static int priv_default_pm_hook(cmtspeech_t *context, bool active, void *userdata)
+{
+  cmtspeech_nokiamodem_t *priv = (cmtspeech_nokiamodem_t*)context;
+
+  priv_set_pm_qos(priv, active);
+#if NOKIAMODEM_VDD2LOCK
+  priv_set_ssi_lock(priv, active);
+#endif
+
+  return 0;
+}
+
+/**
+ * Opens the power management interfaces. The handles are kept
+ * open for the lifetime of the context, so that applying the
+ * PM hook does not require any sysfs/devfs lookups.
+ */
+static void priv_open_pm_interfaces(cmtspeech_nokiamodem_t *priv)
+{
+  priv->d.vdd2_fd = -1;
+#if NOKIAMODEM_VDD2LOCK
+  priv->d.vdd2_fd = open(PM_VDD2_LOCK_INTERFACE, O_WRONLY | O_CLOEXEC, 0);
+  if (priv->d.vdd2_fd < 0)
+    TRACE_IO(DEBUG_PREFIX "Unable to open VDD2 lock, dev %s ('%s').", PM_VDD2_LOCK_INTERFACE, strerror(errno));
 #endif
 
+  priv->d.pm_qos_fd = open(PM_QOS_INTERFACE, O_WRONLY | O_CLOEXEC, 0);
+  if (priv->d.pm_qos_fd < 0)
+    TRACE_IO(DEBUG_PREFIX "Unable to open PM QoS interface, dev %s ('%s').", PM_QOS_INTERFACE, strerror(errno));
+
+  priv->d.pm_active = false;
+  priv->d.pm_hook = priv_default_pm_hook;
+  priv->d.pm_userdata = NULL;
+}
+
+static void priv_close_pm_interfaces(cmtspeech_nokiamodem_t *priv)
+{
+  if (priv->d.vdd2_fd >= 0)
+    close(priv->d.vdd2_fd);
+  if (priv->d.pm_qos_fd >= 0)
+    close(priv->d.pm_qos_fd);
+  priv->d.vdd2_fd = -1;
+  priv->d.pm_qos_fd = -1;
+}
+
+/**
+ * Applies or releases the PM hook, so that it is active
+ * only while speech data is flowing.
+ *
+ * @param force_release release the hook independently
+ *        of the protocol state
+ */
+static void priv_update_pm_state(cmtspeech_nokiamodem_t *priv, bool force_release)
+{
+  bool active =
+    (priv->bcstate.proto_state == CMTSPEECH_STATE_ACTIVE_DL ||
+     priv->bcstate.proto_state == CMTSPEECH_STATE_ACTIVE_DLUL);
+
+  if (force_release == true)
+    active = false;
+
+  if (active != priv->d.pm_active) {
+    CTRACE_DEBUG(&priv->bcstate.trace, DEBUG_PREFIX "%s PM hook.",
+		 active == true ? "applying" : "releasing");
+    if (priv->d.pm_hook((cmtspeech_t*)priv, active, priv->d.pm_userdata) != 0)
+      CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "ERROR: PM hook failed (active %d).", active);
+    priv->d.pm_active = active;
+  }
+}
+
+/**
+ * Arms the wakeline settle timer. Control messages written
+ * before the timer expires are queued, and sent from
+ * priv_flush_deferred().
+ *
+ * @return 0 on success, -1 if the timer is not available
+ */
+static int priv_arm_wakeline_timer(cmtspeech_nokiamodem_t *priv)
+{
+  struct itimerspec its;
+
+  if (priv->d.timerfd < 0)
+    return -1;
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_nsec = CLOCK_WAKE_UP_DELAY_NS;
+  if (timerfd_settime(priv->d.timerfd, 0, &its, NULL) < 0) {
+    CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "ERROR: unable to arm wakeline timer ('%s').", strerror(errno));
+    return -1;
+  }
+
+  priv->bcstate.defer_writes = true;
+  return 0;
+}
+
+/**
+ * Disarms the wakeline settle timer and sends the
+ * control messages queued while it was armed. If the
+ * timer has not expired yet, waits for the rest of the
+ * settle delay first.
+ *
+ * @return 0 on success, -1 if any of the queued messages
+ *         could not be written
+ */
+static int priv_flush_deferred(cmtspeech_nokiamodem_t *priv)
+{
+  struct itimerspec its;
+
+  if (priv->bcstate.defer_writes != true)
+    return 0;
+
+  /* note: the modem is not ready before the delay has passed */
+  if (timerfd_gettime(priv->d.timerfd, &its) == 0 &&
+      (its.it_value.tv_sec != 0 || its.it_value.tv_nsec != 0))
+    nanosleep(&its.it_value, NULL);
+
+  /* note: also clears a pending expiration */
+  memset(&its, 0, sizeof(its));
+  timerfd_settime(priv->d.timerfd, 0, &its, NULL);
+
+  return cmtspeech_bc_flush_deferred(&priv->bcstate, priv->d.fd);
+}
+
+/**
+ * Handles failure to write deferred control messages. The
+ * state machine was already updated when they were queued,
+ * so the modem is out of sync; ask for a protocol reset,
+ * which is reported to the client as a CMTSPEECH_EVENT_RESET.
+ */
+static void priv_handle_deferred_error(cmtspeech_nokiamodem_t *priv)
+{
+  CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "ERROR: deferred control messages lost, resetting protocol state.");
+  cmtspeech_state_change_error((cmtspeech_t*)priv);
+}
+
 /**
  * Allocates SSI wakeline from the driver.
  *
@@ -273,23 +496,22 @@ static int priv_acquire_wakeline(cmtspeech_nokiamodem_t *priv, int id)
   if (priv->d.wakeline_users == 0) {
     unsigned int status = 1;
     res = ioctl (priv->d.fd, CS_SET_WAKELINE, &status);
-    TRACE_IO(DEBUG_PREFIX "Toggled SSI wakeline to %u by id %02x (res %d).", status, id, res);
-
-#if NOKIAMODEM_VDD2LOCK
-    /* step: lock VDD2 whenever modem needs to be able to send
-     *       messages towards us */
-    priv_set_ssi_lock(priv, true);
-#endif
+    CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "Toggled SSI wakeline to %u by id %02x (res %d).", status, id, res);
 
     /* step: this is ugly, but as the hw interface does not provide means to get
      *       an indication when modem is ready, a small delay is
-     *       needed after raising the wakeline */
-    struct timespec tv;
-    tv.tv_sec = 0;
-    tv.tv_nsec = CLOCK_WAKE_UP_DELAY_NS;
-    nanosleep(&tv, NULL);
+     *       needed after raising the wakeline; control messages
+     *       are deferred until the timer expires, and the
+     *       caller is not blocked */
+    if (priv_arm_wakeline_timer(priv) != 0) {
+      struct timespec tv;
+      tv.tv_sec = 0;
+      tv.tv_nsec = CLOCK_WAKE_UP_DELAY_NS;
+      nanosleep(&tv, NULL);
+    }
   }
   priv->d.wakeline_users |= id;
+  SAL_PROBE3(wakeline_acquire, id, priv->d.wakeline_users, res);
   return res;
 }
 
@@ -309,16 +531,14 @@ static int priv_release_wakeline(cmtspeech_nokiamodem_t *priv, int id)
     priv->d.wakeline_users &= ~id;
     if (priv->d.wakeline_users == 0) {
       unsigned int status = 0;
+      int flushed = priv_flush_deferred(priv);
       res = ioctl (priv->d.fd, CS_SET_WAKELINE, &status);
-      TRACE_IO(DEBUG_PREFIX "Toggled SSI wakeline to %u by id %02x (res %d).", status, id, res);
-
-#if NOKIAMODEM_VDD2LOCK
-      /* step: unlock VDD2 whenever we are sure modem no longer needs
-       *       needs to send messages towards us */
-      priv_set_ssi_lock(priv, false);
-#endif
+      CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "Toggled SSI wakeline to %u by id %02x (res %d).", status, id, res);
+      if (flushed != 0)
+	priv_handle_deferred_error(priv);
     }
   }
+  SAL_PROBE3(wakeline_release, id, priv->d.wakeline_users, res);
   return res;
 }
 
@@ -327,14 +547,11 @@ static void priv_reset_wakeline_state(cmtspeech_nokiamodem_t *priv)
   unsigned int status = 0;
   int res;
 
-  TRACE_IO(DEBUG_PREFIX "Reseting SSI wakeline state (user mask %x at reset).", priv->d.wakeline_users);
+  CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "Reseting SSI wakeline state (user mask %x at reset).", priv->d.wakeline_users);
 
-#if NOKIAMODEM_VDD2LOCK
-  /* step: make sure VDD2 is unlocked */
-  if (priv->d.wakeline_users != 0) {
-    priv_set_ssi_lock(priv, false);
-  }
-#endif
+  /* step: send any queued messages (e.g. RESET_CONN_RESP)
+   *       before lowering the wakeline */
+  priv_flush_deferred(priv);
 
   res = ioctl (priv->d.fd, CS_SET_WAKELINE, &status);
   SOFT_ASSERT(res == 0);
@@ -409,31 +626,24 @@ static void priv_initialize_buffer_descriptor(nokiamodem_buffer_desc_t *bd, uint
   bd->flags = desc_flags;
 }
 
-static void priv_initialize_tx_buffer_descriptors_mmap(cmtspeech_nokiamodem_t *priv, int desc_flags)
+/**
+ * Sets up the DL and UL buffer descriptors, and slot offsets,
+ * for the buffer layout reported by the driver.
+ */
+static void priv_apply_buffer_layout(cmtspeech_nokiamodem_t *priv, int desc_flags)
 {
-  int i;
   struct cs_mmap_config_block *mmap_cfg =
     (struct cs_mmap_config_block *)priv->d.buf;
-
-  for(i = 0; i < UL_SLOTS; i++) {
-    uint8_t *slotbuf_i =
-      priv->d.buf + mmap_cfg->tx_offsets[i];
-
-    priv_initialize_buffer_descriptor(&priv->ulbufdesc[i], slotbuf_i, priv->slot_size, 0, i, desc_flags);
-  }
-}
-
-static void priv_initialize_rx_buffer_descriptors_mmap(cmtspeech_nokiamodem_t *priv, int desc_flags)
-{
   int i;
-  struct cs_mmap_config_block *mmap_cfg = 
-    (struct cs_mmap_config_block *)priv->d.buf;
 
   for(i = 0; i < DL_SLOTS; i++) {
-    uint8_t *slotbuf_i =
-      priv->d.buf +  mmap_cfg->rx_offsets[i];
+    priv->d.rx_offsets[i] = mmap_cfg->rx_offsets[i];
+    priv_initialize_buffer_descriptor(&priv->dlbufdesc[i], priv->d.buf + priv->d.rx_offsets[i], priv->slot_size, 0, i, desc_flags);
+  }
 
-    priv_initialize_buffer_descriptor(&priv->dlbufdesc[i], slotbuf_i, priv->slot_size, 0, i, desc_flags);
+  for(i = 0; i < UL_SLOTS; i++) {
+    priv->d.tx_offsets[i] = mmap_cfg->tx_offsets[i];
+    priv_initialize_buffer_descriptor(&priv->ulbufdesc[i], priv->d.buf + priv->d.tx_offsets[i], priv->slot_size, 0, i, desc_flags);
   }
 }
 
@@ -441,7 +651,7 @@ static void priv_initialize_rx_buffer_descriptors_mmap(cmtspeech_nokiamodem_t *p
  * Reinitializes the DL buffer descriptors in case the sample
  * layout has changed.
  *
- * Note: priv_initialize_dl_buffer_descriptors*() must be called
+ * Note: priv_apply_buffer_layout() must be called
  * at least once before this function.
  */
 static void priv_update_dl_buffer_descriptors(cmtspeech_nokiamodem_t *priv)
@@ -498,7 +708,7 @@ static inline int priv_locked_bufdescs(cmtspeech_nokiamodem_t *priv, bool verbos
     if (priv->ulbufdesc[i].flags & BUF_LOCKED) {
       ++locked;
       if (verbose == true)
-	TRACE_IO(DEBUG_PREFIX "UL buf %i(%p,data:%p) locked.",
+	CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "UL buf %i(%p,data:%p) locked.",
 		 i, &priv->ulbufdesc[i].bd, priv->ulbufdesc[i].bd.data);
     }
 
@@ -506,7 +716,7 @@ static inline int priv_locked_bufdescs(cmtspeech_nokiamodem_t *priv, bool verbos
     if (priv->dlbufdesc[i].flags & BUF_LOCKED) {
       ++locked;
       if (verbose == true)
-	TRACE_IO(DEBUG_PREFIX "DL buf %i(%p,data:%p) locked.",
+	CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "DL buf %i(%p,data:%p) locked.",
 		 i, &priv->dlbufdesc[i].bd, priv->dlbufdesc[i].bd.data);
     }
 
@@ -546,15 +756,90 @@ static void priv_reset_buf_state_to_disconnected(cmtspeech_nokiamodem_t *priv)
   priv->conf_data_length = (uint8_t)-1;
   priv->speech_config_resp_pend = false;
   priv->ul_errors = 0;
+  priv->ul_counter = 0;
+  priv->dl_xrun_pending = false;
+  cmtspeech_bc_dl_counter_reset(&priv->bcstate);
   priv->rx_ptr_hw = -1;
   priv->rx_ptr_appl = -1;
   priv->ul_slot_app = -1;
+  priv->setup_started.tv_sec = 0;
+  priv->setup_started.tv_nsec = 0;
+  priv->ul_conceal.anchored = false;
+  priv->ul_conceal.sent_valid = false;
+  priv->ul_conceal.spare_pcount = 0;
   memset(priv->dlbufdesc, 0, DL_SLOTS * sizeof(nokiamodem_buffer_desc_t));
   memset(priv->ulbufdesc, 0, UL_SLOTS * sizeof(nokiamodem_buffer_desc_t));
   priv_invalidate_buffer_slots(priv);
   SOFT_ASSERT(priv_locked_bufdescs(priv, true) == 0);
 }
 
+static void priv_close_event_descriptors(cmtspeech_nokiamodem_t *priv)
+{
+  if (priv->d.epfd >= 0)
+    close(priv->d.epfd);
+  if (priv->d.timerfd >= 0)
+    close(priv->d.timerfd);
+  if (priv->ul_conceal.timerfd >= 0)
+    close(priv->ul_conceal.timerfd);
+  if (priv->d.evfd >= 0)
+    close(priv->d.evfd);
+  priv->d.epfd = -1;
+  priv->d.timerfd = -1;
+  priv->ul_conceal.timerfd = -1;
+  priv->d.evfd = -1;
+}
+
+/**
+ * Creates the wakeline settle timer, the UL deadline timer
+ * and the library event eventfd, and an epoll set combining
+ * them with the driver handle. If this fails, the driver
+ * handle is used directly, raising the wakeline blocks the
+ * caller, UL concealment is not available, and DTMF events
+ * are reported only with the next driver wakeup.
+ */
+static void priv_open_event_descriptors(cmtspeech_nokiamodem_t *priv)
+{
+  struct epoll_event ev;
+
+  priv->ul_conceal.timerfd = -1;
+  priv->d.evfd = -1;
+  priv->d.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  priv->d.epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  if (priv->d.timerfd >= 0 && priv->d.epfd >= 0) {
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = priv->d.fd;
+    if (epoll_ctl(priv->d.epfd, EPOLL_CTL_ADD, priv->d.fd, &ev) == 0) {
+      ev.data.fd = priv->d.timerfd;
+      if (epoll_ctl(priv->d.epfd, EPOLL_CTL_ADD, priv->d.timerfd, &ev) == 0) {
+	/* note: UL concealment is optional */
+	priv->ul_conceal.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (priv->ul_conceal.timerfd >= 0) {
+	  ev.data.fd = priv->ul_conceal.timerfd;
+	  if (epoll_ctl(priv->d.epfd, EPOLL_CTL_ADD, priv->ul_conceal.timerfd, &ev) != 0) {
+	    close(priv->ul_conceal.timerfd);
+	    priv->ul_conceal.timerfd = -1;
+	  }
+	}
+	/* note: DTMF event wakeups are optional */
+	priv->d.evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (priv->d.evfd >= 0) {
+	  ev.data.fd = priv->d.evfd;
+	  if (epoll_ctl(priv->d.epfd, EPOLL_CTL_ADD, priv->d.evfd, &ev) != 0) {
+	    close(priv->d.evfd);
+	    priv->d.evfd = -1;
+	  }
+	}
+	return;
+      }
+    }
+  }
+
+  TRACE_ERROR(DEBUG_PREFIX "unable to set up wakeline timer ('%s'), using blocking delays.", strerror(errno));
+  priv_close_event_descriptors(priv);
+}
+
 cmtspeech_t* cmtspeech_open(void)
 {
   cmtspeech_nokiamodem_t *priv =
@@ -580,6 +865,17 @@ cmtspeech_t* cmtspeech_open(void)
     priv->d.wakeline_users = 0;
     priv->d.fd = fd;
     priv->d.flags = 0;
+    priv_open_event_descriptors(priv);
+    priv_open_pm_interfaces(priv);
+    priv->ul_conceal.mode = CMTSPEECH_NOKIAMODEM_UL_CONCEAL_OFF;
+    priv->ul_conceal.repeats = 0;
+    priv->ul_conceal.noise_seed = 1;
+    priv->ul_conceal.anchored = false;
+    priv->ul_conceal.sent_valid = false;
+    priv->ul_conceal.last_pcount = 0;
+    priv->ul_conceal.spare_pcount = 0;
+    memset(&priv->setup_stats, 0, sizeof(priv->setup_stats));
+    priv->dtmf_event_pending = false;
     ring_buffer_init(&priv->d.evbuf, ringbufdata, ringbufsize);
 
     /* note: we define the memory layout */
@@ -591,6 +887,11 @@ cmtspeech_t* cmtspeech_open(void)
 #else
     priv->d.dlswapbuf = NULL;
 #endif
+    priv->d.retirebuf = malloc(MAX_SLOT_SIZE * (DL_SLOTS + UL_SLOTS));
+    memset(priv->dlbanks, 0, sizeof(priv->dlbanks));
+    memset(priv->ulbanks, 0, sizeof(priv->ulbanks));
+    priv->dlbufdesc = priv->dlbanks[0];
+    priv->ulbufdesc = priv->ulbanks[0];
     priv_reset_buf_state_to_disconnected(priv);
   }
   else {
@@ -617,6 +918,10 @@ int cmtspeech_close(cmtspeech_t *context)
     cmtspeech_nokiamodem_t *priv = (cmtspeech_nokiamodem_t*)context;
 
     priv_reset_wakeline_state(priv);
+    cmtspeech_bc_close(&priv->bcstate);
+    priv_update_pm_state(priv, true);
+    priv_close_event_descriptors(priv);
+    priv_close_pm_interfaces(priv);
 
     if (priv->d.buf)
       munmap(priv->d.buf, priv->d.buflen);
@@ -629,6 +934,9 @@ int cmtspeech_close(cmtspeech_t *context)
     if (priv->d.dlswapbuf)
       free(priv->d.dlswapbuf);
 
+    if (priv->d.retirebuf)
+      free(priv->d.retirebuf);
+
     /* step: finally free the context pointer itself*/
     free(priv);
   }
@@ -641,6 +949,12 @@ int cmtspeech_close(cmtspeech_t *context)
 int cmtspeech_descriptor(cmtspeech_t *context)
 {
   cmtspeech_nokiamodem_t *priv = (cmtspeech_nokiamodem_t*)context;
+
+  /* note: the epoll set becomes readable also when the wakeline
+   *       timer expires, see cmtspeech_check_pending() */
+  if (priv->d.epfd >= 0)
+    return priv->d.epfd;
+
   return priv->d.fd;
 }
 
@@ -667,7 +981,7 @@ static int priv_queue_control_event(cmtspeech_nokiamodem_t *priv, const cmtspeec
     int avail =
       ring_buffer_avail_for_write(&priv->d.evbuf);
 
-    TRACE_ERROR(DEBUG_PREFIX
+    CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX
 		"control event queue overflow "
 		"(lostmsg:%d, newmsg:%d, avail=%u, cavail=%u, event=%u)",
 		oldev->msg_type, event->msg_type, avail, cavail, eventsize);
@@ -702,7 +1016,7 @@ static int priv_dequeue_control_event(cmtspeech_nokiamodem_t *priv, cmtspeech_ev
     int avail =
       ring_buffer_avail_for_read(&priv->d.evbuf);
 
-    TRACE_IO(DEBUG_PREFIX
+    CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX
 	     "notice: control event dequeue with no data "
 	     "(avail=%u, cavail=%u, event=%u)",
 	     avail, cavail, eventsize);
@@ -736,14 +1050,14 @@ static int priv_setup_driver_bufconfig_v2api(cmtspeech_nokiamodem_t *priv)
   }
 
   res = ioctl(priv->d.fd, CS_CONFIG_BUFS, &drvcfg);
-  TRACE_IO(DEBUG_PREFIX "Initialized driver buffer: res %d, params size=%u.",
+  CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "Initialized driver buffer: res %d, params size=%u.",
 	   res, drvcfg.buf_size);
   if (res == 0) {
     struct cs_mmap_config_block *mmap_cfg = 
       (struct cs_mmap_config_block *)priv->d.buf;
     int i;
 
-    TRACE_IO(DEBUG_PREFIX "mmap_cfg: ver=%u, buf_size=%u, rxbufs=%u, txbufs=%u",
+    CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "mmap_cfg: ver=%u, buf_size=%u, rxbufs=%u, txbufs=%u",
 	     if_ver, mmap_cfg->buf_size, mmap_cfg->rx_bufs, mmap_cfg->tx_bufs);
 
     /* note: rolling rx pointer feature introduced in v1 */
@@ -753,24 +1067,23 @@ static int priv_setup_driver_bufconfig_v2api(cmtspeech_nokiamodem_t *priv)
     /* note: run following only when activating */
     if (priv->slot_size > 0) {
       for(i = 0; i < DL_SLOTS; i++)
-	TRACE_IO(DEBUG_PREFIX "mmap_cfg: rxbuf #%u = %u",
+	CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "mmap_cfg: rxbuf #%u = %u",
 		 i, mmap_cfg->rx_offsets[i]);
 
       for(i = 0; i < UL_SLOTS; i++)
-	TRACE_IO(DEBUG_PREFIX "mmap_cfg: txbuf #%u = %u",
+	CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "mmap_cfg: txbuf #%u = %u",
 		 i, mmap_cfg->tx_offsets[i]);
 
-      priv_initialize_rx_buffer_descriptors_mmap(priv, desc_flags);
-      priv_initialize_tx_buffer_descriptors_mmap(priv, desc_flags);
+      priv_apply_buffer_layout(priv, desc_flags);
 
       priv->d.tstamp_rx_ctrl_offset =
 	offsetof(struct cs_mmap_config_block, tstamp_rx_ctrl);
-      TRACE_IO(DEBUG_PREFIX "mmap_cfg: rx-ctrl-tstamp=%u",
+      CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "mmap_cfg: rx-ctrl-tstamp=%u",
 	       priv->d.tstamp_rx_ctrl_offset);
     }
   }
   else {
-    TRACE_ERROR(DEBUG_PREFIX "CS_CONFIG_BUFS returned an error (%d): %s",
+    CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "CS_CONFIG_BUFS returned an error (%d): %s",
 		errno, strerror(errno), drvcfg.buf_size);
   }
 
@@ -799,7 +1112,7 @@ static int priv_setup_driver_bufconfig(cmtspeech_nokiamodem_t *priv)
   /* step: pass new parameters to the driver */
   res = priv_setup_driver_bufconfig_v2api(priv);
   if (res < 0) {
-    TRACE_ERROR(DEBUG_PREFIX "Unable to set up buffer config for call");
+    CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "Unable to set up buffer config for call");
   }
 
   return res;
@@ -840,7 +1153,7 @@ static int priv_setup_and_send_speech_config_reply(cmtspeech_nokiamodem_t *priv)
   if (setupres != 0) {
     /* we cannot properly receover from local speech_config error,
      * so send a request to reset the state to modem */
-    TRACE_ERROR(DEBUG_PREFIX "Setting up driver buffers failed %d.", res);
+    CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "Setting up driver buffers failed %d.", res);
     priv_invalidate_buffer_slots(priv);
     priv_send_reset(priv);
   }
@@ -848,6 +1161,138 @@ static int priv_setup_and_send_speech_config_reply(cmtspeech_nokiamodem_t *priv)
   return res;
 }
 
+static nokiamodem_buffer_desc_t *priv_spare_dl_bank(cmtspeech_nokiamodem_t *priv)
+{
+  return priv->dlbufdesc == priv->dlbanks[0] ? priv->dlbanks[1] : priv->dlbanks[0];
+}
+
+static nokiamodem_buffer_desc_t *priv_spare_ul_bank(cmtspeech_nokiamodem_t *priv)
+{
+  return priv->ulbufdesc == priv->ulbanks[0] ? priv->ulbanks[1] : priv->ulbanks[0];
+}
+
+/**
+ * Returns the retired descriptor matching 'buf', or NULL
+ * if 'buf' is not a retired buffer.
+ */
+static nokiamodem_buffer_desc_t *priv_find_retired_desc(nokiamodem_buffer_desc_t *bank, int slots, cmtspeech_buffer_t *buf)
+{
+  if (buf->index >= 0 && buf->index < slots &&
+      &bank[buf->index].bd == buf &&
+      (bank[buf->index].flags & BUF_RETIRED))
+    return &bank[buf->index];
+
+  return NULL;
+}
+
+/**
+ * Moves buffers held by the application to the spare
+ * descriptor bank, so that the driver buffer layout can be
+ * changed without waiting for the buffers to be released.
+ *
+ * The contents of the held buffers are copied out of the
+ * mmap area, and the descriptors are updated to point
+ * to the copies. The old address is kept in 'mmap_data'
+ * for the cmtspeech_dl_buffer_find_with_*() lookups. The
+ * released buffers are handled in priv_release_retired_dl_buffer()
+ * and priv_release_retired_ul_buffer().
+ *
+ * @return 0 on success, -1 if buffers from an earlier layout
+ *         change are still held by the application
+ */
+static int priv_retire_locked_buffers(cmtspeech_nokiamodem_t *priv)
+{
+  nokiamodem_buffer_desc_t *spare_dl = priv_spare_dl_bank(priv);
+  nokiamodem_buffer_desc_t *spare_ul = priv_spare_ul_bank(priv);
+  uint8_t *to = priv->d.retirebuf;
+  int i;
+
+  if (to == NULL)
+    return -1;
+
+  for(i = 0; i < DL_SLOTS; i++)
+    if (spare_dl[i].flags & BUF_LOCKED)
+      return -1;
+  for(i = 0; i < UL_SLOTS; i++)
+    if (spare_ul[i].flags & BUF_LOCKED)
+      return -1;
+
+  /* step: copy held buffers out of the mmap area */
+  for(i = 0; i < DL_SLOTS + UL_SLOTS; i++, to += MAX_SLOT_SIZE) {
+    nokiamodem_buffer_desc_t *desc =
+      i < DL_SLOTS ? &priv->dlbufdesc[i] : &priv->ulbufdesc[i - DL_SLOTS];
+
+    if (desc->flags & BUF_LOCKED) {
+      SOFT_ASSERT(desc->bd.size <= MAX_SLOT_SIZE);
+      memcpy(to, desc->bd.data, desc->bd.size);
+      desc->mmap_data = desc->bd.data;
+      desc->bd.data = to;
+      desc->bd.payload = to + CMTSPEECH_DATA_HEADER_LEN;
+      desc->flags = BUF_LOCKED | BUF_RETIRED;
+    }
+    else
+      desc->flags = 0;
+  }
+
+  /* step: switch banks, the new bank is set up when the
+   *       new layout is passed to the driver */
+  memset(spare_dl, 0, DL_SLOTS * sizeof(nokiamodem_buffer_desc_t));
+  memset(spare_ul, 0, UL_SLOTS * sizeof(nokiamodem_buffer_desc_t));
+  priv->dlbufdesc = spare_dl;
+  priv->ulbufdesc = spare_ul;
+
+  CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "Retired buffers held by application, switched to descriptor bank %d.",
+	    priv->dlbufdesc == priv->dlbanks[0] ? 0 : 1);
+
+  return 0;
+}
+
+/**
+ * Releases a DL buffer retired in priv_retire_locked_buffers().
+ *
+ * @return 0 if 'buf' was a retired buffer, -ENOENT otherwise
+ */
+static int priv_release_retired_dl_buffer(cmtspeech_nokiamodem_t *priv, cmtspeech_buffer_t *buf)
+{
+  nokiamodem_buffer_desc_t *desc =
+    priv_find_retired_desc(priv_spare_dl_bank(priv), DL_SLOTS, buf);
+
+  if (desc == NULL)
+    return -ENOENT;
+
+  desc->flags = 0;
+
+  return 0;
+}
+
+/**
+ * Releases a UL buffer retired in priv_retire_locked_buffers().
+ * If the frame size has not changed, the frame is copied to
+ * the next UL slot of the current layout, so that it can be
+ * sent normally.
+ *
+ * @return the UL buffer to send, or NULL if the frame
+ *         was dropped
+ */
+static cmtspeech_buffer_t *priv_release_retired_ul_buffer(cmtspeech_nokiamodem_t *priv, nokiamodem_buffer_desc_t *desc)
+{
+  cmtspeech_buffer_t *buf = NULL;
+
+  if (desc->bd.count == (int)priv->slot_size &&
+      priv->speech_config_resp_pend != true &&
+      cmtspeech_ul_buffer_acquire(priv, &buf) == 0) {
+    SOFT_ASSERT(buf->pcount == desc->bd.pcount);
+    memcpy(buf->payload, desc->bd.payload, buf->pcount);
+    buf->frame_flags = desc->bd.frame_flags;
+  }
+  else
+    CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "Dropped UL frame from previous layout (slot %d, %d octets).", desc->bd.index, desc->bd.count);
+
+  desc->flags = 0;
+
+  return buf;
+}
+
 /**
  * Completes processing of SPEECH_CONFIG_REQ.
  *
@@ -872,12 +1317,12 @@ static int priv_drvbuf_layout_change_buffer_released(cmtspeech_nokiamodem_t *pri
 
   int locked = priv_locked_bufdescs(priv, true);
 
-  TRACE_IO(DEBUG_PREFIX "Buffer release during layout change, locked %d.", locked);
+  CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "Buffer release during layout change, locked %d.", locked);
 
   if (locked == 0) {
     int res = priv_setup_and_send_speech_config_reply(priv);
     if (res != 0) {
-      TRACE_ERROR(DEBUG_PREFIX "Sending SPEECH_CONFIG_RESP (delayed) failed with %d.", res);
+      CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "Sending SPEECH_CONFIG_RESP (delayed) failed with %d.", res);
       priv_invalidate_buffer_slots(priv);
     }
     SOFT_ASSERT(priv->speech_config_resp_pend != true);
@@ -907,7 +1352,7 @@ static int priv_handle_speech_config(cmtspeech_nokiamodem_t *priv, cmtspeech_eve
       frame_size = 320 * PCM_SAMPLE_SIZE;
     }
     else {
-      TRACE_ERROR(DEBUG_PREFIX "Invalid sample rate (%u) in SPEECH_CONFIG_REQ.", 
+      CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "Invalid sample rate (%u) in SPEECH_CONFIG_REQ.", 
 		 event->msg.speech_config_req.sample_rate);
       /* FIXME: this error should be propagated so an error response
        *        is sent back to peer */
@@ -916,8 +1361,13 @@ static int priv_handle_speech_config(cmtspeech_nokiamodem_t *priv, cmtspeech_eve
       res = 1;
     }
 
-    if (frame_size > 0)
+    if (frame_size > 0) {
+      /* note: a later SPEECH_CONFIG_REQ during the call only
+       *       changes codec parameters, not counted as setup */
+      if (priv->slot_size == 0)
+	clock_gettime(CLOCK_MONOTONIC, &priv->setup_started);
       priv->slot_size = frame_size + CMTSPEECH_DATA_HEADER_LEN;
+    }
   }
   else {
     /* case: call terminated */
@@ -927,7 +1377,7 @@ static int priv_handle_speech_config(cmtspeech_nokiamodem_t *priv, cmtspeech_eve
     frame_size = 0;
     priv->slot_size = 0;
 
-    TRACE_DEBUG(DEBUG_PREFIX "Parsing SPEECH_CONFIG_REQ, call terminated.");
+    CTRACE_DEBUG(&priv->bcstate.trace, DEBUG_PREFIX "Parsing SPEECH_CONFIG_REQ, call terminated.");
   }
 
   /* note: DMA reconfiguration is needed in all cases, so
@@ -942,8 +1392,15 @@ static int priv_handle_speech_config(cmtspeech_nokiamodem_t *priv, cmtspeech_eve
      *       and DL), as well as reset the mmap area state. */
     res = priv_setup_and_send_speech_config_reply(priv);
   }
+  else if (priv_retire_locked_buffers(priv) == 0) {
+    /* note: Buffers held by the application were moved to the
+     *       spare descriptor bank and remain valid until released,
+     *       so the new layout can be taken into use immediately. */
+    event->msg.speech_config_req.layout_changed = false;
+    res = priv_setup_and_send_speech_config_reply(priv);
+  }
   else {
-    TRACE_IO(DEBUG_PREFIX "Buffer layout changed, but application is holding to %d locked buffers. Postponing SPEECH_CONFIG_RESP reply.", priv_locked_bufdescs(priv, true));
+    CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "Buffer layout changed, but application is holding to %d locked buffers. Postponing SPEECH_CONFIG_RESP reply.", priv_locked_bufdescs(priv, true));
 
     priv->speech_config_resp_pend = true;
     priv_invalidate_buffer_slots(priv);
@@ -955,7 +1412,7 @@ static int priv_handle_speech_config(cmtspeech_nokiamodem_t *priv, cmtspeech_eve
 
 static void priv_initialize_after_peer_reset(cmtspeech_nokiamodem_t *priv)
 {
-  TRACE_IO(DEBUG_PREFIX "Peer reset, initializing local state.");
+  CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "Peer reset, initializing local state.");
   priv->slot_size = 0;
   priv_setup_driver_bufconfig(priv);
   cmtspeech_bc_state_change_reset(priv);
@@ -992,7 +1449,7 @@ static int priv_init_bufconfig_for_test_ramp_ping(cmtspeech_nokiamodem_t *priv,
 {
   int res = 0;
 
-  TRACE_DEBUG(DEBUG_PREFIX "Initializing driver for TEST_RAMP_PING (ramplen %u words).", ramplen);
+  CTRACE_DEBUG(&priv->bcstate.trace, DEBUG_PREFIX "Initializing driver for TEST_RAMP_PING (ramplen %u words).", ramplen);
 
   /* note: in case DMA has not been setup yet, do it now with
    *       the test ramp parameters (possible race conditions
@@ -1032,7 +1489,7 @@ static int priv_handle_test_ramp_ping(cmtspeech_nokiamodem_t *priv, const cmtspe
 				      &rampstart,
 				      &ramplen);
 
-  TRACE_IO(DEBUG_PREFIX "Handling inbound TEST_RAMP_PING (ch:%u, replych:%u, start-val:0x%02x, ramplen %u words).", 
+  CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "Handling inbound TEST_RAMP_PING (ch:%u, replych:%u, start-val:0x%02x, ramplen %u words).", 
 		 channel, replychannel, rampstart, ramplen);
 
   res = priv_acquire_wakeline(priv, WAKELINE_TEST_RAMP_PING);
@@ -1101,12 +1558,45 @@ static inline int priv_rx_ptr_avail(const cmtspeech_nokiamodem_t *priv)
 	 mmap_cfg->rx_ptr_boundary);
 }
 
+/**
+ * Updates call setup statistics when the first DL frame
+ * after SPEECH_CONFIG_REQ has been received.
+ */
+static void priv_update_setup_stats(cmtspeech_nokiamodem_t *priv)
+{
+  cmtspeech_nokiamodem_setup_stats_t *st = &priv->setup_stats;
+  struct timespec now;
+  long long delta_us;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  delta_us = (now.tv_sec - priv->setup_started.tv_sec) * 1000000LL +
+    (now.tv_nsec - priv->setup_started.tv_nsec) / 1000;
+  if (delta_us < 0)
+    delta_us = 0;
+
+  st->last_us = (unsigned int)delta_us;
+  if (st->count == 0 || st->last_us < st->min_us)
+    st->min_us = st->last_us;
+  if (st->last_us > st->max_us)
+    st->max_us = st->last_us;
+  st->total_us += st->last_us;
+  ++st->count;
+
+  priv->setup_started.tv_sec = 0;
+  priv->setup_started.tv_nsec = 0;
+
+  CTRACE_INFO(&priv->bcstate.trace, DEBUG_PREFIX "First DL frame %u us after SPEECH_CONFIG_REQ (min %u, max %u, count %u).",
+	      st->last_us, st->min_us, st->max_us, st->count);
+  SAL_PROBE1(call_setup_latency, st->last_us);
+}
+
 static void handle_inbound_rx_data_received(cmtspeech_nokiamodem_t *priv, const cmtspeech_cmd_t cmd, int *flags)
 {
   int last_slot;
   int next_slot;
+  bool xrun = false;
 
-  TRACE_DEBUG(DEBUG_PREFIX "internal event DL_DATA_RECEIVED.");
+  CTRACE_DEBUG(&priv->bcstate.trace, DEBUG_PREFIX "internal event DL_DATA_RECEIVED.");
 
   /* step: queue event for application */
   *flags |= CMTSPEECH_EVENT_DL_DATA;
@@ -1115,10 +1605,17 @@ static void handle_inbound_rx_data_received(cmtspeech_nokiamodem_t *priv, const
   if (priv->rx_ptr_appl < 0)
     priv->rx_ptr_appl = priv->rx_ptr_hw;
 
+  if (priv->setup_started.tv_sec != 0 || priv->setup_started.tv_nsec != 0)
+    priv_update_setup_stats(priv);
+
   /* step: perform overrun checking */
   last_slot = (priv->rx_ptr_hw) % DL_SLOTS;
   next_slot = (last_slot + 1) % DL_SLOTS;
 
+  TRACE_BINARY(&priv->bcstate.trace, CMTSPEECH_TRACEPOINT_DL_DATA_RECEIVED,
+	       priv->rx_ptr_hw, priv->rx_ptr_appl, last_slot, *flags);
+  SAL_PROBE3(dl_data_received, last_slot, priv->rx_ptr_hw, priv->rx_ptr_appl);
+
   if ((priv->d.flags & DRIVER_FEAT_ROLLING_RX_PTR) &&
       priv_rx_hw_delay(priv) >= DL_SLOTS) {
     struct cs_mmap_config_block *mmap_cfg =
@@ -1128,13 +1625,17 @@ static void handle_inbound_rx_data_received(cmtspeech_nokiamodem_t *priv, const
      *     We have not reacted to driver wakeups fast enough and
      *     driver has overrun the rx buffer at this point. */
 
-    TRACE_INFO(DEBUG_PREFIX "DL buffer overrun (mmaphw %d, hw %d, appl %d, slot %u, count %u, hwdelay %d).",
+    CTRACE_INFO(&priv->bcstate.trace, DEBUG_PREFIX "DL buffer overrun (mmaphw %d, hw %d, appl %d, slot %u, count %u, hwdelay %d).",
 	       mmap_cfg->rx_ptr,
 	       priv->rx_ptr_hw, priv->rx_ptr_appl, last_slot, DL_SLOTS,
 	       priv_rx_hw_delay(priv));
+    TRACE_BINARY(&priv->bcstate.trace, CMTSPEECH_TRACEPOINT_DL_XRUN,
+		 1, last_slot, priv->rx_ptr_hw, priv->rx_ptr_appl);
+    SAL_PROBE4(dl_xrun, 1, last_slot, priv->rx_ptr_hw, priv->rx_ptr_appl);
 
     priv->dlbufdesc[last_slot].flags |= BUF_XRUN;
     *flags |= CMTSPEECH_EVENT_XRUN;
+    xrun = true;
   }
 
   if (priv->dlbufdesc[next_slot].flags & BUF_LOCKED) {
@@ -1143,29 +1644,42 @@ static void handle_inbound_rx_data_received(cmtspeech_nokiamodem_t *priv, const
      *     by application - overrun is not certain, but data
      *     coherency cannot be guaranteed, so reporting as an XRUN */
 
-    TRACE_INFO(DEBUG_PREFIX "possible DL buffer overrun (hw %d, appl %d, slot %u, count %u).",
+    CTRACE_INFO(&priv->bcstate.trace, DEBUG_PREFIX "possible DL buffer overrun (hw %d, appl %d, slot %u, count %u).",
 	       priv->rx_ptr_hw, priv->rx_ptr_appl, next_slot, DL_SLOTS);
+    TRACE_BINARY(&priv->bcstate.trace, CMTSPEECH_TRACEPOINT_DL_XRUN,
+		 2, next_slot, priv->rx_ptr_hw, priv->rx_ptr_appl);
+    SAL_PROBE4(dl_xrun, 2, next_slot, priv->rx_ptr_hw, priv->rx_ptr_appl);
 
     priv->dlbufdesc[next_slot].flags |= BUF_XRUN;
     *flags |= CMTSPEECH_EVENT_XRUN;
+    xrun = true;
   }
 
   if (priv->dlbufdesc[last_slot].flags & BUF_LOCKED) {
     /* xrun case 3:
      *     The slot last used by driver is still owned by application */
 
-    TRACE_INFO(DEBUG_PREFIX "DL buffer overrun (hw %d, appl %d, slot %u, count %u).",
+    CTRACE_INFO(&priv->bcstate.trace, DEBUG_PREFIX "DL buffer overrun (hw %d, appl %d, slot %u, count %u).",
 	       priv->rx_ptr_hw, priv->rx_ptr_appl, last_slot, DL_SLOTS);
+    TRACE_BINARY(&priv->bcstate.trace, CMTSPEECH_TRACEPOINT_DL_XRUN,
+		 3, last_slot, priv->rx_ptr_hw, priv->rx_ptr_appl);
+    SAL_PROBE4(dl_xrun, 3, last_slot, priv->rx_ptr_hw, priv->rx_ptr_appl);
 
     /* note: mark the overrun buffer and raise an event bit */
     priv->dlbufdesc[last_slot].flags |= BUF_XRUN;
     *flags |= CMTSPEECH_EVENT_XRUN;
+    xrun = true;
+  }
+
+  if (xrun == true) {
+    ++priv->bcstate.dl_stats.xruns;
+    priv->dl_xrun_pending = true;
   }
 
   /* step: reenable UL if paused (as DL path is now working) */
   if (priv->ul_errors > 0) {
     priv->ul_errors = 0;
-    TRACE_IO(DEBUG_PREFIX "DL frame received, reactivating UL transfers.");
+    CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "DL frame received, reactivating UL transfers.");
   }
 }
 
@@ -1187,7 +1701,7 @@ static int handle_inbound_control_message(cmtspeech_nokiamodem_t *priv, const cm
   int channel =
     cmtspeech_msg_get_domain(cmd);
 
-  TRACE_DEBUG(DEBUG_PREFIX "handling bytes %02X:%02X:%02X:%02X, on channel %d.",
+  CTRACE_DEBUG(&priv->bcstate.trace, DEBUG_PREFIX "handling bytes %02X:%02X:%02X:%02X, on channel %d.",
 	      cmd.d.buf[0], cmd.d.buf[1], cmd.d.buf[2], cmd.d.buf[3], cmtspeech_msg_get_domain(cmd));
 
   if (channel == CMTSPEECH_DOMAIN_CONTROL) {
@@ -1195,7 +1709,7 @@ static int handle_inbound_control_message(cmtspeech_nokiamodem_t *priv, const cm
     cmtspeech_event_t cmtevent;
     int retval;
 
-    TRACE_IO(DEBUG_PREFIX "read bytes %02X:%02X:%02X:%02X, control channel message (%s).",
+    CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "read bytes %02X:%02X:%02X:%02X, control channel message (%s).",
 	     cmd.d.buf[0], cmd.d.buf[1], cmd.d.buf[2], cmd.d.buf[3], cmtspeech_msg_type_to_string(cmd));
 
     retval = cmtspeech_bc_handle_command(&priv->bcstate, priv, cmd, &cmtevent);
@@ -1226,6 +1740,7 @@ static int handle_inbound_control_message(cmtspeech_nokiamodem_t *priv, const cm
 	    /* note: copy the kernel timestamp for the message */
 	    struct timespec *s = (struct timespec *)(priv->d.buf + priv->d.tstamp_rx_ctrl_offset); 
 	    memcpy(&cmtevent.msg.timing_config_ntf.tstamp, s, sizeof(*s));
+	    priv_ul_conceal_timing_config(priv, &cmtevent);
 	  }
 	  break;
 
@@ -1237,15 +1752,15 @@ static int handle_inbound_control_message(cmtspeech_nokiamodem_t *priv, const cm
 	  break;
 
 	default:
-	  TRACE_ERROR(DEBUG_PREFIX "ERROR: unknown control message of type %d.", type);
+	  CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "ERROR: unknown control message of type %d.", type);
 	  SOFT_ASSERT(false);
 	}
 
       ONDEBUG(
-	      struct timespec *s = (struct timespec *)(priv->d.buf + priv->d.stamp_rx_ctrl_offset);
-	      if (priv->d.stamp_rx_ctrl_offset > 0)
-		cmtspeech_trace_message(CMTSPEECH_TRACE_DEBUG,
-					DEBUG_PREFIX " control message received at %ld:%ldns.", s->tv_sec, s->tv_nsec)
+	      struct timespec *s = (struct timespec *)(priv->d.buf + priv->d.tstamp_rx_ctrl_offset);
+	      if (priv->d.tstamp_rx_ctrl_offset > 0)
+		CTRACE_DEBUG(&priv->bcstate.trace,
+			     DEBUG_PREFIX " control message received at %ld:%ldns.", s->tv_sec, s->tv_nsec)
 	      );
 
       cmtspeech_bc_complete_event_processing(&priv->bcstate, priv, &cmtevent);
@@ -1272,7 +1787,7 @@ static int handle_inbound_control_message(cmtspeech_nokiamodem_t *priv, const cm
 #if 0
 	// def CS_TX_DATA_SENT
       case CS_COMMAND(CS_TX_DATA_SENT):
-	TRACE_DEBUG(DEBUG_PREFIX "internal event UL_DATA_SENT.");
+	CTRACE_DEBUG(&priv->bcstate.trace, DEBUG_PREFIX "internal event UL_DATA_SENT.");
 	fprintf(stderr, "internal: CS_TX_DATA_SENT\n");
 	*flags |= CMTSPEECH_EVENT_TX_DATA_SENT;
 	res = 1;
@@ -1282,11 +1797,12 @@ static int handle_inbound_control_message(cmtspeech_nokiamodem_t *priv, const cm
       case CS_COMMAND(CS_ERROR):
 	{
 	  cmtspeech_event_t cmtevent;
-          TRACE_ERROR(DEBUG_PREFIX "ERROR: ERROR indication %d received, reseting state",
+          CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "ERROR: ERROR indication %d received, reseting state",
 		      cmd.d.cmd & CMD_PARAM_MASK);
 	  cmtevent.msg_type = CMTSPEECH_EVENT_RESET;
 	  cmtevent.prev_state = priv->bcstate.proto_state;
 	  cmtevent.msg.reset_done.cmt_sent_req = 0;
+	  cmtevent.reserved = 0;
 	  priv_initialize_after_peer_reset(priv);
 	  cmtevent.state = priv->bcstate.proto_state;
 	  priv_queue_control_event(priv, &cmtevent);
@@ -1296,16 +1812,334 @@ static int handle_inbound_control_message(cmtspeech_nokiamodem_t *priv, const cm
 	}
 
       default:
-	TRACE_ERROR(DEBUG_PREFIX "ERROR: unknown control message of type %d (%02X:%02X:%02X:%02x).", 
+	CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "ERROR: unknown control message of type %d (%02X:%02X:%02X:%02x).", 
 		    type, cmd.d.buf[0], cmd.d.buf[1], cmd.d.buf[2], cmd.d.buf[3]);
       }
   }
   else
     res = -1;
 
+  priv_update_pm_state(priv, false);
+
   return res;
 }
 
+/**
+ * Fills the header of UL frame in 'slot', and passes the
+ * frame to the driver for sending.
+ *
+ * @return 0 on success, -EBUSY or -EINVAL on error
+ */
+static int priv_send_ul_slot(cmtspeech_nokiamodem_t *priv, int slot, uint8_t *data, int pcount, int frame_flags)
+{
+  cmtspeech_cmd_t msg;
+  int res;
+
+  res = cmtspeech_msg_encode_ul_data_header(data, CMTSPEECH_DATA_HEADER_LEN, priv->ul_counter, priv->conf_data_length, priv->conf_sample_rate, frame_flags);
+  SOFT_ASSERT(res == CMTSPEECH_DATA_HEADER_LEN);
+
+  /* note: send a CS_CS_UL_DATA_READY message to the driver */
+  priv_msg_encode_driver_message(&msg, CS_COMMAND(CS_TX_DATA_READY), slot & CMD_PARAM_MASK);
+  res = priv_write_data(priv, msg);
+  TRACE_BINARY(&priv->bcstate.trace, CMTSPEECH_TRACEPOINT_UL_BUFFER_RELEASE,
+	       slot, priv->ul_counter, pcount, res);
+  SAL_PROBE4(ul_data_send, slot, data, priv->ul_counter, res);
+  if (res == CMTSPEECH_CTRL_LEN) {
+    priv->ul_counter += 4; /* increment of 4*5ms */
+    res = 0;
+  }
+  else {
+    CTRACE_IO(&priv->bcstate.trace, "UL frame send failed with %d (%d: %s)", res, errno, strerror(errno));
+
+    if (res < 0 &&
+	errno == EBUSY) {
+      res = -EBUSY;
+      ++priv->ul_errors;
+    }
+    else {
+      /* note: SSI subsystem in invalid state, stop sending more UL
+       *       frames immediately */
+      res = -EINVAL;
+      priv->ul_errors = MAX_UL_ERRORS_PAUSE;
+    }
+  }
+
+  return res;
+}
+
+/**
+ * Returns floor(a / b) for b > 0.
+ */
+static int64_t priv_floor_div(int64_t a, int64_t b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static int64_t priv_monotonic_us(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+/**
+ * Returns the first UL frame period whose concealment
+ * deadline is later than 't'. The concealment deadline
+ * of period 'k' is UL_CONCEAL_GUARD_US before the UL
+ * deadline 'anchor_us + k * UL_FRAME_PERIOD_US'.
+ */
+static int64_t priv_ul_period_at(nokiamodem_ul_conceal_t *uc, int64_t t)
+{
+  return priv_floor_div(t - uc->anchor_us + UL_CONCEAL_GUARD_US, UL_FRAME_PERIOD_US) + 1;
+}
+
+/**
+ * Arms the UL deadline timer for the concealment deadline
+ * of the period after the last sent frame. If 'arm' is
+ * false, the timer is disarmed.
+ */
+static void priv_arm_ul_deadline(cmtspeech_nokiamodem_t *priv, bool arm)
+{
+  nokiamodem_ul_conceal_t *uc = &priv->ul_conceal;
+  struct itimerspec its;
+  int64_t t;
+
+  if (uc->timerfd < 0)
+    return;
+
+  memset(&its, 0, sizeof(its));
+  if (arm == true && uc->sent_valid == true) {
+    t = uc->anchor_us + (uc->sent_period + 1) * UL_FRAME_PERIOD_US - UL_CONCEAL_GUARD_US;
+    /* note: a deadline already passed expires immediately */
+    if (t < 1)
+      t = 1;
+    its.it_value.tv_sec = t / 1000000;
+    its.it_value.tv_nsec = (t % 1000000) * 1000;
+  }
+  timerfd_settime(uc->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/**
+ * Fills 'payload' with a concealment frame.
+ *
+ * @return frame type to use (CMTSPEECH_DATA_TYPE_*)
+ */
+static int priv_fill_ul_conceal_frame(cmtspeech_nokiamodem_t *priv, uint8_t *payload, int pcount)
+{
+  nokiamodem_ul_conceal_t *uc = &priv->ul_conceal;
+  int16_t *samples = (int16_t*)payload;
+  int i, n = pcount / PCM_SAMPLE_SIZE;
+  int mode = uc->mode;
+
+  if (mode == CMTSPEECH_NOKIAMODEM_UL_CONCEAL_REPEAT &&
+      (uc->last_pcount != pcount || uc->repeats >= UL_CONCEAL_MAX_REPEATS))
+    mode = CMTSPEECH_NOKIAMODEM_UL_CONCEAL_SILENCE;
+
+  if (mode == CMTSPEECH_NOKIAMODEM_UL_CONCEAL_REPEAT) {
+    /* note: attenuate by 6dB more for each repeat */
+    memcpy(payload, uc->last, pcount);
+    for(i = 0; i < n; i++)
+      samples[i] >>= (uc->repeats + 1);
+    return CMTSPEECH_DATA_TYPE_VALID;
+  }
+  else if (mode == CMTSPEECH_NOKIAMODEM_UL_CONCEAL_NOISE) {
+    for(i = 0; i < n; i++) {
+      uc->noise_seed = uc->noise_seed * 1103515245 + 12345;
+      samples[i] = (int16_t)((int)((uc->noise_seed >> 16) % (2 * UL_CONCEAL_NOISE_LEVEL + 1)) - UL_CONCEAL_NOISE_LEVEL);
+    }
+    return CMTSPEECH_DATA_TYPE_VALID;
+  }
+
+  memset(payload, 0, pcount);
+  return CMTSPEECH_DATA_TYPE_INVALID;
+}
+
+/**
+ * Fills the spare concealment frame for the next deadline,
+ * so that only a copy is needed when the deadline is missed.
+ */
+static void priv_prepare_ul_conceal_frame(cmtspeech_nokiamodem_t *priv, int pcount)
+{
+  nokiamodem_ul_conceal_t *uc = &priv->ul_conceal;
+
+  if (pcount <= 0 || pcount > (int)sizeof(uc->spare)) {
+    uc->spare_pcount = 0;
+    return;
+  }
+
+  uc->spare_type = priv_fill_ul_conceal_frame(priv, uc->spare, pcount);
+  uc->spare_pcount = pcount;
+}
+
+/**
+ * Takes the UL frame schedule from a TIMING_CONFIG_NTF. The
+ * modem expects the next UL frame 'msec' ms and 'usec' us
+ * after the message was received, and then one frame
+ * per UL_FRAME_PERIOD_US.
+ */
+static void priv_ul_conceal_timing_config(cmtspeech_nokiamodem_t *priv, const cmtspeech_event_t *event)
+{
+  nokiamodem_ul_conceal_t *uc = &priv->ul_conceal;
+  const struct timespec *ts = &event->msg.timing_config_ntf.tstamp;
+  int64_t anchor;
+
+  if (ts->tv_sec == 0 && ts->tv_nsec == 0)
+    anchor = priv_monotonic_us();
+  else
+    anchor = ts->tv_sec * 1000000LL + ts->tv_nsec / 1000;
+  anchor += event->msg.timing_config_ntf.msec * 1000LL + event->msg.timing_config_ntf.usec;
+
+  /* note: the last sent frame keeps the period nearest to it
+   *       in the new schedule */
+  if (uc->anchored == true && uc->sent_valid == true)
+    uc->sent_period =
+      priv_floor_div(uc->anchor_us + uc->sent_period * UL_FRAME_PERIOD_US - anchor + UL_FRAME_PERIOD_US / 2,
+		     UL_FRAME_PERIOD_US);
+  else
+    uc->sent_valid = false;
+
+  uc->anchor_us = anchor;
+  uc->anchored = true;
+
+  CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "UL deadline schedule set from TIMING_CONFIG_NTF (%u.%03ums).",
+	    event->msg.timing_config_ntf.msec, event->msg.timing_config_ntf.usec);
+
+  if (uc->mode != CMTSPEECH_NOKIAMODEM_UL_CONCEAL_OFF)
+    priv_arm_ul_deadline(priv, true);
+}
+
+/**
+ * Updates concealment state after the application has sent
+ * a UL frame, and sets the deadline for the next frame.
+ *
+ * Each frame period gets one frame. A frame sent for a
+ * period that already has one (e.g. an application frame
+ * arriving after a concealment frame) is counted for the
+ * next period, so that period is not concealed.
+ *
+ * @param payload frame payload, in the order sent to the modem
+ */
+static void priv_ul_conceal_frame_sent(cmtspeech_nokiamodem_t *priv, const uint8_t *payload, int pcount)
+{
+  nokiamodem_ul_conceal_t *uc = &priv->ul_conceal;
+  int64_t now, period;
+
+  if (uc->mode == CMTSPEECH_NOKIAMODEM_UL_CONCEAL_OFF)
+    return;
+
+  now = priv_monotonic_us();
+
+  /* note: until the modem UL timing is known, the schedule
+   *       starts from the first frame sent by the application */
+  if (uc->anchored != true) {
+    uc->anchor_us = now + UL_CONCEAL_SLACK_US + UL_CONCEAL_GUARD_US;
+    uc->anchored = true;
+    uc->sent_valid = false;
+  }
+
+  period = priv_ul_period_at(uc, now);
+  if (uc->sent_valid == true && period <= uc->sent_period)
+    period = uc->sent_period + 1;
+  uc->sent_period = period;
+  uc->sent_valid = true;
+
+  if (uc->mode == CMTSPEECH_NOKIAMODEM_UL_CONCEAL_REPEAT &&
+      pcount <= (int)sizeof(uc->last)) {
+    memcpy(uc->last, payload, pcount);
+    uc->last_pcount = pcount;
+  }
+
+  uc->repeats = 0;
+  priv_prepare_ul_conceal_frame(priv, pcount);
+  priv_arm_ul_deadline(priv, true);
+}
+
+/**
+ * Handles expiration of the UL deadline timer: the application
+ * has not sent a UL frame for the current frame period, so
+ * the spare concealment frame is sent instead.
+ */
+static void priv_handle_ul_deadline(cmtspeech_nokiamodem_t *priv)
+{
+  nokiamodem_ul_conceal_t *uc = &priv->ul_conceal;
+  nokiamodem_buffer_desc_t *desc;
+  int slot = priv->ul_slot_app;
+  int64_t period;
+  int res;
+
+  /* note: the timer is rearmed when the application
+   *       sends the next frame */
+  if (uc->mode == CMTSPEECH_NOKIAMODEM_UL_CONCEAL_OFF ||
+      uc->sent_valid != true ||
+      priv->bcstate.proto_state != CMTSPEECH_STATE_ACTIVE_DLUL ||
+      slot < 0 ||
+      priv->ul_errors >= MAX_UL_ERRORS_PAUSE)
+    return;
+
+  /* note: if the timer expired late, conceal only the
+   *       latest period */
+  period = priv_ul_period_at(uc, priv_monotonic_us()) - 1;
+  if (period <= uc->sent_period) {
+    priv_arm_ul_deadline(priv, true);
+    return;
+  }
+
+  uc->sent_period = period;
+  desc = &priv->ulbufdesc[slot];
+
+  if (desc->flags & (BUF_LOCKED | BUF_INVALID)) {
+    /* note: application still holds the next slot, its
+     *       frame is counted for the next period */
+    priv_arm_ul_deadline(priv, true);
+    return;
+  }
+
+  if (uc->spare_pcount != desc->bd.pcount)
+    priv_prepare_ul_conceal_frame(priv, desc->bd.pcount);
+  if (uc->spare_pcount == 0) {
+    priv_arm_ul_deadline(priv, true);
+    return;
+  }
+
+  memcpy(desc->bd.payload, uc->spare, uc->spare_pcount);
+  res = priv_send_ul_slot(priv, slot, desc->bd.data, desc->bd.pcount, uc->spare_type);
+  ++uc->repeats;
+
+  CTRACE_INFO(&priv->bcstate.trace, DEBUG_PREFIX "UL deadline missed, sent concealment frame (slot %d, mode %d, repeats %d, res %d).",
+	      slot, uc->mode, uc->repeats, res);
+  SAL_PROBE3(ul_conceal, slot, uc->mode, uc->repeats);
+
+  /* note: application continues from the next slot */
+  priv->ul_slot_app = (slot + 1) % UL_SLOTS;
+
+  priv_prepare_ul_conceal_frame(priv, desc->bd.pcount);
+  priv_arm_ul_deadline(priv, true);
+}
+
+/**
+ * Makes cmtspeech_descriptor() readable to report events
+ * queued by the library itself.
+ */
+static void priv_raise_event_signal(cmtspeech_nokiamodem_t *priv)
+{
+  uint64_t one = 1;
+
+  if (priv->d.evfd >= 0 &&
+      write(priv->d.evfd, &one, sizeof(one)) != sizeof(one))
+    CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "unable to signal queued event ('%s').", strerror(errno));
+}
+
+static void priv_drain_event_signal(cmtspeech_nokiamodem_t *priv)
+{
+  uint64_t count;
+
+  if (priv->d.evfd >= 0 &&
+      read(priv->d.evfd, &count, sizeof(count)) != sizeof(count) &&
+      errno != EAGAIN)
+    CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "unable to read event signal ('%s').", strerror(errno));
+}
+
 int cmtspeech_check_pending(cmtspeech_t *context, int *flags)
 {
   cmtspeech_nokiamodem_t *priv = (cmtspeech_nokiamodem_t*)context;
@@ -1317,13 +2151,56 @@ int cmtspeech_check_pending(cmtspeech_t *context, int *flags)
 
   *flags = 0;
 
+  /* note: DTMF events are queued when DL frames are acquired,
+   *       and signalled with 'evfd' (or reported with the next
+   *       driver wakeup if not available) */
+  if (priv->dtmf_event_pending == true) {
+    priv->dtmf_event_pending = false;
+    priv_drain_event_signal(priv);
+    *flags |= CMTSPEECH_EVENT_CONTROL;
+    res = 1;
+  }
+
+  if (priv->d.epfd >= 0) {
+    struct epoll_event ev[4];
+    bool driver_ready = false;
+    int n =
+      epoll_wait(priv->d.epfd, ev, 4, 0);
+
+    for(i = 0; i < n; i++) {
+      if (ev[i].data.fd == priv->d.timerfd) {
+	uint64_t expirations;
+	if (read(priv->d.timerfd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+	  CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "wakeline timer expired, sending %d deferred messages.", priv->bcstate.deferred_cmds);
+	  if (priv_flush_deferred(priv) != 0)
+	    priv_handle_deferred_error(priv);
+	}
+      }
+      else if (ev[i].data.fd == priv->ul_conceal.timerfd) {
+	uint64_t expirations;
+	if (read(priv->ul_conceal.timerfd, &expirations, sizeof(expirations)) == sizeof(expirations))
+	  priv_handle_ul_deadline(priv);
+      }
+      else if (ev[i].data.fd == priv->d.evfd)
+	priv_drain_event_signal(priv);
+      else
+	driver_ready = true;
+    }
+
+    /* note: only library internal timers expired */
+    if (driver_ready != true)
+      return res;
+  }
+
   i = read(priv->d.fd, cmd.d.buf, CMTSPEECH_CTRL_LEN);
   if (i >= CMTSPEECH_CTRL_LEN) {
-    res = handle_inbound_control_message(priv, cmd, flags);
-    TRACE_DEBUG(DEBUG_PREFIX "read %d from cmtspeech device, handle res %d.", i, res);
+    int handled = handle_inbound_control_message(priv, cmd, flags);
+    if (handled != 0)
+      res = handled;
+    CTRACE_DEBUG(&priv->bcstate.trace, DEBUG_PREFIX "read %d from cmtspeech device, handle res %d.", i, res);
   }
   else
-    TRACE_ERROR(DEBUG_PREFIX "read returned %d.", i);
+    CTRACE_ERROR(&priv->bcstate.trace, DEBUG_PREFIX "read returned %d.", i);
 
   return res;
 }
@@ -1337,20 +2214,30 @@ int cmtspeech_read_event(cmtspeech_t *context, cmtspeech_event_t *event)
 
 int cmtspeech_state_change_call_status(cmtspeech_t *context, bool state)
 {
-  return cmtspeech_bc_state_change_call_status(context, state);
+  int res =
+    cmtspeech_bc_state_change_call_status(context, state);
+  priv_update_pm_state((cmtspeech_nokiamodem_t*)context, false);
+  return res;
 }
 
 int cmtspeech_state_change_call_connect(cmtspeech_t *context, bool state)
 {
-  return cmtspeech_bc_state_change_call_connect(context, state);
+  int res =
+    cmtspeech_bc_state_change_call_connect(context, state);
+  priv_update_pm_state((cmtspeech_nokiamodem_t*)context, false);
+  return res;
 }
 
 int cmtspeech_state_change_error(cmtspeech_t *context)
 {
   cmtspeech_nokiamodem_t *priv =
     (cmtspeech_nokiamodem_t*)context;
+  int res =
+    priv_send_reset(priv);
+
+  priv_update_pm_state(priv, false);
 
-  return priv_send_reset(priv);
+  return res;
 }
 
 #if PROTOCOL_SUPPORT_SAMPLE_SWAP
@@ -1390,12 +2277,12 @@ static int priv_rx_appl_slot(cmtspeech_nokiamodem_t *priv)
     int delay = priv_rx_hw_delay(priv);
 
     if (avail == mmap_cfg->rx_ptr_boundary - 1) {
-      TRACE_INFO(DEBUG_PREFIX "no frames available (hw %d, appl %d, avail %d, count %u, boundary %u).",
+      CTRACE_INFO(&priv->bcstate.trace, DEBUG_PREFIX "no frames available (hw %d, appl %d, avail %d, count %u, boundary %u).",
 		 priv->rx_ptr_hw, priv->rx_ptr_appl, avail, DL_SLOTS, mmap_cfg->rx_ptr_boundary);
       return -ENODATA;
     }
     else if (delay >= DL_SLOTS) {
-      TRACE_INFO(DEBUG_PREFIX "late appl wakeup (hw %d, appl %d, delay %d, count %u, boundary %u).",
+      CTRACE_INFO(&priv->bcstate.trace, DEBUG_PREFIX "late appl wakeup (hw %d, appl %d, delay %d, count %u, boundary %u).",
 		 priv->rx_ptr_hw, priv->rx_ptr_appl, delay, DL_SLOTS, mmap_cfg->rx_ptr_boundary);
       return -EPIPE;
     }
@@ -1425,7 +2312,7 @@ static void priv_rx_ptr_appl_handle_xrun(cmtspeech_nokiamodem_t *priv)
 {
   assert(priv->d.flags & DRIVER_FEAT_ROLLING_RX_PTR);
 
-  TRACE_IO(DEBUG_PREFIX "DL xrun, reset hw/appl at %d", priv->rx_ptr_hw);
+  CTRACE_IO(&priv->bcstate.trace, DEBUG_PREFIX "DL xrun, reset hw/appl at %d", priv->rx_ptr_hw);
 
   priv->rx_ptr_appl = priv->rx_ptr_hw;
 }
@@ -1446,6 +2333,7 @@ int cmtspeech_dl_buffer_acquire(cmtspeech_t *context, cmtspeech_buffer_t **buf)
 
   if (slot == -EPIPE) {
     priv_rx_ptr_appl_handle_xrun(priv);
+    priv->dl_xrun_pending = true;
     slot = priv->rx_ptr_appl % DL_SLOTS;
   }
   else if (slot < 0) {
@@ -1473,13 +2361,26 @@ int cmtspeech_dl_buffer_acquire(cmtspeech_t *context, cmtspeech_buffer_t **buf)
   res = cmtspeech_msg_decode_dl_data_header_v5(desc->bd.data, CMTSPEECH_DATA_HEADER_LEN, &frame_counter, &spc_flags, &data_length, &sample_rate, &codec_sample_rate, &data_type);
   SOFT_ASSERT(res == 0);
 
-  TRACE_DEBUG(DEBUG_PREFIX "DL frame received (hw %d, appl %d, slot %u, %u bytes, frame-counter %u, type %d):", priv->rx_ptr_hw, priv->rx_ptr_appl, slot, priv->slot_size, frame_counter, data_type);
+  CTRACE_DEBUG(&priv->bcstate.trace, DEBUG_PREFIX "DL frame received (hw %d, appl %d, slot %u, %u bytes, frame-counter %u, type %d):", priv->rx_ptr_hw, priv->rx_ptr_appl, slot, priv->slot_size, frame_counter, data_type);
+  TRACE_BINARY(&priv->bcstate.trace, CMTSPEECH_TRACEPOINT_DL_BUFFER_ACQUIRE,
+	       slot, frame_counter, spc_flags, data_type);
+  SAL_PROBE5(dl_buffer_acquire, slot, desc->bd.data, frame_counter, spc_flags, data_type);
 
   /* note: decode frame header and fill dlbufdesc fields appropriately */
   desc->bd.frame_flags = CMTSPEECH_DATA_TYPE_VALID;
   desc->bd.spc_flags = spc_flags;
   /* note: reserved bits 0:4 are used for sampling rate info */
   desc->bd.reserved[0] = codec_sample_rate | (sample_rate << 2);
+  /* note: reserved[1] carries the frame counter continuity status */
+  desc->bd.reserved[1] =
+    cmtspeech_bc_dl_frame_check(&priv->bcstate, frame_counter,
+				data_length == CMTSPEECH_DATA_LENGTH_10MS ? 2 : 4,
+				priv->dl_xrun_pending);
+  priv->dl_xrun_pending = false;
+  if ((desc->bd.reserved[1] & ~BC_FRAME_DL) != 0)
+    CTRACE_INFO(&priv->bcstate.trace, DEBUG_PREFIX "DL frame counter %u out of sequence (status 0x%02x, %d missing).",
+		frame_counter, desc->bd.reserved[1] & BC_FRAME_STATUS_MASK,
+		desc->bd.reserved[1] >> BC_FRAME_MISSING_SHIFT);
 
   desc->flags |= BUF_LOCKED;
   *buf = &(desc->bd);
@@ -1502,6 +2403,19 @@ int cmtspeech_dl_buffer_acquire(cmtspeech_t *context, cmtspeech_buffer_t **buf)
   }
 #endif
 
+  {
+    cmtspeech_event_t cmtevent;
+    int rate = (sample_rate == CMTSPEECH_SAMPLE_RATE_16KHZ) ? 16000 : 8000;
+
+    if (cmtspeech_bc_dtmf_dl_frame(&priv->bcstate, &desc->bd, rate, frame_counter, &cmtevent) == 1) {
+      CTRACE_INFO(&priv->bcstate.trace, DEBUG_PREFIX "DTMF digit '%c' detected in DL frame %u.",
+		  cmtevent.msg.dtmf.digit, frame_counter);
+      priv_queue_control_event(priv, &cmtevent);
+      priv->dtmf_event_pending = true;
+      priv_raise_event_signal(priv);
+    }
+  }
+
   /* note: some fields are set at buffer setup time in
    *       priv_setup_driver_bufconfig() */
   SOFT_ASSERT(desc->bd.type == CMTSPEECH_BUFFER_TYPE_PCM_S16_LE);
@@ -1525,6 +2439,10 @@ int cmtspeech_dl_buffer_release(cmtspeech_t *context, cmtspeech_buffer_t *buf)
 
   SOFT_ASSERT(buf != NULL);
 
+  /* note: buffer acquired before a layout change */
+  if (priv_release_retired_dl_buffer(priv, buf) == 0)
+    return 0;
+
   if ((priv->dlbufdesc[buf->index].flags & BUF_LOCKED) == 0)
     return -ENOENT;
 
@@ -1545,29 +2463,48 @@ int cmtspeech_dl_buffer_release(cmtspeech_t *context, cmtspeech_buffer_t *buf)
     }
   }
 
+  SAL_PROBE3(dl_buffer_release, buf->index, buf->data, ret);
+
   return ret;
 }
 
 cmtspeech_buffer_t *cmtspeech_dl_buffer_find_with_data(cmtspeech_t *context, uint8_t *data)
 {
   cmtspeech_nokiamodem_t *priv = (cmtspeech_nokiamodem_t*)context;
+  nokiamodem_buffer_desc_t *spare = priv_spare_dl_bank(priv);
   int i;
 
   for(i = 0; i < DL_SLOTS; i++) {
     if (priv->dlbufdesc[i].bd.data == data)
       return &priv->dlbufdesc[i].bd;
+    if ((spare[i].flags & BUF_RETIRED) && spare[i].bd.data == data)
+      return &spare[i].bd;
   }
+  /* note: pointer stored by the application before a layout
+   *       change moved the buffer, see priv_retire_locked_buffers() */
+  for(i = 0; i < DL_SLOTS; i++)
+    if ((spare[i].flags & BUF_RETIRED) && spare[i].mmap_data == data)
+      return &spare[i].bd;
   return NULL;
 }
 
 cmtspeech_buffer_t *cmtspeech_dl_buffer_find_with_payload(cmtspeech_t *context, uint8_t *payload)
 {
   cmtspeech_nokiamodem_t *priv = (cmtspeech_nokiamodem_t*)context;
+  nokiamodem_buffer_desc_t *spare = priv_spare_dl_bank(priv);
   int i;
+
   for(i = 0; i < DL_SLOTS; i++) {
     if (priv->dlbufdesc[i].bd.payload == payload)
       return &priv->dlbufdesc[i].bd;
+    if ((spare[i].flags & BUF_RETIRED) && spare[i].bd.payload == payload)
+      return &spare[i].bd;
   }
+  /* note: pointer stored by the application before a layout
+   *       change moved the buffer, see priv_retire_locked_buffers() */
+  for(i = 0; i < DL_SLOTS; i++)
+    if ((spare[i].flags & BUF_RETIRED) && spare[i].mmap_data + CMTSPEECH_DATA_HEADER_LEN == payload)
+      return &spare[i].bd;
   return NULL;
 }
 
@@ -1593,6 +2530,18 @@ int cmtspeech_send_timing_request(cmtspeech_t *context)
   return cmtspeech_bc_send_timing_request(&priv->bcstate, context, priv->d.fd);
 }
 
+int cmtspeech_set_dtmf_detection(cmtspeech_t *context, bool enabled)
+{
+  cmtspeech_nokiamodem_t *priv = (cmtspeech_nokiamodem_t*)context;
+  return cmtspeech_bc_set_dtmf_detection(&priv->bcstate, enabled);
+}
+
+int cmtspeech_send_dtmf(cmtspeech_t *context, const char *digits, int tone_ms, int gap_ms)
+{
+  cmtspeech_nokiamodem_t *priv = (cmtspeech_nokiamodem_t*)context;
+  return cmtspeech_bc_send_dtmf(&priv->bcstate, digits, tone_ms, gap_ms);
+}
+
 int cmtspeech_send_ssi_config_request(cmtspeech_t *context, bool state)
 {
   cmtspeech_nokiamodem_t *priv = (cmtspeech_nokiamodem_t*)context;
@@ -1623,13 +2572,19 @@ int cmtspeech_ul_buffer_acquire(cmtspeech_t *context, cmtspeech_buffer_t **buf)
   if (desc->flags & BUF_INVALID)
     return -EINVAL;
 
-  if (desc->flags & BUF_LOCKED)
+  if (desc->flags & BUF_LOCKED) {
+    SAL_PROBE1(ul_buffer_acquire_fail, -ENOBUFS);
     return -ENOBUFS;
+  }
 
   if (buf == NULL)
     return -EINVAL;
 
   desc->bd.frame_flags = 0;
+  /* note: same sampling rate info as for DL buffers, see
+   *       cmtspeech_buffer_sample_rate(); the codec rate is
+   *       not known for UL frames */
+  desc->bd.reserved[0] = CMTSPEECH_SAMPLE_RATE_NONE | (priv->conf_sample_rate << 2);
   desc->flags |= BUF_LOCKED;
 
   /* note: some fields are set at buffer setup time in
@@ -1642,6 +2597,7 @@ int cmtspeech_ul_buffer_acquire(cmtspeech_t *context, cmtspeech_buffer_t **buf)
   SOFT_ASSERT(desc->bd.index == priv->ul_slot_app);
 
   *buf = &priv->ulbufdesc[priv->ul_slot_app].bd;
+  SAL_PROBE2(ul_buffer_acquire, priv->ul_slot_app, desc->bd.data);
 
   ++priv->ul_slot_app;
   priv->ul_slot_app %= UL_SLOTS;
@@ -1652,7 +2608,7 @@ int cmtspeech_ul_buffer_acquire(cmtspeech_t *context, cmtspeech_buffer_t **buf)
 int cmtspeech_ul_buffer_release(cmtspeech_t *context, cmtspeech_buffer_t *buf)
 {
   cmtspeech_nokiamodem_t *priv = (cmtspeech_nokiamodem_t*)context;
-  cmtspeech_cmd_t msg;
+  nokiamodem_buffer_desc_t *retired;
   int res;
 
   SOFT_ASSERT(cmtspeech_protocol_state(context) == CMTSPEECH_STATE_ACTIVE_DLUL);
@@ -1662,6 +2618,14 @@ int cmtspeech_ul_buffer_release(cmtspeech_t *context, cmtspeech_buffer_t *buf)
 
   SOFT_ASSERT(buf->index >= 0);
 
+  /* note: buffer acquired before a layout change */
+  retired = priv_find_retired_desc(priv_spare_ul_bank(priv), UL_SLOTS, buf);
+  if (retired != NULL) {
+    buf = priv_release_retired_ul_buffer(priv, retired);
+    if (buf == NULL)
+      return -EPIPE;
+  }
+
   /* note: special case handling if layout change is pending */
   if (priv->speech_config_resp_pend == true) {
     priv_drvbuf_layout_change_buffer_released(priv, priv->ulbufdesc, buf);
@@ -1688,41 +2652,20 @@ int cmtspeech_ul_buffer_release(cmtspeech_t *context, cmtspeech_buffer_t *buf)
   }
   /* note: only send frames when protocol state allows it */
   else if (cmtspeech_protocol_state(context) == CMTSPEECH_STATE_ACTIVE_DLUL) {
-    static int16_t ul_counter = 0;
-
-    TRACE_DEBUG(DEBUG_PREFIX "filling UL slot %u, size %u.",
+    CTRACE_DEBUG(&priv->bcstate.trace, DEBUG_PREFIX "filling UL slot %u, size %u.",
 		buf->index & CMD_PARAM_MASK, buf->pcount);
 
+    cmtspeech_bc_dtmf_ul_frame(&priv->bcstate, buf,
+			       priv->conf_sample_rate == CMTSPEECH_SAMPLE_RATE_16KHZ ? 16000 : 8000);
+
 #if PROTOCOL_SUPPORT_SAMPLE_SWAP
     if (priv->bcstate.sample_layout == CMTSPEECH_SAMPLE_LAYOUT_SWAPPED_LE)
       priv_inplace_halfword_swap(buf->payload, buf->pcount);
 #endif
 
-    res = cmtspeech_msg_encode_ul_data_header(buf->data, CMTSPEECH_DATA_HEADER_LEN, ul_counter, priv->conf_data_length, priv->conf_sample_rate, buf->frame_flags);
-    SOFT_ASSERT(res == CMTSPEECH_DATA_HEADER_LEN);
-
-    /* note: send a CS_CS_UL_DATA_READY message to the driver */
-    priv_msg_encode_driver_message(&msg, CS_COMMAND(CS_TX_DATA_READY), buf->index & CMD_PARAM_MASK);
-    res = priv_write_data(priv, msg);
-    if (res == CMTSPEECH_CTRL_LEN) {
-      ul_counter += 4; /* increment of 4*5ms */
-      res = 0;
-    }
-    else {
-      TRACE_IO("UL frame send failed with %d (%d: %s)", res, errno, strerror(errno));
-
-      if (res < 0 &&
-	  errno == EBUSY) {
-	res = -EBUSY;
-	++priv->ul_errors;
-      }
-      else {
-	/* note: SSI subsystem in invalid state, stop sending more UL
-	 *       frames immediately */
-	res = -EINVAL;
-	priv->ul_errors = MAX_UL_ERRORS_PAUSE;
-      }
-    }
+    res = priv_send_ul_slot(priv, buf->index, buf->data, buf->pcount, buf->frame_flags);
+    if (res == 0)
+      priv_ul_conceal_frame_sent(priv, buf->payload, buf->pcount);
   }
   else {
     SOFT_ASSERT(cmtspeech_protocol_state(context) != CMTSPEECH_STATE_ACTIVE_DLUL);
@@ -1731,6 +2674,8 @@ int cmtspeech_ul_buffer_release(cmtspeech_t *context, cmtspeech_buffer_t *buf)
 
   priv->ulbufdesc[buf->index].flags &= ~BUF_LOCKED;
 
+  SAL_PROBE3(ul_buffer_release, buf->index, buf->data, res);
+
   return res;
 }
 
@@ -1741,8 +2686,59 @@ const char* cmtspeech_backend_name(cmtspeech_t* context)
 
 int cmtspeech_backend_message(cmtspeech_t *self, int type, int args, ...)
 {
-  /* no-op */
-  return -1;
+  cmtspeech_nokiamodem_t *priv = (cmtspeech_nokiamodem_t*)self;
+  int res = -1;
+  va_list ap;
+
+  va_start(ap, args);
+
+  if (type == CMTSPEECH_NOKIAMODEM_MSG_SET_PM_HOOK && args == 2) {
+    cmtspeech_nokiamodem_pm_hook_t hook =
+      va_arg(ap, cmtspeech_nokiamodem_pm_hook_t);
+    void *userdata =
+      va_arg(ap, void*);
+
+    /* step: release the old hook, and apply the new one
+     *       if speech data is flowing */
+    priv_update_pm_state(priv, true);
+    priv->d.pm_hook = hook ? hook : priv_default_pm_hook;
+    priv->d.pm_userdata = userdata;
+    priv_update_pm_state(priv, false);
+    res = 0;
+  }
+  else if (type == CMTSPEECH_NOKIAMODEM_MSG_SET_UL_CONCEALMENT && args == 1) {
+    int mode =
+      va_arg(ap, int);
+
+    if (mode == CMTSPEECH_NOKIAMODEM_UL_CONCEAL_OFF) {
+      priv_arm_ul_deadline(priv, false);
+      priv->ul_conceal.mode = mode;
+      res = 0;
+    }
+    else if (mode > CMTSPEECH_NOKIAMODEM_UL_CONCEAL_OFF &&
+	     mode <= CMTSPEECH_NOKIAMODEM_UL_CONCEAL_NOISE &&
+	     priv->ul_conceal.timerfd >= 0) {
+      priv->ul_conceal.mode = mode;
+      priv->ul_conceal.repeats = 0;
+      priv->ul_conceal.sent_valid = false;
+      priv->ul_conceal.last_pcount = 0;
+      priv->ul_conceal.spare_pcount = 0;
+      res = 0;
+    }
+  }
+  else if (type == CMTSPEECH_NOKIAMODEM_MSG_GET_SETUP_STATS && args == 1) {
+    cmtspeech_nokiamodem_setup_stats_t *stats =
+      va_arg(ap, cmtspeech_nokiamodem_setup_stats_t*);
+
+    if (stats) {
+      *stats = priv->setup_stats;
+      res = 0;
+    }
+  }
+
+  va_end(ap);
+
+  return res;
 }
 
 int cmtspeech_buffer_codec_sample_rate(cmtspeech_buffer_t *context)
@@ -0,0 +1,101 @@
+/*
+ * This file is part of libcmtspeechdata.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/** @file cmtspeech_nokiamodem.h
+ *
+ * Backend specific messages of the 'nokiamodem' backend
+ * (see cmtspeech_backend_message()).
+ */
+
+#ifndef INCLUDED_CMTSPEECH_NOKIAMODEM_H
+#define INCLUDED_CMTSPEECH_NOKIAMODEM_H
+
+#include <stdbool.h>
+
+#include "cmtspeech.h"
+
+#define CMTSPEECH_NOKIAMODEM_BACKEND_ID "cmtspeech_nokiamodem"
+
+/**
+ * Power management hook. Called with 'active' set to true
+ * when speech data starts to flow (protocol state changes to
+ * ACTIVE_DL or ACTIVE_DLUL), and with false when the call
+ * ends. The hook should lock the system to an operating
+ * point where SSI transfers can be served without delays.
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+typedef int (*cmtspeech_nokiamodem_pm_hook_t)(cmtspeech_t *context, bool active, void *userdata);
+
+/**
+ * Replaces the power management hook. Arguments (args=2):
+ * a cmtspeech_nokiamodem_pm_hook_t and a 'void *' userdata
+ * pointer. Passing a NULL hook restores the default hook,
+ * which sets a CPU DMA latency limit (/dev/cpu_dma_latency),
+ * and on Maemo5 also locks VDD2 (/sys/power/vdd2_lock).
+ *
+ * If a call is active, the previous hook is released and
+ * the new hook applied immediately.
+ */
+#define CMTSPEECH_NOKIAMODEM_MSG_SET_PM_HOOK 1
+
+/**
+ * Call setup latency statistics: time from receiving the
+ * SPEECH_CONFIG_REQ that starts a call to receiving the
+ * first DL speech frame after it.
+ */
+struct cmtspeech_nokiamodem_setup_stats_s {
+  unsigned int count;           /**< number of measurements */
+  unsigned int last_us;         /**< latest measurement */
+  unsigned int min_us;          /**< minimum */
+  unsigned int max_us;          /**< maximum */
+  unsigned long long total_us;  /**< sum of all measurements */
+};
+typedef struct cmtspeech_nokiamodem_setup_stats_s cmtspeech_nokiamodem_setup_stats_t;
+
+/**
+ * Copies call setup latency statistics. Arguments (args=1):
+ * a pointer to cmtspeech_nokiamodem_setup_stats_t.
+ */
+#define CMTSPEECH_NOKIAMODEM_MSG_GET_SETUP_STATS 2
+
+/* UL concealment modes */
+#define CMTSPEECH_NOKIAMODEM_UL_CONCEAL_OFF     0
+#define CMTSPEECH_NOKIAMODEM_UL_CONCEAL_SILENCE 1 /**< silence, marked as
+						     CMTSPEECH_DATA_TYPE_INVALID */
+#define CMTSPEECH_NOKIAMODEM_UL_CONCEAL_REPEAT  2 /**< faded repeat of the last
+						     frame, then silence */
+#define CMTSPEECH_NOKIAMODEM_UL_CONCEAL_NOISE   3 /**< low-level comfort noise */
+
+/**
+ * Enables UL deadline-miss concealment. If the application
+ * has not sent a UL frame for a frame period shortly before
+ * the UL deadline of the modem (from TIMING_CONFIG_NTF), the
+ * backend sends a frame generated according to the selected
+ * mode. Arguments (args=1):
+ * an 'int' mode (CMTSPEECH_NOKIAMODEM_UL_CONCEAL_*). Disabled
+ * by default.
+ *
+ * Note that the concealment frame is sent from
+ * cmtspeech_check_pending(), so the application must keep
+ * polling cmtspeech_descriptor() during the call.
+ */
+#define CMTSPEECH_NOKIAMODEM_MSG_SET_UL_CONCEALMENT 3
+
+#endif /* INCLUDED_CMTSPEECH_NOKIAMODEM_H */
@@ -185,6 +185,34 @@ int cmtspeech_buffer_sample_rate(cmtspeech_buffer_t *context)
   return CMTSPEECH_SAMPLE_RATE_NONE;
 }
 
+int cmtspeech_buffer_frame_status(cmtspeech_buffer_t *context)
+{
+  return 0;
+}
+
+int cmtspeech_buffer_frames_missing(cmtspeech_buffer_t *context)
+{
+  return 0;
+}
+
+int cmtspeech_dl_frame_stats(cmtspeech_t *context, cmtspeech_dl_frame_stats_t *stats)
+{
+  return -1;
+}
+
+/* Interfaces: DTMF tones
+ * ---------------------- */
+
+int cmtspeech_set_dtmf_detection(cmtspeech_t *context, bool enabled)
+{
+  return -1;
+}
+
+int cmtspeech_send_dtmf(cmtspeech_t *context, const char *digits, int tone_ms, int gap_ms)
+{
+  return -1;
+}
+
 /* Interfaces: Low level message handling
  * -------------------------------------- */
 
@@ -205,3 +233,29 @@ int cmtspeech_test_data_ramp_req(cmtspeech_t *context, uint8_t rampstart, uint8_
 {
   return -1;
 }
+
+/* Interfaces: Trace messages
+ * -------------------------- */
+
+int cmtspeech_context_trace_toggle(cmtspeech_t *context, int priority, bool enabled)
+{
+  return -1;
+}
+
+int cmtspeech_context_set_trace_handler(cmtspeech_t *context, cmtspeech_trace_handler_t func)
+{
+  return -1;
+}
+
+/* Interfaces: Binary trace ring
+ * ----------------------------- */
+
+int cmtspeech_trace_ring_read(cmtspeech_t *context, cmtspeech_trace_record_t *records, int count)
+{
+  return -1;
+}
+
+const char *cmtspeech_tracepoint_to_string(int id)
+{
+  return "<unknown>";
+}
@@ -420,7 +420,8 @@ static void *worker_thread(void *context)
 	    printf("WARNING: " DEBUG_PREFIX "buffer overrun in DL direction.\n");
 	  ONDEBUG_TOKENS(fprintf(stderr, "T"));
 	  priv->dl_buf_idx = (priv->dl_buf_idx + 1) % SAL_BUFFER_SLOTS;
-	  dummy_tone_fill_buffer_slot(priv->tone, &priv->dl_buffers[priv->dl_buf_idx], priv->dl_frame_counter++);
+	  dummy_tone_fill_buffer_slot(priv->tone, &priv->dl_buffers[priv->dl_buf_idx], priv->dl_frame_counter);
+	  priv->dl_frame_counter += 4; /* increment of 4*5ms */
 	  cmtspeech_msg_encode_dummy_internal_message(msg.d.buf, CMTSPEECH_CTRL_LEN, DUMMY_DL_DATA_AVAIL);
 	  res = write(priv->control_pipes[1], msg.d.buf, CMTSPEECH_CTRL_LEN);
 	  assert(res == CMTSPEECH_CTRL_LEN);
@@ -519,6 +520,7 @@ int cmtspeech_close(cmtspeech_t *context)
     close(priv->thread_pipes[1]);
 
     dummy_tone_release(priv->tone);
+    cmtspeech_bc_close(&priv->bcstate);
     free(priv);
   }
   else 
@@ -676,6 +678,8 @@ int cmtspeech_state_change_error(cmtspeech_t *context)
 int cmtspeech_dl_buffer_acquire(cmtspeech_t *context, cmtspeech_buffer_t **buf)
 {
   cmtspeech_dummy_t *priv = (cmtspeech_dummy_t*)context;
+  uint16_t frame_counter;
+  uint8_t spc_flags, data_length, sample_rate, data_type;
 
   if (buf == NULL)
     return -EINVAL;
@@ -684,6 +688,9 @@ int cmtspeech_dl_buffer_acquire(cmtspeech_t *context, cmtspeech_buffer_t **buf)
 
   *buf = &priv->dl_buffers[priv->dl_buf_idx].buf;
   priv->dl_buffers[priv->dl_buf_idx].locked = 1;
+
+  cmtspeech_msg_decode_dl_data_header((*buf)->data, CMTSPEECH_DATA_HEADER_LEN, &frame_counter, &spc_flags, &data_length, &sample_rate, &data_type);
+  (*buf)->reserved[1] = cmtspeech_bc_dl_frame_check(&priv->bcstate, frame_counter, 4, false);
   
   return 0;
 }
@@ -745,6 +752,17 @@ int cmtspeech_send_timing_request(cmtspeech_t *context)
   return cmtspeech_bc_send_timing_request(&priv->bcstate, context, priv->thread_pipes[1]);
 }
 
+int cmtspeech_set_dtmf_detection(cmtspeech_t *context, bool enabled)
+{
+  /* note: the dummy DL signal carries no tones */
+  return -1;
+}
+
+int cmtspeech_send_dtmf(cmtspeech_t *context, const char *digits, int tone_ms, int gap_ms)
+{
+  return -1;
+}
+
 int cmtspeech_send_ssi_config_request(cmtspeech_t *context, bool state)
 {
   cmtspeech_dummy_t *priv = (cmtspeech_dummy_t*)context;
@@ -52,6 +52,11 @@ int cmtspeech_initialize_tracing(void)
     else if (strstr(debstr, "info") != NULL)
       cmtspeech_trace_mask |= TRACE_BIT_INFO;
 
+    if (strstr(debstr, "nobinary") != NULL)
+      cmtspeech_trace_mask &= ~TRACE_BIT_BINARY;
+    else if (strstr(debstr, "binary") != NULL)
+      cmtspeech_trace_mask |= TRACE_BIT_BINARY;
+
 #if !defined(NDEBUG)
     if (strstr(debstr, "notrace") != NULL) {
       cmtspeech_trace_mask &= ~TRACE_BIT_STATE_CHANGE;
@@ -89,17 +94,10 @@ int cmtspeech_soft_assert(int v, const char* v_str, int line, const char *file)
   return v;
 }
 
-void cmtspeech_trace_message(int priority, const char *message, ...)
+static void priv_trace_vmessage(cmtspeech_trace_handler_t func, int priority, const char *message, va_list args)
 {
-  va_list args;
-
-  if (!((1 << priority) & cmtspeech_trace_mask))
-    return;
-
-  va_start(args, message);
-
-  if (cmtspeech_glob_trace_f != NULL) {
-    cmtspeech_glob_trace_f(priority, message, args);
+  if (func != NULL) {
+    func(priority, message, args);
   }
   else {
     if (priority == CMTSPEECH_TRACE_ERROR)
@@ -108,20 +106,96 @@ void cmtspeech_trace_message(int priority, const char *message, ...)
     vprintf(message, args);
     printf("\n");
   }
+}
+
+void cmtspeech_trace_message(int priority, const char *message, ...)
+{
+  va_list args;
+
+  if (!((1 << priority) & __atomic_load_n(&cmtspeech_trace_mask, __ATOMIC_RELAXED)))
+    return;
+
+  va_start(args, message);
+  priv_trace_vmessage(__atomic_load_n(&cmtspeech_glob_trace_f, __ATOMIC_ACQUIRE),
+		      priority, message, args);
+  va_end(args);
+}
+
+/**
+ * Emits a trace message using the configuration of a
+ * single library instance. The mask has already been
+ * checked by the CTRACE_* macros.
+ */
+void cmtspeech_trace_message_ctx(const sal_trace_config_t *tc, int priority, const char *message, ...)
+{
+  cmtspeech_trace_handler_t *handler_p =
+    __atomic_load_n(&tc->handler_p, __ATOMIC_ACQUIRE);
+  va_list args;
 
+  va_start(args, message);
+  priv_trace_vmessage(__atomic_load_n(handler_p, __ATOMIC_ACQUIRE),
+		      priority, message, args);
   va_end(args);
 }
 
 void cmtspeech_trace_toggle(int priority, bool enabled)
 {
   if (enabled == true) 
-    cmtspeech_trace_mask |= 1 << priority;
+    __atomic_fetch_or(&cmtspeech_trace_mask, 1 << priority, __ATOMIC_RELAXED);
   else
-    cmtspeech_trace_mask &= ~(1 << priority);
+    __atomic_fetch_and(&cmtspeech_trace_mask, ~(1 << priority), __ATOMIC_RELAXED);
 }
 
 int cmtspeech_set_trace_handler(cmtspeech_trace_handler_t func)
 {
-  cmtspeech_glob_trace_f = func;
+  __atomic_store_n(&cmtspeech_glob_trace_f, func, __ATOMIC_RELEASE);
   return 1;
 }
+
+/**
+ * Initializes instance trace configuration 'tc' to follow
+ * the process-wide trace settings.
+ */
+void sal_trace_config_init(sal_trace_config_t *tc, sal_trace_ring_t *ring)
+{
+  tc->mask = 0;
+  tc->handler = NULL;
+  tc->ring = ring;
+  __atomic_store_n(&tc->handler_p, &cmtspeech_glob_trace_f, __ATOMIC_RELEASE);
+  __atomic_store_n(&tc->mask_p, &cmtspeech_trace_mask, __ATOMIC_RELEASE);
+}
+
+/**
+ * Enables or disables trace level 'priority' for a single
+ * instance. On first use, the instance takes a copy of the
+ * process-wide mask and stops following it.
+ */
+void sal_trace_config_toggle(sal_trace_config_t *tc, int priority, bool enabled)
+{
+  if (__atomic_load_n(&tc->mask_p, __ATOMIC_ACQUIRE) != &tc->mask) {
+    __atomic_store_n(&tc->mask,
+		     __atomic_load_n(&cmtspeech_trace_mask, __ATOMIC_RELAXED),
+		     __ATOMIC_RELAXED);
+    __atomic_store_n(&tc->mask_p, &tc->mask, __ATOMIC_RELEASE);
+  }
+
+  if (enabled == true)
+    __atomic_fetch_or(&tc->mask, 1 << priority, __ATOMIC_RELAXED);
+  else
+    __atomic_fetch_and(&tc->mask, ~(1 << priority), __ATOMIC_RELAXED);
+}
+
+/**
+ * Sets the trace handler for a single instance. Passing NULL
+ * makes the instance follow the process-wide handler again.
+ */
+void sal_trace_config_set_handler(sal_trace_config_t *tc, cmtspeech_trace_handler_t func)
+{
+  if (func == NULL) {
+    __atomic_store_n(&tc->handler_p, &cmtspeech_glob_trace_f, __ATOMIC_RELEASE);
+  }
+  else {
+    __atomic_store_n(&tc->handler, func, __ATOMIC_RELEASE);
+    __atomic_store_n(&tc->handler_p, &tc->handler, __ATOMIC_RELEASE);
+  }
+}
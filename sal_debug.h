@@ -35,6 +35,7 @@
 #define INCLUDED_SAL_DEBUG_H
 
 #include "cmtspeech.h" 
+#include "sal_trace_config.h"
 
 /* Define which traces are compiled in */
 
@@ -58,12 +59,17 @@
 #  define BUILD_WITH_DEBUG_TOKENS 0
 #endif
 
+#ifndef BUILD_WITH_BINARY_TRACE
+#  define BUILD_WITH_BINARY_TRACE 1
+#endif
+
 /* note: trace bits derived from public tracing levels */
 #define TRACE_BIT_ERROR         (1 << CMTSPEECH_TRACE_ERROR)
 #define TRACE_BIT_INFO          (1 << CMTSPEECH_TRACE_INFO)
 #define TRACE_BIT_STATE_CHANGE  (1 << CMTSPEECH_TRACE_STATE_CHANGE)
 #define TRACE_BIT_IO            (1 << CMTSPEECH_TRACE_IO)
 #define TRACE_BIT_DEBUG         (1 << CMTSPEECH_TRACE_DEBUG)
+#define TRACE_BIT_BINARY        (1 << CMTSPEECH_TRACE_BINARY)
 
 /* note: trace bits that are implementation internal */
 #define INTERNAL_TRACE_TOKEN    CMTSPEECH_TRACE_INTERNAL
@@ -71,6 +77,34 @@
 
 extern int cmtspeech_trace_mask;
 
+/* Instance traces: 'tc' is a pointer to sal_trace_config_t */
+/* ---------------------------------------------------------*/
+
+#define SAL_TRACE_MASK(tc) \
+  __atomic_load_n(__atomic_load_n(&(tc)->mask_p, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED)
+
+#define CTRACE_ERROR(tc, x, ...) do { if (SAL_TRACE_MASK(tc) & TRACE_BIT_ERROR) { cmtspeech_trace_message_ctx(tc, CMTSPEECH_TRACE_ERROR, x, ##__VA_ARGS__); } } while(0)
+
+#if BUILD_WITH_INFO
+#define CTRACE_INFO(tc, x, ...) do { if (SAL_TRACE_MASK(tc) & TRACE_BIT_INFO) { cmtspeech_trace_message_ctx(tc, CMTSPEECH_TRACE_INFO, x, ##__VA_ARGS__); } } while(0)
+#else
+#define CTRACE_INFO(tc, x, ...)
+#endif
+
+#if BUILD_WITH_TRACE && !defined(NDEBUG)
+#define CTRACE_STATE_CHANGE(tc, x, ...) do { if (SAL_TRACE_MASK(tc) & TRACE_BIT_STATE_CHANGE) { cmtspeech_trace_message_ctx(tc, CMTSPEECH_TRACE_STATE_CHANGE, x, ##__VA_ARGS__); } } while(0)
+#define CTRACE_IO(tc, x, ...) do { if (SAL_TRACE_MASK(tc) & TRACE_BIT_IO) { cmtspeech_trace_message_ctx(tc, CMTSPEECH_TRACE_IO, x, ##__VA_ARGS__); } } while(0)
+#else
+#define CTRACE_STATE_CHANGE(tc, x, ...)
+#define CTRACE_IO(tc, x, ...)
+#endif
+
+#if BUILD_WITH_DEBUG && !defined(NDEBUG)
+#define CTRACE_DEBUG(tc, x, ...) do { if (SAL_TRACE_MASK(tc) & TRACE_BIT_DEBUG) { cmtspeech_trace_message_ctx(tc, CMTSPEECH_TRACE_DEBUG, x, ##__VA_ARGS__); } } while(0)
+#else
+#define CTRACE_DEBUG(tc, x, ...)
+#endif
+
 /* Traces used by test applications */
 /* ---------------------------------*/
 
@@ -108,6 +142,14 @@ extern int cmtspeech_trace_mask;
 #define ONDEBUG_TOKENS(x) 
 #endif
 
+/* note: binary traces are meant for production use as well, so
+ *       they are not disabled by NDEBUG (see sal_trace_ring.h) */
+#if BUILD_WITH_BINARY_TRACE
+#define TRACE_BINARY(tc, id, a0, a1, a2, a3) do { if (SAL_TRACE_MASK(tc) & TRACE_BIT_BINARY) { sal_trace_ring_put((tc)->ring, id, a0, a1, a2, a3); } } while(0)
+#else
+#define TRACE_BINARY(tc, id, a0, a1, a2, a3)
+#endif
+
 #if !defined(NDEBUG)
 #define SOFT_ASSERT(v) cmtspeech_soft_assert(v, #v, __LINE__, __FILE__)
 #else
@@ -115,6 +157,10 @@ extern int cmtspeech_trace_mask;
 #endif
 
 void cmtspeech_trace_message(int priority, const char *message, ...);
+void cmtspeech_trace_message_ctx(const sal_trace_config_t *tc, int priority, const char *message, ...);
+void sal_trace_config_init(sal_trace_config_t *tc, sal_trace_ring_t *ring);
+void sal_trace_config_toggle(sal_trace_config_t *tc, int priority, bool enabled);
+void sal_trace_config_set_handler(sal_trace_config_t *tc, cmtspeech_trace_handler_t func);
 void cmtspeech_trace_toggle(int priority, bool enabled);
 int cmtspeech_initialize_tracing(void);
 int cmtspeech_soft_assert(int v, const char* v_str, int line, const char *file);
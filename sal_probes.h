@@ -0,0 +1,67 @@
+/*
+ * This file is part of libcmtspeechdata.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/** @file sal_probes.h
+ *
+ * Static (USDT) tracepoints for libcmtspeechdata internal
+ * usage.
+ *
+ * When built with HAVE_SYS_SDT_H, each probe compiles to a
+ * single no-op instruction plus an ELF note. Tools like perf
+ * and bpftrace can attach to it at runtime. Unlike the TRACE_*
+ * macros in sal_debug.h, the probes are not removed in NDEBUG
+ * builds. Without sys/sdt.h the probes expand to nothing.
+ *
+ * All probes use the provider name "libcmtspeechdata". See
+ * doc/README-devel.txt for the list of probes and arguments.
+ */
+
+#ifndef INCLUDED_SAL_PROBES_H
+#define INCLUDED_SAL_PROBES_H
+
+#ifndef HAVE_SYS_SDT_H
+#  define HAVE_SYS_SDT_H 0
+#endif
+
+#if HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define SAL_PROBE1(name, a1) \
+  DTRACE_PROBE1(libcmtspeechdata, name, a1)
+#define SAL_PROBE2(name, a1, a2) \
+  DTRACE_PROBE2(libcmtspeechdata, name, a1, a2)
+#define SAL_PROBE3(name, a1, a2, a3) \
+  DTRACE_PROBE3(libcmtspeechdata, name, a1, a2, a3)
+#define SAL_PROBE4(name, a1, a2, a3, a4) \
+  DTRACE_PROBE4(libcmtspeechdata, name, a1, a2, a3, a4)
+#define SAL_PROBE5(name, a1, a2, a3, a4, a5) \
+  DTRACE_PROBE5(libcmtspeechdata, name, a1, a2, a3, a4, a5)
+
+#else
+
+#define SAL_PROBE1(name, a1)
+#define SAL_PROBE2(name, a1, a2)
+#define SAL_PROBE3(name, a1, a2, a3)
+#define SAL_PROBE4(name, a1, a2, a3, a4)
+#define SAL_PROBE5(name, a1, a2, a3, a4, a5)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* INCLUDED_SAL_PROBES_H */
@@ -0,0 +1,53 @@
+/*
+ * This file is part of libcmtspeechdata.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/** @file sal_trace_config.h
+ *
+ * Per-instance trace configuration for libcmtspeechdata
+ * internal usage.
+ *
+ * Each library instance starts out following the process-wide
+ * trace mask and handler (set with CMTSPEECHDEBUG,
+ * cmtspeech_trace_toggle() and cmtspeech_set_trace_handler()).
+ * Once an instance-specific setting is made, 'mask_p' and/or
+ * 'handler_p' are switched to point to the instance's own copy.
+ * The hot paths only ever dereference these pointers, so no
+ * branch on "is there an override" is needed.
+ *
+ * All fields that can be changed from another thread are
+ * accessed with atomic operations (see sal_debug.h).
+ */
+
+#ifndef INCLUDED_SAL_TRACE_CONFIG_H
+#define INCLUDED_SAL_TRACE_CONFIG_H
+
+#include "cmtspeech.h"
+#include "sal_trace_ring.h"
+
+struct sal_trace_config_s {
+  int *mask_p;                          /**< 'mask', or the process-wide mask */
+  cmtspeech_trace_handler_t *handler_p; /**< 'handler', or the process-wide handler */
+  int mask;                             /**< instance trace mask (TRACE_BIT_*) */
+  cmtspeech_trace_handler_t handler;    /**< instance trace handler */
+  sal_trace_ring_t *ring;               /**< binary trace records, or NULL */
+};
+
+typedef struct sal_trace_config_s sal_trace_config_t;
+
+#endif /* INCLUDED_SAL_TRACE_CONFIG_H */
@@ -0,0 +1,136 @@
+/*
+ * This file is part of libcmtspeechdata.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/** @file sal_trace_ring.h
+ *
+ * Lock-free binary trace ring for libcmtspeechdata.
+ *
+ * Tracepoints on the data path store a fixed-size record
+ * (tracepoint id, CLOCK_MONOTONIC timestamp and four
+ * integer arguments) instead of formatting a message. The
+ * records are decoded later by a reader, either in another
+ * thread or offline.
+ *
+ * The ring has a single producer (the thread driving the
+ * library instance) and a single consumer. If the ring is
+ * full, new records are dropped and counted. The reader
+ * gets a CMTSPEECH_TRACEPOINT_LOST record in their place.
+ */
+
+#ifndef INCLUDED_SAL_TRACE_RING_H
+#define INCLUDED_SAL_TRACE_RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "cmtspeech.h"
+
+#define SAL_TRACE_RING_SLOTS  256   /**< must be a power of two */
+#define SAL_TRACE_RING_MASK   (SAL_TRACE_RING_SLOTS - 1)
+
+struct sal_trace_ring_s {
+  /* producer side */
+  uint32_t write_count;        /**< records written, published with release */
+  uint32_t dropped;            /**< records dropped due to a full ring */
+  /* consumer side, kept on a separate cache line */
+  uint32_t read_count __attribute__((aligned(64)));
+  uint32_t dropped_reported;   /**< value of 'dropped' at last read */
+  cmtspeech_trace_record_t recs[SAL_TRACE_RING_SLOTS];
+};
+
+typedef struct sal_trace_ring_s sal_trace_ring_t;
+
+/**
+ * Initializes the trace ring for use.
+ */
+static inline void sal_trace_ring_init(sal_trace_ring_t *ring)
+{
+  memset(ring, 0, sizeof(*ring));
+}
+
+static inline uint64_t sal_trace_ring_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Stores a record to the ring. Must only be called from
+ * the producer thread.
+ */
+static inline void sal_trace_ring_put(sal_trace_ring_t *ring, int id, int32_t a0, int32_t a1, int32_t a2, int32_t a3)
+{
+  uint32_t w = ring->write_count;
+  uint32_t r = __atomic_load_n(&ring->read_count, __ATOMIC_ACQUIRE);
+  cmtspeech_trace_record_t *rec;
+
+  if (w - r >= SAL_TRACE_RING_SLOTS) {
+    __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  rec = &ring->recs[w & SAL_TRACE_RING_MASK];
+  rec->tstamp_ns = sal_trace_ring_now();
+  rec->id = id;
+  rec->reserved = 0;
+  rec->args[0] = a0;
+  rec->args[1] = a1;
+  rec->args[2] = a2;
+  rec->args[3] = a3;
+
+  __atomic_store_n(&ring->write_count, w + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copies up to 'count' records from the ring to 'out'. Must
+ * only be called from the consumer thread.
+ *
+ * @return number of records copied
+ */
+static inline int sal_trace_ring_read(sal_trace_ring_t *ring, cmtspeech_trace_record_t *out, int count)
+{
+  uint32_t r = ring->read_count;
+  uint32_t w = __atomic_load_n(&ring->write_count, __ATOMIC_ACQUIRE);
+  uint32_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+  int n = 0;
+
+  if (dropped != ring->dropped_reported && count > 0) {
+    memset(&out[n], 0, sizeof(out[n]));
+    out[n].tstamp_ns = sal_trace_ring_now();
+    out[n].id = CMTSPEECH_TRACEPOINT_LOST;
+    out[n].args[0] = dropped - ring->dropped_reported;
+    ring->dropped_reported = dropped;
+    ++n;
+  }
+
+  while (r != w && n < count) {
+    out[n++] = ring->recs[r & SAL_TRACE_RING_MASK];
+    ++r;
+  }
+
+  __atomic_store_n(&ring->read_count, r, __ATOMIC_RELEASE);
+
+  return n;
+}
+
+#endif /* INCLUDED_SAL_TRACE_RING_H */
@@ -0,0 +1,509 @@
+/*
+ * This file is part of libcmtspeechdata.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/** @file test_cmtspeech_bc.c
+ *
+ * Unit test for cmtspeech_backend_common.h. Built from the
+ * sources together with a backend, as the tested functions
+ * are not exported from the library.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cmtspeech.h"
+#include "cmtspeech_backend_common.h"
+
+/* Outcome of one protocol state machine input */
+struct tr_outcome {
+  int proto_state;
+  int priv_state;
+  int tr;                 /**< CMTSPEECH_TR_*, or CMTSPEECH_TR_INVALID */
+  unsigned int effects;   /**< TR_EFFECT_* */
+};
+
+#define TR_EFFECT_RESET           0x01
+#define TR_EFFECT_SET_LAYOUT      0x02
+#define TR_EFFECT_LEGACY_TIMING   0x04
+#define TR_EFFECT_SSI_CONNECT     0x08
+#define TR_EFFECT_SSI_DISCONNECT  0x10
+#define TR_EFFECT_TIMING_REQ      0x20
+#define TR_EFFECT_ERROR_RESET     0x40
+#define TR_EFFECT_SEND_FAILED     0x80
+
+#define TR_PRIV_FIRST  -1
+#define TR_PRIV_LAST   BC_STATE_CONFIG_DEACT_PEND
+
+/* Effects of the requests sent by a transition, as done by
+ * cmtspeech_bc_send_ssi_config_request() and
+ * cmtspeech_bc_send_timing_request() when the write succeeds */
+
+static void priv_ref_reset(struct tr_outcome *o)
+{
+  o->proto_state = CMTSPEECH_STATE_DISCONNECTED;
+  o->priv_state = BC_STATE_IN_SYNC;
+  o->effects |= TR_EFFECT_RESET;
+}
+
+static void priv_ref_send_ssi(struct tr_outcome *o, int active)
+{
+  if (active) {
+    o->priv_state = BC_STATE_CONNECTING;
+    o->effects |= TR_EFFECT_SSI_CONNECT;
+  }
+  else if (o->priv_state == BC_STATE_DISCONNECTING)
+    o->effects |= TR_EFFECT_SEND_FAILED;
+  else {
+    o->priv_state = BC_STATE_DISCONNECTING;
+    o->effects |= TR_EFFECT_SSI_DISCONNECT;
+  }
+}
+
+static void priv_ref_send_timing(struct tr_outcome *o)
+{
+  o->priv_state = BC_STATE_TIMING;
+  o->effects |= TR_EFFECT_TIMING_REQ;
+}
+
+/**
+ * Transition id as computed from the previous and new state
+ * of an event before the transition table was introduced.
+ */
+static int priv_ref_event_tr(int prev_state, int state, int msg_type)
+{
+  if (prev_state == CMTSPEECH_STATE_DISCONNECTED &&
+      state == CMTSPEECH_STATE_CONNECTED)
+    return CMTSPEECH_TR_1_CONNECTED;
+  else if (prev_state == CMTSPEECH_STATE_CONNECTED &&
+	   state == CMTSPEECH_STATE_DISCONNECTED)
+    return CMTSPEECH_TR_2_DISCONNECTED;
+  else if (prev_state == CMTSPEECH_STATE_CONNECTED &&
+	   state == CMTSPEECH_STATE_ACTIVE_DL)
+    return CMTSPEECH_TR_3_DL_START;
+  else if ((prev_state == CMTSPEECH_STATE_ACTIVE_DL ||
+	    prev_state == CMTSPEECH_STATE_ACTIVE_DLUL) &&
+	   state == CMTSPEECH_STATE_CONNECTED)
+    return CMTSPEECH_TR_4_DLUL_STOP;
+  else if (prev_state == CMTSPEECH_STATE_ACTIVE_DL &&
+	   state == CMTSPEECH_STATE_ACTIVE_DL)
+    return CMTSPEECH_TR_5_PARAM_UPDATE;
+  else if (msg_type == CMTSPEECH_TIMING_CONFIG_NTF)
+    return CMTSPEECH_TR_6_TIMING_UPDATE;
+  else if (msg_type == CMTSPEECH_EVENT_RESET)
+    return CMTSPEECH_TR_10_RESET;
+  else if (prev_state == CMTSPEECH_STATE_ACTIVE_DLUL &&
+	   state == CMTSPEECH_STATE_ACTIVE_DL)
+    return CMTSPEECH_TR_11_UL_STOP;
+  else if (prev_state == CMTSPEECH_STATE_ACTIVE_DL &&
+	   state == CMTSPEECH_STATE_ACTIVE_DLUL)
+    return CMTSPEECH_TR_12_UL_START;
+
+  return CMTSPEECH_TR_INVALID;
+}
+
+/**
+ * Reference model: the if/else chains of cmtspeech_bc_handle_command()
+ * and cmtspeech_bc_post_command() as they were before the transition
+ * table was introduced. Returns non-zero if 'input' is allowed in
+ * 'proto_state' by the protocol (the former STATE_ASSERTs).
+ */
+static int priv_ref_transition(int proto_state, int priv_state, int server_active, int input, struct tr_outcome *o)
+{
+  int msg_type = -1, allowed = 1;
+
+  o->proto_state = proto_state;
+  o->priv_state = priv_state;
+  o->effects = 0;
+
+  switch(input)
+    {
+    case BC_INPUT_SPEECH_CONFIG_REQ_ACT:
+    case BC_INPUT_SPEECH_CONFIG_REQ_DEACT:
+      msg_type = CMTSPEECH_SPEECH_CONFIG_REQ;
+      allowed = (proto_state == CMTSPEECH_STATE_CONNECTED ||
+		 proto_state == CMTSPEECH_STATE_ACTIVE_DL ||
+		 proto_state == CMTSPEECH_STATE_ACTIVE_DLUL);
+      o->priv_state = (input == BC_INPUT_SPEECH_CONFIG_REQ_ACT) ?
+	BC_STATE_CONFIG_ACT_PEND : BC_STATE_CONFIG_DEACT_PEND;
+      break;
+
+    case BC_INPUT_UPLINK_CONFIG_NTF:
+      msg_type = CMTSPEECH_UPLINK_CONFIG_NTF;
+      allowed = (proto_state == CMTSPEECH_STATE_ACTIVE_DL);
+      if (proto_state == CMTSPEECH_STATE_ACTIVE_DL) {
+	o->proto_state = CMTSPEECH_STATE_ACTIVE_DLUL;
+	o->priv_state = BC_STATE_IN_SYNC;
+      }
+      break;
+
+    case BC_INPUT_TIMING_CONFIG_NTF:
+      msg_type = CMTSPEECH_TIMING_CONFIG_NTF;
+      allowed = (proto_state == CMTSPEECH_STATE_ACTIVE_DL ||
+		 proto_state == CMTSPEECH_STATE_ACTIVE_DLUL);
+      if (proto_state == CMTSPEECH_STATE_ACTIVE_DL) {
+	o->proto_state = CMTSPEECH_STATE_ACTIVE_DLUL;
+	o->priv_state = BC_STATE_IN_SYNC;
+	o->effects |= TR_EFFECT_LEGACY_TIMING;
+      }
+      if (o->priv_state == BC_STATE_TIMING)
+	o->priv_state = BC_STATE_IN_SYNC;
+      break;
+
+    case BC_INPUT_SSI_CONFIG_RESP_OK:
+      msg_type = CMTSPEECH_SSI_CONFIG_RESP;
+      allowed = (proto_state == CMTSPEECH_STATE_CONNECTED ||
+		 proto_state == CMTSPEECH_STATE_DISCONNECTED);
+      if (priv_state == BC_STATE_CONNECTING) {
+	o->proto_state = CMTSPEECH_STATE_CONNECTED;
+	o->priv_state = BC_STATE_IN_SYNC;
+	o->effects |= TR_EFFECT_SET_LAYOUT;
+      }
+      else if (priv_state == BC_STATE_DISCONNECTING)
+	priv_ref_reset(o);
+      else if (priv_state == BC_STATE_SSI_CONFIG_PEND) {
+	if (server_active) {
+	  priv_ref_send_ssi(o, 1);
+	  o->proto_state = CMTSPEECH_STATE_DISCONNECTED;
+	  o->priv_state = BC_STATE_CONNECTING;
+	}
+	else {
+	  priv_ref_send_ssi(o, 0);
+	  o->proto_state = CMTSPEECH_STATE_CONNECTED;
+	  o->priv_state = BC_STATE_DISCONNECTING;
+	}
+      }
+      break;
+
+    case BC_INPUT_SSI_CONFIG_RESP_ERROR:
+      msg_type = CMTSPEECH_SSI_CONFIG_RESP;
+      allowed = (proto_state == CMTSPEECH_STATE_CONNECTED ||
+		 proto_state == CMTSPEECH_STATE_DISCONNECTED);
+      if (priv_state == BC_STATE_CONNECTING ||
+	  priv_state == BC_STATE_DISCONNECTING)
+	o->priv_state = BC_STATE_IN_SYNC;
+      o->effects |= TR_EFFECT_ERROR_RESET;
+      break;
+
+    case BC_INPUT_RESET_CONN_REQ:
+      msg_type = CMTSPEECH_EVENT_RESET;
+      allowed = (proto_state != CMTSPEECH_STATE_DISCONNECTED);
+      priv_ref_reset(o);
+      break;
+
+    case BC_INPUT_RESET_CONN_RESP:
+      msg_type = CMTSPEECH_EVENT_RESET;
+      allowed = (proto_state != CMTSPEECH_STATE_DISCONNECTED);
+      priv_ref_reset(o);
+      if (priv_state == BC_STATE_RESET_BEFORE_CONNECT)
+	priv_ref_send_ssi(o, 1);
+      break;
+
+    case BC_INPUT_TEST_RAMP_PING:
+      msg_type = CMTSPEECH_TEST_RAMP_PING;
+      allowed = (proto_state == CMTSPEECH_STATE_DISCONNECTED);
+      break;
+
+    case BC_INPUT_SENT_RESET_CONN_REQ:
+      o->proto_state = CMTSPEECH_STATE_INVALID;
+      o->priv_state = BC_STATE_IN_SYNC;
+      break;
+
+    case BC_INPUT_SENT_SPEECH_CONFIG_RESP_ERROR:
+      msg_type = CMTSPEECH_SPEECH_CONFIG_REQ;
+      allowed = (priv_state == BC_STATE_CONFIG_ACT_PEND ||
+		 priv_state == BC_STATE_CONFIG_DEACT_PEND);
+      o->priv_state = BC_STATE_IN_SYNC;
+      break;
+
+    case BC_INPUT_SENT_SPEECH_CONFIG_RESP_OK:
+      msg_type = CMTSPEECH_SPEECH_CONFIG_REQ;
+      allowed = (priv_state == BC_STATE_CONFIG_ACT_PEND ||
+		 priv_state == BC_STATE_CONFIG_DEACT_PEND);
+      if (proto_state == CMTSPEECH_STATE_CONNECTED) {
+	/* TR3 */
+	if (priv_state == BC_STATE_CONFIG_ACT_PEND) {
+	  o->proto_state = CMTSPEECH_STATE_ACTIVE_DL;
+	  o->priv_state = BC_STATE_IN_SYNC;
+	  priv_ref_send_timing(o);
+	}
+      }
+      else if (proto_state == CMTSPEECH_STATE_ACTIVE_DL ||
+	       proto_state == CMTSPEECH_STATE_ACTIVE_DLUL) {
+	if (priv_state == BC_STATE_CONFIG_ACT_PEND) {
+	  /* TR11, or TR5 with no change */
+	  if (proto_state == CMTSPEECH_STATE_ACTIVE_DLUL) {
+	    o->proto_state = CMTSPEECH_STATE_ACTIVE_DL;
+	    o->priv_state = BC_STATE_IN_SYNC;
+	  }
+	}
+	else if (priv_state == BC_STATE_CONFIG_DEACT_PEND) {
+	  /* TR4 */
+	  o->proto_state = CMTSPEECH_STATE_CONNECTED;
+	  o->priv_state = BC_STATE_IN_SYNC;
+	  if (!server_active)
+	    priv_ref_send_ssi(o, 0);
+	}
+      }
+      break;
+    }
+
+  /* note: sent RESET_CONN_REQ does not complete an event */
+  o->tr = (msg_type < 0) ? CMTSPEECH_TR_INVALID :
+    priv_ref_event_tr(proto_state, o->proto_state, msg_type);
+
+  return allowed;
+}
+
+/**
+ * Applies a row of the transition table like priv_transition_apply()
+ * in cmtspeech_backend_common.c does.
+ */
+static void priv_table_transition(const cmtspeech_bc_transition_t *t, int proto_state, int priv_state, struct tr_outcome *o)
+{
+  o->proto_state = (t->next_proto != BC_KEEP) ? t->next_proto : proto_state;
+  o->priv_state = (t->next_priv != BC_KEEP) ? t->next_priv : priv_state;
+  o->tr = t->tr;
+  o->effects = 0;
+
+  if (t->actions & BC_ACTION_RESET_STATE)
+    priv_ref_reset(o);
+  if (t->actions & BC_ACTION_SET_LAYOUT)
+    o->effects |= TR_EFFECT_SET_LAYOUT;
+  if (t->actions & BC_ACTION_LEGACY_TIMING)
+    o->effects |= TR_EFFECT_LEGACY_TIMING;
+  if (t->actions & BC_ACTION_SSI_CONNECT)
+    priv_ref_send_ssi(o, 1);
+  if (t->actions & BC_ACTION_SSI_DISCONNECT)
+    priv_ref_send_ssi(o, 0);
+  if (t->actions & BC_ACTION_TIMING_REQ)
+    priv_ref_send_timing(o);
+  if (t->actions & BC_ACTION_ERROR_RESET)
+    o->effects |= TR_EFFECT_ERROR_RESET;
+}
+
+START_TEST(test_transition_table)
+{
+  cmtspeech_bc_state_t state;
+  int proto, priv, server, input;
+
+  memset(&state, 0, sizeof(state));
+
+  /* test: every state and input give the same next state, requests
+   *       and side-effects as the state machine did before the
+   *       transition table, and the same transition id for inputs
+   *       the protocol allows */
+  for(proto = CMTSPEECH_STATE_INVALID; proto <= CMTSPEECH_STATE_TEST_RAMP_PING_ACTIVE; proto++)
+    for(priv = TR_PRIV_FIRST; priv <= TR_PRIV_LAST; priv++)
+      for(server = 0; server < 2; server++)
+	for(input = 0; input < BC_INPUT_LAST; input++) {
+	  const cmtspeech_bc_transition_t *t;
+	  struct tr_outcome ref, res;
+	  int allowed;
+
+	  state.proto_state = proto;
+	  state.priv_state = priv;
+	  state.call_server_active = server;
+
+	  t = cmtspeech_bc_transition_lookup(&state, input);
+	  fail_unless(t != NULL);
+
+	  allowed = priv_ref_transition(proto, priv, server, input, &ref);
+	  priv_table_transition(t, proto, priv, &res);
+
+	  fail_unless(res.proto_state == ref.proto_state &&
+		      res.priv_state == ref.priv_state &&
+		      res.effects == ref.effects,
+		      "input %d in state %d/%d (server %d): table %d/%d/%02x, expected %d/%d/%02x",
+		      input, proto, priv, server,
+		      res.proto_state, res.priv_state, res.effects,
+		      ref.proto_state, ref.priv_state, ref.effects);
+
+	  if (allowed)
+	    fail_unless(res.tr == ref.tr,
+			"input %d in state %d/%d (server %d): TR %d, expected %d",
+			input, proto, priv, server, res.tr, ref.tr);
+	}
+}
+END_TEST
+
+/**
+ * Feeds a DL frame counter sequence with a gap, a duplicate,
+ * a late frame, an overrun and a restart to the continuity
+ * checker, and verifies per-frame status and statistics.
+ */
+START_TEST(test_dl_frame_continuity)
+{
+  static const struct {
+    uint16_t counter;
+    bool xrun;
+    int status;
+    int missing;
+  } seq[] = {
+    { 65528, false, 0, 0 },
+    { 65532, false, 0, 0 },
+    { 0,     false, 0, 0 },
+    { 8,     false, CMTSPEECH_FRAME_STATUS_GAP, 1 },
+    { 8,     false, CMTSPEECH_FRAME_STATUS_DUPLICATE, 0 },
+    { 4,     false, CMTSPEECH_FRAME_STATUS_REORDERED, 0 },
+    { 12,    false, 0, 0 },
+    { 32,    true,  CMTSPEECH_FRAME_STATUS_GAP | CMTSPEECH_FRAME_STATUS_XRUN, 4 },
+    { 20000, false, 0, 0 },
+    { 20004, false, 0, 0 },
+  };
+  cmtspeech_bc_state_t state;
+  cmtspeech_buffer_t buf;
+  cmtspeech_dl_frame_stats_t *stats = &state.dl_stats;
+  int i;
+
+  cmtspeech_bc_open(&state);
+  memset(&buf, 0, sizeof(buf));
+  buf.type = CMTSPEECH_BUFFER_TYPE_PCM_S16_LE;
+
+  for(i = 0; i < (int)(sizeof(seq) / sizeof(seq[0])); i++) {
+    buf.reserved[1] = cmtspeech_bc_dl_frame_check(&state, seq[i].counter, 4, seq[i].xrun);
+    fail_unless(cmtspeech_buffer_frame_status(&buf) == seq[i].status,
+		"frame %d: status %02x", i, cmtspeech_buffer_frame_status(&buf));
+    fail_unless(cmtspeech_buffer_frames_missing(&buf) == seq[i].missing,
+		"frame %d: %d missing", i, cmtspeech_buffer_frames_missing(&buf));
+  }
+
+  fail_unless(stats->frames == 10);
+  fail_unless(stats->lost == 0);
+  fail_unless(stats->dropped == 4);
+  fail_unless(stats->duplicated == 1);
+  fail_unless(stats->reordered == 1);
+  fail_unless(stats->resyncs == 1);
+
+  cmtspeech_bc_close(&state);
+}
+END_TEST
+
+/**
+ * Checks that a counter not on a frame boundary of the
+ * sequence is a resync, not a reordered frame.
+ */
+START_TEST(test_dl_frame_misaligned)
+{
+  cmtspeech_bc_state_t state;
+  cmtspeech_dl_frame_stats_t *stats = &state.dl_stats;
+
+  cmtspeech_bc_open(&state);
+
+  fail_unless(cmtspeech_bc_dl_frame_check(&state, 0, 4, false) == BC_FRAME_DL);
+  fail_unless(cmtspeech_bc_dl_frame_check(&state, 4, 4, false) == BC_FRAME_DL);
+  fail_unless(cmtspeech_bc_dl_frame_check(&state, 5, 4, false) == BC_FRAME_DL);
+  fail_unless(cmtspeech_bc_dl_frame_check(&state, 9, 4, false) == BC_FRAME_DL);
+
+  fail_unless(stats->resyncs == 1);
+  fail_unless(stats->reordered == 0);
+  fail_unless(stats->lost == 0);
+
+  cmtspeech_bc_close(&state);
+}
+END_TEST
+
+/**
+ * Checks that a late frame is taken off the count where its
+ * gap was accounted: 'dropped' after an overrun gap, 'lost'
+ * otherwise.
+ */
+START_TEST(test_dl_frame_late_after_gap)
+{
+  cmtspeech_bc_state_t state;
+  cmtspeech_dl_frame_stats_t *stats = &state.dl_stats;
+  int res;
+
+  cmtspeech_bc_open(&state);
+
+  /* case: gap caused by a local overrun */
+  cmtspeech_bc_dl_frame_check(&state, 0, 4, false);
+  res = cmtspeech_bc_dl_frame_check(&state, 12, 4, true);
+  fail_unless((res & BC_FRAME_STATUS_MASK) == (CMTSPEECH_FRAME_STATUS_GAP | CMTSPEECH_FRAME_STATUS_XRUN));
+  fail_unless(stats->dropped == 2);
+  res = cmtspeech_bc_dl_frame_check(&state, 4, 4, false);
+  fail_unless((res & BC_FRAME_STATUS_MASK) == CMTSPEECH_FRAME_STATUS_REORDERED);
+  fail_unless(stats->dropped == 1);
+  fail_unless(stats->lost == 0);
+
+  /* case: gap of frames lost on the radio side */
+  cmtspeech_bc_dl_frame_check(&state, 16, 4, false);
+  res = cmtspeech_bc_dl_frame_check(&state, 28, 4, false);
+  fail_unless((res & BC_FRAME_STATUS_MASK) == CMTSPEECH_FRAME_STATUS_GAP);
+  fail_unless(stats->lost == 2);
+  res = cmtspeech_bc_dl_frame_check(&state, 24, 4, false);
+  fail_unless((res & BC_FRAME_STATUS_MASK) == CMTSPEECH_FRAME_STATUS_REORDERED);
+  fail_unless(stats->lost == 1);
+  fail_unless(stats->dropped == 1);
+  fail_unless(stats->reordered == 2);
+
+  cmtspeech_bc_close(&state);
+}
+END_TEST
+
+/**
+ * Checks that buffers not passed through the DL continuity
+ * checker, such as UL buffers, report no frame status.
+ */
+START_TEST(test_ul_frame_status)
+{
+  cmtspeech_buffer_t buf;
+
+  memset(&buf, 0, sizeof(buf));
+  buf.type = CMTSPEECH_BUFFER_TYPE_PCM_S16_LE;
+  buf.reserved[0] = CMTSPEECH_SAMPLE_RATE_8KHZ << 2;
+  buf.reserved[1] = CMTSPEECH_FRAME_STATUS_GAP | (3 << BC_FRAME_MISSING_SHIFT);
+
+  fail_unless(cmtspeech_buffer_frame_status(&buf) == 0);
+  fail_unless(cmtspeech_buffer_frames_missing(&buf) == 0);
+}
+END_TEST
+
+Suite *cmtspeech_bc_suite(void)
+{
+  Suite *suite = suite_create("cmtspeech_bc");
+
+  TCase *tr = tcase_create("transitions");
+
+  TCase *dl = tcase_create("dl_frames");
+
+  tcase_add_test(tr, test_transition_table);
+  tcase_add_test(dl, test_dl_frame_continuity);
+  tcase_add_test(dl, test_dl_frame_misaligned);
+  tcase_add_test(dl, test_dl_frame_late_after_gap);
+  tcase_add_test(dl, test_ul_frame_status);
+
+  suite_add_tcase(suite, tr);
+  suite_add_tcase(suite, dl);
+
+  return suite;
+}
+
+int main(int argc, char *argv[])
+{
+  int nr_failed;
+  Suite *suite = cmtspeech_bc_suite();
+  SRunner *runner = srunner_create(suite);
+  srunner_set_xml(runner, "/tmp/result.xml");
+  srunner_run_all(runner, CK_NORMAL);
+  nr_failed = srunner_ntests_failed(runner);
+  srunner_free(runner);
+  return (nr_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,174 @@
+/*
+ * This file is part of libcmtspeechdata.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/** @file test_cmtspeech_dtmf.c
+ *
+ * Unit test for cmtspeech_dtmf.c.
+ */
+
+#include <check.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cmtspeech_dtmf.h"
+
+#define MAX_FRAME 320 /* 20ms at 16kHz */
+
+/**
+ * Generates 'digits' into 20ms frames over 'noise' amplitude of
+ * white noise and runs the frames through the detector. Detected
+ * digits are stored to 'out'.
+ */
+static void priv_loop(const char *digits, int tone_ms, int gap_ms, int rate, int noise, char *out)
+{
+  cmtspeech_dtmf_gen_t gen;
+  cmtspeech_dtmf_det_t det;
+  int16_t frame[MAX_FRAME];
+  int16_t tone[MAX_FRAME];
+  int i, n = rate / 50, frames, count = 0;
+
+  srand(1);
+  cmtspeech_dtmf_gen_init(&gen);
+  cmtspeech_dtmf_det_init(&det);
+  fail_unless(cmtspeech_dtmf_gen_start(&gen, digits, tone_ms, gap_ms) == 0);
+
+  /* note: one silent frame first, so that tones do not start
+   *       at a detector block boundary */
+  for(frames = 0; frames < 400; frames++) {
+    memset(tone, 0, sizeof(tone));
+    if (frames > 0)
+      cmtspeech_dtmf_gen_fill(&gen, tone, n, rate);
+    for(i = 0; i < n; i++)
+      frame[i] = tone[i] + (noise ? rand() % (2 * noise + 1) - noise : 0);
+
+    i = cmtspeech_dtmf_det_process(&det, frame, n, rate);
+    if (i != 0)
+      out[count++] = i;
+  }
+
+  out[count] = 0;
+}
+
+START_TEST(test_dtmf_all_digits)
+{
+  static const char digits[] = "123A456B789C*0#D";
+  char out[64];
+
+  priv_loop(digits, 40, 40, 8000, 0, out);
+  fail_unless(strcmp(out, digits) == 0);
+
+  priv_loop(digits, 40, 40, 16000, 0, out);
+  fail_unless(strcmp(out, digits) == 0);
+
+  /* step: -26dBFS of noise against -11/-13dBFS tones */
+  priv_loop(digits, 60, 60, 8000, 1500, out);
+  fail_unless(strcmp(out, digits) == 0);
+}
+END_TEST
+
+START_TEST(test_dtmf_reject)
+{
+  cmtspeech_dtmf_det_t det;
+  int16_t frame[160];
+  char out[64];
+  int i, j, hits = 0;
+
+  /* step: tones too short to be key presses */
+  priv_loop("5555", 20, 40, 8000, 0, out);
+  fail_unless(out[0] == 0);
+
+  /* step: loud noise alone */
+  priv_loop("", 40, 40, 8000, 8000, out);
+  fail_unless(out[0] == 0);
+
+  /* step: a loud tone outside the DTMF band */
+  cmtspeech_dtmf_det_init(&det);
+  for(i = 0; i < 100; i++) {
+    for(j = 0; j < 160; j++)
+      frame[j] = (j & 1) ? 4000 : -4000;
+    hits += cmtspeech_dtmf_det_process(&det, frame, 160, 8000) != 0;
+  }
+  fail_unless(hits == 0);
+}
+END_TEST
+
+START_TEST(test_dtmf_generator)
+{
+  cmtspeech_dtmf_gen_t gen;
+  int16_t frame[160];
+  int i, peak = 0;
+
+  cmtspeech_dtmf_gen_init(&gen);
+  fail_unless(cmtspeech_dtmf_gen_active(&gen) != true);
+  fail_unless(cmtspeech_dtmf_gen_start(&gen, "12x", 40, 40) == -EINVAL);
+  fail_unless(cmtspeech_dtmf_gen_start(&gen, "1", 0, 40) == -EINVAL);
+  fail_unless(cmtspeech_dtmf_gen_start(&gen, "012345678901234567890123456789012", 40, 40) == -EINVAL);
+
+  /* step: 40ms tone and 40ms gap are four 20ms frames */
+  fail_unless(cmtspeech_dtmf_gen_start(&gen, "D", 40, 40) == 0);
+  for(i = 0; i < 4; i++) {
+    fail_unless(cmtspeech_dtmf_gen_active(&gen) == true);
+    cmtspeech_dtmf_gen_fill(&gen, frame, 160, 8000);
+  }
+  fail_unless(cmtspeech_dtmf_gen_active(&gen) != true);
+
+  /* step: samples after the last digit are left untouched */
+  fail_unless(cmtspeech_dtmf_gen_start(&gen, "5", 10, 0) == 0);
+  for(i = 0; i < 160; i++)
+    frame[i] = 1234;
+  cmtspeech_dtmf_gen_fill(&gen, frame, 160, 8000);
+  for(i = 0; i < 80; i++)
+    if (abs(frame[i]) > peak)
+      peak = abs(frame[i]);
+  fail_unless(peak > 14000 && peak < 16572);
+  fail_unless(frame[80] == 1234 && frame[159] == 1234);
+
+  /* step: an empty string stops the generator */
+  fail_unless(cmtspeech_dtmf_gen_start(&gen, "1", 40, 40) == 0);
+  fail_unless(cmtspeech_dtmf_gen_start(&gen, "", 40, 40) == 0);
+  fail_unless(cmtspeech_dtmf_gen_active(&gen) != true);
+}
+END_TEST
+
+Suite *dtmf_suite(void)
+{
+  Suite *suite = suite_create("dtmf");
+  TCase *dtmf = tcase_create("dtmf");
+
+  tcase_add_test(dtmf, test_dtmf_all_digits);
+  tcase_add_test(dtmf, test_dtmf_reject);
+  tcase_add_test(dtmf, test_dtmf_generator);
+  suite_add_tcase(suite, dtmf);
+
+  return suite;
+}
+
+int main(int argc, char *argv[])
+{
+  int nr_failed;
+  Suite *suite = dtmf_suite();
+  SRunner *runner = srunner_create(suite);
+  srunner_set_xml(runner, "/tmp/result.xml");
+  srunner_run_all(runner, CK_NORMAL);
+  nr_failed = srunner_ntests_failed(runner);
+  srunner_free(runner);
+  return (nr_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -48,6 +48,11 @@
 #error "Endianess must be set."
 #endif
 
+#include "test_cmtspeech_msgs_ref.c"
+
+/* messages compared against the reference codec */
+#define REF_ITERATIONS 1000000
+
 START_TEST(test_speech_codec_req)
 {
   cmtspeech_cmd_t cmd;
@@ -308,6 +313,233 @@ START_TEST(test_dl_data_frame)
 }
 END_TEST
 
+START_TEST(test_msg_decode)
+{
+  cmtspeech_cmd_t cmd, cmd2;
+  cmtspeech_msg_t msg;
+  int i;
+
+  /* test: decode via the generic interface */
+  cmtspeech_msg_encode_speech_config_req(&cmd, 1, 0, CMTSPEECH_CODEC_INFO_AMR_WB, CMTSPEECH_CELLULAR_INFO_WCDMA, CMTSPEECH_SAMPLE_RATE_16KHZ, CMTSPEECH_DATA_FORMAT_S16LINPCM);
+  memset(&msg, 0xff, sizeof(msg));
+  fail_unless(cmtspeech_msg_decode(cmd, &msg) == 0);
+  fail_unless(msg.type == CMTSPEECH_SPEECH_CONFIG_REQ);
+  fail_unless(msg.domain == CMTSPEECH_DOMAIN_CONTROL);
+  fail_unless(msg.u.speech_config_req.speech_data_stream == 1);
+  fail_unless(msg.u.speech_config_req.call_user_connecting_ind == 0);
+  fail_unless(msg.u.speech_config_req.codec_info == CMTSPEECH_CODEC_INFO_AMR_WB);
+  fail_unless(msg.u.speech_config_req.cellular_info == CMTSPEECH_CELLULAR_INFO_WCDMA);
+  fail_unless(msg.u.speech_config_req.sample_rate == CMTSPEECH_SAMPLE_RATE_16KHZ);
+  fail_unless(msg.u.speech_config_req.data_format == CMTSPEECH_DATA_FORMAT_S16LINPCM);
+
+  cmtspeech_msg_encode_timing_config_ntf(&cmd, 511, 1023);
+  memset(&msg, 0xff, sizeof(msg));
+  fail_unless(cmtspeech_msg_decode(cmd, &msg) == 0);
+  fail_unless(msg.type == CMTSPEECH_TIMING_CONFIG_NTF);
+  fail_unless(msg.u.timing_config_ntf.msec == 511);
+  fail_unless(msg.u.timing_config_ntf.usec == 1023);
+  /* note: unused fields must be cleared */
+  for(i = 2; i < CMTSPEECH_MSG_MAX_FIELDS; i++)
+    fail_unless(msg.u.fields[i] == 0);
+
+  cmtspeech_msg_encode_test_ramp_ping(&cmd, CMTSPEECH_DOMAIN_CONTROL, CMTSPEECH_DOMAIN_DATA, 0x12, 0x34);
+  fail_unless(cmtspeech_msg_decode(cmd, &msg) == 0);
+  fail_unless(msg.type == CMTSPEECH_TEST_RAMP_PING);
+  fail_unless(msg.u.test_ramp_ping.replydomain == CMTSPEECH_DOMAIN_DATA);
+  fail_unless(msg.u.test_ramp_ping.rampstart == 0x12);
+  fail_unless(msg.u.test_ramp_ping.ramplen == 0x34);
+
+  /* test: generic encoding matches the per-type encoders */
+  cmtspeech_msg_encode_ssi_config_req(&cmd, CMTSPEECH_SAMPLE_LAYOUT_INORDER_LE, 2, 1);
+  fail_unless(cmtspeech_msg_decode(cmd, &msg) == 0);
+  fail_unless(msg.u.ssi_config_req.layout == CMTSPEECH_SAMPLE_LAYOUT_INORDER_LE);
+  fail_unless(msg.u.ssi_config_req.version == 2);
+  fail_unless(msg.u.ssi_config_req.state == 1);
+  fail_unless(cmtspeech_msg_encode(&cmd2, &msg) == CMTSPEECH_CTRL_LEN);
+  fail_unless(memcmp(cmd.d.buf, cmd2.d.buf, CMTSPEECH_CTRL_LEN) == 0);
+
+  cmtspeech_msg_encode_uplink_config_ntf(&cmd);
+  fail_unless(cmtspeech_msg_decode(cmd, &msg) == 0);
+  fail_unless(msg.type == CMTSPEECH_UPLINK_CONFIG_NTF);
+  fail_unless(cmtspeech_msg_encode(&cmd2, &msg) == CMTSPEECH_CTRL_LEN);
+  fail_unless(memcmp(cmd.d.buf, cmd2.d.buf, CMTSPEECH_CTRL_LEN) == 0);
+
+  /* test: unknown message type */
+  cmd.d.buf[BYTE0] = 0xf1;
+  fail_unless(cmtspeech_msg_decode(cmd, &msg) != 0);
+  msg.type = 0x0f;
+  fail_unless(cmtspeech_msg_encode(&cmd2, &msg) < 0);
+}
+END_TEST
+
+START_TEST(test_dl_data_frame_codec_rate)
+{
+  uint8_t buf[4];
+  uint16_t frame_counter;
+  uint8_t spc_flags, data_length, sample_rate, codec_sample_rate, data_type;
+
+  cmtspeech_msg_encode_dl_data_header_v5(buf, sizeof(buf), 0xabcd, CMTSPEECH_SPC_FLAGS_BFI | CMTSPEECH_SPC_FLAGS_DTX_USED, CMTSPEECH_DATA_LENGTH_20MS, CMTSPEECH_SAMPLE_RATE_16KHZ, CMTSPEECH_SAMPLE_RATE_16KHZ, CMTSPEECH_DATA_TYPE_INVALID);
+
+  /* note: same bit pattern as the test vector in test_dl_data_frame */
+  fail_unless(buf[BYTE0] == 0xab);
+  fail_unless(buf[BYTE1] == 0xcd);
+  fail_unless(buf[BYTE2] == 0x50);
+  fail_unless(buf[BYTE3] == 0xa9);
+
+  cmtspeech_msg_decode_dl_data_header_v5(buf, sizeof(buf), &frame_counter, &spc_flags, &data_length, &sample_rate, &codec_sample_rate, &data_type);
+  fail_unless(frame_counter == 0xabcd);
+  fail_unless(codec_sample_rate == CMTSPEECH_SAMPLE_RATE_16KHZ);
+}
+END_TEST
+
+/* xorshift32, so that failures are reproducible */
+static uint32_t priv_rand(uint32_t *state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+START_TEST(test_msg_decode_reference)
+{
+  uint32_t seed = 0x2a;
+  int i;
+
+  /* test: decoders give the same results as the reference codec
+   *       for any message word */
+  for(i = 0; i < REF_ITERATIONS; i++) {
+    cmtspeech_cmd_t cmd;
+    uint8_t a[6], b[6];
+    uint16_t c[2], d[2];
+
+    cmd.d.cmd = priv_rand(&seed);
+
+    fail_unless(cmtspeech_msg_get_type(cmd) == ref_msg_get_type(cmd));
+    fail_unless(cmtspeech_msg_get_domain(cmd) == ref_msg_get_domain(cmd));
+
+    memset(a, 0, sizeof(a)); memset(b, 0, sizeof(b));
+    fail_unless(cmtspeech_msg_decode_speech_config_req(cmd, &a[0], &a[1], &a[2], &a[3], &a[4], &a[5]) ==
+                ref_msg_decode_speech_config_req(cmd, &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]));
+    fail_unless(memcmp(a, b, sizeof(a)) == 0, "SPEECH_CONFIG_REQ 0x%08x", cmd.d.cmd);
+
+    memset(c, 0, sizeof(c)); memset(d, 0, sizeof(d));
+    fail_unless(cmtspeech_msg_decode_timing_config_ntf(cmd, &c[0], &c[1]) ==
+                ref_msg_decode_timing_config_ntf(cmd, &d[0], &d[1]));
+    fail_unless(memcmp(c, d, sizeof(c)) == 0, "TIMING_CONFIG_NTF 0x%08x", cmd.d.cmd);
+
+    memset(a, 0, sizeof(a)); memset(b, 0, sizeof(b));
+    fail_unless(cmtspeech_msg_decode_ssi_config_req(cmd, &a[0], &a[1], &a[2]) ==
+                ref_msg_decode_ssi_config_req(cmd, &b[0], &b[1], &b[2]));
+    fail_unless(cmtspeech_msg_decode_ssi_config_resp(cmd, &a[3], &a[4]) ==
+                ref_msg_decode_ssi_config_resp(cmd, &b[3], &b[4]));
+    fail_unless(cmtspeech_msg_decode_speech_config_resp(cmd, &a[5]) ==
+                ref_msg_decode_speech_config_resp(cmd, &b[5]));
+    fail_unless(memcmp(a, b, sizeof(a)) == 0, "SSI_CONFIG_* 0x%08x", cmd.d.cmd);
+
+    memset(a, 0, sizeof(a)); memset(b, 0, sizeof(b));
+    fail_unless(cmtspeech_msg_decode_test_ramp_ping(cmd, &a[0], &a[1], &a[2], &a[3]) ==
+                ref_msg_decode_test_ramp_ping(cmd, &b[0], &b[1], &b[2], &b[3]));
+    fail_unless(memcmp(a, b, sizeof(a)) == 0, "TEST_RAMP_PING 0x%08x", cmd.d.cmd);
+
+    /* note: data headers use the same byte order as control messages */
+    memset(a, 0, sizeof(a)); memset(b, 0, sizeof(b));
+    memset(c, 0, sizeof(c)); memset(d, 0, sizeof(d));
+    fail_unless(cmtspeech_msg_decode_ul_data_header(cmd.d.buf, CMTSPEECH_DATA_HEADER_LEN, &c[0], &a[0], &a[1], &a[2]) ==
+                ref_msg_decode_ul_data_header(cmd.d.buf, CMTSPEECH_DATA_HEADER_LEN, &d[0], &b[0], &b[1], &b[2]));
+    fail_unless(memcmp(a, b, sizeof(a)) == 0 && c[0] == d[0], "UL header 0x%08x", cmd.d.cmd);
+
+    memset(a, 0, sizeof(a)); memset(b, 0, sizeof(b));
+    memset(c, 0, sizeof(c)); memset(d, 0, sizeof(d));
+    fail_unless(cmtspeech_msg_decode_dl_data_header_v5(cmd.d.buf, CMTSPEECH_DATA_HEADER_LEN, &c[0], &a[0], &a[1], &a[2], &a[3], &a[4]) ==
+                ref_msg_decode_dl_data_header_v5(cmd.d.buf, CMTSPEECH_DATA_HEADER_LEN, &d[0], &b[0], &b[1], &b[2], &b[3], &b[4]));
+    fail_unless(memcmp(a, b, sizeof(a)) == 0 && c[0] == d[0], "DL header 0x%08x", cmd.d.cmd);
+  }
+
+  /* test: short data header buffers are rejected alike */
+  {
+    uint8_t buf[4] = { 0 }, u8;
+    uint16_t u16;
+    fail_unless(cmtspeech_msg_decode_ul_data_header(buf, 3, &u16, &u8, &u8, &u8) ==
+                ref_msg_decode_ul_data_header(buf, 3, &u16, &u8, &u8, &u8));
+    fail_unless(cmtspeech_msg_decode_dl_data_header(buf, 3, &u16, &u8, &u8, &u8, &u8) ==
+                ref_msg_decode_dl_data_header(buf, 3, &u16, &u8, &u8, &u8, &u8));
+  }
+}
+END_TEST
+
+START_TEST(test_msg_encode_reference)
+{
+  uint32_t seed = 0x2b;
+  int i;
+
+  /* test: encoders give the same message words as the reference
+   *       codec for any argument values */
+  for(i = 0; i < REF_ITERATIONS; i++) {
+    cmtspeech_cmd_t cmd, ref;
+    uint32_t r1 = priv_rand(&seed), r2 = priv_rand(&seed);
+    uint8_t u[6] = { r1, r1 >> 8, r1 >> 16, r1 >> 24, r2, r2 >> 8 };
+    uint16_t w[2] = { r1, r2 >> 16 };
+
+    fail_unless(cmtspeech_msg_encode_speech_config_req(&cmd, u[0], u[1], u[2], u[3], u[4], u[5]) ==
+                ref_msg_encode_speech_config_req(&ref, u[0], u[1], u[2], u[3], u[4], u[5]));
+    fail_unless(cmd.d.cmd == ref.d.cmd, "SPEECH_CONFIG_REQ 0x%08x != 0x%08x", cmd.d.cmd, ref.d.cmd);
+
+    fail_unless(cmtspeech_msg_encode_timing_config_ntf(&cmd, w[0], w[1]) ==
+                ref_msg_encode_timing_config_ntf(&ref, w[0], w[1]));
+    fail_unless(cmd.d.cmd == ref.d.cmd, "TIMING_CONFIG_NTF 0x%08x != 0x%08x", cmd.d.cmd, ref.d.cmd);
+
+    fail_unless(cmtspeech_msg_encode_ssi_config_req(&cmd, u[0], u[1], u[2]) ==
+                ref_msg_encode_ssi_config_req(&ref, u[0], u[1], u[2]));
+    fail_unless(cmd.d.cmd == ref.d.cmd, "SSI_CONFIG_REQ 0x%08x != 0x%08x", cmd.d.cmd, ref.d.cmd);
+
+    fail_unless(cmtspeech_msg_encode_ssi_config_resp(&cmd, u[3], u[4]) ==
+                ref_msg_encode_ssi_config_resp(&ref, u[3], u[4]));
+    fail_unless(cmd.d.cmd == ref.d.cmd, "SSI_CONFIG_RESP 0x%08x != 0x%08x", cmd.d.cmd, ref.d.cmd);
+
+    /* note: the reference did not mask the SPEECH_CONFIG_RESP result
+     *       and TEST_RAMP_PING domain, so out-of-range values spilled
+     *       into the reserved and type bits; the table masks them */
+    fail_unless(cmtspeech_msg_encode_speech_config_resp(&cmd, u[5] & 0x1) ==
+                ref_msg_encode_speech_config_resp(&ref, u[5] & 0x1));
+    fail_unless(cmd.d.cmd == ref.d.cmd, "SPEECH_CONFIG_RESP 0x%08x != 0x%08x", cmd.d.cmd, ref.d.cmd);
+
+    fail_unless(cmtspeech_msg_encode_test_ramp_ping(&cmd, u[0] & 0xf, u[1], u[2], u[3]) ==
+                ref_msg_encode_test_ramp_ping(&ref, u[0] & 0xf, u[1], u[2], u[3]));
+    fail_unless(cmd.d.cmd == ref.d.cmd, "TEST_RAMP_PING 0x%08x != 0x%08x", cmd.d.cmd, ref.d.cmd);
+
+    fail_unless(cmtspeech_msg_encode_ul_data_header(cmd.d.buf, CMTSPEECH_DATA_HEADER_LEN, w[0], u[2], u[3], u[4]) ==
+                ref_msg_encode_ul_data_header(ref.d.buf, CMTSPEECH_DATA_HEADER_LEN, w[0], u[2], u[3], u[4]));
+    fail_unless(cmd.d.cmd == ref.d.cmd, "UL header 0x%08x != 0x%08x", cmd.d.cmd, ref.d.cmd);
+
+    /* note: the reference wrote the codec sample rate to the wrong
+     *       bits (see test_dl_data_frame_codec_rate), so only the
+     *       variant without it is compared */
+    fail_unless(cmtspeech_msg_encode_dl_data_header(cmd.d.buf, CMTSPEECH_DATA_HEADER_LEN, w[0], u[1], u[2], u[3], u[4]) ==
+                ref_msg_encode_dl_data_header(ref.d.buf, CMTSPEECH_DATA_HEADER_LEN, w[0], u[1], u[2], u[3], u[4]));
+    fail_unless(cmd.d.cmd == ref.d.cmd, "DL header 0x%08x != 0x%08x", cmd.d.cmd, ref.d.cmd);
+  }
+
+  {
+    cmtspeech_cmd_t cmd, ref;
+
+    cmtspeech_msg_encode_reset_conn_req(&cmd);
+    ref_msg_encode_reset_conn_req(&ref);
+    fail_unless(cmd.d.cmd == ref.d.cmd);
+    cmtspeech_msg_encode_reset_conn_resp(&cmd);
+    ref_msg_encode_reset_conn_resp(&ref);
+    fail_unless(cmd.d.cmd == ref.d.cmd);
+    cmtspeech_msg_encode_new_timing_config_req(&cmd);
+    ref_msg_encode_new_timing_config_req(&ref);
+    fail_unless(cmd.d.cmd == ref.d.cmd);
+    cmtspeech_msg_encode_uplink_config_ntf(&cmd);
+    ref_msg_encode_uplink_config_ntf(&ref);
+    fail_unless(cmd.d.cmd == ref.d.cmd);
+  }
+}
+END_TEST
+
 Suite *ssi_msgs_suite(void)
 {
   Suite *suite = suite_create("ssi_msgs");
@@ -321,9 +553,13 @@ Suite *ssi_msgs_suite(void)
   tcase_add_test(control, test_ssi_config_resp);
   tcase_add_test(control, test_reset_conn_req);
   tcase_add_test(control, test_reset_conn_resp);
+  tcase_add_test(control, test_msg_decode);
+  tcase_add_test(control, test_msg_decode_reference);
+  tcase_add_test(control, test_msg_encode_reference);
 
   tcase_add_test(data, test_ul_data_frame);
   tcase_add_test(data, test_dl_data_frame);
+  tcase_add_test(data, test_dl_data_frame_codec_rate);
 
   suite_add_tcase(suite, control);
   suite_add_tcase(suite, data);
@@ -23,7 +23,7 @@
 
 /** @file test_ring.c
  *
- * Unit test for sal_ring.h.
+ * Unit test for sal_ring.h and sal_trace_ring.h.
  */
 
 #include <check.h>
@@ -31,6 +31,7 @@
 #include <stdint.h>
 
 #include "sal_ring.h"
+#include "sal_trace_ring.h"
 
 START_TEST(test_ring_read)
 {
@@ -109,6 +110,46 @@ START_TEST(test_ring_write)
 }
 END_TEST
 
+START_TEST(test_trace_ring)
+{
+  static sal_trace_ring_t ring;
+  static cmtspeech_trace_record_t recs[SAL_TRACE_RING_SLOTS + 1];
+  int i, n;
+
+  sal_trace_ring_init(&ring);
+  fail_unless(sal_trace_ring_read(&ring, recs, 4) == 0);
+
+  sal_trace_ring_put(&ring, CMTSPEECH_TRACEPOINT_DL_BUFFER_ACQUIRE, 1, 2, 3, 4);
+  sal_trace_ring_put(&ring, CMTSPEECH_TRACEPOINT_UL_BUFFER_RELEASE, 5, 6, 7, 8);
+  n = sal_trace_ring_read(&ring, recs, 4);
+  fail_unless(n == 2);
+  fail_unless(recs[0].id == CMTSPEECH_TRACEPOINT_DL_BUFFER_ACQUIRE);
+  fail_unless(recs[0].args[0] == 1 && recs[0].args[3] == 4);
+  fail_unless(recs[1].id == CMTSPEECH_TRACEPOINT_UL_BUFFER_RELEASE);
+  fail_unless(recs[1].args[2] == 7);
+  fail_unless(recs[1].tstamp_ns >= recs[0].tstamp_ns);
+
+  /* step: overflow the ring, excess records are dropped */
+  for(i = 0; i < SAL_TRACE_RING_SLOTS + 10; i++)
+    sal_trace_ring_put(&ring, CMTSPEECH_TRACEPOINT_DL_DATA_RECEIVED, i, 0, 0, 0);
+
+  n = sal_trace_ring_read(&ring, recs, SAL_TRACE_RING_SLOTS + 1);
+  fail_unless(n == SAL_TRACE_RING_SLOTS + 1);
+  fail_unless(recs[0].id == CMTSPEECH_TRACEPOINT_LOST);
+  fail_unless(recs[0].args[0] == 10);
+  fail_unless(recs[1].args[0] == 0);
+  fail_unless(recs[SAL_TRACE_RING_SLOTS].args[0] == SAL_TRACE_RING_SLOTS - 1);
+
+  /* step: partial reads keep the order */
+  sal_trace_ring_put(&ring, CMTSPEECH_TRACEPOINT_DL_XRUN, 1, 0, 0, 0);
+  sal_trace_ring_put(&ring, CMTSPEECH_TRACEPOINT_DL_XRUN, 2, 0, 0, 0);
+  fail_unless(sal_trace_ring_read(&ring, recs, 1) == 1);
+  fail_unless(recs[0].args[0] == 1);
+  fail_unless(sal_trace_ring_read(&ring, recs, 4) == 1);
+  fail_unless(recs[0].args[0] == 2);
+}
+END_TEST
+
 Suite *ring_suite(void)
 {
   Suite *suite = suite_create("ring_buffer");
@@ -116,6 +157,7 @@ Suite *ring_suite(void)
 
   tcase_add_test(ring, test_ring_read);
   tcase_add_test(ring, test_ring_write);
+  tcase_add_test(ring, test_trace_ring);
   suite_add_tcase(suite, ring);
 
   return suite;
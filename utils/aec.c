@@ -0,0 +1,307 @@
+/* -*- c-file-style: "linux" -*- */
+
+/*
+ * Acoustic echo canceller for the loopback/handsfree path.
+ *
+ * Partitioned-block frequency-domain NLMS (MDF): the echo path is
+ * modelled by AEC_TAIL_MSEC of filter split into blocks of about
+ * 8 ms, each adapted in the frequency domain with per-bin power
+ * normalization. The gradient constraint is applied to one
+ * partition per block in turn. Adaptation is frozen during
+ * double-talk (Geigel detector), and when the caller reports that
+ * the capture has no near-end activity (e.g. from a VAD), as there
+ * is then no echo to learn from.
+ *
+ * The far-end reference is the DL audio as it was written to the
+ * sink. Each write records when its first sample will be played
+ * (now + playback queue length). The capture side uses this to
+ * line up the reference with the microphone signal, and only has
+ * to model the acoustic path and the capture latency.
+ *
+ * Capture is processed in blocks, so the output lags the input by
+ * one block.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define AEC_MAX_BLOCK		128	/* 8 ms at 16 kHz */
+#define AEC_TAIL_MSEC		128
+#define AEC_MAX_PARTS		16
+#define AEC_REF_LEN		8192	/* far-end history, samples */
+#define AEC_PREDELAY_MSEC	8	/* reference runs ahead of capture by this */
+#define AEC_RESYNC_MSEC		10	/* realign if off by more */
+#define AEC_MU			0.4f
+#define AEC_POWER_SMOOTH	0.7f
+#define AEC_DTD_THRESHOLD	0.5f	/* near/far peak ratio for double-talk */
+#define AEC_DTD_HANGOVER	8	/* blocks */
+#define AEC_FIFO		(2 * PLC_MAX_FRAME + AEC_MAX_BLOCK)
+
+struct aec {
+	int rate;
+	int block;		/* B, samples */
+	int parts;		/* P */
+	struct fft fft;		/* 2B points */
+
+	cpx X[AEC_MAX_PARTS][2 * AEC_MAX_BLOCK];	/* reference spectra */
+	cpx W[AEC_MAX_PARTS][2 * AEC_MAX_BLOCK];	/* filter */
+	float xpeak[AEC_MAX_PARTS];	/* reference peak per partition */
+	float power[2 * AEC_MAX_BLOCK];
+	float xprev[AEC_MAX_BLOCK];
+	int xhead;		/* newest partition in X */
+	int constrain;		/* partition constrained next */
+	int dtd_hold;
+	cpx tmp[2 * AEC_MAX_BLOCK];
+	cpx acc[2 * AEC_MAX_BLOCK];
+
+	/* far-end reference as played */
+	s16 ref[AEC_REF_LEN];
+	unsigned int ref_written;	/* samples written */
+	unsigned int ref_read;		/* next sample for the canceller */
+	unsigned int anchor_pos;	/* sample played at 'anchor_time' */
+	struct timespec anchor_time;
+	int anchored;
+	int synced;
+
+	/* capture block assembly */
+	s16 din[AEC_MAX_BLOCK];
+	int din_fill;
+	s16 dout[AEC_FIFO];
+	int dout_fill;
+
+	unsigned int blocks;
+	unsigned int frozen;	/* blocks without adaptation */
+	unsigned int resyncs;
+};
+
+static void aec_reset(struct aec *a, int rate)
+{
+	memset(a, 0, sizeof(*a));
+	a->rate = rate;
+	a->block = rate / 125;
+	if (a->block > AEC_MAX_BLOCK)
+		a->block = AEC_MAX_BLOCK;
+	a->parts = AEC_TAIL_MSEC * rate / 1000 / a->block;
+	if (a->parts > AEC_MAX_PARTS)
+		a->parts = AEC_MAX_PARTS;
+	fft_init(&a->fft, 2 * a->block);
+
+	/* constant latency of one block */
+	a->dout_fill = a->block;
+}
+
+void aec_init(struct aec *a)
+{
+	aec_reset(a, 8000);
+}
+
+static long aec_usec_since(const struct timespec *t)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t->tv_sec) * 1000000 +
+		(now.tv_nsec - t->tv_nsec) / 1000;
+}
+
+/*
+ * Records n samples of far-end audio that were just written to a
+ * sink with 'delay_us' of audio already queued (-1 if unknown).
+ */
+void aec_playback(struct aec *a, const s16 *buf, int n, int rate, long delay_us)
+{
+	int i;
+
+	if (rate != a->rate)
+		aec_reset(a, rate);
+
+	if (delay_us >= 0) {
+		clock_gettime(CLOCK_MONOTONIC, &a->anchor_time);
+		a->anchor_pos = a->ref_written - (int)((long long)delay_us * rate / 1000000);
+		a->anchored = 1;
+	}
+
+	for (i = 0; i < n; i++)
+		a->ref[(a->ref_written + i) % AEC_REF_LEN] = buf[i];
+	a->ref_written += n;
+}
+
+/*
+ * Moves the reference read position to match a capture frame of
+ * n samples that ends now.
+ */
+static void aec_sync(struct aec *a, int n)
+{
+	long since = aec_usec_since(&a->anchor_time);
+	int predelay = AEC_PREDELAY_MSEC * a->rate / 1000;
+	unsigned int want;
+	int off;
+
+	/* samples already in din precede this frame; the reference
+	 * is taken 'predelay' ahead so that the echo path is causal */
+	want = a->anchor_pos + (int)((long long)since * a->rate / 1000000)
+		- n - a->din_fill + predelay;
+	off = (int)(want - a->ref_read);
+
+	if (!a->synced || off > AEC_RESYNC_MSEC * a->rate / 1000 ||
+	    -off > AEC_RESYNC_MSEC * a->rate / 1000) {
+		if (a->synced)
+			a->resyncs++;
+		a->ref_read = want;
+		a->synced = 1;
+	}
+}
+
+static float aec_ref_sample(struct aec *a)
+{
+	unsigned int pos = a->ref_read++;
+	int age = (int)(a->ref_written - pos);
+
+	if (age <= 0 || age > AEC_REF_LEN)
+		return 0;
+	return a->ref[pos % AEC_REF_LEN];
+}
+
+static void aec_block(struct aec *a, const s16 *d, s16 *out, int adapt)
+{
+	int B = a->block, N = 2 * B, P = a->parts;
+	cpx *X0, *E = a->tmp, *Y = a->acc;
+	float dpeak = 0, xpeak = 0, mu = AEC_MU;
+	int i, k, p;
+
+	/* step: transform [previous, current] reference block */
+	a->xhead = (a->xhead + P - 1) % P;
+	X0 = a->X[a->xhead];
+	a->xpeak[a->xhead] = 0;
+	for (i = 0; i < B; i++) {
+		float x = aec_ref_sample(a);
+
+		X0[i].re = a->xprev[i];
+		X0[i].im = 0;
+		X0[B + i].re = x;
+		X0[B + i].im = 0;
+		a->xprev[i] = x;
+		if (fabsf(x) > a->xpeak[a->xhead])
+			a->xpeak[a->xhead] = fabsf(x);
+	}
+	fft_forward(&a->fft, X0);
+
+	/* step: echo estimate Y = sum W[p] X[p] */
+	memset(Y, 0, N * sizeof(cpx));
+	for (p = 0; p < P; p++) {
+		const cpx *X = a->X[(a->xhead + p) % P], *W = a->W[p];
+
+		for (k = 0; k < N; k++) {
+			Y[k].re += W[k].re * X[k].re - W[k].im * X[k].im;
+			Y[k].im += W[k].re * X[k].im + W[k].im * X[k].re;
+		}
+		if (a->xpeak[p] > xpeak)
+			xpeak = a->xpeak[p];
+	}
+	fft_inverse(&a->fft, Y);
+
+	/* step: error signal, also the output */
+	for (i = 0; i < B; i++) {
+		float e = d[i] - Y[B + i].re;
+
+		if (abs(d[i]) > dpeak)
+			dpeak = abs(d[i]);
+		if (e > 32767)
+			e = 32767;
+		if (e < -32768)
+			e = -32768;
+		out[i] = e;
+		E[i].re = E[i].im = 0;
+		E[B + i].re = e;
+		E[B + i].im = 0;
+	}
+
+	a->blocks++;
+
+	if (!adapt) {
+		a->frozen++;
+		return;
+	}
+
+	/* step: double-talk detection */
+	if (dpeak > AEC_DTD_THRESHOLD * xpeak)
+		a->dtd_hold = AEC_DTD_HANGOVER;
+	if (a->dtd_hold > 0 || xpeak < 1) {
+		if (a->dtd_hold > 0)
+			a->dtd_hold--;
+		a->frozen++;
+		return;
+	}
+
+	fft_forward(&a->fft, E);
+
+	/* step: per-bin normalized update */
+	X0 = a->X[a->xhead];
+	for (k = 0; k < N; k++) {
+		float x2 = X0[k].re * X0[k].re + X0[k].im * X0[k].im;
+
+		a->power[k] = AEC_POWER_SMOOTH * a->power[k] +
+			(1 - AEC_POWER_SMOOTH) * P * x2;
+		/* E becomes the normalized step */
+		E[k].re *= mu / (a->power[k] + N * 10000.0f);
+		E[k].im *= mu / (a->power[k] + N * 10000.0f);
+	}
+
+	for (p = 0; p < P; p++) {
+		const cpx *X = a->X[(a->xhead + p) % P];
+		cpx *W = a->W[p];
+
+		for (k = 0; k < N; k++) {
+			W[k].re += X[k].re * E[k].re + X[k].im * E[k].im;
+			W[k].im += X[k].re * E[k].im - X[k].im * E[k].re;
+		}
+	}
+
+	/* step: gradient constraint for one partition */
+	memcpy(Y, a->W[a->constrain], N * sizeof(cpx));
+	fft_inverse(&a->fft, Y);
+	for (i = B; i < N; i++)
+		Y[i].re = Y[i].im = 0;
+	fft_forward(&a->fft, Y);
+	memcpy(a->W[a->constrain], Y, N * sizeof(cpx));
+	a->constrain = (a->constrain + 1) % P;
+}
+
+/*
+ * Removes the echo from a capture frame of n samples at 'rate',
+ * in place. The filter is only adapted if 'adapt' is set.
+ */
+void aec_capture(struct aec *a, s16 *buf, int n, int rate, int adapt)
+{
+	int i, used = 0;
+
+	if (rate != a->rate)
+		aec_reset(a, rate);
+
+	if (!a->anchored || n > PLC_MAX_FRAME)
+		return;
+
+	aec_sync(a, n);
+
+	while (used < n) {
+		int take = a->block - a->din_fill;
+
+		if (take > n - used)
+			take = n - used;
+		memcpy(a->din + a->din_fill, buf + used, take * sizeof(s16));
+		a->din_fill += take;
+		used += take;
+
+		if (a->din_fill == a->block) {
+			aec_block(a, a->din, a->dout + a->dout_fill, adapt);
+			a->dout_fill += a->block;
+			a->din_fill = 0;
+		}
+	}
+
+	memcpy(buf, a->dout, n * sizeof(s16));
+	a->dout_fill -= n;
+	for (i = 0; i < a->dout_fill; i++)
+		a->dout[i] = a->dout[n + i];
+}
@@ -37,6 +37,7 @@ int period_size = 0;		/* auto */
 int latency_min = 512;		/* in frames / 2 */
 int latency_max = 8192;		/* in frames / 2 */
 int block = 0;			/* block mode */
+int alsa_period = 1024;		/* in frames, two periods per buffer */
 int resample = 1;
 unsigned long loop_limit;
 
@@ -336,7 +337,7 @@ static void start_sink(struct test_ctx *ctx)
 	snd_pcm_uframes_t p_size, p_psize;
 	unsigned int p_time;
 	unsigned int val;
-	int size = 1024;
+	int size = alsa_period;
 	int *bufsize = &size;
 	
 	/* The sample type to use */
@@ -400,7 +401,7 @@ static void start_source(struct test_ctx *ctx)
 	snd_pcm_uframes_t c_size, c_psize;
 	unsigned int c_time;
 	unsigned int val;
-	int size = 1024;
+	int size = alsa_period;
 	int *bufsize = &size;
 	
 	/* Create the recording stream */
@@ -470,6 +471,18 @@ static void stop_sink(struct test_ctx *ctx)
 	ctx->sink = NULL;
 }
 
+/*
+ * Sets the period used by the next start_sink() and start_source().
+ * Only two periods per buffer are supported.
+ */
+int audio_set_buffer(int period_ms, int periods)
+{
+	if (periods != 2 || period_ms <= 0)
+		return -1;
+	alsa_period = rate * period_ms / 1000;
+	return 0;
+}
+
 static void audio_init(struct test_ctx *ctx)
 {
 	int err = snd_output_stdio_attach(&output, stdout, 0);
@@ -479,7 +492,29 @@ static void audio_init(struct test_ctx *ctx)
 	setscheduler();
 }
 
-static const char *audio_strerror(void)
+/* Blocking backend, the tool falls back to polling the source itself. */
+static AUDIO_MAYBE_UNUSED int audio_poll_fd(snd_pcm_t *handle)
+{
+	return -1;
+}
+
+static AUDIO_MAYBE_UNUSED int audio_read_avail(snd_pcm_t *handle)
+{
+	return -1;
+}
+
+/* Returns the playback queue length in microseconds, or -1. */
+static long audio_write_delay(snd_pcm_t *handle)
+{
+	snd_pcm_sframes_t delay;
+
+	if (snd_pcm_delay(handle, &delay) < 0)
+		return -1;
+
+	return (long long)delay * 1000000 / rate;
+}
+
+static AUDIO_MAYBE_UNUSED const char *audio_strerror(void)
 {
 	return strerror(errno);
 }
@@ -9,6 +9,30 @@
 #include "audio.h"
 typedef int16_t s16;
 
+#include "kernels.c"
+#include "plc.c"
+#include "jbuf.c"
+#include "fft.c"
+#include "aec.c"
+#include "chain.c"
+#include "vad.c"
+#include "ns.c"
+#include "inject.c"
+#include "mixer.c"
+#include "metrics.c"
+
+#define AUDIO_DC_SHIFT	6	/* DC estimate time constant, 64 frames */
+
+/* State of a gain stage */
+struct audio_gain {
+	float gain;
+	int agc;		/* adapt the gain to the signal level */
+	int dc_block;		/* track and remove the DC offset */
+	int dc;			/* DC estimate, Q8 */
+	int dc_valid;
+	unsigned int overflows;
+};
+
 struct test_ctx {
 #ifdef CMT_REAL
 	DBusConnection* dbus_conn;
@@ -27,6 +51,28 @@ struct test_ctx {
 	int data_through;
 
 	int source_cc, sink_cc;
+	int ul_frame_bytes;
+
+	struct plc plc;
+	struct jbuf jbuf;
+	struct aec aec;
+	s16 dl_frame[PLC_MAX_FRAME];
+
+	struct chain ul_chain, dl_chain;
+	struct audio_gain ul_gain, dl_gain;
+	struct vad vad;
+	struct ns ns;
+	struct inject inject;
+	struct mixer mixer;
+	struct metrics ul_metrics, dl_metrics;
+	int quality_alarms;	/* METRICS_ALARM_* seen this call */
+	int noise_gain;		/* comfort noise source, Q15, 0 if off */
+	int ul_frame_flags;	/* for the UL frame being processed */
+	int ul_speech;		/* VAD decision for the UL frame being
+				   processed, 1 if no vad stage */
+	long dl_delay;		/* playback queue before the current write */
+	int dtmf_detect;
+	const char *dtmf_digits;	/* sent when UL starts */
 #endif
 };
 
@@ -47,46 +93,6 @@ void to_stereo(s16 *b1, s16 *b2, int size)
 	}
 }
 
-float adjust_volume(float factor, s16 *b, int size, int dc_adj)
-{
-	int i;
-	long v;
-	long long avg = 0;
-	static int overflows = 0;
-	int min=99999, max=-99999; 
-	for (i = 0; i < size/2; i++) {
-		v = b[i] + dc_adj;
-		v = v * factor;
-		avg += v;
-		if (v > max) max=v;
-		if (v < min) min=v;
-		if (v > SHRT_MAX) {
-			v = SHRT_MAX;
-			overflows++;
-		}
-		if (v < SHRT_MIN) {
-			v = SHRT_MIN;
-			overflows++;
-		}
-		b[i] = v;
-	}
-	if (size > 4) {
-	avg = avg / ( size/2 );
-	printf("%.4f gain, %d overflows, %6d..%d..%d\n", factor, overflows, min, (int) avg, max);
-	if (-min > max)
-		max = -min;
-	if (max > (SHRT_MAX * 0.7))
-		factor *= 0.7;
-	if (max < (SHRT_MAX * 0.3))
-		factor *= 1.02;
-	if (factor < 1)
-		factor = 1;
-	if (factor > 30)
-		factor = 30;
-	}
-	return factor;
-}
-
 #ifdef ALSA
 #define MAN_STEREO
 #include "alsa.c"
@@ -128,10 +134,16 @@ void wd_done(void)
  */
 short int sbuf[SSIZE*8];
 
+/* speaker gain and call quality lines shown on the status page */
+static float wd_speaker_gain = 1;
+static char wd_quality[512];
+
 #ifdef MAN_STEREO
+#define AUDIO_GAIN_INIT	3
+#define AUDIO_AGC	1
+
 ssize_t audio_read(audio_t fd, void *buf, size_t count)
 {
-	static float gain = 3;
 	ssize_t res;
 	if (count > SSIZE*4) {
 		printf("Too big request\n");
@@ -139,58 +151,111 @@ ssize_t audio_read(audio_t fd, void *buf, size_t count)
 	}
 	res = audio_read_raw(fd, sbuf, count*2);
 	to_mono(sbuf, buf, res);
-	gain = adjust_volume(gain, buf, count, -3300);
 	return res/2;
 }
 
 ssize_t audio_write(audio_t fd, void *buf, size_t count)
 {
-	static float gain = 3;
 	ssize_t res;
 	if (count > SSIZE*4) {
 		printf("Too big request\n");
 		exit(1);
 	}
-	gain = adjust_volume(gain, buf, count, 0);
 	to_stereo(buf, sbuf, count);
 	res = audio_write_raw(fd, sbuf, count*2);
 	{
 		char buf[1024];
 
-		sprintf(buf, "call\ndriver: %s\nspeaker: %.2f\n",
+		sprintf(buf, "call\ndriver: %s\nspeaker: %.2f\n%s",
 			DRIVER_NAME,
-			gain);
+			wd_speaker_gain, wd_quality);
 		wd_write(buf);
 	}
 	return res/2;
 }
 #else
+#define AUDIO_GAIN_INIT	1
+#define AUDIO_AGC	0
+
 ssize_t audio_read(audio_t fd, void *buf, size_t count)
 {
-	ssize_t res = audio_read_raw(fd, buf, count);
-	static float gain = 1;
-	gain = adjust_volume(1, buf, count, 0);
-	return res;
+	return audio_read_raw(fd, buf, count);
 }
 
 ssize_t audio_write(audio_t fd, void *buf, size_t count)
 {
 	ssize_t res;
-	static float gain = 1;
-	gain = adjust_volume(1, buf, count, 0);
 	res = audio_write_raw(fd, buf, count);
 	{
 		char buf[1024];
 
-		sprintf(buf, "call\ndriver: %s\nspeaker: %.2f\n",
+		sprintf(buf, "call\ndriver: %s\nspeaker: %.2f\n%s",
 			DRIVER_NAME,
-			gain);
+			wd_speaker_gain, wd_quality);
 		wd_write(buf);
 	}
 	return res;
 }
 #endif
 
+void audio_gain_init(struct audio_gain *g, int dc_block)
+{
+	memset(g, 0, sizeof(*g));
+	g->gain = AUDIO_GAIN_INIT;
+	g->agc = AUDIO_AGC;
+	g->dc_block = dc_block;
+}
+
+/*
+ * Gain stage. Removes the DC offset (if enabled) and applies the
+ * gain in one pass over the frame, then adapts the gain (AGC) to the
+ * frame peak.
+ *
+ * The DC offset is tracked by a single-pole IIR on the frame means,
+ * so the per-sample loop has no recursion. The estimate used for a
+ * frame is the one from the frames before it.
+ */
+void audio_gain(struct audio_gain *g, s16 *buf, size_t count)
+{
+	int n = count / 2;
+	int peak, clipped;
+	int64_t sum;
+
+	if (n <= 0)
+		return;
+
+	/* first frame: start from its own mean */
+	if (g->dc_block && !g->dc_valid) {
+		int i;
+
+		for (sum = 0, i = 0; i < n; i++)
+			sum += buf[i];
+		g->dc = (sum << 8) / n;
+		g->dc_valid = 1;
+	}
+
+	sum = kern_dc_gain(buf, n, g->dc_block ? g->dc >> 8 : 0,
+			   g->gain * 256, &peak, &clipped);
+	g->overflows += clipped;
+
+	if (g->dc_block)
+		g->dc += (int)((sum << 8) / n - g->dc) >> AUDIO_DC_SHIFT;
+
+	if (count <= 4)
+		return;
+	printf("%.4f gain, %d overflows, dc %d, peak %d\n", g->gain, g->overflows, g->dc >> 8, peak);
+	if (!g->agc)
+		return;
+	if (peak > (SHRT_MAX * 0.7))
+		g->gain *= 0.7;
+	if (peak < (SHRT_MAX * 0.3))
+		g->gain *= 1.02;
+	if (g->gain < 1)
+		g->gain = 1;
+	if (g->gain > 30)
+		g->gain = 30;
+}
+
 void audio_generate(s16 *buf, size_t count)
 {
 	int i;
@@ -16,4 +16,7 @@ typedef int audio_t;
 typedef long long pa_usec_t;
 #endif
 
+/* for backend functions that not every tool calls */
+#define AUDIO_MAYBE_UNUSED __attribute__((unused))
+
 ssize_t audio_write(audio_t fd, void *buf, size_t count);
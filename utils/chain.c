@@ -0,0 +1,140 @@
+/* -*- c-file-style: "linux" -*- */
+
+/*
+ * Audio processing chain.
+ *
+ * A chain is an ordered list of stages that a frame is passed
+ * through. The stages are configured at run time, before the call,
+ * and all buffers are part of the chain itself, so running a chain
+ * never allocates.
+ *
+ * A stage either works in place, or writes its output into the
+ * chain buffer that does not hold its input (ping-pong). Each stage
+ * keeps a count of the ticks spent in it: CPU cycles where a cycle
+ * counter is readable from user space, nanoseconds otherwise.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define CHAIN_MAX_STAGES	8
+#define CHAIN_MAX_FRAME		JBUF_MAX_OUT	/* samples per stage output */
+
+#if defined(__i386__) || defined(__x86_64__)
+#define CHAIN_TICK_UNIT		"cycles"
+#else
+#define CHAIN_TICK_UNIT		"ns"
+#endif
+
+/*
+ * Processes n samples at 'rate' from 'in' into 'out' and returns
+ * the number of output samples, at most CHAIN_MAX_FRAME. For
+ * in-place stages 'in' and 'out' are the same buffer.
+ */
+typedef int (*chain_fn)(void *priv, const s16 *in, s16 *out, int n, int rate);
+
+struct chain_stage {
+	const char *name;
+	chain_fn process;
+	void *priv;
+	int inplace;
+
+	unsigned int calls;
+	uint64_t ticks;		/* total */
+	uint64_t max;		/* worst single call */
+};
+
+struct chain {
+	const char *name;
+	int count;
+	struct chain_stage stage[CHAIN_MAX_STAGES];
+	s16 buf[2][CHAIN_MAX_FRAME];
+};
+
+static inline uint64_t chain_ticks(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+#endif
+}
+
+void chain_init(struct chain *c, const char *name)
+{
+	memset(c, 0, sizeof(*c));
+	c->name = name;
+}
+
+/* Appends a stage. Returns -1 if the chain is full. */
+int chain_add(struct chain *c, const char *name, chain_fn process,
+	      void *priv, int inplace)
+{
+	struct chain_stage *s;
+
+	if (c->count == CHAIN_MAX_STAGES)
+		return -1;
+
+	s = &c->stage[c->count++];
+	memset(s, 0, sizeof(*s));
+	s->name = name;
+	s->process = process;
+	s->priv = priv;
+	s->inplace = inplace;
+	return 0;
+}
+
+/*
+ * Runs n samples in 'buf' through the chain. In-place stages may
+ * modify 'buf'. Returns the number of output samples and sets
+ * '*out' to the buffer holding them (either 'buf' or a chain
+ * buffer).
+ */
+int chain_run(struct chain *c, s16 *buf, int n, int rate, s16 **out)
+{
+	s16 *cur = buf;
+	int i;
+
+	for (i = 0; i < c->count && n > 0; i++) {
+		struct chain_stage *s = &c->stage[i];
+		s16 *dst = cur;
+		uint64_t t;
+
+		if (!s->inplace)
+			dst = (cur == c->buf[0]) ? c->buf[1] : c->buf[0];
+
+		t = chain_ticks();
+		n = s->process(s->priv, cur, dst, n, rate);
+		t = chain_ticks() - t;
+
+		s->calls++;
+		s->ticks += t;
+		if (t > s->max)
+			s->max = t;
+		cur = dst;
+	}
+
+	*out = cur;
+	return n;
+}
+
+/* Prints the average and worst ticks per frame of each stage. */
+void chain_report(struct chain *c, FILE *f)
+{
+	int i;
+
+	fprintf(f, "%s chain (" CHAIN_TICK_UNIT " avg/max):", c->name);
+	for (i = 0; i < c->count; i++) {
+		struct chain_stage *s = &c->stage[i];
+
+		fprintf(f, " %s %llu/%llu", s->name,
+			(unsigned long long)(s->calls ? s->ticks / s->calls : 0),
+			(unsigned long long)s->max);
+	}
+	fprintf(f, "\n");
+}
@@ -40,12 +40,15 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <getopt.h>
+#include <math.h>
 #include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <cmtspeech.h>
 #include <dbus/dbus.h>
@@ -305,11 +308,230 @@ static int priv_setup_signals(void)
   return res;
 }
 
+/*
+ * Processing stages for the UL and DL chains. UL stages see the
+ * captured frame before it is sent to the modem, DL stages the
+ * decoded (and concealed) frame before it is played.
+ */
+
+/* note: aec and ns are opt-in, aec must be in both chains */
+#define TEST_UL_CHAIN_DEFAULT "gain,inject,mix,metrics,tap"
+#define TEST_DL_CHAIN_DEFAULT "jbuf,gain,metrics,tap"
+
+static int test_ul_gain(void *priv, const s16 *in, s16 *out, int n, int rate)
+{
+	struct test_ctx *ctx = priv;
+
+	audio_gain(&ctx->ul_gain, out, n * 2);
+	return n;
+}
+
+static int test_dl_gain(void *priv, const s16 *in, s16 *out, int n, int rate)
+{
+	struct test_ctx *ctx = priv;
+
+	audio_gain(&ctx->dl_gain, out, n * 2);
+	wd_speaker_gain = ctx->dl_gain.gain;
+	return n;
+}
+
+static int test_ul_aec(void *priv, const s16 *in, s16 *out, int n, int rate)
+{
+	struct test_ctx *ctx = priv;
+
+	aec_capture(&ctx->aec, out, n, rate, ctx->ul_speech);
+	return n;
+}
+
+static int test_ul_ns(void *priv, const s16 *in, s16 *out, int n, int rate)
+{
+	struct test_ctx *ctx = priv;
+
+	ns_process(&ctx->ns, out, n, rate, ctx->ul_speech);
+	return n;
+}
+
+/* Mixes the announcement, if one is playing, into the frame */
+static int test_ul_inject(void *priv, const s16 *in, s16 *out, int n, int rate)
+{
+	struct test_ctx *ctx = priv;
+
+	inject_process(&ctx->inject, out, n, rate);
+	return n;
+}
+
+/* Adds the audio of the sources registered by other threads */
+static int test_ul_mix(void *priv, const s16 *in, s16 *out, int n, int rate)
+{
+	struct test_ctx *ctx = priv;
+
+	mixer_process(&ctx->mixer, out, n, rate);
+	return n;
+}
+
+/* DL side of the echo canceller: records the far-end reference */
+static int test_dl_aec(void *priv, const s16 *in, s16 *out, int n, int rate)
+{
+	struct test_ctx *ctx = priv;
+
+	aec_playback(&ctx->aec, in, n, rate, ctx->dl_delay);
+	return n;
+}
+
+/*
+ * Marks the frame as speech (CMTSPEECH_DATA_TYPE_VALID) or silence
+ * (CMTSPEECH_DATA_TYPE_ZERO) for the modem. The modem does not use
+ * the payload of a silence frame, so the later aec, ns and tap
+ * stages skip their work for it.
+ */
+static int test_ul_vad(void *priv, const s16 *in, s16 *out, int n, int rate)
+{
+	struct test_ctx *ctx = priv;
+
+	ctx->ul_speech = vad_process(&ctx->vad, in, n);
+	ctx->ul_frame_flags = ctx->ul_speech ?
+		CMTSPEECH_DATA_TYPE_VALID : CMTSPEECH_DATA_TYPE_ZERO;
+	return n;
+}
+
+static int test_dl_jbuf(void *priv, const s16 *in, s16 *out, int n, int rate)
+{
+	struct test_ctx *ctx = priv;
+
+	return jbuf_process(&ctx->jbuf, in, n, rate, ctx->dl_delay, out);
+}
+
+/**
+ * Called when a DL metrics window completes: refreshes the quality
+ * lines of the status page and warns about new alarms.
+ */
+static void test_check_quality(struct test_ctx *ctx)
+{
+	char *p = wd_quality, *end = wd_quality + sizeof(wd_quality);
+	int alarms = 0, bit;
+
+	if (ctx->ul_active && ctx->dl_active)
+		alarms = metrics_alarms(&ctx->ul_metrics, &ctx->dl_metrics);
+
+	p += metrics_format(&ctx->ul_metrics, "ul", p, end - p);
+	if (p < end)
+		p += metrics_format(&ctx->dl_metrics, "dl", p, end - p);
+
+	for (bit = 1; bit <= METRICS_ALARM_DL_CLIP; bit <<= 1) {
+		if (!(alarms & bit))
+			continue;
+		if (p < end)
+			p += snprintf(p, end - p, "alarm: %s\n", metrics_alarm_name(bit));
+		if (!(ctx->quality_alarms & bit))
+			fprintf(stderr, PREFIX "WARNING: %s\n", metrics_alarm_name(bit));
+	}
+	ctx->quality_alarms |= alarms;
+}
+
+static int test_ul_metrics(void *priv, const s16 *in, s16 *out, int n, int rate)
+{
+	struct test_ctx *ctx = priv;
+
+	metrics_process(&ctx->ul_metrics, in, n, rate);
+	return n;
+}
+
+static int test_dl_metrics(void *priv, const s16 *in, s16 *out, int n, int rate)
+{
+	struct test_ctx *ctx = priv;
+	unsigned int windows = ctx->dl_metrics.windows;
+
+	metrics_process(&ctx->dl_metrics, in, n, rate);
+	if (ctx->dl_metrics.windows != windows)
+		test_check_quality(ctx);
+	return n;
+}
+
+static int test_ul_tap(void *priv, const s16 *in, s16 *out, int n, int rate)
+{
+	struct test_ctx *ctx = priv;
+
+	if (!ctx->ul_speech)
+		return n;
+	if (write(ctx->source_cc, in, n * 2) < 0)
+		printf("cc write failed: %m\n");
+	return n;
+}
+
+static int test_dl_tap(void *priv, const s16 *in, s16 *out, int n, int rate)
+{
+	struct test_ctx *ctx = priv;
+
+	if (write(ctx->sink_cc, in, n * 2) < 0)
+		printf("error writing sink cc, %m\n");
+	return n;
+}
+
+static const struct test_stage {
+	const char *name;
+	chain_fn ul, dl;	/* NULL if not available in that direction */
+	int inplace;
+} test_stages[] = {
+	{ "gain", test_ul_gain, test_dl_gain, 1 },
+	{ "aec", test_ul_aec, test_dl_aec, 1 },
+	{ "jbuf", NULL, test_dl_jbuf, 0 },
+	{ "vad", test_ul_vad, NULL, 1 },
+	{ "ns", test_ul_ns, NULL, 1 },
+	{ "inject", test_ul_inject, NULL, 1 },
+	{ "mix", test_ul_mix, NULL, 1 },
+	{ "metrics", test_ul_metrics, test_dl_metrics, 1 },
+	{ "tap", test_ul_tap, test_dl_tap, 1 },
+};
+
+/*
+ * Sets up the UL or DL chain from a comma-separated list of stage
+ * names ("none" for an empty chain). Exits on an unknown stage.
+ */
+static void test_setup_chain(struct test_ctx *ctx, int dl, const char *spec)
+{
+	struct chain *c = dl ? &ctx->dl_chain : &ctx->ul_chain;
+	char names[128], *name, *save;
+	unsigned int i;
+
+	chain_init(c, dl ? "DL" : "UL");
+
+	snprintf(names, sizeof(names), "%s", spec);
+	for (name = strtok_r(names, ",", &save); name;
+	     name = strtok_r(NULL, ",", &save)) {
+		chain_fn fn = NULL;
+
+		if (!strcmp(name, "none"))
+			continue;
+
+		for (i = 0; i < sizeof(test_stages) / sizeof(test_stages[0]); i++)
+			if (!strcmp(name, test_stages[i].name))
+				break;
+		if (i < sizeof(test_stages) / sizeof(test_stages[0]))
+			fn = dl ? test_stages[i].dl : test_stages[i].ul;
+
+		if (!fn) {
+			fprintf(stderr, "ERROR: no %s stage '%s'\n", c->name, name);
+			exit(1);
+		}
+		if (chain_add(c, test_stages[i].name, fn, ctx, test_stages[i].inplace) < 0) {
+			fprintf(stderr, "ERROR: too many %s stages\n", c->name);
+			exit(1);
+		}
+	}
+}
+
 static struct option const opt_tbl[] =
   {
     {"verbose",         0, NULL, 'v'},
     {"help",            0, NULL, 'h'},
     {"audio",           0, NULL, 'a'},
+    {"ul-chain",        1, NULL, 'u'},
+    {"dl-chain",        1, NULL, 'd'},
+    {"dtmf-detect",     0, NULL, 'D'},
+    {"dtmf-send",       1, NULL, 'T'},
+    {"play",            1, NULL, 'p'},
+    {"duck",            1, NULL, 'k'},
+    {"noise",           1, NULL, 'n'},
     {NULL,              0, NULL, 0}
   };
 
@@ -317,6 +539,15 @@ static void priv_usage(char *name)
 {
   fprintf(stderr, "usage: %s [options]\n", name);
   fprintf(stderr, "\noptions:\n\t[-v|--verbose] [-h|--help]\n");
+  fprintf(stderr, "\t[-u|--ul-chain stage,...] (default: " TEST_UL_CHAIN_DEFAULT ")\n");
+  fprintf(stderr, "\t[-d|--dl-chain stage,...] (default: " TEST_DL_CHAIN_DEFAULT ")\n");
+  fprintf(stderr, "\t[-D|--dtmf-detect] [-T|--dtmf-send digits] (sent when UL starts)\n");
+  fprintf(stderr, "\t[-p|--play file] (WAV, or raw 8 kHz mono; mixed into UL when UL starts)\n");
+  fprintf(stderr, "\t[-k|--duck dB] (microphone attenuation while playing, default 0)\n");
+  fprintf(stderr, "\t[-n|--noise dBFS] (comfort noise mixed into UL, e.g. -60)\n");
+  fprintf(stderr, "\nstages: gain, aec, jbuf (DL only), vad, ns, inject and mix (UL only), metrics, tap; 'none' for no processing\n");
+  fprintf(stderr, "aec and ns are off by default; aec must be added to both chains, e.g. -u gain,vad,aec,ns,inject,mix,metrics,tap -d jbuf,gain,aec,metrics,tap\n");
+  fprintf(stderr, "with vad before them, aec, ns and the UL tap skip frames without speech\n");
   exit(1);
 }
 
@@ -327,7 +558,7 @@ static void priv_parse_options(struct test_ctx *ctx, int argc, char *argv[])
 
   assert(ctx);
 
-  while (res = getopt_long(argc, argv, "hvat", opt_tbl, &opt_index), res != -1) {
+  while (res = getopt_long(argc, argv, "hvatu:d:DT:p:k:n:", opt_tbl, &opt_index), res != -1) {
     switch (res)
       {
 
@@ -336,6 +567,37 @@ static void priv_parse_options(struct test_ctx *ctx, int argc, char *argv[])
 	fprintf(stderr, PREFIX "Increasing verbosity to %d.\n", ctx->verbose);
 	break;
 
+      case 'u':
+	test_setup_chain(ctx, 0, optarg);
+	break;
+
+      case 'd':
+	test_setup_chain(ctx, 1, optarg);
+	break;
+
+      case 'D':
+	ctx->dtmf_detect = 1;
+	break;
+
+      case 'T':
+	ctx->dtmf_digits = optarg;
+	break;
+
+      case 'p':
+	if (inject_open(&ctx->inject, optarg) < 0) {
+	  fprintf(stderr, "ERROR: unable to open '%s': %m\n", optarg);
+	  exit(1);
+	}
+	break;
+
+      case 'k':
+	inject_set_duck(&ctx->inject, atoi(optarg));
+	break;
+
+      case 'n':
+	ctx->noise_gain = 32767 * pow(10, atoi(optarg) / 20.0);
+	break;
+
       case 'a':
 	fprintf(stderr, "Enabling audio path\n");
 #if 0
@@ -378,6 +640,39 @@ static void priv_parse_options(struct test_ctx *ctx, int argc, char *argv[])
   }
 }
 
+/*
+ * Comfort noise producer: a mixer source fed from its own thread,
+ * kept about 40 ms ahead of the UL frames.
+ */
+static void *test_noise_thread(void *arg)
+{
+	struct test_ctx *ctx = arg;
+	struct mixer_source *s = mixer_add(&ctx->mixer, "noise");
+	uint32_t seed = 1;
+	s16 buf[PLC_MAX_FRAME / 2];
+
+	if (!s)
+		return NULL;
+	mixer_set_gain(s, ctx->noise_gain);
+
+	while (!global_exit_request) {
+		int i, n = mixer_rate(&ctx->mixer) / 100;	/* 10 ms */
+
+		if (mixer_space(s) < MIXER_RING - 4 * n) {
+			usleep(5000);
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			seed = seed * 1103515245 + 12345;
+			buf[i] = seed >> 16;
+		}
+		mixer_write(s, buf, n);
+	}
+
+	mixer_remove(s);
+	return NULL;
+}
+
 static void test_handle_cmtspeech_data_upload(struct test_ctx *ctx)
 {
 	cmtspeech_buffer_t *dlbuf, *ulbuf;
@@ -393,12 +688,20 @@ static void test_handle_cmtspeech_data_upload(struct test_ctx *ctx)
 	}
 
 	while (ctx->source && active_ul && loops) {
+		int avail = audio_read_avail(ctx->source);
+
 		loops --;
+
+		/* Non-blocking source: wait until a full frame is queued. */
+		if (avail >= 0 && avail < ctx->ul_frame_bytes)
+			break;
+
 		res = cmtspeech_ul_buffer_acquire(ctx->cmtspeech, &ulbuf);
 		if (res != 0) {
 			fprintf(stderr, "don't have free upload buffer\n");
 			break;
 		}
+		ctx->ul_frame_bytes = ulbuf->pcount;
 
 		memset(ulbuf->payload, 0, ulbuf->pcount);
 		//printf("readbuf: %d bytes\n", ulbuf->pcount);
@@ -407,17 +710,24 @@ static void test_handle_cmtspeech_data_upload(struct test_ctx *ctx)
 			fprintf(stderr, "error reading from source (%d), error %s\n", ulbuf->pcount,
 				audio_strerror());
 		} else {
+			int rate = (cmtspeech_buffer_sample_rate(ulbuf) == CMTSPEECH_SAMPLE_RATE_16KHZ) ? 16000 : 8000;
+			s16 *out;
+
 			if (num != ulbuf->pcount)
 				fprintf(stderr, "could not fill incoming buffer\n");
+
+			ctx->ul_frame_flags = ulbuf->frame_flags;
+			ctx->ul_speech = 1;
+			num = chain_run(&ctx->ul_chain, (s16 *)ulbuf->payload, num / 2, rate, &out) * 2;
+			ulbuf->frame_flags = ctx->ul_frame_flags;
+			if (num > ulbuf->pcount)
+				num = ulbuf->pcount;
+			if (out != (s16 *)ulbuf->payload)
+				memcpy(ulbuf->payload, out, num);
 			ulbuf->pcount = num;
 		}
 		//printf("readbuf done: %d bytes\n", ulbuf->pcount);
 
-		error = write(ctx->source_cc, ulbuf->payload, num);
-		if (error < 0) {
-			printf("cc write failed: %m\n");
-		}
-
 		ctx->data_through += ulbuf->pcount;
       
 		res = cmtspeech_ul_buffer_release(ctx->cmtspeech, ulbuf);
@@ -463,16 +773,113 @@ static void test_handle_cmtspeech_data_upload(struct test_ctx *ctx)
 	}
 }
 
+/**
+ * Writes n samples of DL audio to the sink, after running them
+ * through the DL processing chain.
+ */
+static void test_write_dl(struct test_ctx *ctx, s16 *buf, int n, int rate)
+{
+	s16 *out;
+	int num;
+
+	ctx->dl_delay = audio_write_delay(ctx->sink);
+	n = chain_run(&ctx->dl_chain, buf, n, rate, &out);
+
+	num = audio_write(ctx->sink, out, n * 2);
+	if (num < 0) {
+		fprintf(stderr, "Error writing to sink, %d, error %s\n", n * 2, audio_strerror());
+	}
+}
+
+/**
+ * Copies the DL frame out of 'dlbuf' and releases the buffer. Frames
+ * missing before it (frame counter gap) are concealed and written to
+ * the sink first, and duplicate or late frames are dropped. The frame
+ * itself is concealed if the modem marked it bad (BFI), or if it was
+ * overwritten before release (xrun).
+ */
+static void test_play_dl_frame(struct test_ctx *ctx, cmtspeech_buffer_t *dlbuf)
+{
+	struct plc *plc = &ctx->plc;
+	unsigned int spc_flags = dlbuf->spc_flags;
+	int bytes = dlbuf->pcount;
+	int status = cmtspeech_buffer_frame_status(dlbuf);
+	int missing = cmtspeech_buffer_frames_missing(dlbuf);
+	int samples, rate, bad, res;
+
+	if (bytes > (int)sizeof(ctx->dl_frame))
+		bytes = sizeof(ctx->dl_frame);
+	samples = bytes / 2;
+	rate = (cmtspeech_buffer_sample_rate(dlbuf) == CMTSPEECH_SAMPLE_RATE_16KHZ) ? 16000 : 8000;
+
+	memcpy(ctx->dl_frame, dlbuf->payload, bytes);
+	jbuf_arrival(&ctx->jbuf, samples * 1000 / (rate / 1000));
+
+	res = cmtspeech_dl_buffer_release(ctx->cmtspeech, dlbuf);
+	bad = (spc_flags & CMTSPEECH_SPC_FLAGS_BFI) || res == -EPIPE;
+
+	if (status & (CMTSPEECH_FRAME_STATUS_DUPLICATE | CMTSPEECH_FRAME_STATUS_REORDERED)) {
+		INFO(fprintf(stderr, PREFIX "dropping %s DL frame\n",
+			     (status & CMTSPEECH_FRAME_STATUS_DUPLICATE) ? "duplicate" : "late"));
+		return;
+	}
+
+	if (missing > 0)
+		INFO(fprintf(stderr, PREFIX "%d DL frames %s\n", missing,
+			     (status & CMTSPEECH_FRAME_STATUS_XRUN) ? "dropped (xrun)" : "lost"));
+	if (missing > PLC_MAX_GAP)
+		missing = PLC_MAX_GAP;
+
+	while (missing-- > 0) {
+		s16 lost[PLC_MAX_FRAME];
+
+		plc_conceal(plc, lost, samples, rate);
+		test_write_dl(ctx, lost, samples, rate);
+	}
+
+	if (spc_flags & CMTSPEECH_SPC_FLAGS_MUTE)
+		memset(ctx->dl_frame, 0, bytes);
+
+	if (bad) {
+		DEBUG(fprintf(stderr, PREFIX "concealing DL frame (%s)\n",
+			      res == -EPIPE ? "xrun" : "bfi"));
+		plc_conceal(plc, ctx->dl_frame, samples, rate);
+	} else
+		plc_good(plc, ctx->dl_frame, samples, rate);
+
+	printf("Writing : %d bytes\n", bytes);
+	test_write_dl(ctx, ctx->dl_frame, samples, rate);
+
+	if (ctx->jbuf.frames % 250 == 0)
+		INFO(fprintf(stderr, PREFIX "DL jitter buffer: target %d ms, delay %d ms, %u expanded, %u compressed\n",
+			     ctx->jbuf.target_ms, ctx->jbuf.delay_ms,
+			     ctx->jbuf.expanded, ctx->jbuf.compressed));
+	if (ctx->jbuf.frames % 250 == 0 && ctx->aec.blocks)
+		INFO(fprintf(stderr, PREFIX "echo canceller: %u blocks, %u frozen, %u resyncs\n",
+			     ctx->aec.blocks, ctx->aec.frozen, ctx->aec.resyncs));
+	if (ctx->jbuf.frames % 250 == 0 && ctx->vad.frames)
+		INFO(fprintf(stderr, PREFIX "UL VAD: %u of %u frames speech\n",
+			     ctx->vad.speech_frames, ctx->vad.frames));
+	if (ctx->jbuf.frames % 250 == 0) {
+		INFO(chain_report(&ctx->ul_chain, stderr));
+		INFO(chain_report(&ctx->dl_chain, stderr));
+	}
+	if (ctx->jbuf.frames % 250 == 0 && ctx->dl_metrics.call.frames) {
+		char line[160];
+
+		metrics_format(&ctx->ul_metrics, PREFIX "UL", line, sizeof(line));
+		INFO(fputs(line, stderr));
+		metrics_format(&ctx->dl_metrics, PREFIX "DL", line, sizeof(line));
+		INFO(fputs(line, stderr));
+	}
+}
+
 static void test_handle_cmtspeech_data_download(struct test_ctx *ctx)
 {
-	cmtspeech_buffer_t *dlbuf, *ulbuf;
-	char scratch[10240];
-	int res, error, num;
+	cmtspeech_buffer_t *dlbuf;
+	int res;
 	int state = cmtspeech_protocol_state(ctx->cmtspeech);
-	int active_ul = (state == CMTSPEECH_STATE_ACTIVE_DLUL);
 	int active_dl = (state == CMTSPEECH_STATE_ACTIVE_DLUL) || (state == CMTSPEECH_STATE_ACTIVE_DL);
-	int loops;
-
 
 	if (!active_dl)
 	  return;
@@ -489,17 +896,8 @@ static void test_handle_cmtspeech_data_download(struct test_ctx *ctx)
 		fprintf(stderr, PREFIX "have packet but no sink?.\n");
 		exit(1);
 	}
-	int cnt = dlbuf->pcount;
-	printf("Writing : %d bytes\n", dlbuf->pcount);
-	num = audio_write(ctx->sink, dlbuf->payload, dlbuf->pcount);
-	if (write(ctx->sink_cc, dlbuf->payload, dlbuf->pcount) < 0) {
-		printf("error writing sink cc, %m\n");
-	}
-	if (num < 0) {
-		fprintf(stderr, "Error writing to sink, %d, error %s\n", dlbuf->pcount, audio_strerror());
-	}
+	test_play_dl_frame(ctx, dlbuf);
 	report_sound(ctx);	
-	res = cmtspeech_dl_buffer_release(ctx->cmtspeech, dlbuf);
 }
 
 static int test_handle_cmtspeech_control(struct test_ctx *ctx)
@@ -510,6 +908,12 @@ static int test_handle_cmtspeech_control(struct test_ctx *ctx)
   cmtspeech_read_event(ctx->cmtspeech, &cmtevent);
   DEBUG(fprintf(stderr, PREFIX "read cmtspeech event %d.\n", cmtevent.msg_type));
 
+  /* note: not a state transition */
+  if (cmtevent.msg_type == CMTSPEECH_EVENT_DTMF) {
+    INFO(printf(PREFIX "DTMF '%c' received\n", cmtevent.msg.dtmf.digit));
+    return 0;
+  }
+
   state_tr = cmtspeech_event_to_state_transition(ctx->cmtspeech, &cmtevent);
   DEBUG(fprintf(stderr, PREFIX "state transition %d.\n", state_tr));
 
@@ -525,6 +929,10 @@ static int test_handle_cmtspeech_control(struct test_ctx *ctx)
     case CMTSPEECH_TR_3_DL_START:
       /* Start audio playback here ? */
 	    ctx->dl_active = 1;
+	    metrics_init(&ctx->ul_metrics);
+	    metrics_init(&ctx->dl_metrics);
+	    ctx->quality_alarms = 0;
+	    wd_quality[0] = 0;
 	    start_sink(ctx);
 	    if (ctx->ul_active)
 		    start_source(ctx);
@@ -555,6 +963,10 @@ static int test_handle_cmtspeech_control(struct test_ctx *ctx)
 	    ctx->ul_active = 1;
 	    if (ctx->dl_active)
 		    start_source(ctx);
+	    inject_start(&ctx->inject);
+	    if (ctx->dtmf_digits &&
+		cmtspeech_send_dtmf(ctx->cmtspeech, ctx->dtmf_digits, 100, 100) != 0)
+		    fprintf(stderr, PREFIX "WARNING: unable to send DTMF '%s'\n", ctx->dtmf_digits);
 	    break;
       /* Start audio record? */
       /* no-op */
@@ -570,7 +982,8 @@ static int test_mainloop(struct test_ctx *ctx)
 {
   const int cmt = 0;
   const int dbus = 1;
-  struct pollfd fds[2];
+  const int audio = 2;
+  struct pollfd fds[3];
   int res = 0;
   int first = 1;
 
@@ -579,7 +992,7 @@ static int test_mainloop(struct test_ctx *ctx)
   assert(fds[cmt].fd >= 0);
 
   while(!global_exit_request) {
-    int count = 1, pollres;
+    int count = 1, pollres, audio_fd = -1;
 
     if (ctx->dbus_fd >= 0) {
       fds[dbus].fd = ctx->dbus_fd;
@@ -587,8 +1000,22 @@ static int test_mainloop(struct test_ctx *ctx)
       fds[dbus].events = POLLIN;
       count = 2;
     }
+    else {
+      fds[dbus].fd = -1;
+      fds[dbus].revents = 0;
+    }
 
-    if (!ctx->source)
+    /* Sources that expose a descriptor are polled, others are busy-looped. */
+    if (ctx->source)
+	    audio_fd = audio_poll_fd(ctx->source);
+    fds[audio].revents = 0;
+    if (audio_fd >= 0) {
+	    fds[audio].fd = audio_fd;
+	    fds[audio].events = POLLIN;
+	    count = 3;
+    }
+
+    if (!ctx->source || audio_fd >= 0)
 	    pollres = poll(fds, count, -1);
     else
 	    pollres = 1;
@@ -596,7 +1023,7 @@ static int test_mainloop(struct test_ctx *ctx)
     DEBUG(fprintf(stderr, "poll returned %d (count:%d, cmt:%02X, dbus:%02X)\n",
 		 pollres, count, fds[cmt].revents, fds[dbus].revents));
 
-    if (ctx->source)
+    if (ctx->source && (audio_fd < 0 || fds[audio].revents))
 	    test_handle_cmtspeech_data_upload(ctx);
     
     if (pollres > 0) {
@@ -656,6 +1083,7 @@ int main(int argc, char *argv[])
   DBusBusType dbus_type = DBUS_BUS_SYSTEM;
   static struct test_ctx ctx0;
   struct test_ctx *ctx = &ctx0;
+  pthread_t noise_thread;
   int res = 0;
 
   fprintf(stderr, "NFS sucks, version 0.0.1\n");
@@ -670,8 +1098,22 @@ int main(int argc, char *argv[])
   ctx->data_through = 0;
   ctx->source_cc = -1;
   ctx->sink_cc = -1;
+  ctx->ul_frame_bytes = 0;
   ctx->ul_active = 0;
   ctx->dl_active = 0;
+  plc_init(&ctx->plc);
+  jbuf_init(&ctx->jbuf);
+  aec_init(&ctx->aec);
+  vad_init(&ctx->vad);
+  metrics_init(&ctx->ul_metrics);
+  metrics_init(&ctx->dl_metrics);
+  ns_init(&ctx->ns);
+  inject_init(&ctx->inject);
+  mixer_init(&ctx->mixer);
+  audio_gain_init(&ctx->ul_gain, 1);
+  audio_gain_init(&ctx->dl_gain, 0);
+  test_setup_chain(ctx, 0, TEST_UL_CHAIN_DEFAULT);
+  test_setup_chain(ctx, 1, TEST_DL_CHAIN_DEFAULT);
 
   audio_init(ctx);
 
@@ -702,11 +1144,27 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  if (ctx->dtmf_detect &&
+      cmtspeech_set_dtmf_detection(ctx->cmtspeech, true) != 0)
+    fprintf(stderr, "WARNING: DTMF detection not supported\n");
+
+  if (ctx->noise_gain &&
+      pthread_create(&noise_thread, NULL, test_noise_thread, ctx) != 0) {
+    fprintf(stderr, "WARNING: unable to start comfort noise\n");
+    ctx->noise_gain = 0;
+  }
+
   INFO(fprintf(stderr, PREFIX "Setup succesful, entering mainloop.\n"));
 
   res = test_mainloop(ctx);
 
+  if (ctx->noise_gain) {
+    global_exit_request = 1;
+    pthread_join(noise_thread, NULL);
+  }
+
   cmtspeech_close(ctx->cmtspeech);
+  inject_close(&ctx->inject);
   test_dbus_release(ctx);
 
   INFO(fprintf(stderr, PREFIX "Completed, exiting (%d).\n", res));
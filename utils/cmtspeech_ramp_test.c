@@ -23,9 +23,26 @@
 
 /** @file cmtspeech_ramp_test.c
  *
- * Tool that opens a libcmtspeechdata instance, performs
- * a loop of tests with the TEST_RAMP_PING interface, and
- * closes the instance.
+ * Tool that measures the round-trip latency of the modem
+ * data path with the TEST_RAMP_PING interface.
+ *
+ * Each ping sends a TEST_RAMP_PING request, waits for the
+ * ramp frame to arrive on DL, checks that its payload is the
+ * requested ramp, and records the time from the request to
+ * the reception of the frame. The reception time is taken
+ * from the DL_DATA_RECEIVED record of the binary trace ring,
+ * i.e. when the library handled the driver's notification;
+ * if the ring is not available, the time the frame was
+ * acquired is used instead.
+ *
+ * The driver timestamp in the mmap area (tstamp_rx_ctrl,
+ * see kernel-headers/linux/cs-protocol.h) cannot be used.
+ * It is only taken when a control message is received, and
+ * the ramp reply arrives as a data frame. The driver has no
+ * timestamp for received data frames.
+ *
+ * The result is printed as a latency histogram with
+ * percentiles, as text or as JSON (-j).
  */
 
 /**
@@ -33,11 +50,54 @@
  *  - <none>
  */
 
-#include <stdio.h>
+#include <errno.h>
+#include <getopt.h>
 #include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <cmtspeech.h>
 
+#define PREFIX "cmtspeech_ramp_test: "
+
+#define RAMP_HIST_BUCKETS   100   /* 1 ms each, the last one is open */
+#define RAMP_TRACE_RECORDS  16
+
+struct ramp_ctx {
+  cmtspeech_t *cmtspeech;
+  int pings;                /**< pings to send */
+  int ramplen;              /**< ramp length in 32bit words */
+  int interval_ms;          /**< delay between pings */
+  int timeout_ms;           /**< wait for a reply before giving up */
+  int json;
+  int verbose;
+
+  unsigned int *latency_us; /**< one per reply */
+  int replies;
+  int timeouts;
+  int corrupt;              /**< replies with a wrong payload */
+  unsigned int hist[RAMP_HIST_BUCKETS];
+};
+
+static volatile sig_atomic_t global_exit_request = 0;
+
+static void priv_signal_handler(int signr)
+{
+  (void)signr;
+  global_exit_request = 1;
+}
+
+static uint64_t priv_now_ns(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
 static void priv_dump_ramp_frame(uint8_t *slotbuf, unsigned int slot_size)
 {
   unsigned int i;
@@ -53,66 +113,330 @@ static void priv_dump_ramp_frame(uint8_t *slotbuf, unsigned int slot_size)
     }
   if ((i + 4) % 16 != 4)
     printf("\n");
-}    
+}
+
+/**
+ * Returns the number of octets in 'payload' that differ from
+ * a ramp starting at 'rampstart'.
+ *
+ * note: written as a single counting loop without early exit,
+ *       so that the compiler vectorizes the compare
+ */
+static int priv_ramp_errors(const uint8_t *payload, int len, uint8_t rampstart)
+{
+  int i, errors = 0;
 
-int main(int argc, char *argv[]) {
+  for(i = 0; i < len; i++)
+    errors += payload[i] != (uint8_t)(rampstart + i);
+
+  return errors;
+}
+
+/**
+ * Drains the binary trace ring. Returns the timestamp of the
+ * last DL_DATA_RECEIVED record, or 0 if there was none.
+ */
+static uint64_t priv_drain_trace_ring(cmtspeech_t *cmtspeech)
+{
+  cmtspeech_trace_record_t rec[RAMP_TRACE_RECORDS];
+  uint64_t tstamp = 0;
+  int n, i;
+
+  while ((n = cmtspeech_trace_ring_read(cmtspeech, rec, RAMP_TRACE_RECORDS)) > 0) {
+    for(i = 0; i < n; i++)
+      if (rec[i].id == CMTSPEECH_TRACEPOINT_DL_DATA_RECEIVED)
+	tstamp = rec[i].tstamp_ns;
+    if (n < RAMP_TRACE_RECORDS)
+      break;
+  }
+
+  return tstamp;
+}
+
+/**
+ * Sends one ramp ping and waits for the reply. Returns 0
+ * when a reply was received, 1 on timeout and a negative
+ * value on errors.
+ */
+static int priv_ping(struct ramp_ctx *ctx, uint8_t rampstart)
+{
   struct pollfd fds[1];
-  cmtspeech_t *cmtspeech;
-  int res = 0, i, fd;
-  int pollres, test_msgs = 0;
-  const int send_test_msgs = 3;
-  const uint8_t test_frame_size = 81;
-  
-  cmtspeech_init();
+  uint64_t sent_ns, deadline_ns;
+  int res;
+
+  priv_drain_trace_ring(ctx->cmtspeech);
 
-  cmtspeech = cmtspeech_open();
-  if (!cmtspeech) {
-    fprintf(stderr, "ERROR: unable to open libcmtspeechdata instance\n");
+  sent_ns = priv_now_ns();
+  res = cmtspeech_test_data_ramp_req(ctx->cmtspeech, rampstart, ctx->ramplen);
+  if (res != 0) {
+    fprintf(stderr, PREFIX "ERROR: unable to send TEST_RAMP_PING (%d)\n", res);
     return -1;
   }
+  deadline_ns = sent_ns + ctx->timeout_ms * 1000000ULL;
 
-  fd = cmtspeech_descriptor(cmtspeech);
-  if (fd < 0) {
-    fprintf(stderr, "ERROR: invalid libcmtspeechdata descriptor.\n");
-    return -2;
-  }
-    
-  for (i = 0;; i++) {
-    if (cmtspeech_protocol_state(cmtspeech) == CMTSPEECH_STATE_DISCONNECTED) {
-      if (++test_msgs == send_test_msgs)
-	break;
+  fds[0].fd = cmtspeech_descriptor(ctx->cmtspeech);
+  fds[0].events = POLLIN;
+
+  while (!global_exit_request) {
+    int64_t left_ms = ((int64_t)(deadline_ns - priv_now_ns())) / 1000000;
+    int flags = 0;
+
+    if (left_ms <= 0)
+      return 1;
+
+    res = poll(fds, 1, left_ms);
+    if (res < 0 && errno != EINTR)
+      return -1;
+    if (res <= 0)
+      continue;
 
-      cmtspeech_test_data_ramp_req(cmtspeech, 0xaa /*(uint8_t)i*/, test_frame_size);
+    res = cmtspeech_check_pending(ctx->cmtspeech, &flags);
+    if (res <= 0)
+      continue;
+
+    if (flags & CMTSPEECH_EVENT_CONTROL) {
+      cmtspeech_event_t event;
+      cmtspeech_read_event(ctx->cmtspeech, &event);
+      if (ctx->verbose)
+	fprintf(stderr, PREFIX "read event %d.\n", event.msg_type);
     }
 
-    fds[0].fd = fd;
-    pollres = poll(fds, 1, 20);
-    printf("poll returned %d (iter %d).\n", pollres, i);
-    if (pollres == 1) {
-      int flags = 0, res =
-	cmtspeech_check_pending(cmtspeech, &flags);      
-      if (res > 0) {
-	if (flags & CMTSPEECH_EVENT_DL_DATA) {
-	  cmtspeech_buffer_t *buf;
-	  res = cmtspeech_dl_buffer_acquire(cmtspeech, &buf);
-	  if (res == 0) {
-	    printf("Received a test ramp packet (%u bytes). Dumping its contents.", buf->count);
-	    priv_dump_ramp_frame(buf->data, buf->count);
-	    res = cmtspeech_dl_buffer_release(cmtspeech, buf);
-	  }
-	}
-	if (flags & CMTSPEECH_EVENT_CONTROL) {
-	  cmtspeech_event_t event;
-	  cmtspeech_read_event(cmtspeech, &event);
-	  printf("read event %d.\n", event.msg_type);
+    if (flags & CMTSPEECH_EVENT_DL_DATA) {
+      cmtspeech_buffer_t *buf;
+      uint64_t rx_ns;
+      unsigned int us;
+
+      res = cmtspeech_dl_buffer_acquire(ctx->cmtspeech, &buf);
+      if (res != 0)
+	continue;
+
+      rx_ns = priv_drain_trace_ring(ctx->cmtspeech);
+      if (rx_ns < sent_ns)
+	rx_ns = priv_now_ns();
+      us = (rx_ns - sent_ns) / 1000;
+
+      if (buf->pcount != ctx->ramplen * 4 ||
+	  priv_ramp_errors(buf->payload, buf->pcount, rampstart) != 0) {
+	if (ctx->corrupt++ == 0 && ctx->verbose) {
+	  printf("Corrupt test ramp packet (%u bytes). Dumping its contents.\n", buf->count);
+	  priv_dump_ramp_frame(buf->data, buf->count);
 	}
       }
+
+      ctx->latency_us[ctx->replies++] = us;
+      ctx->hist[us / 1000 < RAMP_HIST_BUCKETS ? us / 1000 : RAMP_HIST_BUCKETS - 1]++;
+
+      cmtspeech_dl_buffer_release(ctx->cmtspeech, buf);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+static int priv_cmp_uint(const void *a, const void *b)
+{
+  unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* note: 'sorted' must be sorted and hold n > 0 values */
+static unsigned int priv_percentile(const unsigned int *sorted, int n, int pct)
+{
+  return sorted[(n - 1) * pct / 100];
+}
+
+static void priv_report(struct ramp_ctx *ctx)
+{
+  static const int pcts[] = { 50, 90, 95, 99 };
+  const int npcts = sizeof(pcts) / sizeof(pcts[0]);
+  unsigned long long total = 0;
+  unsigned int *l = ctx->latency_us;
+  int n = ctx->replies, i, first;
+
+  qsort(l, n, sizeof(*l), priv_cmp_uint);
+  for(i = 0; i < n; i++)
+    total += l[i];
+
+  if (ctx->json) {
+    printf("{\"ramplen\": %d, \"pings\": %d, \"replies\": %d, \"timeouts\": %d, \"corrupt\": %d",
+	   ctx->ramplen, ctx->replies + ctx->timeouts, n, ctx->timeouts, ctx->corrupt);
+    if (n > 0) {
+      printf(", \"min_us\": %u, \"max_us\": %u, \"mean_us\": %llu",
+	     l[0], l[n - 1], total / n);
+      for(i = 0; i < npcts; i++)
+	printf(", \"p%d_us\": %u", pcts[i], priv_percentile(l, n, pcts[i]));
+    }
+    printf(", \"histogram_ms\": {");
+    for(i = 0, first = 1; i < RAMP_HIST_BUCKETS; i++) {
+      if (!ctx->hist[i])
+	continue;
+      printf("%s\"%d\": %u", first ? "" : ", ", i, ctx->hist[i]);
+      first = 0;
+    }
+    printf("}}\n");
+    return;
+  }
+
+  printf("%d pings, %d replies, %d timeouts, %d corrupt (ramp of %d words)\n",
+	 ctx->replies + ctx->timeouts, n, ctx->timeouts, ctx->corrupt, ctx->ramplen);
+  if (n == 0)
+    return;
+
+  printf("latency: min %.2f ms, mean %.2f ms, max %.2f ms\n",
+	 l[0] / 1000.0, total / n / 1000.0, l[n - 1] / 1000.0);
+  for(i = 0; i < npcts; i++)
+    printf("%sp%d %.2f ms", i ? ", " : "", pcts[i], priv_percentile(l, n, pcts[i]) / 1000.0);
+  printf("\n\n");
+
+  for(i = 0; i < RAMP_HIST_BUCKETS; i++) {
+    int bar, j;
+
+    if (!ctx->hist[i])
+      continue;
+    bar = (ctx->hist[i] * 60 + n - 1) / n;
+    printf("%3d%s ms %7u ", i, i == RAMP_HIST_BUCKETS - 1 ? "+" : " ", ctx->hist[i]);
+    for(j = 0; j < bar; j++)
+      putchar('#');
+    putchar('\n');
+  }
+}
+
+static struct option const opt_tbl[] =
+  {
+    {"verbose",         0, NULL, 'v'},
+    {"help",            0, NULL, 'h'},
+    {"count",           1, NULL, 'c'},
+    {"length",          1, NULL, 'l'},
+    {"interval",        1, NULL, 'i'},
+    {"timeout",         1, NULL, 't'},
+    {"json",            0, NULL, 'j'},
+    {NULL,              0, NULL, 0}
+  };
+
+static void priv_usage(char *name)
+{
+  fprintf(stderr, "usage: %s [options]\n", name);
+  fprintf(stderr, "\noptions:\n\t[-v|--verbose] [-h|--help] [-j|--json]\n");
+  fprintf(stderr, "\t[-c|--count pings] (default: 100)\n");
+  fprintf(stderr, "\t[-l|--length words] (ramp length in 32bit words, 1-255, default: 81)\n");
+  fprintf(stderr, "\t[-i|--interval ms] (delay between pings, default: 20)\n");
+  fprintf(stderr, "\t[-t|--timeout ms] (wait for each reply, default: 1000)\n");
+  exit(1);
+}
+
+static void priv_parse_options(struct ramp_ctx *ctx, int argc, char *argv[])
+{
+  int opt_index;
+  int res;
+
+  while (res = getopt_long(argc, argv, "vhc:l:i:t:j", opt_tbl, &opt_index), res != -1) {
+    switch (res)
+      {
+      case 'v':
+	++ctx->verbose;
+	break;
+
+      case 'c':
+	ctx->pings = atoi(optarg);
+	break;
+
+      case 'l':
+	ctx->ramplen = atoi(optarg);
+	break;
+
+      case 'i':
+	ctx->interval_ms = atoi(optarg);
+	break;
+
+      case 't':
+	ctx->timeout_ms = atoi(optarg);
+	break;
+
+      case 'j':
+	ctx->json = 1;
+	break;
+
+      case 'h':
+      default:
+	priv_usage(argv[0]);
+	break;
+      }
+  }
+
+  if (ctx->pings <= 0 || ctx->ramplen < 1 || ctx->ramplen > 255 ||
+      ctx->interval_ms < 0 || ctx->timeout_ms <= 0)
+    priv_usage(argv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+  static struct ramp_ctx ctx0;
+  struct ramp_ctx *ctx = &ctx0;
+  int res = 0, i;
+
+  ctx->pings = 100;
+  ctx->ramplen = 81;
+  ctx->interval_ms = 20;
+  ctx->timeout_ms = 1000;
+  priv_parse_options(ctx, argc, argv);
+
+  ctx->latency_us = calloc(ctx->pings, sizeof(*ctx->latency_us));
+  if (!ctx->latency_us) {
+    fprintf(stderr, PREFIX "ERROR: out of memory\n");
+    return -1;
+  }
+
+  signal(SIGINT, priv_signal_handler);
+  signal(SIGTERM, priv_signal_handler);
+
+  cmtspeech_init();
+
+  ctx->cmtspeech = cmtspeech_open();
+  if (!ctx->cmtspeech) {
+    fprintf(stderr, PREFIX "ERROR: unable to open libcmtspeechdata instance\n");
+    return -1;
+  }
+
+  if (cmtspeech_descriptor(ctx->cmtspeech) < 0) {
+    fprintf(stderr, PREFIX "ERROR: invalid libcmtspeechdata descriptor.\n");
+    return -2;
+  }
+
+  /* note: DL_DATA_RECEIVED records give the reception time */
+  cmtspeech_context_trace_toggle(ctx->cmtspeech, CMTSPEECH_TRACE_BINARY, true);
+
+  for (i = 0; i < ctx->pings && !global_exit_request; i++) {
+    if (cmtspeech_protocol_state(ctx->cmtspeech) != CMTSPEECH_STATE_DISCONNECTED) {
+      fprintf(stderr, PREFIX "ERROR: modem not idle (state %d), stopping.\n",
+	      cmtspeech_protocol_state(ctx->cmtspeech));
+      res = -1;
+      break;
     }
-    else if (pollres < 0)
+
+    /* note: a different ramp for each ping, so that a late
+     *       reply to an earlier ping is caught as corrupt */
+    res = priv_ping(ctx, (uint8_t)i);
+    if (res < 0)
+      break;
+    if (res > 0) {
+      ++ctx->timeouts;
+      fprintf(stderr, PREFIX "ping %d timed out\n", i);
+      /* note: the library stays in TEST_RAMP_PING_ACTIVE until
+       *       a reply arrives, so no further pings can be sent */
       break;
+    }
+    res = 0;
+
+    if (ctx->interval_ms)
+      poll(NULL, 0, ctx->interval_ms);
   }
 
-  cmtspeech_close(cmtspeech);
+  priv_report(ctx);
+
+  cmtspeech_close(ctx->cmtspeech);
+  free(ctx->latency_us);
 
   return res;
 }
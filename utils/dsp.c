@@ -10,25 +10,153 @@
 #include <sys/ioctl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #include "utils/audio.h"
 
 #define DRIVER_NAME "dsp"
 
+/*
+ * The device is used in non-blocking mode. Fragments are sized to
+ * (at most) one 20ms modem frame, and the playback queue is kept
+ * at DSP_DEFAULT_FRAGMENTS fragments unless overridden with the
+ * CMT_DSP_FRAGMENTS environment variable. Anything written beyond
+ * the queue limit is dropped instead of adding latency, and counted
+ * in dsp_dropped.
+ */
+#define DSP_FRAME_MSEC		20
+#define DSP_DEFAULT_FRAGMENTS	3
+#define DSP_MAX_FRAGMENTS	32
+
+static int dsp_period_msec = DSP_FRAME_MSEC;
+static int dsp_fragments;	/* 0: DSP_DEFAULT_FRAGMENTS or environment */
+static int dsp_frag_bytes;
+static int dsp_max_queued;
+static int dsp_dropped;		/* playback bytes dropped */
+static int dsp_speed;
+static char dsp_rbuf[4 * SSIZE];	/* captured, not yet read */
+static int dsp_rfill;
+
+/*
+ * Captured data is drained from the device into dsp_rbuf whenever
+ * the application looks at the source, so that a partial frame does
+ * not keep the descriptor readable (and poll() returning) until the
+ * rest of the frame arrives.
+ */
+static void dsp_drain(int fd)
+{
+	audio_buf_info info;
+	ssize_t res;
+	int room = sizeof(dsp_rbuf) - dsp_rfill;
+
+	if (ioctl(fd, SNDCTL_DSP_GETISPACE, &info) == -1 || info.bytes <= 0)
+		return;
+	if (info.bytes < room)
+		room = info.bytes;
+	if (room <= 0)
+		return;
+
+	res = read(fd, dsp_rbuf + dsp_rfill, room);
+	if (res > 0)
+		dsp_rfill += res;
+}
+
 ssize_t audio_read_raw(int fd, void *buf, size_t count)
 {
-	ssize_t res = read(fd, buf, count);
-	return res;
+	/* Only return what is already there, never wait for the rest. */
+	dsp_drain(fd);
+
+	if (!dsp_rfill) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if ((size_t)dsp_rfill < count)
+		count = dsp_rfill;
+	memcpy(buf, dsp_rbuf, count);
+	dsp_rfill -= count;
+	memmove(dsp_rbuf, dsp_rbuf + count, dsp_rfill);
+	return count;
 }
 
+/*
+ * Returns the number of bytes written, which is less than 'count'
+ * when the tail did not fit the playback queue and was dropped.
+ */
 ssize_t audio_write_raw(int fd, void *buf, size_t count)
 {
+	audio_buf_info info;
+	size_t room = count;
+	int queued;
 	ssize_t res;
-	res = write(fd, buf, count);
+
+	if (ioctl(fd, SNDCTL_DSP_GETODELAY, &queued) == 0) {
+		if (queued >= dsp_max_queued)
+			room = 0;
+		else if ((size_t)(dsp_max_queued - queued) < room)
+			room = dsp_max_queued - queued;
+	}
+
+	if (ioctl(fd, SNDCTL_DSP_GETOSPACE, &info) == 0 &&
+	    (size_t)info.bytes < room)
+		room = info.bytes;
+
+	if (!room) {
+		dsp_dropped += count;
+		return 0;
+	}
+
+	res = write(fd, buf, room);
+	if (res < 0 && errno == EAGAIN)
+		res = 0;
+	if (res < 0)
+		return res;
+
+	dsp_dropped += count - res;
 	return res;
 }
 
+static AUDIO_MAYBE_UNUSED int audio_poll_fd(int fd)
+{
+	return fd;
+}
+
+static AUDIO_MAYBE_UNUSED int audio_read_avail(int fd)
+{
+	dsp_drain(fd);
+	return dsp_rfill;
+}
+
+/* Returns the playback queue length in microseconds, or -1. */
+static long audio_write_delay(int fd)
+{
+	int queued;
+
+	if (!dsp_speed || ioctl(fd, SNDCTL_DSP_GETODELAY, &queued) == -1)
+		return -1;
+
+	/* 16bit stereo */
+	return (long long)queued * 1000000 / (dsp_speed * 4);
+}
+
+/*
+ * Returns the fragment size selector for SNDCTL_DSP_SETFRAGMENT:
+ * largest power of two not exceeding one period (by default one
+ * modem frame).
+ */
+static int dsp_frag_shift(int speed)
+{
+	/* 16bit stereo */
+	int frame = speed * 4 * dsp_period_msec / 1000;
+	int shift = 4;
+
+	while ((2 << shift) <= frame)
+		shift++;
+
+	return shift;
+}
+
 #define DEVICE_NAME "/dev/dsp"
 
 int audio_open(int speed)
@@ -36,7 +164,7 @@ int audio_open(int speed)
 	int audio_fd;
 
 	printf("Opening %s, speed %d\n", DEVICE_NAME, speed);
-	if ((audio_fd = open(DEVICE_NAME, O_RDWR, 0)) == -1) { /* Opening device failed */  
+	if ((audio_fd = open(DEVICE_NAME, O_RDWR | O_NONBLOCK, 0)) == -1) { /* Opening device failed */  
 		perror(DEVICE_NAME);  
 		exit(1);  
 	} 
@@ -66,8 +194,20 @@ int audio_open(int speed)
 	}
 
 	{
-		//    unsigned int frag = 0x7fff000a;/* Unlimited number of 1k fragments */
-		unsigned int frag = 0x7fff000c;
+		int frags = DSP_DEFAULT_FRAGMENTS;
+		char *env = getenv("CMT_DSP_FRAGMENTS");
+		unsigned int frag;
+
+		if (dsp_fragments)
+			frags = dsp_fragments;
+		else if (env)
+			frags = atoi(env);
+		if (frags < 2)
+			frags = 2;
+		if (frags > DSP_MAX_FRAGMENTS)
+			frags = DSP_MAX_FRAGMENTS;
+
+		frag = (frags << 16) | dsp_frag_shift(speed);
 
 		if (ioctl (audio_fd, SNDCTL_DSP_SETFRAGMENT, &frag) == -1) {
 			perror ("SNDCTL_DSP_SETFRAGMENT");
@@ -131,6 +271,20 @@ int audio_open(int speed)
 			printf("The device doesn't support the requested speed.\n");
 		}
 		printf("The sample rate is %d\n", speed);
+		dsp_speed = speed;
+	}
+
+	{
+		audio_buf_info info;
+
+		if (ioctl(audio_fd, SNDCTL_DSP_GETOSPACE, &info) == -1) {
+			perror("SNDCTL_DSP_GETOSPACE");
+			exit(5);
+		}
+
+		dsp_frag_bytes = info.fragsize;
+		dsp_max_queued = info.fragstotal * info.fragsize;
+		printf("Fragments: %d x %d bytes\n", info.fragstotal, info.fragsize);
 	}
 
 	return audio_fd;
@@ -139,7 +293,9 @@ int audio_open(int speed)
 static void start_source(struct test_ctx *ctx)
 {
 	static char silence[SSIZE];
-	audio_write(ctx->sink, silence, SSIZE);
+
+	/* Prime the playback queue with one fragment of silence. */
+	audio_write(ctx->sink, silence, dsp_frag_bytes);
 }
 
 static void start_sink(struct test_ctx *ctx)
@@ -154,12 +310,25 @@ static void stop_sink(struct test_ctx *ctx)
 {
 }
 
+/*
+ * Sets the fragment layout used by the next audio_init(). Fragment
+ * sizes are rounded down to a power of two.
+ */
+int audio_set_buffer(int period_ms, int periods)
+{
+	if (period_ms <= 0 || periods < 2 || periods > DSP_MAX_FRAGMENTS)
+		return -1;
+	dsp_period_msec = period_ms;
+	dsp_fragments = periods;
+	return 0;
+}
+
 void audio_init(struct test_ctx *ctx)
 {
 	ctx->source = ctx->sink = audio_open(4000);
 }
 
-static const char *audio_strerror(void)
+static AUDIO_MAYBE_UNUSED const char *audio_strerror(void)
 {
 	return strerror(errno);
 }
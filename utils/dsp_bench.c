@@ -0,0 +1,148 @@
+/* -*- c-file-style: "linux" -*- */
+
+/*
+ * CPU cost of the speech processing stages.
+ *
+ * Runs each stage over a few minutes of synthetic speech-band
+ * signal plus noise at 8 and 16 kHz, and prints one line per stage
+ * and rate:
+ *
+ *   <stage> <rate> <microseconds per 20 ms frame>
+ *
+ * Build with the flags used for the real tool, e.g.
+ * "make dsp_bench CFLAGS_BENCH='-O3 -fno-trapping-math -mfpu=neon'".
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+typedef int16_t s16;
+
+#include "kernels.c"
+#include "plc.c"
+#include "fft.c"
+#include "aec.c"
+#include "ns.c"
+#include "vad.c"
+#include "mixer.c"
+#include "metrics.c"
+
+#define BENCH_FRAMES		10000	/* 200 s of audio */
+#define BENCH_SIGNAL_FRAMES	50
+
+#if defined(__aarch64__)
+#define BENCH_ARCH "aarch64"
+#elif defined(__arm__)
+#define BENCH_ARCH "arm"
+#elif defined(__x86_64__)
+#define BENCH_ARCH "x86_64"
+#elif defined(__i386__)
+#define BENCH_ARCH "i386"
+#else
+#define BENCH_ARCH "unknown"
+#endif
+
+static struct aec aec;
+static struct ns ns;
+static struct vad vad;
+static struct mixer mixer;
+static struct metrics metrics;
+
+static s16 signal_buf[BENCH_SIGNAL_FRAMES * PLC_MAX_FRAME];
+static s16 frame[PLC_MAX_FRAME];
+
+static double now_usec(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static void make_signal(int rate)
+{
+	int i, n = BENCH_SIGNAL_FRAMES * rate / 50;
+
+	srand(1);
+	for (i = 0; i < n; i++) {
+		double env = fabs(sin(2 * M_PI * 3 * i / rate));
+
+		signal_buf[i] = env * 4000 * sin(2 * M_PI * 200 * i / rate) +
+			rand() % 601 - 300;
+	}
+}
+
+static const s16 *next_frame(int f, int n)
+{
+	memcpy(frame, signal_buf + (f % BENCH_SIGNAL_FRAMES) * n,
+	       n * sizeof(s16));
+	return frame;
+}
+
+static void bench(int rate)
+{
+	int n = rate / 50, f;
+	double t;
+
+	make_signal(rate);
+
+	ns_init(&ns);
+	t = now_usec();
+	for (f = 0; f < BENCH_FRAMES; f++) {
+		next_frame(f, n);
+		ns_process(&ns, frame, n, rate, 1);
+	}
+	printf("ns %d %.2f\n", rate, (now_usec() - t) / BENCH_FRAMES);
+
+	aec_init(&aec);
+	t = now_usec();
+	for (f = 0; f < BENCH_FRAMES; f++) {
+		int i;
+
+		aec_playback(&aec, next_frame(f, n), n, rate, 40000);
+		/* echo only, so that the filter keeps adapting */
+		for (i = 0; i < n; i++)
+			frame[i] >>= 2;
+		aec_capture(&aec, frame, n, rate, 1);
+	}
+	printf("aec %d %.2f\n", rate, (now_usec() - t) / BENCH_FRAMES);
+
+	vad_init(&vad);
+	t = now_usec();
+	for (f = 0; f < BENCH_FRAMES; f++)
+		vad_process(&vad, next_frame(f, n), n);
+	printf("vad %d %.2f\n", rate, (now_usec() - t) / BENCH_FRAMES);
+
+	/* four sources, refilled from the same thread */
+	mixer_init(&mixer);
+	for (f = 0; f < 4; f++)
+		mixer_set_gain(mixer_add(&mixer, "bench"), 16384);
+	t = now_usec();
+	for (f = 0; f < BENCH_FRAMES; f++) {
+		int i;
+
+		for (i = 0; i < 4; i++)
+			mixer_write(&mixer.src[i], signal_buf, n);
+		next_frame(f, n);
+		mixer_process(&mixer, frame, n, rate);
+	}
+	printf("mix4 %d %.2f\n", rate, (now_usec() - t) / BENCH_FRAMES);
+
+	metrics_init(&metrics);
+	t = now_usec();
+	for (f = 0; f < BENCH_FRAMES; f++)
+		metrics_process(&metrics, next_frame(f, n), n, rate);
+	printf("metrics %d %.2f\n", rate, (now_usec() - t) / BENCH_FRAMES);
+}
+
+int main(void)
+{
+	printf("# arch %s, us per 20 ms frame\n", BENCH_ARCH);
+	bench(8000);
+	bench(16000);
+	return 0;
+}
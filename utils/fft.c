@@ -0,0 +1,103 @@
+/* -*- c-file-style: "linux" -*- */
+
+/*
+ * In-place radix-2 complex FFT for the frequency-domain speech
+ * processing stages.
+ *
+ * Twiddle factors and the bit-reversal permutation are computed
+ * once in fft_init(), so the transforms do no allocation and no
+ * trigonometry. Real signals are transformed by passing them with
+ * a zero imaginary part.
+ */
+
+#include <math.h>
+
+#define FFT_MAX		512
+
+typedef struct {
+	float re, im;
+} cpx;
+
+struct fft {
+	int n;
+	cpx tw[FFT_MAX / 2];
+	unsigned short rev[FFT_MAX];
+};
+
+/* Prepares an n-point transform. Returns -1 if n is not supported. */
+int fft_init(struct fft *f, int n)
+{
+	int i, j, bits = 0;
+
+	if (n < 2 || n > FFT_MAX || (n & (n - 1)))
+		return -1;
+
+	while ((1 << bits) < n)
+		bits++;
+
+	f->n = n;
+	for (i = 0; i < n / 2; i++) {
+		f->tw[i].re = cos(2 * M_PI * i / n);
+		f->tw[i].im = -sin(2 * M_PI * i / n);
+	}
+	for (i = 0; i < n; i++) {
+		int r = 0;
+
+		for (j = 0; j < bits; j++)
+			if (i & (1 << j))
+				r |= 1 << (bits - 1 - j);
+		f->rev[i] = r;
+	}
+
+	return 0;
+}
+
+void fft_forward(const struct fft *f, cpx *x)
+{
+	int n = f->n;
+	int i, len;
+
+	for (i = 0; i < n; i++) {
+		int r = f->rev[i];
+
+		if (r > i) {
+			cpx t = x[i];
+			x[i] = x[r];
+			x[r] = t;
+		}
+	}
+
+	for (len = 2; len <= n; len <<= 1) {
+		int half = len / 2, step = n / len;
+		int k, j;
+
+		for (k = 0; k < n; k += len) {
+			for (j = 0; j < half; j++) {
+				cpx w = f->tw[j * step];
+				cpx *a = &x[k + j], *b = &x[k + j + half];
+				float tr = b->re * w.re - b->im * w.im;
+				float ti = b->re * w.im + b->im * w.re;
+
+				b->re = a->re - tr;
+				b->im = a->im - ti;
+				a->re += tr;
+				a->im += ti;
+			}
+		}
+	}
+}
+
+/* Inverse transform, scaled by 1/n. */
+void fft_inverse(const struct fft *f, cpx *x)
+{
+	float scale = 1.0f / f->n;
+	int i;
+
+	for (i = 0; i < f->n; i++)
+		x[i].im = -x[i].im;
+	fft_forward(f, x);
+	for (i = 0; i < f->n; i++) {
+		x[i].re *= scale;
+		x[i].im *= -scale;
+	}
+}
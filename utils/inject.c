@@ -0,0 +1,228 @@
+/* -*- c-file-style: "linux" -*- */
+
+/*
+ * Announcement injector for the UL path.
+ *
+ * A prompt file is mapped into memory when it is opened, with all
+ * pages read in up front (MAP_POPULATE), so mixing it into UL frames
+ * never waits for the disk. RIFF/WAVE files with 16-bit PCM in one
+ * or two channels are played at their own rate; other files are
+ * taken as raw mono 16-bit little-endian samples at INJECT_RAW_RATE.
+ *
+ * The prompt is resampled to the call rate by linear interpolation
+ * from a Q16 source position and added to the frame with
+ * saturation. While a prompt plays, the microphone signal can be
+ * ducked; the gain ramps over one frame at the start and the end.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INJECT_RAW_RATE		8000
+#define INJECT_MAX_FRAME	PLC_MAX_FRAME
+
+struct inject {
+	const uint8_t *map;	/* whole file, NULL if none */
+	size_t map_len;
+	const uint8_t *data;	/* first sample frame */
+	unsigned int frames;	/* sample frames in the file */
+	int channels;
+	int rate;
+
+	uint64_t pos;		/* Q16, in source frames */
+	int playing;
+	int duck;		/* Q15 microphone gain during a prompt */
+	int mic_gain;		/* Q15, as applied to the last frame */
+	unsigned int plays;	/* prompts played to the end */
+
+	s16 buf[INJECT_MAX_FRAME];
+};
+
+void inject_init(struct inject *in)
+{
+	memset(in, 0, sizeof(*in));
+	in->duck = 32767;
+	in->mic_gain = 32767;
+}
+
+static unsigned int inject_le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static unsigned int inject_le32(const uint8_t *p)
+{
+	return inject_le16(p) | inject_le16(p + 2) << 16;
+}
+
+/*
+ * Finds the format and the sample data of a RIFF/WAVE file. Returns
+ * -1 if the file is not 16-bit PCM.
+ */
+static int inject_parse_wav(struct inject *in)
+{
+	const uint8_t *p = in->map + 12, *end = in->map + in->map_len;
+	int have_fmt = 0;
+
+	while (p + 8 <= end) {
+		size_t len = inject_le32(p + 4);
+
+		if (len > (size_t)(end - p - 8))
+			len = end - p - 8;
+
+		if (!memcmp(p, "fmt ", 4) && len >= 16) {
+			if (inject_le16(p + 8) != 1 ||	/* PCM */
+			    inject_le16(p + 22) != 16)
+				return -1;
+			in->channels = inject_le16(p + 10);
+			in->rate = inject_le32(p + 12);
+			have_fmt = 1;
+		} else if (!memcmp(p, "data", 4) && have_fmt) {
+			in->data = p + 8;
+			in->frames = len / (2 * in->channels);
+			return 0;
+		}
+		/* chunks are padded to even length */
+		p += 8 + len + (len & 1);
+	}
+
+	return -1;
+}
+
+/*
+ * Maps a prompt file. Returns -1 with errno set if the file cannot
+ * be read or has an unsupported format.
+ */
+int inject_open(struct inject *in, const char *path)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 || st.st_size < 2) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	in->map = map;
+	in->map_len = st.st_size;
+
+	if (in->map_len >= 12 && !memcmp(in->map, "RIFF", 4) &&
+	    !memcmp(in->map + 8, "WAVE", 4)) {
+		if (inject_parse_wav(in) < 0 ||
+		    in->channels < 1 || in->channels > 2 ||
+		    in->rate < 4000 || in->rate > 96000) {
+			munmap(map, in->map_len);
+			in->map = NULL;
+			errno = EINVAL;
+			return -1;
+		}
+	} else {
+		in->data = in->map;
+		in->frames = in->map_len / 2;
+		in->channels = 1;
+		in->rate = INJECT_RAW_RATE;
+	}
+
+	return 0;
+}
+
+void inject_close(struct inject *in)
+{
+	if (in->map)
+		munmap((void *)in->map, in->map_len);
+	in->map = NULL;
+	in->playing = 0;
+}
+
+/*
+ * Attenuates the microphone by 'db' while a prompt plays. Negative
+ * values would boost it past Q15 unity, and are treated as 0.
+ */
+void inject_set_duck(struct inject *in, int db)
+{
+	if (db < 0)
+		db = 0;
+	in->duck = 32767 * pow(10, -db / 20.0);
+}
+
+/* Starts the prompt from the beginning. */
+void inject_start(struct inject *in)
+{
+	in->pos = 0;
+	in->playing = in->map != NULL && in->frames > 1;
+}
+
+static int inject_sample(const struct inject *in, unsigned int k)
+{
+	const uint8_t *p = in->data + 2 * k * in->channels;
+
+	if (in->channels == 2)
+		return ((s16)inject_le16(p) + (s16)inject_le16(p + 2)) >> 1;
+	return (s16)inject_le16(p);
+}
+
+/*
+ * Resamples up to n samples at 'rate' from the current position into
+ * in->buf. Returns the number of samples, less than n at the end of
+ * the prompt.
+ */
+static int inject_resample(struct inject *in, int n, int rate)
+{
+	uint32_t step = ((uint64_t)in->rate << 16) / rate;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		uint64_t p = in->pos + (uint64_t)i * step;
+		unsigned int k = p >> 16;
+		int frac = p & 0xffff, a, b;
+
+		if (k + 1 >= in->frames)
+			break;
+		a = inject_sample(in, k);
+		b = inject_sample(in, k + 1);
+		in->buf[i] = a + (int)(((int64_t)(b - a) * frac) >> 16);
+	}
+
+	in->pos += (uint64_t)i * step;
+	return i;
+}
+
+/* Mixes the prompt into a UL frame of n samples at 'rate', in place. */
+void inject_process(struct inject *in, s16 *buf, int n, int rate)
+{
+	int got = 0, target;
+
+	if (n > INJECT_MAX_FRAME)
+		return;
+
+	if (in->playing) {
+		got = inject_resample(in, n, rate);
+		if (got < n) {
+			in->playing = 0;
+			in->plays++;
+		}
+	}
+
+	target = in->playing ? in->duck : 32767;
+	if (target != 32767 || in->mic_gain != 32767)
+		kern_gain_ramp(buf, n, in->mic_gain, target);
+	in->mic_gain = target;
+
+	kern_mix_sat(buf, in->buf, got);
+}
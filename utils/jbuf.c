@@ -0,0 +1,190 @@
+/* -*- c-file-style: "linux" -*- */
+
+/*
+ * Adaptive DL jitter buffer.
+ *
+ * The playback queue of the sound device is used as the buffer.
+ * Frame arrival times are tracked to find how much queued audio
+ * is needed to ride out the arrival jitter: each arrival updates
+ * a late-arrival accumulator (how far behind the nominal 20 ms
+ * cadence the stream is), and the accumulator values are kept in
+ * a histogram. The target playout delay is a high percentile of
+ * that histogram.
+ *
+ * The queue is steered towards the target by time-stretching the
+ * frames before they are written (WSOLA-style): one pitch-like
+ * period is removed from, or repeated in, a frame with a crossfade
+ * at the best-matching lag. Nothing is dropped or padded with
+ * silence. At most one period per frame is added or removed.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define JBUF_MAX_MSEC		200	/* histogram range */
+#define JBUF_MIN_MSEC		20	/* never aim below one frame */
+#define JBUF_HYST_MSEC		10	/* dead band around the target */
+#define JBUF_PERCENTILE		95
+#define JBUF_WINDOW		500	/* frames, histogram is halved after */
+#define JBUF_MIN_LAG_HZ		400	/* shortest stretch segment */
+#define JBUF_MAX_LAG_HZ		100	/* longest stretch segment */
+#define JBUF_MAX_OUT		(PLC_MAX_FRAME + PLC_MAX_FRAME / 2)
+
+struct jbuf {
+	unsigned int hist[JBUF_MAX_MSEC + 1];
+	unsigned int hist_total;
+	struct timespec last;	/* previous arrival */
+	int late_us;		/* late-arrival accumulator */
+	int target_ms;		/* target playout delay */
+	int delay_ms;		/* last measured playout delay */
+
+	unsigned int frames;
+	unsigned int expanded;	/* frames stretched */
+	unsigned int compressed;	/* frames shortened */
+};
+
+void jbuf_init(struct jbuf *jb)
+{
+	memset(jb, 0, sizeof(*jb));
+	jb->target_ms = JBUF_MIN_MSEC;
+}
+
+static int jbuf_percentile(struct jbuf *jb, int pct)
+{
+	unsigned int limit = (jb->hist_total * pct + 99) / 100;
+	unsigned int sum = 0;
+	int i;
+
+	for (i = 0; i <= JBUF_MAX_MSEC; i++) {
+		sum += jb->hist[i];
+		if (sum >= limit)
+			return i;
+	}
+	return JBUF_MAX_MSEC;
+}
+
+/*
+ * Records the arrival of a frame of 'frame_us' microseconds and
+ * updates the target delay.
+ */
+void jbuf_arrival(struct jbuf *jb, int frame_us)
+{
+	struct timespec now;
+	int i, ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (jb->last.tv_sec || jb->last.tv_nsec) {
+		long iat = (now.tv_sec - jb->last.tv_sec) * 1000000 +
+			(now.tv_nsec - jb->last.tv_nsec) / 1000;
+
+		/* how late the stream runs compared to the nominal cadence */
+		jb->late_us += iat - frame_us;
+		if (jb->late_us < 0)
+			jb->late_us = 0;
+		if (jb->late_us > JBUF_MAX_MSEC * 1000)
+			jb->late_us = JBUF_MAX_MSEC * 1000;
+	}
+	jb->last = now;
+
+	ms = jb->late_us / 1000;
+	jb->hist[ms]++;
+	if (++jb->hist_total >= JBUF_WINDOW) {
+		jb->hist_total = 0;
+		for (i = 0; i <= JBUF_MAX_MSEC; i++) {
+			jb->hist[i] >>= 1;
+			jb->hist_total += jb->hist[i];
+		}
+	}
+
+	jb->target_ms = jbuf_percentile(jb, JBUF_PERCENTILE) + JBUF_MIN_MSEC;
+	if (jb->target_ms > JBUF_MAX_MSEC)
+		jb->target_ms = JBUF_MAX_MSEC;
+	jb->frames++;
+}
+
+/*
+ * Finds the lag in [min, max] at which the signal best matches
+ * itself, comparing 'win' samples. Returns 0 if the match is too
+ * poor for a clean splice.
+ */
+static int jbuf_find_lag(const s16 *x, int win, int min, int max)
+{
+	int64_t e0 = kern_dot(x, x, win) >> 15;
+	int64_t score, best = 0;
+	int lag, best_lag = 0;
+
+	for (lag = min; lag <= max; lag++) {
+		int64_t c = kern_dot(x, x + lag, win) >> 15;
+		int64_t e = kern_dot(x + lag, x + lag, win) >> 15;
+
+		/* squared correlation over energy, positive c only */
+		if (c <= 0)
+			continue;
+		score = (c * c) / (e + 1);
+		if (score > best) {
+			best = score;
+			best_lag = lag;
+		}
+	}
+
+	/* near silence: any lag splices cleanly */
+	if (e0 < win / 8 + 1)
+		return best_lag ? best_lag : min;
+
+	/* require a normalized correlation of at least 0.7 */
+	if (2 * best < e0)
+		return 0;
+
+	return best_lag;
+}
+
+/*
+ * Time-stretches the frame 'in' of n samples at 'rate' into 'out'
+ * (room for JBUF_MAX_OUT samples), steering the measured playout
+ * delay 'delay_us' (-1 if unknown) towards the target. Returns the
+ * number of samples in 'out'.
+ */
+int jbuf_process(struct jbuf *jb, const s16 *in, int n, int rate,
+		 long delay_us, s16 *out)
+{
+	int min = rate / JBUF_MIN_LAG_HZ;
+	int max = rate / JBUF_MAX_LAG_HZ;
+	int lag = 0;
+
+	if (max > n / 2)
+		max = n / 2;
+
+	if (delay_us < 0 || n > PLC_MAX_FRAME || min >= max) {
+		memcpy(out, in, n * sizeof(s16));
+		return n;
+	}
+
+	jb->delay_ms = delay_us / 1000;
+
+	if (jb->delay_ms > jb->target_ms + JBUF_HYST_MSEC ||
+	    jb->delay_ms < jb->target_ms - JBUF_HYST_MSEC)
+		lag = jbuf_find_lag(in, n - max, min, max);
+
+	if (lag && jb->delay_ms > jb->target_ms) {
+		/* accelerate: merge the first two periods into one */
+		kern_crossfade(out, in, in + lag, lag);
+		memcpy(out + lag, in + 2 * lag, (n - 2 * lag) * sizeof(s16));
+		jb->compressed++;
+		return n - lag;
+	}
+
+	if (lag) {
+		/* expand: the second period fades back into the first,
+		 * which is then played again */
+		memcpy(out, in, lag * sizeof(s16));
+		kern_crossfade(out + lag, in + lag, in, lag);
+		memcpy(out + 2 * lag, in + lag, (n - lag) * sizeof(s16));
+		jb->expanded++;
+		return n + lag;
+	}
+
+	memcpy(out, in, n * sizeof(s16));
+	return n;
+}
@@ -0,0 +1,154 @@
+/* -*- c-file-style: "linux" -*- */
+
+/*
+ * Fixed-point kernels shared by the speech processing stages.
+ *
+ * The loops are written so that the compiler can vectorize them
+ * (-O2 -ftree-vectorize, or -O3): unit stride, no aliasing between
+ * input and output, and independent accumulators in reductions.
+ */
+
+#include <stdint.h>
+
+/* Inner product of two 16-bit sample vectors. */
+static inline int64_t kern_dot(const s16 *a, const s16 *b, int n)
+{
+	int64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		s0 += a[i] * b[i];
+		s1 += a[i + 1] * b[i + 1];
+		s2 += a[i + 2] * b[i + 2];
+		s3 += a[i + 3] * b[i + 3];
+	}
+	for (; i < n; i++)
+		s0 += a[i] * b[i];
+
+	return s0 + s1 + s2 + s3;
+}
+
+/*
+ * Crossfades n samples from 'a' to 'b' into 'out' with a linear
+ * Q15 ramp. 'out' may be the same as 'a' or 'b'.
+ */
+static inline void kern_crossfade(s16 *out, const s16 *a, const s16 *b, int n)
+{
+	int w = 0, dw, i;
+
+	if (n <= 0)
+		return;
+
+	dw = 32768 / n;
+	for (i = 0; i < n; i++, w += dw)
+		out[i] = (a[i] * (32768 - w) + b[i] * w) >> 15;
+}
+
+/*
+ * Subtracts 'dc' from n samples in place and scales them by the Q8
+ * 'gain', saturating to 16 bits. Returns the sum of the input
+ * samples. '*peak' is set to the largest output magnitude before
+ * saturation, and '*clipped' to the number of saturated samples.
+ */
+static inline int64_t kern_dc_gain(s16 *buf, int n, int dc, int gain,
+				   int *peak, int *clipped)
+{
+	int64_t sum = 0;
+	int hi = 0, clip = 0, i;
+
+	for (i = 0; i < n; i++) {
+		int x = buf[i];
+		int v = ((x - dc) * gain) >> 8;
+		int a = v < 0 ? -v : v;
+
+		sum += x;
+		hi = a > hi ? a : hi;
+		clip += a > 32767;
+		v = v > 32767 ? 32767 : v;
+		v = v < -32768 ? -32768 : v;
+		buf[i] = v;
+	}
+
+	*peak = hi;
+	*clipped = clip;
+	return sum;
+}
+
+/* Adds n samples of 'src' to 'buf' in place, saturating to 16 bits. */
+static inline void kern_mix_sat(s16 *buf, const s16 *src, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		int v = buf[i] + src[i];
+
+		v = v > 32767 ? 32767 : v;
+		v = v < -32768 ? -32768 : v;
+		buf[i] = v;
+	}
+}
+
+/*
+ * Scales n samples in place by a Q15 gain that moves linearly from
+ * 'g0' to 'g1' over the buffer.
+ */
+static inline void kern_gain_ramp(s16 *buf, int n, int g0, int g1)
+{
+	int step, i;
+
+	if (n <= 0)
+		return;
+
+	/* gain in Q23, so that short ramps still move */
+	step = ((g1 - g0) << 8) / n;
+	for (i = 0; i < n; i++) {
+		int g = ((g0 << 8) + i * step) >> 8;
+
+		buf[i] = (buf[i] * g) >> 15;
+	}
+}
+
+/*
+ * Adds n samples of 'src' scaled by the Q15 'gain' to 'buf' in
+ * place, saturating to 16 bits.
+ */
+static inline void kern_mix_gain_sat(s16 *buf, const s16 *src, int n, int gain)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		int v = buf[i] + ((src[i] * gain) >> 15);
+
+		v = v > 32767 ? 32767 : v;
+		v = v < -32768 ? -32768 : v;
+		buf[i] = v;
+	}
+}
+
+/*
+ * Level statistics of n samples in one pass. Returns the sum of
+ * squares; '*sum' is set to the sum of the samples, '*peak' to the
+ * largest magnitude and '*clipped' to the number of samples at full
+ * scale.
+ */
+static inline int64_t kern_stats(const s16 *buf, int n, int64_t *sum,
+				 int *peak, int *clipped)
+{
+	int64_t s = 0, sq = 0;
+	int hi = 0, clip = 0, i;
+
+	for (i = 0; i < n; i++) {
+		int x = buf[i];
+		int a = x < 0 ? -x : x;
+
+		s += x;
+		sq += x * x;
+		hi = a > hi ? a : hi;
+		clip += a >= 32767;
+	}
+
+	*sum = s;
+	*peak = hi;
+	*clipped = clip;
+	return sq;
+}
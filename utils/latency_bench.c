@@ -0,0 +1,315 @@
+/* -*- c-file-style: "linux" -*- */
+
+/*
+ * Acoustic loopback latency benchmark.
+ *
+ * Sweeps playback/capture buffer layouts of the audio backend it is
+ * built for (-DALSA, -DPULSE or -DDSP), and measures the real round
+ * trip of each: a chirp marker is written to the sink, and found
+ * again in the captured signal by cross-correlation. The latency is
+ * the number of samples the application reads between writing the
+ * marker and reading it back, so it covers playback buffering, the
+ * acoustic (or cable) path and capture buffering.
+ *
+ * Each layout runs in a child process, since the backends exit on
+ * setup errors. One JSON object per layout is written to stdout:
+ *
+ *   {"driver": "alsa", "period_ms": 20, "periods": 2, "status": "ok",
+ *    "markers": 10, "lost": 0, "min_ms": .., "median_ms": ..,
+ *    "max_ms": .., "reported_ms": ..}
+ *
+ * "reported_ms" is the mean playback delay the driver reported when
+ * the markers were written. "status" is "unsupported" for layouts the
+ * backend cannot set up, and "failed" if the run did not complete.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "audio.c"
+
+#define BENCH_RATE		8000	/* samples per second through audio_read() */
+#define BENCH_MARKER		256	/* chirp, 32 ms */
+#define BENCH_SEARCH		BENCH_RATE	/* longest latency found, 1 s */
+#define BENCH_SETTLE_MS		500	/* between markers */
+#define BENCH_THRESHOLD		0.3	/* normalized correlation for a hit */
+#define BENCH_MAX_BLOCK		2048
+#define BENCH_MAX_MARKERS	100
+#define BENCH_MAX_CONFIGS	16
+
+struct test_ctx ctx0;
+struct test_ctx *ctx = &ctx0;
+
+static int verbose;
+static int markers = 10;
+static int period_ms[BENCH_MAX_CONFIGS] = { 10, 20, 40 };
+static int n_period_ms = 3;
+static int periods[BENCH_MAX_CONFIGS] = { 2, 3, 4 };
+static int n_periods = 3;
+
+static s16 marker[BENCH_MARKER];
+static int64_t marker_energy;
+static s16 cap[BENCH_SEARCH + BENCH_MARKER];
+
+/* Hann-windowed linear chirp from 300 to 3400 Hz. */
+static void make_marker(void)
+{
+	double f0 = 300, f1 = 3400;
+	int i;
+
+	for (i = 0; i < BENCH_MARKER; i++) {
+		double t = (double)i / BENCH_RATE;
+		double T = (double)BENCH_MARKER / BENCH_RATE;
+		double ph = 2 * M_PI * (f0 * t + (f1 - f0) * t * t / (2 * T));
+		double w = 0.5 - 0.5 * cos(2 * M_PI * i / (BENCH_MARKER - 1));
+
+		marker[i] = 20000 * w * sin(ph);
+	}
+	marker_energy = kern_dot(marker, marker, BENCH_MARKER);
+}
+
+/*
+ * Finds the marker in 'cap'. Returns its offset in samples, or -1 if
+ * no position correlates well enough.
+ */
+static int find_marker(void)
+{
+	int64_t e = kern_dot(cap, cap, BENCH_MARKER);
+	double best = 0;
+	int k, at = -1;
+
+	for (k = 0; k < BENCH_SEARCH; k++) {
+		double c = kern_dot(cap + k, marker, BENCH_MARKER);
+		double norm = e > 0 ? c * c / ((double)e * marker_energy) : 0;
+
+		if (norm > best) {
+			best = norm;
+			at = k;
+		}
+		e += cap[k + BENCH_MARKER] * cap[k + BENCH_MARKER] -
+			cap[k] * cap[k];
+	}
+
+	return best >= BENCH_THRESHOLD * BENCH_THRESHOLD ? at : -1;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Runs one layout in the child: returns the result line in 'out'.
+ */
+static void measure(int pms, int np, char *out, size_t len)
+{
+	static s16 in[BENCH_MAX_BLOCK], play[BENCH_MAX_BLOCK];
+	double lat[BENCH_MAX_MARKERS], reported = 0;
+	int block = BENCH_RATE * pms / 1000;
+	int found = 0, lost = 0, reports = 0;
+	int since = -BENCH_RATE;	/* one more second before the first marker */
+	int playing = -1;		/* marker samples written, -1 if idle */
+	int fill = -1;			/* samples captured, -1 if idle */
+
+	if (block > BENCH_MAX_BLOCK)
+		block = BENCH_MAX_BLOCK;
+
+	audio_init(ctx);
+	start_sink(ctx);
+	start_source(ctx);
+
+	while (found + lost < markers) {
+		int n = audio_read(ctx->source, in, block * 2) / 2, i;
+
+		if (n <= 0) {
+			usleep(1000);
+			continue;
+		}
+
+		if (fill >= 0) {
+			int room = sizeof(cap) / sizeof(cap[0]) - fill;
+			int take = n < room ? n : room;
+
+			memcpy(cap + fill, in, take * sizeof(s16));
+			fill += take;
+			if (take == room) {
+				int at = find_marker();
+
+				if (at >= 0)
+					lat[found++] = at * 1000.0 / BENCH_RATE;
+				else
+					lost++;
+				fill = -1;
+				since = 0;
+			}
+		} else
+			since += n;
+
+		/* the marker starts a block, right after the read */
+		if (fill < 0 && playing < 0 && since >= BENCH_RATE * BENCH_SETTLE_MS / 1000) {
+			long d = audio_write_delay(ctx->sink);
+
+			if (d >= 0) {
+				reported += d / 1000.0;
+				reports++;
+			}
+			playing = 0;
+			fill = 0;
+		}
+
+		memset(play, 0, n * sizeof(s16));
+		if (playing >= 0) {
+			for (i = 0; i < n && playing < BENCH_MARKER; i++)
+				play[i] = marker[playing++];
+			if (playing == BENCH_MARKER)
+				playing = -1;
+		}
+		audio_write(ctx->sink, play, n * 2);
+	}
+
+	stop_source(ctx);
+	stop_sink(ctx);
+
+	if (!found) {
+		snprintf(out, len, "\"status\": \"ok\", \"markers\": %d, \"lost\": %d",
+			 markers, lost);
+		return;
+	}
+
+	qsort(lat, found, sizeof(lat[0]), cmp_double);
+	snprintf(out, len, "\"status\": \"ok\", \"markers\": %d, \"lost\": %d, "
+		 "\"min_ms\": %.2f, \"median_ms\": %.2f, \"max_ms\": %.2f, \"reported_ms\": %.2f",
+		 markers, lost, lat[0], lat[found / 2], lat[found - 1],
+		 reports ? reported / reports : -1.0);
+}
+
+/* Runs one layout in a child process and prints its result line. */
+static void run_config(int pms, int np)
+{
+	char line[512] = "";
+	int fd[2], status, got = 0;
+	pid_t pid;
+
+	printf("{\"driver\": \"%s\", \"period_ms\": %d, \"periods\": %d, ",
+	       DRIVER_NAME, pms, np);
+
+	if (audio_set_buffer(pms, np) < 0) {
+		printf("\"status\": \"unsupported\"}\n");
+		fflush(stdout);
+		return;
+	}
+
+	fflush(stdout);
+	if (pipe(fd) < 0 || (pid = fork()) < 0) {
+		printf("\"status\": \"failed\"}\n");
+		fflush(stdout);
+		return;
+	}
+
+	if (!pid) {
+		/* note: the backends trace to stdout */
+		close(fd[0]);
+		dup2(verbose ? 2 : open("/dev/null", O_WRONLY), 1);
+		/* give up if the streams stall */
+		alarm(10 + markers * 3);
+		measure(pms, np, line, sizeof(line));
+		write(fd[1], line, strlen(line));
+		_exit(0);
+	}
+
+	close(fd[1]);
+	while (got < (int)sizeof(line) - 1) {
+		ssize_t r = read(fd[0], line + got, sizeof(line) - 1 - got);
+
+		if (r <= 0)
+			break;
+		got += r;
+	}
+	line[got] = 0;
+	close(fd[0]);
+	waitpid(pid, &status, 0);
+
+	if (!got || !WIFEXITED(status) || WEXITSTATUS(status))
+		printf("\"status\": \"failed\"}\n");
+	else
+		printf("%s}\n", line);
+	fflush(stdout);
+}
+
+static int parse_list(const char *s, int *v)
+{
+	int n = 0;
+
+	while (*s && n < BENCH_MAX_CONFIGS) {
+		v[n] = strtol(s, (char **)&s, 10);
+		if (v[n] <= 0)
+			return -1;
+		n++;
+		if (*s == ',')
+			s++;
+		else if (*s)
+			return -1;
+	}
+	return n ? n : -1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-v] [-m markers] [-p period_ms,...] [-n periods,...]\n", name);
+	fprintf(stderr, "\t-m markers per layout (default 10, at most %d)\n", BENCH_MAX_MARKERS);
+	fprintf(stderr, "\t-p period lengths to sweep, in ms (default 10,20,40)\n");
+	fprintf(stderr, "\t-n periods per buffer to sweep (default 2,3,4)\n");
+	fprintf(stderr, "\t-v show backend traces on stderr\n");
+	fprintf(stderr, "Results go to stdout, one JSON object per layout.\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int c, i, j;
+
+	while ((c = getopt(argc, argv, "hvm:p:n:")) != -1) {
+		switch (c) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 'm':
+			markers = atoi(optarg);
+			if (markers < 1 || markers > BENCH_MAX_MARKERS)
+				usage(argv[0]);
+			break;
+		case 'p':
+			n_period_ms = parse_list(optarg, period_ms);
+			if (n_period_ms < 0)
+				usage(argv[0]);
+			break;
+		case 'n':
+			n_periods = parse_list(optarg, periods);
+			if (n_periods < 0)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	/* note: keep the call status page untouched */
+	strcpy(wd_buf, "/dev/null");
+
+	make_marker();
+	for (i = 0; i < n_period_ms; i++)
+		for (j = 0; j < n_periods; j++)
+			run_config(period_ms[i], periods[j]);
+
+	return 0;
+}
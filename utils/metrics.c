@@ -0,0 +1,197 @@
+/* -*- c-file-style: "linux" -*- */
+
+/*
+ * Per-call audio quality metrics of one direction.
+ *
+ * Every frame goes through one fused pass (kern_stats()) that yields
+ * the sum, sum of squares, peak and clip count, and the counters are
+ * accumulated over the call and over a window of METRICS_WINDOW_MS.
+ * Levels in dB are only computed when the numbers are read, so the
+ * per-frame cost is the one pass.
+ *
+ * Frames below METRICS_SILENCE of RMS count as silence. Frames with
+ * a peak of at most METRICS_DEAD_PEAK carry no signal at all, not
+ * even the microphone or line noise floor; a direction that is dead
+ * for a whole window while the other one carries speech is reported
+ * as one-way audio by metrics_alarms().
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define METRICS_WINDOW_MS	10000
+#define METRICS_SILENCE		33	/* RMS, -60 dBFS */
+#define METRICS_DEAD_PEAK	4	/* LSBs */
+#define METRICS_FLOOR_DB	-99.0f	/* level reported for digital zero */
+
+/* one-way audio: dead frames in the window of one direction ... */
+#define METRICS_ONE_WAY_DEAD	95	/* percent */
+/* ... while the other one has at most this much silence */
+#define METRICS_ONE_WAY_SILENCE	80	/* percent */
+/* clipping: clipped samples per million in a window */
+#define METRICS_CLIP_PPM	1000
+
+enum {
+	METRICS_ALARM_UL_DEAD = 1,	/* one-way audio, nothing sent */
+	METRICS_ALARM_DL_DEAD = 2,	/* one-way audio, nothing received */
+	METRICS_ALARM_UL_CLIP = 4,
+	METRICS_ALARM_DL_CLIP = 8,
+};
+
+/* Counters over some stretch of frames */
+struct metrics_acc {
+	unsigned int frames;
+	unsigned int silent;	/* frames below METRICS_SILENCE */
+	unsigned int dead;	/* frames with no signal */
+	uint64_t samples;
+	uint64_t clipped;
+	int64_t sum;
+	uint64_t sumsq;
+	int peak;
+};
+
+struct metrics {
+	struct metrics_acc call;
+	struct metrics_acc win;		/* window being filled */
+	struct metrics_acc last;	/* last complete window */
+	int win_ms;
+	unsigned int windows;		/* complete windows this call */
+};
+
+/* Numbers derived from a metrics_acc, see metrics_get() */
+struct metrics_stats {
+	float rms_db;		/* dBFS, METRICS_FLOOR_DB for digital zero */
+	float peak_db;		/* dBFS */
+	int peak;
+	uint64_t clipped;	/* samples */
+	int silence_pct;	/* frames below METRICS_SILENCE */
+	int dead_pct;		/* frames with no signal */
+	int dc;			/* mean sample value */
+};
+
+void metrics_init(struct metrics *m)
+{
+	memset(m, 0, sizeof(*m));
+}
+
+/* Accounts one frame of n samples at 'rate'. */
+void metrics_process(struct metrics *m, const s16 *buf, int n, int rate)
+{
+	struct metrics_acc *a[2] = { &m->call, &m->win };
+	uint64_t sumsq;
+	int64_t sum;
+	int peak, clipped, i;
+
+	if (n <= 0)
+		return;
+
+	sumsq = kern_stats(buf, n, &sum, &peak, &clipped);
+
+	for (i = 0; i < 2; i++) {
+		a[i]->frames++;
+		a[i]->silent += sumsq < (uint64_t)n * METRICS_SILENCE * METRICS_SILENCE;
+		a[i]->dead += peak <= METRICS_DEAD_PEAK;
+		a[i]->samples += n;
+		a[i]->clipped += clipped;
+		a[i]->sum += sum;
+		a[i]->sumsq += sumsq;
+		if (peak > a[i]->peak)
+			a[i]->peak = peak;
+	}
+
+	m->win_ms += n * 1000 / rate;
+	if (m->win_ms >= METRICS_WINDOW_MS) {
+		m->last = m->win;
+		memset(&m->win, 0, sizeof(m->win));
+		m->win_ms = 0;
+		m->windows++;
+	}
+}
+
+static float metrics_db(double v)
+{
+	return v > 0 ? 20 * log10(v / 32768) : METRICS_FLOOR_DB;
+}
+
+/* Derives levels and ratios from the counters in 'a'. */
+void metrics_get(const struct metrics_acc *a, struct metrics_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->rms_db = METRICS_FLOOR_DB;
+	s->peak_db = METRICS_FLOOR_DB;
+	if (!a->frames)
+		return;
+
+	s->rms_db = metrics_db(sqrt((double)a->sumsq / a->samples));
+	s->peak_db = metrics_db(a->peak);
+	s->peak = a->peak;
+	s->clipped = a->clipped;
+	s->silence_pct = a->silent * 100 / a->frames;
+	s->dead_pct = a->dead * 100 / a->frames;
+	s->dc = a->sum / (int64_t)a->samples;
+}
+
+/*
+ * Formats the call totals of 'm' as one status line, prefixed with
+ * 'name'.
+ */
+int metrics_format(const struct metrics *m, const char *name, char *buf, size_t len)
+{
+	struct metrics_stats s;
+
+	metrics_get(&m->call, &s);
+	return snprintf(buf, len, "%s: %.1f dBFS, peak %.1f dBFS, %llu clipped, %d%% silence, dc %d\n",
+			name, s.rms_db, s.peak_db, (unsigned long long)s.clipped,
+			s.silence_pct, s.dc);
+}
+
+static int metrics_clipping(const struct metrics_acc *a)
+{
+	return a->samples && a->clipped * 1000000 / a->samples >= METRICS_CLIP_PPM;
+}
+
+/*
+ * Checks the last complete windows of both directions. Returns a
+ * mask of METRICS_ALARM_*, 0 if the call sounds healthy or no window
+ * is complete yet.
+ */
+int metrics_alarms(const struct metrics *ul, const struct metrics *dl)
+{
+	struct metrics_stats u, d;
+	int alarms = 0;
+
+	if (!ul->windows || !dl->windows)
+		return 0;
+
+	metrics_get(&ul->last, &u);
+	metrics_get(&dl->last, &d);
+
+	if (u.dead_pct >= METRICS_ONE_WAY_DEAD && d.silence_pct <= METRICS_ONE_WAY_SILENCE)
+		alarms |= METRICS_ALARM_UL_DEAD;
+	if (d.dead_pct >= METRICS_ONE_WAY_DEAD && u.silence_pct <= METRICS_ONE_WAY_SILENCE)
+		alarms |= METRICS_ALARM_DL_DEAD;
+	if (metrics_clipping(&ul->last))
+		alarms |= METRICS_ALARM_UL_CLIP;
+	if (metrics_clipping(&dl->last))
+		alarms |= METRICS_ALARM_DL_CLIP;
+
+	return alarms;
+}
+
+/* Short description of a single METRICS_ALARM_* bit. */
+const char *metrics_alarm_name(int alarm)
+{
+	switch (alarm) {
+	case METRICS_ALARM_UL_DEAD:
+		return "one-way audio (no UL)";
+	case METRICS_ALARM_DL_DEAD:
+		return "one-way audio (no DL)";
+	case METRICS_ALARM_UL_CLIP:
+		return "UL clipping";
+	case METRICS_ALARM_DL_CLIP:
+		return "DL clipping";
+	}
+	return "unknown";
+}
@@ -0,0 +1,226 @@
+/* -*- c-file-style: "linux" -*- */
+
+/*
+ * UL mixer: adds audio from other threads to the UL frames.
+ *
+ * Each source is a single-producer single-consumer ring: one
+ * producer thread writes samples at the call rate, and the mixer
+ * stage, running in the call loop, reads one frame from every
+ * active source per UL frame, scales it by the source gain and adds
+ * it to the frame with saturation. A source that has less than a
+ * frame queued contributes what it has and counts an underrun.
+ *
+ * Sources live in a fixed table. The state of each slot is the only
+ * thing the threads hand over:
+ *
+ *   FREE -> CLAIMED   mixer_add(), by compare-and-swap
+ *   CLAIMED -> ACTIVE mixer_add(), once the slot is set up
+ *   ACTIVE -> REMOVED mixer_remove(), by the producer
+ *   REMOVED -> FREE   mixer stage, once it no longer reads the ring
+ *   REMOVED -> CLAIMED mixer_add(), by compare-and-swap, before the
+ *                     mixer stage got to it
+ *
+ * so sources come and go during a call without locks, and the call
+ * loop never waits for a producer. A slot reclaimed from REMOVED may
+ * still be read by the mixer stage; mixer_add() waits for it to move
+ * on ('reading') before resetting the ring.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+
+#define MIXER_MAX_SOURCES	8
+#define MIXER_RING		4096	/* samples, power of two */
+
+enum {
+	MIXER_FREE,
+	MIXER_CLAIMED,
+	MIXER_ACTIVE,
+	MIXER_REMOVED,
+};
+
+struct mixer_source {
+	int state;		/* MIXER_*, atomic */
+	const char *name;
+	int gain;		/* Q15, 32768 is unity, atomic */
+	int mute;		/* atomic */
+
+	/* ring, free-running indices */
+	unsigned int wr;	/* written by the producer */
+	unsigned int rd;	/* written by the mixer */
+	s16 ring[MIXER_RING];
+
+	unsigned int underruns;	/* frames short of samples */
+	unsigned int overruns;	/* writes that did not fit */
+};
+
+struct mixer {
+	struct mixer_source src[MIXER_MAX_SOURCES];
+	int rate;		/* of the last UL frame, atomic */
+	int reading;		/* slot the mixer stage reads, -1 if none, atomic */
+	s16 tmp[PLC_MAX_FRAME];
+};
+
+void mixer_init(struct mixer *m)
+{
+	memset(m, 0, sizeof(*m));
+	m->rate = 8000;
+	m->reading = -1;
+}
+
+/*
+ * Registers a source with unity gain. Safe to call from any thread.
+ * Returns NULL if all slots are in use.
+ */
+struct mixer_source *mixer_add(struct mixer *m, const char *name)
+{
+	int i;
+
+	for (i = 0; i < MIXER_MAX_SOURCES; i++) {
+		struct mixer_source *s = &m->src[i];
+		int expected = __atomic_load_n(&s->state, __ATOMIC_RELAXED);
+
+		if (expected != MIXER_FREE && expected != MIXER_REMOVED)
+			continue;
+		if (!__atomic_compare_exchange_n(&s->state, &expected, MIXER_CLAIMED,
+						 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			continue;
+
+		/* note: pairs with the recheck in mixer_process() */
+		while (expected == MIXER_REMOVED &&
+		       __atomic_load_n(&m->reading, __ATOMIC_SEQ_CST) == i)
+			sched_yield();
+
+		s->name = name;
+		s->gain = 32768;
+		s->mute = 0;
+		s->wr = s->rd = 0;
+		s->underruns = s->overruns = 0;
+		__atomic_store_n(&s->state, MIXER_ACTIVE, __ATOMIC_RELEASE);
+		return s;
+	}
+
+	return NULL;
+}
+
+/*
+ * Unregisters a source. The producer must not use 's' afterwards;
+ * the slot may be reused by the next mixer_add().
+ */
+void mixer_remove(struct mixer_source *s)
+{
+	__atomic_store_n(&s->state, MIXER_REMOVED, __ATOMIC_RELEASE);
+}
+
+void mixer_set_gain(struct mixer_source *s, int gain_q15)
+{
+	__atomic_store_n(&s->gain, gain_q15, __ATOMIC_RELAXED);
+}
+
+void mixer_set_mute(struct mixer_source *s, int mute)
+{
+	__atomic_store_n(&s->mute, mute, __ATOMIC_RELAXED);
+}
+
+/* Sample rate producers should write at. */
+int mixer_rate(struct mixer *m)
+{
+	return __atomic_load_n(&m->rate, __ATOMIC_RELAXED);
+}
+
+/* Samples a producer can write without overrunning the ring. */
+int mixer_space(struct mixer_source *s)
+{
+	unsigned int rd = __atomic_load_n(&s->rd, __ATOMIC_ACQUIRE);
+
+	return MIXER_RING - (s->wr - rd);
+}
+
+/*
+ * Queues n samples from the producer thread. Returns the number of
+ * samples queued, less than n if the ring is full.
+ */
+int mixer_write(struct mixer_source *s, const s16 *buf, int n)
+{
+	unsigned int wr = s->wr;
+	int space = mixer_space(s), first;
+
+	if (n > space) {
+		s->overruns++;
+		n = space;
+	}
+
+	first = MIXER_RING - wr % MIXER_RING;
+	if (first > n)
+		first = n;
+	memcpy(s->ring + wr % MIXER_RING, buf, first * sizeof(s16));
+	memcpy(s->ring, buf + first, (n - first) * sizeof(s16));
+
+	__atomic_store_n(&s->wr, wr + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+/* Takes up to n samples from a source ring into 'out'. */
+static int mixer_read(struct mixer_source *s, s16 *out, int n)
+{
+	unsigned int rd = s->rd;
+	int avail = __atomic_load_n(&s->wr, __ATOMIC_ACQUIRE) - rd, first;
+
+	if (n > avail)
+		n = avail;
+
+	first = MIXER_RING - rd % MIXER_RING;
+	if (first > n)
+		first = n;
+	memcpy(out, s->ring + rd % MIXER_RING, first * sizeof(s16));
+	memcpy(out + first, s->ring, (n - first) * sizeof(s16));
+
+	__atomic_store_n(&s->rd, rd + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+/* Adds one frame of every active source to 'buf', in place. */
+void mixer_process(struct mixer *m, s16 *buf, int n, int rate)
+{
+	int i;
+
+	if (n > PLC_MAX_FRAME)
+		return;
+
+	__atomic_store_n(&m->rate, rate, __ATOMIC_RELAXED);
+
+	for (i = 0; i < MIXER_MAX_SOURCES; i++) {
+		struct mixer_source *s = &m->src[i];
+		int state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+		int got;
+
+		if (state == MIXER_REMOVED) {
+			/* note: fails if mixer_add() reclaimed it first */
+			__atomic_compare_exchange_n(&s->state, &state, MIXER_FREE,
+						    0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (state != MIXER_ACTIVE)
+			continue;
+
+		/* note: announce the read before checking the state
+		 *       again, so that mixer_add() either sees us in the
+		 *       slot or we see it reclaimed */
+		__atomic_store_n(&m->reading, i, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&s->state, __ATOMIC_SEQ_CST) != MIXER_ACTIVE) {
+			__atomic_store_n(&m->reading, -1, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		/* note: muted sources are still drained, so that they
+		 *       resume in time */
+		got = mixer_read(s, m->tmp, n);
+		if (got < n)
+			s->underruns++;
+		if (!__atomic_load_n(&s->mute, __ATOMIC_RELAXED))
+			kern_mix_gain_sat(buf, m->tmp, got,
+					  __atomic_load_n(&s->gain, __ATOMIC_RELAXED));
+		__atomic_store_n(&m->reading, -1, __ATOMIC_RELEASE);
+	}
+}
@@ -0,0 +1,219 @@
+/* -*- c-file-style: "linux" -*- */
+
+/*
+ * UL noise suppressor.
+ *
+ * Short-time spectral gain with 50% overlapped sqrt-Hann windows
+ * (8 ms hop, 16 ms frame). The noise power of each bin is tracked
+ * continuously as a running mean of the bin power, which moves
+ * much more slowly while the bin is well above the noise, so that
+ * speech is not learned as noise. The gain is the Wiener gain from
+ * a decision-directed a priori SNR estimate, limited to
+ * NS_FLOOR of gain to avoid musical noise.
+ *
+ * Frames the caller marks as non-speech (e.g. from a VAD) skip the
+ * transforms: every bin would get about the NS_FLOOR gain, and a
+ * flat gain can be applied to the windowed frame directly. The
+ * noise estimate is then left as it was.
+ *
+ * Capture is processed in hops, so the output lags the input by
+ * one hop of block assembly plus one hop of overlap-add.
+ *
+ * The per-bin loops are branch-free selects; gcc vectorizes them
+ * at -O3 with -fno-trapping-math.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#define NS_MAX_HOP		128	/* 8 ms at 16 kHz */
+#define NS_FLOOR		0.1f	/* gain floor, -20 dB */
+#define NS_DD_ALPHA		0.98f	/* a priori SNR smoothing */
+#define NS_NOISE_SMOOTH		0.05f	/* noise tracking per hop ... */
+#define NS_NOISE_SMOOTH_SPEECH	0.0005f	/* ... with the bin well above it */
+#define NS_SPEECH_SNR		4.0f
+#define NS_FIFO			(2 * PLC_MAX_FRAME + NS_MAX_HOP)
+
+struct ns {
+	int rate;
+	int hop;		/* H, samples */
+	struct fft fft;		/* 2H points */
+	float win[2 * NS_MAX_HOP];
+
+	float in[2 * NS_MAX_HOP];	/* last two hops of input */
+	float ola[NS_MAX_HOP];		/* second half of the last frame */
+	cpx spec[2 * NS_MAX_HOP];
+	float noise[NS_MAX_HOP + 1];	/* per-bin noise power */
+	float snr[NS_MAX_HOP + 1];	/* a posteriori SNR after gain, last hop */
+	int noise_valid;
+
+	/* capture block assembly */
+	s16 din[NS_MAX_HOP];
+	int din_fill;
+	s16 dout[NS_FIFO];
+	int dout_fill;
+
+	unsigned int hops;
+};
+
+static void ns_reset(struct ns *s, int rate)
+{
+	int i, n;
+
+	memset(s, 0, sizeof(*s));
+	s->rate = rate;
+	s->hop = rate / 125;
+	if (s->hop > NS_MAX_HOP)
+		s->hop = NS_MAX_HOP;
+	n = 2 * s->hop;
+	fft_init(&s->fft, n);
+
+	/* sqrt-Hann: squares of overlapping halves sum to one */
+	for (i = 0; i < n; i++)
+		s->win[i] = sin(M_PI * i / n);
+
+	/* constant latency of one hop */
+	s->dout_fill = s->hop;
+}
+
+void ns_init(struct ns *s)
+{
+	ns_reset(s, 8000);
+}
+
+/* Computes the gain of each bin from the spectrum of a frame. */
+static void ns_gains(struct ns *s, float *gain)
+{
+	float power[NS_MAX_HOP + 1];
+	int k, H = s->hop;
+
+	for (k = 0; k <= H; k++)
+		power[k] = s->spec[k].re * s->spec[k].re +
+			s->spec[k].im * s->spec[k].im;
+
+	if (!s->noise_valid) {
+		memcpy(s->noise, power, (H + 1) * sizeof(float));
+		s->noise_valid = 1;
+	}
+
+	for (k = 0; k <= H; k++) {
+		float p = power[k];
+		float post = p / (s->noise[k] + 1e-3f);
+		float prio = NS_DD_ALPHA * s->snr[k] +
+			(1 - NS_DD_ALPHA) * (post > 1 ? post - 1 : 0);
+		float g = prio / (1 + prio);
+		float rate = post < NS_SPEECH_SNR ?
+			NS_NOISE_SMOOTH : NS_NOISE_SMOOTH_SPEECH;
+
+		g = g > NS_FLOOR ? g : NS_FLOOR;
+		gain[k] = g;
+		s->snr[k] = g * g * post;
+		s->noise[k] += (p - s->noise[k]) * rate;
+	}
+}
+
+/*
+ * Overlap-adds a frame with the NS_FLOOR gain on all bins, which
+ * is the windowed input scaled by NS_FLOOR.
+ */
+static void ns_hop_floor(struct ns *s, s16 *out)
+{
+	int H = s->hop;
+	int i;
+
+	for (i = 0; i < H; i++) {
+		float y = s->ola[i] +
+			NS_FLOOR * s->in[i] * s->win[i] * s->win[i];
+
+		if (y > 32767)
+			y = 32767;
+		if (y < -32768)
+			y = -32768;
+		out[i] = y;
+		s->ola[i] = NS_FLOOR * s->in[H + i] * s->win[H + i] * s->win[H + i];
+	}
+}
+
+static void ns_hop(struct ns *s, const s16 *x, s16 *out, int speech)
+{
+	float gain[NS_MAX_HOP + 1];
+	int H = s->hop, N = 2 * H;
+	int i, k;
+
+	memmove(s->in, s->in + H, H * sizeof(float));
+	for (i = 0; i < H; i++)
+		s->in[H + i] = x[i];
+
+	if (!speech) {
+		ns_hop_floor(s, out);
+		s->hops++;
+		return;
+	}
+
+	for (i = 0; i < N; i++) {
+		s->spec[i].re = s->in[i] * s->win[i];
+		s->spec[i].im = 0;
+	}
+	fft_forward(&s->fft, s->spec);
+
+	ns_gains(s, gain);
+	for (k = 0; k <= H; k++) {
+		s->spec[k].re *= gain[k];
+		s->spec[k].im *= gain[k];
+	}
+	for (k = 1; k < H; k++) {
+		s->spec[N - k].re *= gain[k];
+		s->spec[N - k].im *= gain[k];
+	}
+	fft_inverse(&s->fft, s->spec);
+
+	for (i = 0; i < H; i++) {
+		float y = s->ola[i] + s->spec[i].re * s->win[i];
+
+		if (y > 32767)
+			y = 32767;
+		if (y < -32768)
+			y = -32768;
+		out[i] = y;
+		s->ola[i] = s->spec[H + i].re * s->win[H + i];
+	}
+	s->hops++;
+}
+
+/*
+ * Suppresses noise in a capture frame of n samples at 'rate', in
+ * place. If 'speech' is not set, the frame only gets the floor
+ * gain.
+ */
+void ns_process(struct ns *s, s16 *buf, int n, int rate, int speech)
+{
+	int i, used = 0;
+
+	if (rate != s->rate)
+		ns_reset(s, rate);
+
+	if (n > PLC_MAX_FRAME)
+		return;
+
+	while (used < n) {
+		int take = s->hop - s->din_fill;
+
+		if (take > n - used)
+			take = n - used;
+		memcpy(s->din + s->din_fill, buf + used, take * sizeof(s16));
+		s->din_fill += take;
+		used += take;
+
+		if (s->din_fill == s->hop) {
+			ns_hop(s, s->din, s->dout + s->dout_fill, speech);
+			s->dout_fill += s->hop;
+			s->din_fill = 0;
+		}
+	}
+
+	memcpy(buf, s->dout, n * sizeof(s16));
+	s->dout_fill -= n;
+	for (i = 0; i < s->dout_fill; i++)
+		s->dout[i] = s->dout[n + i];
+}
@@ -0,0 +1,177 @@
+/* -*- c-file-style: "linux" -*- */
+
+/*
+ * Downlink packet loss concealment.
+ *
+ * A lost frame is replaced by repeating the last pitch period of
+ * the good signal, faded to silence over PLC_FADE_MSEC. The first
+ * good frame after a loss is overlap-added with the continuation
+ * of the synthetic signal, so that there is no click on recovery.
+ *
+ * All arithmetic is fixed point (Q15 gains). For good frames the
+ * only cost is a copy into the history buffer; the pitch search
+ * runs once per loss.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define PLC_MAX_FRAME		320	/* samples, 20 ms at 16 kHz */
+#define PLC_HIST		(2 * PLC_MAX_FRAME)
+#define PLC_MIN_PITCH_HZ	66
+#define PLC_MAX_PITCH_HZ	400
+#define PLC_CORR_MSEC		10	/* pitch search window */
+#define PLC_OLA_MSEC		4	/* crossfade on recovery */
+#define PLC_OLA_MAX		(16 * PLC_OLA_MSEC)
+#define PLC_FADE_MSEC		60	/* concealment fades to silence */
+#define PLC_MAX_GAP		3	/* max missing frames synthesized */
+
+struct plc {
+	int rate;		/* samples per second, 0 if unknown */
+	s16 hist[PLC_HIST];	/* latest output, newest sample last */
+	int pitch;		/* repeated period in samples */
+	int pos;		/* read position within the period */
+	int gain;		/* Q15 concealment gain */
+	int fade_step;		/* Q15 gain decrement per sample */
+	int lost;		/* consecutive concealed frames */
+
+	unsigned int frames;	/* good frames played */
+	unsigned int concealed;	/* frames synthesized */
+};
+
+void plc_init(struct plc *p)
+{
+	memset(p, 0, sizeof(*p));
+}
+
+static void plc_set_rate(struct plc *p, int rate)
+{
+	if (p->rate == rate)
+		return;
+
+	memset(p->hist, 0, sizeof(p->hist));
+	p->rate = rate;
+	p->lost = 0;
+	p->fade_step = 32767 / (rate * PLC_FADE_MSEC / 1000);
+}
+
+/* Normalized correlation score of the history tail against 'lag'. */
+static int64_t plc_score(const s16 *x, int win, int lag)
+{
+	int64_t c = kern_dot(x, x - lag, win) >> 15;
+	int64_t e = kern_dot(x - lag, x - lag, win) >> 15;
+
+	if (c <= 0)
+		return 0;
+	return (c * c) / (e + 1);
+}
+
+static int plc_find_pitch(struct plc *p)
+{
+	int win = p->rate * PLC_CORR_MSEC / 1000;
+	int min = p->rate / PLC_MAX_PITCH_HZ;
+	int max = p->rate / PLC_MIN_PITCH_HZ;
+	int step = p->rate / 8000;
+	const s16 *x = p->hist + PLC_HIST - win;
+	int64_t score, best = -1;
+	int lag, best_lag = max, lo, hi;
+
+	if (step < 1)
+		step = 1;
+
+	/* coarse search at 8 kHz resolution ... */
+	for (lag = min; lag <= max; lag += step) {
+		score = plc_score(x, win, lag);
+		if (score > best) {
+			best = score;
+			best_lag = lag;
+		}
+	}
+
+	/* ... refined around the best candidate */
+	lo = best_lag - step + 1;
+	hi = best_lag + step - 1;
+	if (hi > max)
+		hi = max;
+	for (lag = lo; lag <= hi; lag++) {
+		if (lag == best_lag)
+			continue;
+		score = plc_score(x, win, lag);
+		if (score > best) {
+			best = score;
+			best_lag = lag;
+		}
+	}
+
+	return best_lag;
+}
+
+static void plc_synth(struct plc *p, s16 *out, int n)
+{
+	const s16 *period = p->hist + PLC_HIST - p->pitch;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		out[i] = (period[p->pos] * p->gain) >> 15;
+		if (++p->pos == p->pitch)
+			p->pos = 0;
+		p->gain -= p->fade_step;
+		if (p->gain < 0)
+			p->gain = 0;
+	}
+}
+
+static void plc_push_history(struct plc *p, const s16 *buf, int n)
+{
+	if (n >= PLC_HIST) {
+		memcpy(p->hist, buf + n - PLC_HIST, sizeof(p->hist));
+		return;
+	}
+	memmove(p->hist, p->hist + n, (PLC_HIST - n) * sizeof(s16));
+	memcpy(p->hist + PLC_HIST - n, buf, n * sizeof(s16));
+}
+
+/*
+ * Fills 'buf' (n samples at 'rate') with a concealment frame.
+ */
+void plc_conceal(struct plc *p, s16 *buf, int n, int rate)
+{
+	plc_set_rate(p, rate);
+
+	if (p->lost == 0) {
+		p->pitch = plc_find_pitch(p);
+		p->pos = 0;
+		p->gain = 32767;
+	}
+
+	plc_synth(p, buf, n);
+	p->lost++;
+	p->concealed++;
+}
+
+/*
+ * Passes a good frame of n samples through. If it follows a loss,
+ * the start of the frame is crossfaded from the concealment signal
+ * in place.
+ */
+void plc_good(struct plc *p, s16 *buf, int n, int rate)
+{
+	plc_set_rate(p, rate);
+
+	if (p->lost > 0) {
+		s16 tail[PLC_OLA_MAX];
+		int len = rate * PLC_OLA_MSEC / 1000;
+
+		if (len > n)
+			len = n;
+		if (len > PLC_OLA_MAX)
+			len = PLC_OLA_MAX;
+
+		plc_synth(p, tail, len);
+		kern_crossfade(buf, tail, buf, len);
+		p->lost = 0;
+	}
+
+	plc_push_history(p, buf, n);
+	p->frames++;
+}
@@ -61,7 +61,7 @@ static const pa_sample_spec ss = {
 /* alternate-sample-rate must be 4000 in /etc/pulse/daemon.conf to get calls working both ways*/
 /* (alternate-sample-rate = 44100 and sample-rate = 48000 work as well now) */
 };
-static const pa_buffer_attr pa_attr = {
+static pa_buffer_attr pa_attr = {
 	.fragsize = (uint32_t) 512,
 	.maxlength = (uint32_t) -1,
 	.minreq = (uint32_t) -1,
@@ -107,7 +107,41 @@ static void stop_sink(struct test_ctx *ctx)
 
 void audio_init(struct test_ctx *ctx) {}
 
-static const char *audio_strerror(void)
+/* Sets the fragment and target length of the next streams. */
+int audio_set_buffer(int period_ms, int periods)
+{
+	if (period_ms <= 0 || periods < 1)
+		return -1;
+	pa_attr.fragsize = ss.rate * 2 * period_ms / 1000;
+	pa_attr.tlength = pa_attr.fragsize * periods;
+	return 0;
+}
+
+/* Blocking backend, the tool falls back to polling the source itself. */
+static AUDIO_MAYBE_UNUSED int audio_poll_fd(pa_simple *handle)
+{
+	return -1;
+}
+
+static AUDIO_MAYBE_UNUSED int audio_read_avail(pa_simple *handle)
+{
+	return -1;
+}
+
+/* Returns the playback queue length in microseconds, or -1. */
+static long audio_write_delay(pa_simple *handle)
+{
+	pa_usec_t latency;
+	int error;
+
+	latency = pa_simple_get_latency(handle, &error);
+	if (latency == (pa_usec_t) -1)
+		return -1;
+
+	return latency;
+}
+
+static AUDIO_MAYBE_UNUSED const char *audio_strerror(void)
 {
   return pa_strerror(pa_errno);
 }
@@ -0,0 +1,95 @@
+/* -*- c-file-style: "linux" -*- */
+
+/*
+ * Voice activity detector for UL frames.
+ *
+ * Each frame is classified from its mean energy and zero-crossing
+ * rate, compared to a running estimate of the background noise
+ * energy. Loud frames are speech; frames only somewhat above the
+ * noise count as speech if they cross zero often, which catches
+ * unvoiced sounds (s, f, sh) that carry little energy. Speech is
+ * held for a hangover period so that word endings are not cut.
+ *
+ * Integer arithmetic only, one pass over the frame for the energy
+ * and one for the zero crossings.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define VAD_MIN_ENERGY		100	/* mean square, below is silence (-70 dBFS) */
+#define VAD_SPEECH_RATIO	4	/* energy over noise for speech (6 dB) */
+#define VAD_UNVOICED_RATIO	2	/* ... with a high zero-crossing rate */
+#define VAD_UNVOICED_ZCR	80	/* zero crossings per 256 samples */
+#define VAD_NOISE_DOWN		2	/* noise estimate falls fast ... */
+#define VAD_NOISE_UP		7	/* ... and rises slowly (log2 frames) */
+#define VAD_NOISE_UP_SPEECH	10	/* ... even slower during speech */
+#define VAD_HANGOVER		8	/* frames of speech after the last loud one */
+
+struct vad {
+	int64_t noise;		/* background energy estimate */
+	int hangover;
+	int speech;		/* decision for the last frame */
+
+	unsigned int frames;
+	unsigned int speech_frames;
+};
+
+void vad_init(struct vad *v)
+{
+	memset(v, 0, sizeof(*v));
+	v->noise = VAD_MIN_ENERGY;
+}
+
+static int vad_zero_crossings(const s16 *x, int n)
+{
+	int i, count = 0;
+
+	for (i = 1; i < n; i++)
+		count += (x[i] ^ x[i - 1]) < 0;
+	return count;
+}
+
+/*
+ * Classifies a frame of n samples. Returns 1 for speech, 0 for
+ * silence.
+ */
+int vad_process(struct vad *v, const s16 *x, int n)
+{
+	int64_t e;
+	int zcr, active;
+
+	if (n <= 1)
+		return v->speech;
+
+	e = kern_dot(x, x, n) / n;
+	zcr = vad_zero_crossings(x, n) * 256 / n;
+
+	/* the call starts with the background level */
+	if (v->frames == 0 && e > v->noise)
+		v->noise = e;
+
+	active = e > VAD_MIN_ENERGY &&
+		(e > VAD_SPEECH_RATIO * v->noise ||
+		 (e > VAD_UNVOICED_RATIO * v->noise && zcr > VAD_UNVOICED_ZCR));
+
+	/* note: the estimate rises very slowly during speech, so that
+	 *       it does not learn the talker but still recovers from
+	 *       a step in the background level */
+	if (e < v->noise)
+		v->noise -= (v->noise - e) >> VAD_NOISE_DOWN;
+	else
+		v->noise += ((e - v->noise) >> (active ? VAD_NOISE_UP_SPEECH : VAD_NOISE_UP)) + 1;
+	if (v->noise < VAD_MIN_ENERGY)
+		v->noise = VAD_MIN_ENERGY;
+
+	if (active)
+		v->hangover = VAD_HANGOVER;
+	else if (v->hangover > 0)
+		v->hangover--;
+
+	v->speech = active || v->hangover > 0;
+	v->frames++;
+	v->speech_frames += v->speech;
+	return v->speech;
+}